@@ -154,6 +154,14 @@ contains(CONFIG, config_jemalloc) {
     LIBS += -ljemalloc
 }
 
+# Test if ZeroMQ is installed (optional). If so, the zmq_* conf options for push notifications from bitcoind are
+# available. See ZmqSubNotifier.cpp.
+qtCompileTest(zmq)
+contains(CONFIG, config_zmq) {
+    DEFINES += ENABLE_ZMQ
+    LIBS += -lzmq
+}
+
 macx {
     LIBS += -lrocksdb -lz -lbz2
 }
@@ -205,6 +213,7 @@ SOURCES += \
     Util.cpp \
     Version.cpp \
     WebSocket.cpp \
+    ZmqSubNotifier.cpp \
     register_MetaTypes.cpp
 
 HEADERS += \
@@ -236,6 +245,7 @@ HEADERS += \
     RPCMsgId.h \
     ServerMisc.h \
     Servers.h \
+    SortedVec.h \
     SrvMgr.h \
     Storage.h \
     SubsMgr.h \
@@ -245,7 +255,8 @@ HEADERS += \
     TXO_Compact.h \
     Util.h \
     Version.h \
-    WebSocket.h
+    WebSocket.h \
+    ZmqSubNotifier.h
 
 # Robin Hood unordered_flat_map implememntation (single header and MUCH more efficient than unordered_map!)
 HEADERS += robin_hood/robin_hood.h
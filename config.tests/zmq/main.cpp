@@ -0,0 +1,16 @@
+#include <zmq.h>
+
+static_assert(ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 0, 0), "libzmq 4.0.0 or later is required");
+
+int main()
+{
+    void *ctx = zmq_ctx_new();
+    if (!ctx)
+        return 1;
+    void *sock = zmq_socket(ctx, ZMQ_SUB);
+    if (!sock)
+        return 1;
+    zmq_close(sock);
+    zmq_ctx_term(ctx);
+    return 0;
+}
@@ -25,6 +25,7 @@
 #include "Servers.h"
 #include "ThreadPool.h"
 #include "Util.h"
+#include "ZmqSubNotifier.h"
 
 #include <QCommandLineParser>
 #include <QDir>
@@ -131,6 +132,10 @@ void App::startup()
 #endif
 
         controller = std::make_unique<Controller>(options);
+        connect(controller.get(), &Controller::exportSnapshotComplete, this, [this]{
+            Log() << "Snapshot export complete, exiting ...";
+            exit(0);
+        }, Qt::QueuedConnection);
         controller->startup(); // may throw
 
         if (!options->statsInterfaces.isEmpty()) {
@@ -332,6 +337,21 @@ void App::parseArgs()
                    " is loaded, all of the script hashes in the database will be written to outputfile as a JSON array."),
            QString("outputfile"),
          },
+         {
+           "export-snapshot",
+           QString("Export a portable snapshot of the database. If specified, after the database is loaded, all of the"
+                   " database tables as well as the headers and txid files will be written to outputfile in a chunked,"
+                   " checksummed, compressed format suitable for use with --import-snapshot on another machine. "
+                   APPNAME " exits once the snapshot has been written."),
+           QString("outputfile"),
+         },
+         {
+           "import-snapshot",
+           QString("Import a snapshot previously written by --export-snapshot. The datadir must be empty (or"
+                   " newly-created). The snapshot is loaded into the database before " APPNAME " proceeds to synch"
+                   " normally with bitcoind from the snapshot's tip."),
+           QString("inputfile"),
+         },
      };
 
     bool haveTests{}, haveBenches{};
@@ -743,6 +763,16 @@ void App::parseArgs()
         // log this later in case we are in syslog mode
         Util::AsyncOnObject(this, [mh]{ Debug() << "config: max_history = " << mh; });
     }
+    if (conf.hasValue("max_batch")) {
+        bool ok;
+        int mb = conf.intValue("max_batch", -1, &ok);
+        if (!ok || mb < options->maxBatchMin || mb > options->maxBatchMax)
+            throw BadArgs(QString("max_batch: bad value. Specify a value in the range [%1, %2]")
+                          .arg(options->maxBatchMin).arg(options->maxBatchMax));
+        options->maxBatch = mb;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [mb]{ Debug() << "config: max_batch = " << mb; });
+    }
     if (conf.hasValue("max_buffer")) {
         bool ok;
         int mb = conf.intValue("max_buffer", -1, &ok);
@@ -883,6 +913,66 @@ void App::parseArgs()
         // log this later in case we are in syslog mode
         Util::AsyncOnObject(this, [p]{ Debug() << "config: bitcoind_throttle = " << QString("(hi: %1, lo: %2, decay: %3)").arg(p.hi).arg(p.lo).arg(p.decay); });
     }
+    if (conf.hasValue("bitcoind_clients")) {
+        bool ok;
+        const auto val = conf.intValue("bitcoind_clients", options->bdNClients, &ok);
+        if (!ok || val < options->minBDNClients || val > options->maxBDNClients)
+            throw BadArgs(QString("bitcoind_clients: Please specify an integer in the range [%1, %2]")
+                          .arg(options->minBDNClients).arg(options->maxBDNClients));
+        options->bdNClients = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: bitcoind_clients = " << val; });
+    }
+    if (conf.hasValue("bitcoind_batch_size")) {
+        bool ok;
+        const auto val = conf.intValue("bitcoind_batch_size", options->bdBatchSize, &ok);
+        if (!ok || val < options->minBDBatchSize || val > options->maxBDBatchSize)
+            throw BadArgs(QString("bitcoind_batch_size: Please specify an integer in the range [%1, %2]")
+                          .arg(options->minBDBatchSize).arg(options->maxBDBatchSize));
+        options->bdBatchSize = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: bitcoind_batch_size = " << val; });
+    }
+    // 'persist_mempool'
+    options->persistMempool = ConfParseBool("persist_mempool", options->persistMempool);
+    // 'bitcoind_rest'
+    options->bitcoindRest = ConfParseBool("bitcoind_rest", options->bitcoindRest);
+    // 'block_download_mem'
+    if (conf.hasValue("block_download_mem")) {
+        bool ok;
+        const auto val = conf.intValue("block_download_mem", options->blockDLMemMB, &ok);
+        if (!ok || val < options->minBlockDLMemMB || val > options->maxBlockDLMemMB)
+            throw BadArgs(QString("block_download_mem: Please specify an integer in the range [%1, %2]")
+                          .arg(options->minBlockDLMemMB).arg(options->maxBlockDLMemMB));
+        options->blockDLMemMB = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: block_download_mem = " << val; });
+    }
+    // 'result_cache_mem'
+    if (conf.hasValue("result_cache_mem")) {
+        bool ok;
+        const auto val = conf.intValue("result_cache_mem", options->resultCacheMB, &ok);
+        if (!ok || val < options->minResultCacheMB || val > options->maxResultCacheMB)
+            throw BadArgs(QString("result_cache_mem: Please specify an integer in the range [%1, %2]")
+                          .arg(options->minResultCacheMB).arg(options->maxResultCacheMB));
+        options->resultCacheMB = val;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [val]{ Debug() << "config: result_cache_mem = " << val; });
+    }
+    // 'zmq_hashblock', 'zmq_hashtx', 'zmq_rawtx', 'zmq_sequence'
+    for (const auto topic : options->zmqTopics) {
+        const QString key = QString("zmq_%1").arg(topic);
+        if (!conf.hasValue(key))
+            continue;
+        const QString addr = conf.value(key).trimmed();
+        if (!ZmqSubNotifier::isAvailable())
+            throw BadArgs(QString("%1: This build of %2 lacks ZMQ support").arg(key, APPNAME));
+        if (!addr.startsWith("tcp://") && !addr.startsWith("ipc://"))
+            throw BadArgs(QString("%1: Please specify an endpoint of the form tcp://host:port or ipc://path").arg(key));
+        options->zmqEndpoints[topic] = addr;
+        // log this later in case we are in syslog mode
+        Util::AsyncOnObject(this, [key, addr]{ Debug() << "config: " << key << " = " << addr; });
+    }
     if (conf.hasValue("max_subs_per_ip")) {
         bool ok;
         const int64_t subs = conf.int64Value("max_subs_per_ip", -1, &ok);
@@ -967,6 +1057,17 @@ void App::parseArgs()
     if (const auto outFile = parser.value("dump-sh"); !outFile.isEmpty()) {
         options->dumpScriptHashes = outFile; // we do no checking here, but Controller::startup will throw BadArgs if it cannot open this file for writing.
     }
+    // parse --export-snapshot & --import-snapshot
+    if (const auto outFile = parser.value("export-snapshot"); !outFile.isEmpty()) {
+        options->exportSnapshot = outFile; // Controller::startup will throw BadArgs if it cannot open this file for writing.
+    }
+    if (const auto inFile = parser.value("import-snapshot"); !inFile.isEmpty()) {
+        if (!QFile::exists(inFile))
+            throw BadArgs(QString("Snapshot file not found: %1").arg(inFile));
+        if (!options->exportSnapshot.isEmpty())
+            throw BadArgs("--export-snapshot and --import-snapshot may not both be specified");
+        options->importSnapshot = inFile;
+    }
 }
 
 /*static*/
@@ -1098,7 +1199,8 @@ void App::start_httpServer(const Options::Interface &iface)
     std::shared_ptr<SimpleHttpServer> server(new SimpleHttpServer(iface.first, iface.second, 16384));
     httpServers.push_back(server);
     server->tryStart(); // may throw, waits for server to start
-    server->set404Message("Error: Unknown endpoint. /stats & /debug are the only valid endpoint I understand.\r\n");
+    server->set404Message("Error: Unknown endpoint. /stats, /debug, /blocknotify & /walletnotify are the only valid"
+                          " endpoints I understand.\r\n");
     static const auto CRLF = QByteArrayLiteral("\r\n");
     server->addEndpoint("/stats",[this](SimpleHttpServer::Request &req){
         req.response.contentType = "application/json; charset=utf-8";
@@ -1113,6 +1215,24 @@ void App::start_httpServer(const Options::Interface &iface)
         stats = stats.isNull() ? QVariantList{QVariant()} : stats;
         req.response.data = Json::toUtf8(stats, false) + CRLF; // may throw -- caller will handle exception
     });
+    // Local triggers for bitcoind's -blocknotify and -walletnotify, e.g.:
+    //     -blocknotify="curl -s http://127.0.0.1:8080/blocknotify"
+    // These only ask the Controller to synch now rather than at the next poll, so they are harmless, but we still only
+    // honor them from the local machine.
+    const auto notifyEndpoint = [this](bool newBlock) {
+        return [this, newBlock](SimpleHttpServer::Request &req) {
+            if (!req.peerAddress.isLoopback()) {
+                req.response.status = 403;
+                req.response.statusText = "Forbidden";
+                req.response.data = "Error: this endpoint may only be accessed from localhost.\r\n";
+                return;
+            }
+            if (controller) controller->notifyFromBitcoind(newBlock);
+            req.response.data = "OK" + CRLF;
+        };
+    };
+    server->addEndpoint("/blocknotify", notifyEndpoint(true));
+    server->addEndpoint("/walletnotify", notifyEndpoint(false));
 }
 
 /* static */
@@ -27,6 +27,7 @@
 #include <QSslSocket>
 
 #include <mutex>
+#include <vector>
 
 namespace {
     enum class PingTimes : int {
@@ -35,8 +36,10 @@ namespace {
     };
 }
 
-BitcoinDMgr::BitcoinDMgr(const QString &hostName, quint16 port, const QString &user, const QString &pass, bool useSsl)
-    : Mgr(nullptr), IdMixin(newId()), hostName(hostName), port(port), user(user), pass(pass), useSsl(useSsl)
+BitcoinDMgr::BitcoinDMgr(const QString &hostName, quint16 port, const QString &user, const QString &pass, bool useSsl,
+                         int nClients)
+    : Mgr(nullptr), IdMixin(newId()), hostName(hostName), port(port), user(user), pass(pass), useSsl(useSsl),
+      clients(size_t(std::max(nClients, 1))), clientLoads(clients.size())
 {
     setObjectName("BitcoinDMgr");
     _thread.setObjectName(objectName());
@@ -45,7 +48,7 @@ BitcoinDMgr::BitcoinDMgr(const QString &hostName, quint16 port, const QString &u
 BitcoinDMgr::~BitcoinDMgr() {  cleanup(); }
 
 void BitcoinDMgr::startup() {
-    Log() << objectName() << ": starting " << N_CLIENTS << " " << Util::Pluralize("bitcoin rpc client", N_CLIENTS) << " ...";
+    Log() << objectName() << ": starting " << nClients() << " " << Util::Pluralize("bitcoin rpc client", nClients()) << " ...";
 
     // As soon as a good BitcoinD is up, try and grab the network info (version, subversion, etc).  This must
     // happen early because the values in this info object determine which workarounds we may or may not apply to
@@ -75,6 +78,7 @@ void BitcoinDMgr::startup() {
             // tell all extant requests being serviced by this BitcoinD about this failure
             notifyFailForRequestsMatchingBitcoinD(static_cast<BitcoinD *>(c) /* guaranteed to be a BitcoinD * */,
                                                   "bitcoind connection lost");
+            clientLost(static_cast<BitcoinD *>(c));
         });
         connect(client.get(), &QObject::destroyed, this, [this](QObject *o){
             // just in case there are any extant requests up when this has been deleted (unlikely)
@@ -145,15 +149,27 @@ void BitcoinDMgr::cleanup() {
 auto BitcoinDMgr::stats() const -> Stats
 {
     QVariantList l;
-    constexpr int timeout = kDefaultTimeout/qMax(N_CLIENTS,1);
-    for (const auto & client : clients) {
+    const int timeout = kDefaultTimeout/qMax(nClients(),1);
+    const int firstInteractiveOnly = nClients() - nInteractiveOnly();
+    for (int i = 0; i < nClients(); ++i) {
+        const auto & client = clients[size_t(i)];
         if (!client) continue;
         auto map = client->statsSafe(timeout).toMap();
         auto name = map.take("name").toString();
+        const auto & load = clientLoads[size_t(i)];
+        map["dispatch"] = QVariantMap{
+            { "lanes", i >= firstInteractiveOnly ? "interactive only" : "interactive, bulk" },
+            { "in flight (interactive)", load.inFlight[size_t(Lane::Interactive)] },
+            { "in flight (bulk)", load.inFlight[size_t(Lane::Bulk)] },
+            { "max in flight", load.maxInFlight },
+            { "sent (interactive)", load.nSent[size_t(Lane::Interactive)] },
+            { "sent (bulk)", load.nSent[size_t(Lane::Bulk)] },
+        };
         l += QVariantMap({{ name, map }});
     }
     QVariantMap m;
     m["rpc clients"] = l;
+    m["in flight table size"] = inFlightTable.size();
     m["extant request contexts"] = BitcoinDMgrHelper::ReqCtxObj::extant.load();
     m["request context table size"] = reqContextTable.size();
     m["request zombie count"] = requestZombieCtr;
@@ -167,20 +183,69 @@ auto BitcoinDMgr::stats() const -> Stats
 }
 
 
-BitcoinD *BitcoinDMgr::getBitcoinD()
+int BitcoinDMgr::pickBitcoinD(Lane lane)
 {
     if (goodSet.empty())
-        return nullptr;
-    // Scan round-robin through clients for a client that is both in the goodSet (authenticated) and still has
-    // immediate "isGood" status. Note this loop is optimized for the common case where all clients are in the goodSet
-    // and so most of the time it will only iterate once.
-    for (int i = 0; i < N_CLIENTS; ++i) {
-        auto client = clients[ roundRobinCursor++ % N_CLIENTS ].get();
-        if (goodSet.count(client->id) && client->isGood())
-            return client;
+        return -1;
+    const int n = nClients();
+    // Bulk requests stay off the interactive-only connections, unless those are all that's up.
+    for (const int limit : { lane == Lane::Bulk ? n - nInteractiveOnly() : n, n }) {
+        int best = -1;
+        unsigned bestScore = 0;
+        const unsigned start = roundRobinCursor++; // rotate the starting point so that ties are spread evenly
+        for (int i = 0; i < limit; ++i) {
+            const auto idx = (start + unsigned(i)) % unsigned(limit);
+            const auto *client = clients[idx].get();
+            if (!client || !goodSet.count(client->id) || !client->isGood())
+                continue;
+            const auto & load = clientLoads[idx];
+            const unsigned nBulk = load.inFlight[size_t(Lane::Bulk)], nInteractive = load.inFlight[size_t(Lane::Interactive)];
+            // An Interactive request queued behind a Bulk one has to wait for a whole block to come down the pipe
+            // first, so for those a connection with any Bulk work in flight is a last resort.
+            const unsigned score = lane == Lane::Interactive ? nBulk * 1000u + nInteractive : nBulk + nInteractive;
+            if (best < 0 || score < bestScore) {
+                best = int(idx);
+                bestScore = score;
+            }
+        }
+        if (best >= 0)
+            return best;
     }
     // nothing found
-    return nullptr;
+    return -1;
+}
+
+void BitcoinDMgr::noteSent(int clientIdx, const RPC::Message::Id &id, Lane lane)
+{
+    auto & load = clientLoads[size_t(clientIdx)];
+    ++load.inFlight[size_t(lane)];
+    ++load.nSent[size_t(lane)];
+    load.maxInFlight = std::max(load.maxInFlight, load.inFlight[0] + load.inFlight[1]);
+    inFlightTable.insert(id, InFlightReq{unsigned(clientIdx), lane});
+}
+
+void BitcoinDMgr::requestDone(const RPC::Message::Id &id)
+{
+    if (auto it = inFlightTable.find(id); it != inFlightTable.end()) {
+        auto & ct = clientLoads[it->clientIdx].inFlight[size_t(it->lane)];
+        ct = ct ? ct - 1 : 0;
+        inFlightTable.erase(it);
+    }
+}
+
+void BitcoinDMgr::clientLost(const BitcoinD *bd)
+{
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (clients[i].get() != bd)
+            continue;
+        for (auto it = inFlightTable.begin(); it != inFlightTable.end(); ) {
+            if (it->clientIdx == i)
+                it = inFlightTable.erase(it);
+            else
+                ++it;
+        }
+        clientLoads[i].inFlight[0] = clientLoads[i].inFlight[1] = 0;
+    }
 }
 
 namespace {
@@ -340,13 +405,14 @@ BlockHash BitcoinDMgr::getBitcoinDGenesisHash() const
     return bitcoinDGenesisHash;
 }
 
-/// This is safe to call from any thread. Internally it dispatches messages to this obejct's thread.
-/// Does not throw. Results/Error/Fail functions are called in the context of the `sender` thread.
-void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, const QString & method, const QVariantList & params,
-                                const ResultsF & resf, const ErrorF & errf, const FailF & failf)
+namespace {
+    constexpr bool debugDeletes = false; // set this to true to print debug messages tracking all the below object deletions (tested: no leaks!)
+}
+
+auto BitcoinDMgr::newReqContext(QObject *sender, const RPC::Message::Id &rid, const ResultsF & resf, const ErrorF & errf,
+                                const FailF & failf) -> std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj>
 {
     using namespace BitcoinDMgrHelper;
-    constexpr bool debugDeletes = false; // set this to true to print debug messages tracking all the below object deletions (tested: no leaks!)
     // A note about ownership: this context object is "owned" by the connections below to ->sender *only*.
     // It will be auto-deleted when the shared_ptr refct held by the lambdas drops to 0.  This is guaranteed
     // to happen either as a result of a successful request reply, or due to bitcoind failure, or if the sender
@@ -387,16 +453,56 @@ void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, co
     // send the context to our thread
     context->moveToThread(this->thread());
 
+    return context;
+}
+
+bool BitcoinDMgr::putReqContextInTable(const RPC::Message::Id &rid, const std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> &context)
+{
+    // put context in table -- this table is consulted in handleMessageCommon to dispatch
+    // the reply directly to this context object
+    if (auto it = reqContextTable.find(rid); LIKELY(it == reqContextTable.end() || it.value().expired())) {
+        // does not exist in table, put in table
+        context->ts = Util::getTime(); // set timestamp; used by requestTimeoutChecker()
+        reqContextTable[rid] = context; // weak ref inserted into table
+        // Install cleanup handler to remove object from table on `destroyed`.
+        // NOTE: it's not clear to me if the destroyed signal is guaranteed to be delivered if
+        // context->thread() != this->thread().  Currently the two live in the same thread but
+        // if that changes -- update this code and/or test that the signal is in fact delivered
+        // reliably.
+        connect(context.get(), &QObject::destroyed, this, [this, rid](QObject *context) {
+            // remove context from table and also check it's what we expect
+            if (const auto ref = reqContextTable.take(rid).lock(); ref && ref.get() != context) {
+                // this should never happen
+                Error() << "Context in table with rid " << rid << " differs from what we expected! FIXME!";
+            }
+            if constexpr (debugDeletes)
+                DebugM(__func__, " - req context table size now: ", reqContextTable.size());
+        });
+        return true;
+    }
+    // this indicates a bug the calling code; it is sending dupe id's which we do not support
+    emit context->fail(rid, QString("Request id %1 already exists in table! FIXME!").arg(rid.toString()));
+    return false;
+}
+
+/// This is safe to call from any thread. Internally it dispatches messages to this obejct's thread.
+/// Does not throw. Results/Error/Fail functions are called in the context of the `sender` thread.
+void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, const QString & method, const QVariantList & params,
+                                const ResultsF & resf, const ErrorF & errf, const FailF & failf, Lane lane)
+{
+    auto context = newReqContext(sender, rid, resf, errf, failf);
+
     // schedule this ASAP
-    Util::AsyncOnObject(this, [this, context, rid, method, params] {
-        auto bd = getBitcoinD();
-        if (UNLIKELY(!bd)) {
+    Util::AsyncOnObject(this, [this, context, rid, method, params, lane] {
+        const int idx = pickBitcoinD(lane);
+        if (UNLIKELY(idx < 0)) {
             emit context->fail(rid, "Unable to find a good BitcoinD connection");
             return;
         }
+        auto *bd = clients[size_t(idx)].get();
         context->bd = bd; // record which bitcoind is servicing this request for notifyFailForRequestsMatchingBitcoinD()
 
-        // Note: there is a small chance of a race condition here because the `bd` that getBitcoinD() returns runs in
+        // Note: there is a small chance of a race condition here because the `bd` that pickBitcoinD() picks runs in
         // its own thread, and it may have "gone bad" from underneath our feet as this code executes by losing its
         // connection; we must defensively handle that situation just in case the "lostConnection" signal is emitted
         // when we are here.  In that very unlikely case, if a request has not completed in 15 seconds, eventually
@@ -404,31 +510,9 @@ void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, co
         // for BitcoinD to just never respond, so we need to be able to handle that situation as well with a guaranteed
         // `fail` signal delivery "some time later".
 
-        // put context in table -- this table is consulted in handleMessageCommon to dispatch
-        // the reply directly to this context object
-        if (auto it = reqContextTable.find(rid); LIKELY(it == reqContextTable.end() || it.value().expired())) {
-            // does not exist in table, put in table
-            context->ts = Util::getTime(); // set timestamp; used by requestTimeoutChecker()
-            reqContextTable[rid] = context; // weak ref inserted into table
-            // Install cleanup handler to remove object from table on `destroyed`.
-            // NOTE: it's not clear to me if the destroyed signal is guaranteed to be delivered if
-            // context->thread() != this->thread().  Currently the two live in the same thread but
-            // if that changes -- update this code and/or test that the signal is in fact delivered
-            // reliably.
-            connect(context.get(), &QObject::destroyed, this, [this, rid](QObject *context) {
-                // remove context from table and also check it's what we expect
-                if (const auto ref = reqContextTable.take(rid).lock(); ref && ref.get() != context) {
-                    // this should never happen
-                    Error() << "Context in table with rid " << rid << " differs from what we expected! FIXME!";
-                }
-                if constexpr (debugDeletes)
-                    DebugM(__func__, " - req context table size now: ", reqContextTable.size());
-            });
-        } else {
-            // this indicates a bug the calling code; it is sending dupe id's which we do not support
-            emit context->fail(rid, QString("Request id %1 already exists in table! FIXME!").arg(rid.toString()));
+        if (!putReqContextInTable(rid, context))
             return;
-        }
+        noteSent(idx, rid, lane);
 
         /*
            Notes:
@@ -446,6 +530,64 @@ void BitcoinDMgr::submitRequest(QObject *sender, const RPC::Message::Id &rid, co
     // .. aand.. return right away
 }
 
+void BitcoinDMgr::submitBatchRequest(QObject *sender, const RPC::Batch &batch, const ResultsF & resf, const ErrorF & errf,
+                                     const FailF & failf, Lane lane)
+{
+    if (batch.isEmpty())
+        return;
+    std::vector<std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj>> contexts;
+    contexts.reserve(size_t(batch.size()));
+    for (const auto & item : batch)
+        contexts.push_back(newReqContext(sender, item.id, resf, errf, failf));
+
+    // schedule this ASAP -- the whole batch goes to the same BitcoinD, but successive batches get spread across all
+    // the good BitcoinD's by pickBitcoinD().
+    Util::AsyncOnObject(this, [this, contexts, batch, lane] {
+        const int idx = pickBitcoinD(lane);
+        if (UNLIKELY(idx < 0)) {
+            for (int i = 0; i < batch.size(); ++i)
+                emit contexts[size_t(i)]->fail(batch[i].id, "Unable to find a good BitcoinD connection");
+            return;
+        }
+        auto *bd = clients[size_t(idx)].get();
+        RPC::Batch toSend;
+        toSend.reserve(batch.size());
+        for (int i = 0; i < batch.size(); ++i) {
+            auto & context = contexts[size_t(i)];
+            context->bd = bd; // record which bitcoind is servicing this request for notifyFailForRequestsMatchingBitcoinD()
+            if (putReqContextInTable(batch[i].id, context)) {
+                noteSent(idx, batch[i].id, lane);
+                toSend.push_back(batch[i]);
+            }
+        }
+        // Note: the same caveats and failure handling described in submitRequest() above apply here, per item.
+        if (!toSend.isEmpty())
+            bd->sendRequestBatch(toSend);
+    });
+}
+
+void BitcoinDMgr::submitRestRequest(QObject *sender, const RPC::Message::Id &rid, const QString &path,
+                                    const ResultsF & resf, const ErrorF & errf, const FailF & failf, Lane lane)
+{
+    auto context = newReqContext(sender, rid, resf, errf, failf);
+
+    // schedule this ASAP
+    Util::AsyncOnObject(this, [this, context, rid, path, lane] {
+        const int idx = pickBitcoinD(lane);
+        if (UNLIKELY(idx < 0)) {
+            emit context->fail(rid, "Unable to find a good BitcoinD connection");
+            return;
+        }
+        auto *bd = clients[size_t(idx)].get();
+        context->bd = bd; // record which bitcoind is servicing this request for notifyFailForRequestsMatchingBitcoinD()
+        // Note: the same caveats and failure handling described in submitRequest() above apply here.
+        if (!putReqContextInTable(rid, context))
+            return;
+        noteSent(idx, rid, lane);
+        bd->sendRestGet(rid, path);
+    });
+}
+
 void BitcoinDMgr::requestTimeoutChecker()
 {
     const auto cutoffTime = Util::getTime() - kRequestTimeoutMS /* 15 seconds */;
@@ -464,6 +606,8 @@ void BitcoinDMgr::requestTimeoutChecker()
                    " preparing the request, or bitcoind may have hung)");
         }
     }
+    // Note: a timed-out request stays in inFlightTable (and counts against its connection's load) until bitcoind
+    // answers it or the connection is lost; see requestDone() and clientLost().
 }
 
 void BitcoinDMgr::notifyFailForRequestsMatchingBitcoinD(const BitcoinD *bd, const QString &errorMessage)
@@ -499,6 +643,7 @@ void BitcoinDMgr::handleMessageCommon(const RPC::Message &msg, ReqCtxResultsOrEr
 void BitcoinDMgr::on_Message(quint64 bid, const RPC::Message &msg)
 {
     TraceM("Msg from: ", bid, " (reqId: ", msg.id, " method: ", msg.method, ")");
+    requestDone(msg.id);
 
     // handle the messsage by looking up the context in the table and emitting the proper signal
     handleMessageCommon(msg, &BitcoinDMgrHelper::ReqCtxObj::results);
@@ -511,6 +656,7 @@ void BitcoinDMgr::on_ErrorMessage(quint64 bid, const RPC::Message &msg)
     if (msg.errorCode() == bitcoin::RPCErrorCode::RPC_IN_WARMUP) {
         emit inWarmUp(msg.errorMessage());
     }
+    requestDone(msg.id);
 
     // handle the messsage by looking up the context in the table and emitting the proper signal
     handleMessageCommon(msg, &BitcoinDMgrHelper::ReqCtxObj::error);
@@ -545,6 +691,7 @@ BitcoinD::BitcoinD(const QString &host, quint16 port, const QString & user, cons
     setAuth(user, pass);
     setHeaderHost(QString("%1:%2").arg(host).arg(port)); // for HTTP RFC 2616 Host: field
     setV1(true); // bitcoind uses jsonrpc v1
+    acceptBatchReplies = true; // BitcoinDMgr::submitBatchRequest sends us JSON-RPC batches
     resetPingTimer(int(PingTimes::Normal)); // just sets pingtime_ms and stale_threshold = pingtime_ms * 2
 
     connectMiscSignals();
@@ -28,10 +28,12 @@
 #include <QHostAddress>
 #include <QVariantMap>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <set>
 #include <shared_mutex>
+#include <vector>
 
 class BitcoinD;
 namespace BitcoinDMgrHelper { class ReqCtxObj; }
@@ -53,13 +55,27 @@ class BitcoinDMgr : public Mgr, public IdMixin, public ThreadObjectMixin, public
 {
     Q_OBJECT
 public:
-    BitcoinDMgr(const QString &hostnameOrIP, quint16 port, const QString &user, const QString &pass, bool useSsl);
+    BitcoinDMgr(const QString &hostnameOrIP, quint16 port, const QString &user, const QString &pass, bool useSsl,
+                int nClients = 3);
     ~BitcoinDMgr() override;
 
     void startup() override; ///< from Mgr
     void cleanup() override; ///< from Mgr
 
-    static constexpr int N_CLIENTS = 3; ///< the number of simultaneous BitcoinD clients we spawn. TODO: make this configurable.
+    /// The number of simultaneous BitcoinD clients we spawn (from the `bitcoind_clients` conf option).
+    int nClients() const { return int(clients.size()); }
+
+    /// Which connections a request may be dispatched to. Each request goes to the least-loaded good connection in
+    /// its lane.
+    enum class Lane : uint8_t {
+        /// Requests someone is waiting on (client tx lookups, fee estimates, broadcasts, mempool synch). May use any
+        /// connection, but avoid ones that are busy with Bulk requests.
+        Interactive,
+        /// Big, slow requests (block downloads). Never sent to the last connection(s) if there are more than 3, so
+        /// that a long `getblock` never holds up an Interactive request queued behind it on the same pipelined
+        /// connection. With 3 or fewer, reserving one would cost block downloads too large a share of bitcoind.
+        Bulk,
+    };
 
     using ResultsF = std::function<void(const RPC::Message &response)>;
     using ErrorF = ResultsF; // identical to ResultsF above except the message passed in is an error="" message.
@@ -82,7 +98,25 @@ public:
     ///        use newId() to guarantee this.
     /// NOTE2: calling this method while this BitcoinDManager is stopped or about to be stopped is not supported.
     void submitRequest(QObject *sender, const RPC::Message::Id &id, const QString & method, const QVariantList & params,
-                       const ResultsF & = ResultsF(), const ErrorF & = ErrorF(), const FailF & = FailF());
+                       const ResultsF & = ResultsF(), const ErrorF & = ErrorF(), const FailF & = FailF(),
+                       Lane lane = Lane::Interactive);
+
+    /// This is safe to call from any thread. Like submitRequest() above, but sends all the requests in `batch` to
+    /// the same bitcoind as a single JSON-RPC batch (one HTTP round-trip). Successive batches are spread across all the
+    /// good bitcoind connections. The callbacks have the same semantics as for submitRequest(), and are called exactly
+    /// once *per batch item* (use the `id` of the RPC::Message to tell the items apart). The same uniqueness rules
+    /// apply to each item's id.
+    void submitBatchRequest(QObject *sender, const RPC::Batch &batch,
+                            const ResultsF & = ResultsF(), const ErrorF & = ErrorF(), const FailF & = FailF(),
+                            Lane lane = Lane::Interactive);
+
+    /// This is safe to call from any thread. Like submitRequest() above, but does an HTTP GET of `path` on bitcoind's
+    /// REST interface (e.g. "/rest/block/<hash>.bin"), which bitcoind serves on its RPC port if started with -rest.
+    /// On success, ResultsF gets an RPC::Message whose result() is the raw response body (a QByteArray). If bitcoind
+    /// replied with an HTTP error, ErrorF gets an error message whose errorCode() is the HTTP status (e.g. 404).
+    void submitRestRequest(QObject *sender, const RPC::Message::Id &id, const QString &path,
+                           const ResultsF & = ResultsF(), const ErrorF & = ErrorF(), const FailF & = FailF(),
+                           Lane lane = Lane::Interactive);
 
     /// Thread-safe.  Returns a copy of the BitcoinDInfo object.  This object is refreshed each time we
     /// reconnect to BitcoinD.  This is called by ServerBase in various places.
@@ -123,12 +157,36 @@ private:
 
     static constexpr int miniTimeout = 333, tinyTimeout = 167, medTimeout = 500, longTimeout = 1000;
 
-    std::set<quint64> goodSet; ///< set of bitcoind's (by id) that are `isGood` (connected, authed). This set is updated as we get signaled from BitcoinD objects. May be empty. Has at most N_CLIENTS elements.
+    std::set<quint64> goodSet; ///< set of bitcoind's (by id) that are `isGood` (connected, authed). This set is updated as we get signaled from BitcoinD objects. May be empty. Has at most nClients() elements.
 
-    std::unique_ptr<BitcoinD> clients[N_CLIENTS];
-    unsigned roundRobinCursor = 0; ///< this is incremented each time. use this % N_CLIENTS to dole out bitcoind's in a round-robin fashion
+    std::vector<std::unique_ptr<BitcoinD>> clients; ///< sized in c'tor, populated in startup()
+    unsigned roundRobinCursor = 0; ///< this is incremented each time; breaks ties between equally loaded bitcoind's
 
-    BitcoinD *getBitcoinD(); ///< may return nullptr if none are up. Otherwise does a round-robin of the ones present to grab one. to be called only in this thread.
+    /// Per-connection load, parallel to `clients`. Only accessed from this thread.
+    struct ClientLoad {
+        unsigned inFlight[2] = {}; ///< requests sent but not yet answered, by Lane
+        quint64 nSent[2] = {}; ///< lifetime requests sent, by Lane
+        unsigned maxInFlight = 0; ///< the most we ever had in flight at once on this connection
+    };
+    std::vector<ClientLoad> clientLoads;
+    /// Requests that were sent to a BitcoinD and not yet answered: id -> (index into `clients`, lane).
+    /// Used to keep clientLoads accurate even for replies whose sender has gone away or timed out. An entry only goes
+    /// away when bitcoind answers or the connection is lost, since until then the request still occupies that
+    /// connection. Only accessed from this thread.
+    struct InFlightReq { unsigned clientIdx; Lane lane; };
+    QHash<RPC::Message::Id, InFlightReq> inFlightTable;
+    /// The number of connections (the last ones) that only ever get Interactive requests
+    int nInteractiveOnly() const { return nClients() > 3 ? std::max(1, nClients() / 4) : 0; }
+
+    /// Returns the index into `clients` of the least-loaded good connection for `lane`, or -1 if none are up. To be
+    /// called only in this thread.
+    int pickBitcoinD(Lane lane);
+    /// Records request `id` as sent on clients[clientIdx] (updates clientLoads and inFlightTable)
+    void noteSent(int clientIdx, const RPC::Message::Id &id, Lane lane);
+    /// Called for every reply from bitcoind, to update clientLoads.
+    void requestDone(const RPC::Message::Id &id);
+    /// Called when a connection is lost: all of its in-flight requests are gone.
+    void clientLost(const BitcoinD *bd);
 
     mutable std::shared_mutex bitcoinDInfoLock;
     BitcoinDInfo bitcoinDInfo;     ///< guarded by bitcoinDInfoLock
@@ -148,6 +206,13 @@ private:
 
     // -- Request context table and request handler function --
     QHash<RPC::Message::Id, std::weak_ptr<BitcoinDMgrHelper::ReqCtxObj>> reqContextTable; // this should only be accessed from this thread
+    /// Creates a new request context whose signals are connected to the callbacks (in `sender`'s thread). Used by
+    /// submitRequest and submitBatchRequest. Thread-safe.
+    std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> newReqContext(QObject *sender, const RPC::Message::Id &id,
+                                                                const ResultsF &, const ErrorF &, const FailF &);
+    /// Puts the context into reqContextTable. Returns false (after emitting `fail` on the context) if `id` is a dupe.
+    /// Call this only from this thread.
+    bool putReqContextInTable(const RPC::Message::Id &id, const std::shared_ptr<BitcoinDMgrHelper::ReqCtxObj> &context);
     // called in on_Message and on_ErrorMessage -- dispatches message by emitting proper signal
     template <typename ReqCtxObjT> // <-- we must template this here because ReqCtxObj is not defined yet. :/
     void handleMessageCommon(const RPC::Message &, void (ReqCtxObjT::*resultsOrErrorFunc)(const RPC::Message &));
@@ -168,7 +233,8 @@ class BitcoinD : public RPC::HttpConnection, public ThreadObjectMixin /* NB: als
     Q_OBJECT
 
 public:
-    /// TODO: Have this come from config. For now: support up to ~50MiB blocks (hex encoded) from bitcoind.
+    /// TODO: Have this come from config. For now: support up to ~50MiB blocks (hex encoded) from bitcoind via
+    /// JSON-RPC, or up to ~100MiB blocks via the REST interface (binary).
     /// This should work for now since we are on 32MiB max block size on BCH anyway right now.
     static constexpr qint64 BTCD_DEFAULT_MAX_BUFFER = 100'000'000;
 
@@ -16,16 +16,21 @@
 // along with this program (see LICENSE.txt).  If not, see
 // <https://www.gnu.org/licenses/>.
 //
+#include "App.h"
 #include "BlockProc.h"
 #include "BTC.h"
+#include "ThreadPool.h"
 #include "Util.h"
 
 #include "bitcoin/transaction.h"
 #include "robin_hood/robin_hood.h"
 
 #include <QTextStream>
+#include <QtEndian>
 
 #include <algorithm>
+#include <functional>
+#include <ios>
 #include <set>
 #include <unordered_set>
 
@@ -40,8 +45,7 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
     header = b.GetBlockHeader();
     estimatedThisSizeBytes = sizeof(*this) + size_t(BTC::GetBlockHeaderSize());
     txInfos.reserve(b.vtx.size());
-    robin_hood::unordered_flat_map<TxHash, unsigned, HashHasher, std::equal_to<TxHash>, 99> txHashToIndex; // since we know the size ahead of time here, we can set max_load_factor to 99% and avoid over-allocating the hash table
-    txHashToIndex.reserve(b.vtx.size());
+    std::vector<HashX> outHashXs; // parallel to `outputs`, used by fillFinish()
 
     // run through all tx's, build inputs and outputs lists
     size_t txIdx = 0;
@@ -51,8 +55,6 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
         info.hash = BTC::Hash2ByteArrayRev(tx->GetHash());
         info.nInputs = IONum(tx->vin.size());
         info.nOutputs = IONum(tx->vout.size());
-        // remember the tx hash -> index association for use later in this function
-        txHashToIndex[info.hash] = unsigned(txIdx); // cheap copy + cheap hash func. should make this fast.
 
         // process outputs for this tx
         if (!tx->vout.empty())
@@ -66,23 +68,16 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
                 OutPt{ unsigned(txIdx), outN, out.nValue, {} }
             );
             estimatedThisSizeBytes += sizeof(OutPt);
-            const size_t outputIdx = outputs.size()-1;
-            if (const auto cscript = out.scriptPubKey;
+            if (const auto & cscript = out.scriptPubKey;
                     !BTC::IsOpReturn(cscript))  ///< skip OP_RETURN
-            {
-                const HashX hashX = BTC::HashXFromCScript(cscript);
-                // add this output to the hashX -> outputs association for later
-                auto & ag = hashXAggregated[ hashX ];
-                ag.outs.emplace_back( outputIdx );
-                if (auto & vec = ag.txNumsInvolvingHashX; vec.empty() || vec.back() != txIdx)
-                    vec.emplace_back(txIdx);
-            }
+                outHashXs.push_back(BTC::HashXFromCScript(cscript));
             else {
                 ++nOpReturns;
+                outHashXs.emplace_back();
             }/*//use this clause if you want to actually save/process opreturn scripts:
               else {
                 // OpReturn tracking...
-                opreturns.emplace_back(OpReturn{unsigned(outputIdx), cscript});
+                opreturns.emplace_back(OpReturn{unsigned(outputs.size()-1), cscript});
             }*/
             ++outN;
         }
@@ -107,49 +102,277 @@ void PreProcessedBlock::fill(BlockHeight blockHeight, size_t blockSize, const bi
         ++txIdx;
     }
 
+    fillFinish(outHashXs);
+}
+
+namespace {
+    /// Minimal bounds-checked reader over the bytes of a serialized block, used by the streaming
+    /// PreProcessedBlock::fill(). Like bitcoin's deserializers, it throws std::ios_base::failure on bad data.
+    class RawBlockReader {
+        const uint8_t *p, * const end;
+    public:
+        explicit RawBlockReader(const QByteArray &ba)
+            : p(reinterpret_cast<const uint8_t *>(ba.constData())), end(p + ba.size()) {}
+
+        const uint8_t *pos() const { return p; }
+        size_t remaining() const { return size_t(end - p); }
+        /// returns a pointer to the next `n` bytes and advances past them
+        const uint8_t *skip(size_t n) {
+            if (UNLIKELY(remaining() < n))
+                throw std::ios_base::failure("RawBlockReader: unexpected end of data");
+            const uint8_t *ret = p;
+            p += n;
+            return ret;
+        }
+        uint16_t u16() { return qFromLittleEndian<quint16>(skip(2)); }
+        uint32_t u32() { return qFromLittleEndian<quint32>(skip(4)); }
+        int64_t i64() { return qFromLittleEndian<qint64>(skip(8)); }
+        /// Identical semantics to bitcoin::ReadCompactSize (rejects non-canonical encodings and sizes > MAX_SIZE).
+        uint64_t compactSize() {
+            const uint8_t chSize = *skip(1);
+            uint64_t ret;
+            if (chSize < 253)
+                ret = chSize;
+            else if (chSize == 253) {
+                if ((ret = u16()) < 253)
+                    throw std::ios_base::failure("non-canonical ReadCompactSize()");
+            } else if (chSize == 254) {
+                if ((ret = u32()) < 0x10000u)
+                    throw std::ios_base::failure("non-canonical ReadCompactSize()");
+            } else {
+                if ((ret = qFromLittleEndian<quint64>(skip(8))) < 0x100000000ULL)
+                    throw std::ios_base::failure("non-canonical ReadCompactSize()");
+            }
+            if (ret > bitcoin::MAX_SIZE)
+                throw std::ios_base::failure("ReadCompactSize(): size too large");
+            return ret;
+        }
+    };
+
+    /// A (pointer, length) view into the raw block bytes
+    struct RawSpan {
+        const uint8_t *data;
+        size_t len;
+        /// shallow QByteArray view (no copy) -- only valid for as long as the underlying raw block
+        QByteArray toByteArray() const { return QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(len)); }
+    };
+
+    QByteArray RawHashRev(const uint8_t *hash) {
+        QByteArray ret(reinterpret_cast<const char *>(hash), HashLen); // deep copy
+        std::reverse(ret.begin(), ret.end());
+        return ret;
+    }
+
+    /// Below these sizes the work isn't worth farming out; blocks this small are processed entirely in the calling thread.
+    constexpr size_t kMinTxsPerJob = 1000, kMinInputsPerJob = 4000;
+
+    /// Runs `func` over [0, n) on the app-global ThreadPool (or just in this thread if there is no app, as in some tests).
+    /// Throws ThreadPool::ShuttingDown if the app is exiting and the pool dropped some of the work.
+    template <typename Func>
+    void ParallelFor(size_t n, size_t minChunk, const Func & func) {
+        if (auto *pool = AppThreadPool(); LIKELY(pool))
+            pool->parallelFor(n, minChunk, func);
+        else if (n)
+            func(size_t(0), n);
+    }
+
+    /// The number of shards ParallelFor would split `n` items into (always >= 1)
+    size_t NumShards(size_t n, size_t minChunk) {
+        const auto *pool = AppThreadPool();
+        return std::clamp<size_t>(n / minChunk, 1, size_t(std::max(pool ? pool->maxThreadCount() : 1, 1)));
+    }
+} // namespace
+
+void PreProcessedBlock::fill(BlockHeight blockHeight, const QByteArray &rawBlock)
+{
+    if (!header.IsNull() || !txInfos.empty())
+        clear();
+    height = blockHeight;
+    sizeBytes = size_t(rawBlock.size());
+    estimatedThisSizeBytes = sizeof(*this) + size_t(BTC::GetBlockHeaderSize());
+
+    RawBlockReader r(rawBlock);
+    r.skip(size_t(BTC::GetBlockHeaderSize()));
+    BTC::Deserialize(header, rawBlock); // reads just the first 80 bytes
+    const uint64_t nTx = r.compactSize();
+    // every tx is at least 10 bytes, so this bounds the reserve() below even for garbage input
+    if (UNLIKELY(nTx > r.remaining() / 10))
+        throw std::ios_base::failure("PreProcessedBlock::fill: bad tx count");
+    txInfos.reserve(nTx);
+    // These are just guesses to avoid most reallocs; shrink_to_fit() in fillFinish() trims the excess.
+    inputs.reserve(nTx * 2);
+    outputs.reserve(nTx * 2);
+    // Locations of the things to hash in phase 2 below. These all point into `rawBlock`.
+    std::vector<RawSpan> txSpans, outScripts; // parallel to `txInfos` and `outputs`, respectively
+    std::vector<const uint8_t *> prevoutHashes; // parallel to `inputs`
+    txSpans.reserve(nTx);
+    outScripts.reserve(nTx * 2);
+    prevoutHashes.reserve(nTx * 2);
+
+    // Phase 1 (this thread): walk the block, noting the layout of every tx. This is cheap; all the hashing is deferred.
+    for (unsigned txIdx = 0; txIdx < nTx; ++txIdx) {
+        const uint8_t * const txBegin = r.pos();
+        TxInfo info;
+        r.skip(4); // nVersion
+
+        // inputs
+        const uint64_t nIn = r.compactSize();
+        info.nInputs = IONum(nIn);
+        if (nIn)
+            // remember input0Index position for this tx
+            info.input0Index.emplace( unsigned(inputs.size()) );
+        for (uint64_t i = 0; i < nIn; ++i) {
+            prevoutHashes.push_back(r.skip(HashLen));
+            const uint32_t prevoutN = r.u32();
+            r.skip(r.compactSize()); // scriptSig
+            r.skip(4); // nSequence
+            // note we do place the coinbase tx here even though we ignore it later on -- we keep it to have accurate indices
+            inputs.emplace_back(InputPt{ txIdx, {}, uint16_t(prevoutN), {} });
+        }
+
+        // outputs
+        const uint64_t nOut = r.compactSize();
+        info.nOutputs = IONum(nOut);
+        if (nOut)
+            // remember output0 index for this txindex
+            info.output0Index.emplace( unsigned(outputs.size()) );
+        for (uint64_t i = 0; i < nOut; ++i) {
+            const int64_t value = r.i64();
+            const size_t scriptLen = r.compactSize();
+            outScripts.push_back({r.skip(scriptLen), scriptLen});
+            outputs.emplace_back(OutPt{ txIdx, IONum(i), value * bitcoin::Amount::satoshi(), {} });
+        }
+
+        r.skip(4); // nLockTime
+
+        txSpans.push_back({txBegin, size_t(r.pos() - txBegin)});
+        txInfos.emplace_back(std::move(info));
+    }
+    if (UNLIKELY(r.remaining()))
+        throw std::ios_base::failure(QString("PreProcessedBlock::fill: %1 extra bytes at end of block")
+                                     .arg(r.remaining()).toStdString());
+
+    // Phase 2 (thread pool, by tx range): hash txids and output scripts, and copy out the prevout hashes
+    std::vector<HashX> outHashXs(outputs.size()); // parallel to `outputs`, used by fillFinish()
+    ParallelFor(txInfos.size(), kMinTxsPerJob, [&](size_t begin, size_t end) {
+        for (size_t txIdx = begin; txIdx < end; ++txIdx) {
+            auto & info = txInfos[txIdx];
+            // the txid is just the double sha256 of the tx's serialized bytes, which we have right here
+            info.hash = BTC::HashRev(txSpans[txIdx].toByteArray());
+            if (info.input0Index)
+                for (unsigned i = *info.input0Index, e = i + info.nInputs; i < e; ++i)
+                    inputs[i].prevoutHash = RawHashRev(prevoutHashes[i]);
+            if (info.output0Index)
+                for (unsigned i = *info.output0Index, e = i + info.nOutputs; i < e; ++i)
+                    if (const auto & script = outScripts[i]; !script.len || *script.data != bitcoin::opcodetype::OP_RETURN)
+                        // hash the script in place (same as BTC::HashXFromCScript)
+                        outHashXs[i] = BTC::HashRev(script.toByteArray(), true);
+        }
+    });
+
+    for (const auto & script : outScripts)
+        nOpReturns += script.len && *script.data == bitcoin::opcodetype::OP_RETURN;
+    estimatedThisSizeBytes += inputs.size() * sizeof(InputPt) + outputs.size() * sizeof(OutPt)
+                              + txInfos.size() * (sizeof(TxInfo) + HashLen);
+
+    fillFinish(outHashXs);
+}
+
+void PreProcessedBlock::fillFinish(const std::vector<HashX> &outHashXs)
+{
+    assert(outHashXs.size() == outputs.size());
+
     // shrink inputs/outputs to fit now to conserve memory
     inputs.shrink_to_fit();
     outputs.shrink_to_fit();
 
-    // at this point we have a partially constructed object. we must run through all the inputs again
-    // and figure out which if any refer to tx's in this block, and assign those to our hashXIns.
+    // Build the txid -> txIdx index once; after this it is only ever read (concurrently, by phase 1 below).
+    robin_hood::unordered_flat_map<TxHash, unsigned, HashHasher, std::equal_to<TxHash>, 99> txHashToIndex; // since we know the size ahead of time here, we can set max_load_factor to 99% and avoid over-allocating the hash table
+    txHashToIndex.reserve(txInfos.size());
+    for (unsigned txIdx = 0; txIdx < txInfos.size(); ++txIdx)
+        txHashToIndex[txInfos[txIdx].hash] = txIdx; // cheap copy + cheap hash func. should make this fast.
+
+    // Phase 1 (thread pool, by input range): figure out which inputs, if any, refer to tx's in this block.
     // Also: to save memory on txhash's for such inputs, we make sure the txhash refers to the same underlying
     // QByteArray data.
-    size_t inIdx = 0;
-    for (auto & inp : inputs) {
-        if (const auto it = txHashToIndex.find(inp.prevoutHash); it != txHashToIndex.end()) {
-            // this input refers to a tx in this block!
-            const auto prevTxIdx = it->second;
-            assert(prevTxIdx < txInfos.size() && prevTxIdx < b.vtx.size());
-            const TxInfo & prevInfo = txInfos[prevTxIdx];
-            inp.prevoutHash = prevInfo.hash; //<--- ensure shallow copy that points to same underlying data (saves memory)
-            if (prevInfo.output0Index.has_value())
+    ParallelFor(inputs.size(), kMinInputsPerJob, [&](size_t begin, size_t end) {
+        for (size_t inIdx = begin; inIdx < end; ++inIdx) {
+            auto & inp = inputs[inIdx];
+            if (const auto it = txHashToIndex.find(inp.prevoutHash); it != txHashToIndex.end()) {
+                // this input refers to a tx in this block!
+                const auto prevTxIdx = it->second;
+                assert(prevTxIdx < txInfos.size());
+                const TxInfo & prevInfo = txInfos[prevTxIdx];
+                if (UNLIKELY(!prevInfo.output0Index.has_value() || inp.prevoutN >= prevInfo.nOutputs))
+                    // can't happen with a valid block
+                    throw std::ios_base::failure("PreProcessedBlock::fill: input spends a nonexistent in-block output");
+                inp.prevoutHash = prevInfo.hash; //<--- ensure shallow copy that points to same underlying data (saves memory)
                 inp.parentTxOutIdx.emplace( *prevInfo.output0Index + inp.prevoutN ); // save the index into the `outputs` array where the parent tx to this spend occurred
-            else { assert(0); }
-            auto & outp = outputs[ inp.parentTxOutIdx.value() ];
-            outp.spentInInputIndex.emplace( inIdx ); // mark the output as spent by this index
-            const auto & prevTx = b.vtx[prevTxIdx];
-            assert(inp.prevoutN < prevTx->vout.size());
-            if (const auto cscript = prevTx->vout[inp.prevoutN].scriptPubKey;  // grab prevOut address
-                    !BTC::IsOpReturn(cscript))
-            {
-                // mark this input as involving this hashX
-                const HashX hashX = BTC::HashXFromCScript(cscript);
-                auto & ag = hashXAggregated[ hashX ];
-                ag.ins.emplace_back(inIdx);
-                if (auto & vec = ag.txNumsInvolvingHashX; vec.empty() || vec.back() != inp.txIdx)
-                    vec.emplace_back(inp.txIdx);  // now that we resolved the input's spending address, mark this input's txIdx as having touched this hashX
             }
         }
-        ++inIdx;
+    });
+
+    // Phase 2 (this thread): mark the outputs spent in this block. Done serially so that a (bogus) double-spend within
+    // the block can't race; the last spend wins.
+    for (unsigned inIdx = 0; inIdx < inputs.size(); ++inIdx)
+        if (const auto & parent = inputs[inIdx].parentTxOutIdx)
+            outputs[*parent].spentInInputIndex.emplace( inIdx ); // mark the output as spent by this index
+
+    // Phase 3 (thread pool, one shard per contiguous tx range): aggregate outputs and in-block inputs by hashX. Since
+    // each shard visits its txs in order, and each tx's outputs and inputs in order, every list within a shard comes
+    // out sorted, and txNumsInvolvingHashX needs only an adjacent-duplicate check.
+    using AggMap = decltype(hashXAggregated);
+    const size_t nShards = NumShards(txInfos.size(), kMinTxsPerJob);
+    std::vector<AggMap> shards(nShards);
+    ParallelFor(nShards, 1, [&](size_t shardBegin, size_t shardEnd) {
+        for (size_t shard = shardBegin; shard < shardEnd; ++shard) {
+            auto & map = shards[shard];
+            const auto Add = [&map](const HashX &hashX, std::vector<unsigned> AggregatedOutsIns::*list, unsigned idx, unsigned txIdx) {
+                auto & ag = map[ hashX ];
+                (ag.*list).emplace_back( idx );
+                if (auto & vec = ag.txNumsInvolvingHashX; vec.empty() || vec.back() != txIdx)
+                    vec.emplace_back(txIdx);
+            };
+            const auto txEnd = unsigned(txInfos.size() * (shard + 1) / nShards);
+            for (auto txIdx = unsigned(txInfos.size() * shard / nShards); txIdx < txEnd; ++txIdx) {
+                const auto & info = txInfos[txIdx];
+                if (info.output0Index)
+                    for (unsigned outIdx = *info.output0Index, e = outIdx + info.nOutputs; outIdx < e; ++outIdx)
+                        if (const HashX & hashX = outHashXs[outIdx]; !hashX.isEmpty()) // skip OP_RETURN
+                            Add(hashX, &AggregatedOutsIns::outs, outIdx, txIdx);
+                if (info.input0Index)
+                    for (unsigned inIdx = *info.input0Index, e = inIdx + info.nInputs; inIdx < e; ++inIdx)
+                        if (const auto & parent = inputs[inIdx].parentTxOutIdx)
+                            // grab prevOut address (empty if OP_RETURN) and mark this input as involving it
+                            if (const HashX & hashX = outHashXs[*parent]; !hashX.isEmpty())
+                                Add(hashX, &AggregatedOutsIns::ins, inIdx, txIdx);
+            }
+        }
+    });
+
+    // Phase 4 (this thread): merge the shards in tx order, so the lists stay sorted and the result is deterministic
+    // (and identical to what a single shard would have produced).
+    if (!shards.empty())
+        hashXAggregated = std::move(shards.front());
+    for (size_t i = 1; i < shards.size(); ++i) {
+        for (auto & [hashX, src] : shards[i]) {
+            auto & dst = hashXAggregated[hashX];
+            if (dst.txNumsInvolvingHashX.empty()) {
+                dst = std::move(src);
+                continue;
+            }
+            dst.outs.insert(dst.outs.end(), src.outs.begin(), src.outs.end());
+            dst.ins.insert(dst.ins.end(), src.ins.begin(), src.ins.end());
+            dst.txNumsInvolvingHashX.insert(dst.txNumsInvolvingHashX.end(), src.txNumsInvolvingHashX.begin(),
+                                            src.txNumsInvolvingHashX.end());
+        }
+        shards[i] = AggMap(); // free memory early
     }
 
     for (auto & [hashX, ag] : hashXAggregated ) {
-        std::sort(ag.ins.begin(), ag.ins.end());
-        std::sort(ag.outs.begin(), ag.outs.end());
-        std::sort(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end());
-        auto last = std::unique(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end());
-        ag.txNumsInvolvingHashX.erase(last, ag.txNumsInvolvingHashX.end());
+        assert(std::is_sorted(ag.ins.begin(), ag.ins.end()) && std::is_sorted(ag.outs.begin(), ag.outs.end())
+               && std::adjacent_find(ag.txNumsInvolvingHashX.begin(), ag.txNumsInvolvingHashX.end(),
+                                     std::greater_equal<TxNum>()) == ag.txNumsInvolvingHashX.end());
         ag.ins.shrink_to_fit();
         ag.outs.shrink_to_fit();
         ag.txNumsInvolvingHashX.shrink_to_fit();
@@ -204,6 +427,11 @@ PreProcessedBlockPtr PreProcessedBlock::makeShared(unsigned height_, size_t size
 {
     return std::make_shared<PreProcessedBlock>(height_, size, block);
 }
+/*static*/
+PreProcessedBlockPtr PreProcessedBlock::makeShared(unsigned height_, const QByteArray &rawBlock)
+{
+    return std::make_shared<PreProcessedBlock>(height_, rawBlock);
+}
 
 
 // very much a work in progress. this needs to also consult the UTXO set to be complete. For now we just
@@ -224,3 +452,360 @@ PreProcessedBlock::hashXsByTx() const
     }
     return ret;
 }
+
+#ifdef ENABLE_TESTS
+#include <QRandomGenerator>
+
+#include <cstdlib>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+namespace {
+    /// Returns the process's peak resident set size so far, in KiB, or -1 if unknown on this platform.
+    long peakRSSKiB() {
+#if defined(Q_OS_UNIX)
+        struct rusage ru{};
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#  if defined(Q_OS_DARWIN)
+            return long(ru.ru_maxrss / 1024); // bytes on Darwin
+#  else
+            return long(ru.ru_maxrss); // KiB on Linux & the BSDs
+#  endif
+        }
+#endif
+        return -1;
+    }
+
+    /// Makes a random but well-formed block with `nTx` txs (plus the coinbase). About half of the inputs spend outputs
+    /// of earlier txs in the same block, and some output scripts are re-used, so that every code path in
+    /// PreProcessedBlock::fill() gets exercised.
+    bitcoin::CBlock makeSyntheticBlock(unsigned nTx) {
+        auto *rng = QRandomGenerator::global();
+        const auto RandBytes = [rng](size_t n) {
+            std::vector<uint8_t> v(n);
+            for (auto & b : v) b = uint8_t(rng->bounded(256));
+            return v;
+        };
+        const auto RandHash = [&RandBytes] {
+            const auto v = RandBytes(HashLen);
+            bitcoin::uint256 h;
+            std::copy(v.begin(), v.end(), h.begin());
+            return h;
+        };
+        std::vector<bitcoin::CScript> scripts; // previously used output scripts, for address re-use
+        const auto RandOutScript = [&] {
+            const auto r = rng->bounded(100);
+            if (r == 0) // OP_RETURN
+                return bitcoin::CScript() << bitcoin::opcodetype::OP_RETURN << RandBytes(20);
+            if (r < 10 && !scripts.empty()) // re-use
+                return scripts[rng->bounded(quint32(scripts.size()))];
+            // p2pkh
+            auto s = bitcoin::CScript() << bitcoin::opcodetype::OP_DUP << bitcoin::opcodetype::OP_HASH160 << RandBytes(20)
+                                        << bitcoin::opcodetype::OP_EQUALVERIFY << bitcoin::opcodetype::OP_CHECKSIG;
+            scripts.push_back(s);
+            return s;
+        };
+        bitcoin::CBlock block;
+        block.nVersion = 0x20000000;
+        block.hashPrevBlock = RandHash();
+        block.hashMerkleRoot = RandHash();
+        block.nTime = 1600000000;
+        block.nBits = 0x1d00ffff;
+        block.nNonce = rng->generate();
+        block.vtx.reserve(nTx + 1);
+        std::vector<bitcoin::COutPoint> unspent; // spendable outputs of txs already in the block
+        for (unsigned i = 0; i <= nTx; ++i) {
+            bitcoin::CMutableTransaction tx;
+            tx.nVersion = 2;
+            if (i == 0) {
+                // coinbase
+                tx.vin.emplace_back(bitcoin::COutPoint(), bitcoin::CScript() << RandBytes(8));
+            } else {
+                const unsigned nIn = 1 + rng->bounded(3);
+                for (unsigned j = 0; j < nIn; ++j) {
+                    bitcoin::COutPoint prevout(RandHash(), rng->bounded(4));
+                    if (!unspent.empty() && rng->bounded(2)) {
+                        // spend an output of a tx in this block
+                        const auto k = rng->bounded(quint32(unspent.size()));
+                        prevout = unspent[k];
+                        unspent[k] = unspent.back();
+                        unspent.pop_back();
+                    }
+                    tx.vin.emplace_back(prevout, bitcoin::CScript() << RandBytes(72) << RandBytes(33));
+                }
+            }
+            const unsigned nOut = 1 + rng->bounded(3);
+            for (unsigned j = 0; j < nOut; ++j)
+                tx.vout.emplace_back(int64_t(1 + rng->bounded(100'000'000)) * bitcoin::Amount::satoshi(), RandOutScript());
+            auto txRef = bitcoin::MakeTransactionRef(std::move(tx));
+            for (unsigned j = 0; j < txRef->vout.size(); ++j)
+                if (!BTC::IsOpReturn(txRef->vout[j].scriptPubKey))
+                    unspent.emplace_back(txRef->GetId(), j);
+            block.vtx.push_back(std::move(txRef));
+        }
+        return block;
+    }
+
+    /// Throws if `a` and `b` differ in any of their data
+    void checkSame(const PreProcessedBlock &a, const PreProcessedBlock &b) {
+        const auto Fail = [](const QString &what) { throw Exception(QString("Blocks differ: %1").arg(what)); };
+        if (a.height != b.height || a.sizeBytes != b.sizeBytes || a.header.GetHash() != b.header.GetHash())
+            Fail("header");
+        if (a.nOpReturns != b.nOpReturns) Fail("nOpReturns");
+        if (a.txInfos.size() != b.txInfos.size()) Fail("txInfos.size()");
+        for (size_t i = 0; i < a.txInfos.size(); ++i) {
+            const auto &x = a.txInfos[i], &y = b.txInfos[i];
+            if (x.hash != y.hash || x.nInputs != y.nInputs || x.nOutputs != y.nOutputs
+                    || x.input0Index != y.input0Index || x.output0Index != y.output0Index)
+                Fail(QString("txInfos[%1]").arg(i));
+        }
+        if (a.outputs.size() != b.outputs.size()) Fail("outputs.size()");
+        for (size_t i = 0; i < a.outputs.size(); ++i) {
+            const auto &x = a.outputs[i], &y = b.outputs[i];
+            if (x.txIdx != y.txIdx || x.outN != y.outN || x.amount != y.amount || x.spentInInputIndex != y.spentInInputIndex)
+                Fail(QString("outputs[%1]").arg(i));
+        }
+        if (a.inputs.size() != b.inputs.size()) Fail("inputs.size()");
+        for (size_t i = 0; i < a.inputs.size(); ++i) {
+            const auto &x = a.inputs[i], &y = b.inputs[i];
+            if (x.txIdx != y.txIdx || x.prevoutHash != y.prevoutHash || x.prevoutN != y.prevoutN
+                    || x.parentTxOutIdx != y.parentTxOutIdx)
+                Fail(QString("inputs[%1]").arg(i));
+        }
+        if (a.hashXAggregated.size() != b.hashXAggregated.size()) Fail("hashXAggregated.size()");
+        for (const auto & [hashX, ag] : a.hashXAggregated) {
+            const auto it = b.hashXAggregated.find(hashX);
+            if (it == b.hashXAggregated.end() || ag.ins != it->second.ins || ag.outs != it->second.outs
+                    || ag.txNumsInvolvingHashX != it->second.txNumsInvolvingHashX)
+                Fail(QString("hashXAggregated[%1]").arg(QString(hashX.toHex())));
+        }
+    }
+
+    /// A p2pkh output script paying to the hash160 made of 20 `fill` bytes
+    bitcoin::CScript P2PKH(uint8_t fill) {
+        return bitcoin::CScript() << bitcoin::opcodetype::OP_DUP << bitcoin::opcodetype::OP_HASH160
+                                  << std::vector<uint8_t>(20, fill) << bitcoin::opcodetype::OP_EQUALVERIFY
+                                  << bitcoin::opcodetype::OP_CHECKSIG;
+    }
+
+    /// Wraps `txs` (the first of which should be the coinbase) in a block
+    bitcoin::CBlock BlockOf(std::vector<bitcoin::CMutableTransaction> txs) {
+        bitcoin::CBlock block;
+        block.nVersion = 0x20000000;
+        block.nTime = 1600000000;
+        block.nBits = 0x1d00ffff;
+        block.nNonce = uint32_t(txs.size());
+        for (auto & tx : txs)
+            block.vtx.push_back(bitcoin::MakeTransactionRef(std::move(tx)));
+        return block;
+    }
+
+    /// Fills a PreProcessedBlock from `block` via both the streaming parser and the CBlock path, throws if the two
+    /// differ, and returns the streaming parser's result.
+    PreProcessedBlockPtr fillBothWays(BlockHeight height, const bitcoin::CBlock &block) {
+        const QByteArray raw = BTC::Serialize(block);
+        auto ppb = PreProcessedBlock::makeShared(height, raw);
+        checkSame(*ppb, *PreProcessedBlock::makeShared(height, size_t(raw.size()), block));
+        return ppb;
+    }
+
+    void test() {
+        const auto Check = [](bool b, const QString &what) {
+            if (!b) throw Exception(QString("Check failed: %1").arg(what));
+        };
+        const auto Out = [](int64_t sats, const bitcoin::CScript &script) {
+            return bitcoin::CTxOut(sats * bitcoin::Amount::satoshi(), script);
+        };
+        const auto Coinbase = [](uint8_t tag, std::vector<bitcoin::CTxOut> outs) {
+            bitcoin::CMutableTransaction tx;
+            tx.nVersion = 1;
+            tx.vin.emplace_back(bitcoin::COutPoint(), bitcoin::CScript() << std::vector<uint8_t>(4, tag));
+            tx.vout = std::move(outs);
+            return tx;
+        };
+        const auto Tx = [](std::vector<bitcoin::COutPoint> prevouts, std::vector<bitcoin::CTxOut> outs) {
+            bitcoin::CMutableTransaction tx;
+            tx.nVersion = 2;
+            for (const auto & prevout : prevouts)
+                tx.vin.emplace_back(prevout, bitcoin::CScript() << std::vector<uint8_t>(72, 0x30));
+            tx.vout = std::move(outs);
+            return tx;
+        };
+        const auto External = [](uint8_t fill, uint32_t n) {
+            bitcoin::uint256 h;
+            std::fill(h.begin(), h.end(), fill);
+            return bitcoin::COutPoint(h, n);
+        };
+        const auto Agg = [&Check](const PreProcessedBlock &ppb, const bitcoin::CScript &script) {
+            const auto it = ppb.hashXAggregated.find(BTC::HashXFromCScript(script));
+            Check(it != ppb.hashXAggregated.end(), "hashX present");
+            return it->second;
+        };
+        using Idxs = std::vector<unsigned>;
+        using TxNums = std::vector<TxNum>;
+        const auto opReturn = bitcoin::CScript() << bitcoin::opcodetype::OP_RETURN << std::vector<uint8_t>(10, 0xee);
+
+        // A coinbase-only block (with an OP_RETURN output)
+        {
+            const auto block = BlockOf({ Coinbase(1, {Out(50'0000'0000, P2PKH(1)), Out(0, opReturn)}) });
+            const auto ppb = fillBothWays(1, block);
+            Check(ppb->txInfos.size() == 1 && ppb->inputs.size() == 1 && ppb->outputs.size() == 2, "coinbase-only: sizes");
+            Check(ppb->txInfos[0].hash == BTC::Hash2ByteArrayRev(block.vtx[0]->GetId()), "coinbase-only: txid");
+            Check(!ppb->inputs[0].parentTxOutIdx && ppb->inputs[0].prevoutHash == QByteArray(HashLen, '\0'),
+                  "coinbase-only: null prevout");
+            Check(ppb->nOpReturns == 1 && ppb->hashXAggregated.size() == 1, "coinbase-only: hashXs");
+            const auto ag = Agg(*ppb, P2PKH(1));
+            Check(ag.outs == Idxs{0} && ag.ins.empty() && ag.txNumsInvolvingHashX == TxNums{0}, "coinbase-only: aggregate");
+        }
+
+        // A block whose txs spend outputs created earlier in the same block. Layout (output / input indices):
+        //   cb: out 0
+        //   a:  in 1 (external);                    outs 1 (P2PKH 2), 2 (P2PKH 3), 3 (OP_RETURN)
+        //   b:  ins 2 (a:0), 3 (a:1), 4 (external); outs 4 (P2PKH 2, re-used), 5 (P2PKH 4)
+        //   c:  in 5 (b:1);                         out 6 (empty script)
+        //   d:  in 6 (external);                    out 7 (P2PKH 5)
+        {
+            const auto cb = Coinbase(2, {Out(50'0000'0000, P2PKH(1))});
+            const auto a = Tx({External(0xaa, 0)}, {Out(1000, P2PKH(2)), Out(2000, P2PKH(3)), Out(0, opReturn)});
+            const auto b = Tx({bitcoin::COutPoint(a.GetId(), 0), bitcoin::COutPoint(a.GetId(), 1), External(0xbb, 5)},
+                              {Out(1500, P2PKH(2)), Out(1400, P2PKH(4))});
+            const auto c = Tx({bitcoin::COutPoint(b.GetId(), 1)}, {Out(1300, bitcoin::CScript())});
+            const auto d = Tx({External(0xcc, 1)}, {Out(42, P2PKH(5))});
+            const auto block = BlockOf({cb, a, b, c, d});
+            const auto ppb = fillBothWays(2, block);
+            Check(ppb->txInfos.size() == 5 && ppb->inputs.size() == 7 && ppb->outputs.size() == 8, "in-block spends: sizes");
+            for (size_t i = 0; i < block.vtx.size(); ++i)
+                Check(ppb->txInfos[i].hash == BTC::Hash2ByteArrayRev(block.vtx[i]->GetId()), "in-block spends: txid");
+            const std::vector<std::optional<unsigned>> parents = {{}, {}, 1u, 2u, {}, 5u, {}};
+            for (size_t i = 0; i < parents.size(); ++i)
+                Check(ppb->inputs[i].parentTxOutIdx == parents[i], QString("in-block spends: inputs[%1] parent").arg(i));
+            const std::vector<std::optional<unsigned>> spentIn = {{}, 2u, 3u, {}, {}, 5u, {}, {}};
+            for (size_t i = 0; i < spentIn.size(); ++i)
+                Check(ppb->outputs[i].spentInInputIndex == spentIn[i], QString("in-block spends: outputs[%1] spent").arg(i));
+            // in-block prevout hashes share the parent's txid data
+            Check(ppb->inputs[2].prevoutHash.constData() == ppb->txInfos[1].hash.constData(), "in-block spends: shallow prevout");
+            Check(ppb->inputs[4].prevoutHash == BTC::Hash2ByteArrayRev(External(0xbb, 5).GetTxId())
+                  && ppb->inputs[4].prevoutN == 5, "in-block spends: external prevout");
+            Check(ppb->nOpReturns == 1 && ppb->hashXAggregated.size() == 6, "in-block spends: hashX count");
+            auto ag = Agg(*ppb, P2PKH(1));
+            Check(ag.outs == Idxs{0} && ag.ins.empty() && ag.txNumsInvolvingHashX == TxNums{0}, "in-block spends: P2PKH 1");
+            ag = Agg(*ppb, P2PKH(2));
+            Check(ag.outs == Idxs{1, 4} && ag.ins == Idxs{2} && ag.txNumsInvolvingHashX == TxNums{1, 2}, "in-block spends: P2PKH 2");
+            ag = Agg(*ppb, P2PKH(3));
+            Check(ag.outs == Idxs{2} && ag.ins == Idxs{3} && ag.txNumsInvolvingHashX == TxNums{1, 2}, "in-block spends: P2PKH 3");
+            ag = Agg(*ppb, P2PKH(4));
+            Check(ag.outs == Idxs{5} && ag.ins == Idxs{5} && ag.txNumsInvolvingHashX == TxNums{2, 3}, "in-block spends: P2PKH 4");
+            ag = Agg(*ppb, bitcoin::CScript());
+            Check(ag.outs == Idxs{6} && ag.ins.empty() && ag.txNumsInvolvingHashX == TxNums{3}, "in-block spends: empty script");
+            ag = Agg(*ppb, P2PKH(5));
+            Check(ag.outs == Idxs{7} && ag.ins.empty() && ag.txNumsInvolvingHashX == TxNums{4}, "in-block spends: P2PKH 5");
+
+            // the streaming parser must reject truncated data and trailing garbage
+            const QByteArray raw = BTC::Serialize(block);
+            for (const auto & bad : {raw.left(raw.size() - 1), raw.left(BTC::GetBlockHeaderSize() + 40), raw + '\0'}) {
+                bool threw = false;
+                try {
+                    PreProcessedBlock::makeShared(2, bad);
+                } catch (const std::ios_base::failure &) {
+                    threw = true;
+                }
+                Check(threw, QString("malformed block of %1 bytes rejected").arg(bad.size()));
+            }
+        }
+
+        // Random blocks
+        for (const unsigned nTx : {1u, 10u, 200u})
+            fillBothWays(3, makeSyntheticBlock(nTx));
+
+        // A block big enough (> kMinTxsPerJob txs, > kMinInputsPerJob inputs) that fill() farms its phases out to the
+        // pool: the result must match both the CBlock path and a run with the pool limited to this thread.
+        if (auto *pool = AppThreadPool()) {
+            const int nThreads = pool->maxThreadCount();
+            Defer restore([pool, nThreads]{ pool->setMaxThreadCount(nThreads); });
+            const auto block = makeSyntheticBlock(5000);
+            const QByteArray raw = BTC::Serialize(block);
+            pool->setMaxThreadCount(1);
+            Check(NumShards(block.vtx.size(), kMinTxsPerJob) == 1, "big block: one shard at 1 thread");
+            const auto serial = PreProcessedBlock::makeShared(4, raw);
+            pool->setMaxThreadCount(std::max(nThreads, 4));
+            Check(NumShards(block.vtx.size(), kMinTxsPerJob) > 1, "big block: sharded");
+            const auto submitted = pool->numJobsSubmitted();
+            const auto parallel = fillBothWays(4, block);
+            Check(pool->numJobsSubmitted() > submitted, "big block: work went to the pool");
+            checkSame(*serial, *parallel);
+        }
+
+        // A pool that shuts down under parallelFor() must say so, rather than leaving a broken promise behind
+        {
+            ThreadPool pool;
+            pool.setMaxThreadCount(4);
+            pool.shutdownWaitForJobs();
+            bool threw = false;
+            try {
+                pool.parallelFor(100, 1, [](size_t, size_t) {});
+            } catch (const ThreadPool::ShuttingDown &) {
+                threw = true;
+            }
+            Check(threw, "parallelFor on a shut-down pool throws ShuttingDown");
+        }
+
+        Log() << "blockproc: test passed";
+    }
+
+    void bench() {
+        const auto EnvInt = [](const char *name, int def) {
+            const char *s = std::getenv(name);
+            const int val = s ? std::atoi(s) : 0;
+            return val > 0 ? val : def;
+        };
+        const unsigned nTx = unsigned(EnvInt("NTX", 200'000));
+        const int iters = EnvInt("ITERS", 5);
+        Log() << "Generating a synthetic block with " << nTx << " txs (set NTX to change) ...";
+        QByteArray raw;
+        {
+            const auto block = makeSyntheticBlock(nTx);
+            raw = BTC::Serialize(block);
+        }
+        Log() << "Block size: " << QString::number(raw.size() / 1e6, 'f', 3) << " MB, iterations: " << iters
+              << " (set ITERS to change); peak RSS so far: " << peakRSSKiB() << " KiB";
+
+        const auto Time = [iters](const QString &what, const auto & func) {
+            PreProcessedBlockPtr ret;
+            const auto t0 = Util::getTimeNS();
+            for (int i = 0; i < iters; ++i)
+                ret = func();
+            const auto elapsed = (Util::getTimeNS() - t0) / 1e9;
+            Log() << what << ": " << QString::number(iters / elapsed, 'f', 2) << " blocks/sec ("
+                  << QString::number(elapsed * 1e3 / iters, 'f', 1) << " msec/block), peak RSS: " << peakRSSKiB() << " KiB";
+            return ret;
+        };
+        const auto Streaming = [&raw] { return PreProcessedBlock::makeShared(1, raw); };
+
+        // The streaming parser runs first so that the peak RSS reported after it is not masked by the CBlock path.
+        PreProcessedBlockPtr ppbSerial, ppbParallel, ppbCBlock;
+        auto *pool = AppThreadPool();
+        if (pool) {
+            const int nThreads = pool->maxThreadCount();
+            pool->setMaxThreadCount(1); // makes the parallel phases run entirely in this thread
+            ppbSerial = Time("Streaming parser, 1 thread", Streaming);
+            pool->setMaxThreadCount(nThreads);
+            ppbParallel = Time(QString("Streaming parser, %1 threads").arg(nThreads), Streaming);
+        } else
+            ppbSerial = Time("Streaming parser", Streaming);
+        ppbCBlock = Time("CBlock + fill", [&raw] {
+            return PreProcessedBlock::makeShared(1, size_t(raw.size()), BTC::Deserialize<bitcoin::CBlock>(raw));
+        });
+
+        Log() << "Verifying that all paths produce identical results ...";
+        checkSame(*ppbSerial, *ppbCBlock);
+        if (ppbParallel)
+            checkSame(*ppbSerial, *ppbParallel);
+        Log() << "Ok";
+    }
+
+    static const auto test_ = App::registerTest("blockproc", &test);
+    static const auto bench_ = App::registerBench("blockproc", &bench);
+}
+#endif
@@ -162,13 +162,24 @@ struct PreProcessedBlock
     // c'tors, etc... note this class is trivially copyable, move constructible, etc etc
     PreProcessedBlock() = default;
     PreProcessedBlock(BlockHeight bheight, size_t rawBlockSizeBytes, const bitcoin::CBlock &b) { fill(bheight, rawBlockSizeBytes, b); }
+    PreProcessedBlock(BlockHeight bheight, const QByteArray &rawBlock) { fill(bheight, rawBlock); }
     /// reset this to empty
     inline void clear() { *this = PreProcessedBlock(); }
     /// fill this block with data from bitcoin's CBlock
     void fill(BlockHeight blockHeight, size_t rawSizeBytes, const bitcoin::CBlock &b);
+    /// Fill this block directly from the serialized block bytes, in a single pass and without materializing a
+    /// bitcoin::CBlock (no per-tx, per-script allocations; txids and scripthashes are hashed straight out of
+    /// `rawBlock`). The result is identical to deserializing to a CBlock and calling the above. Throws
+    /// std::ios_base::failure if the data is truncated or malformed.
+    ///
+    /// For large blocks the hashing, input resolution and hashX aggregation are split by tx range across the
+    /// app-global ThreadPool, so this must not be called from one of that pool's threads.
+    void fill(BlockHeight blockHeight, const QByteArray &rawBlock);
 
     /// convenience factory static method: given a block, return a shard_ptr instance of this struct
     static PreProcessedBlockPtr makeShared(unsigned height, size_t sizeBytes, const bitcoin::CBlock &block);
+    /// As above, but parses the serialized block directly (see the second fill() overload). This is the fast path.
+    static PreProcessedBlockPtr makeShared(unsigned height, const QByteArray &rawBlock);
 
     /// debug string
     QString toDebugString() const;
@@ -178,4 +189,10 @@ struct PreProcessedBlock
 
 protected:
     static const TxHash nullhash;
+
+private:
+    /// Common to both fill() overloads: resolves the inputs that spend outputs of txs in this same block and builds
+    /// hashXAggregated (in parallel, for large blocks), using `outHashXs`, the hashX of each entry in `outputs` (or
+    /// empty for OP_RETURN).
+    void fillFinish(const std::vector<HashX> &outHashXs);
 };
@@ -25,19 +25,24 @@
 #include "SubsMgr.h"
 #include "ThreadPool.h"
 #include "TXO.h"
+#include "ZmqSubNotifier.h"
 
 #include "bitcoin/transaction.h"
 #include "robin_hood/robin_hood.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstring> // for std::memcpy
 #include <iterator>
 #include <list>
 #include <map>
+#include <optional>
+#include <unordered_map>
 
 
 Controller::Controller(const std::shared_ptr<const Options> &o)
-    : Mgr(nullptr), polltimeMS(int(o->pollTimeSecs * 1e3)), options(o)
+    : Mgr(nullptr), polltimeMS(int(o->pollTimeSecs * 1e3)), options(o), restEnabled(o->bitcoindRest)
 {
     setObjectName("Controller");
     _thread.setObjectName(objectName());
@@ -61,7 +66,14 @@ void Controller::startup()
         // this may take a long time but normally this branch is not taken
         dumpScriptHashes(options->dumpScriptHashes);
 
-    bitcoindmgr = std::make_shared<BitcoinDMgr>(options->bitcoind.first, options->bitcoind.second, options->rpcuser, options->rpcpassword, options->bitcoindUsesTls);
+    if (! options->exportSnapshot.isEmpty()) {
+        // this may take a long time but normally this branch is not taken
+        exportSnapshot(options->exportSnapshot);
+        return; // the App exits on exportSnapshotComplete, so there is no point in connecting to bitcoind
+    }
+
+    bitcoindmgr = std::make_shared<BitcoinDMgr>(options->bitcoind.first, options->bitcoind.second, options->rpcuser,
+                                                options->rpcpassword, options->bitcoindUsesTls, options->bdNClients);
     {
         auto constexpr waitTimer = "wait4bitcoind", callProcessTimer = "callProcess";
         int constexpr msgPeriod = 10000, // 10sec
@@ -145,27 +157,17 @@ void Controller::startup()
         conns += connect(bitcoindmgr.get(), &BitcoinDMgr::allConnectionsLost, this, [this]{ stopTimer(mempoolLogTimer);});
     }
 
-    {
-        // set up periodic refresh of mempool fee histogram
-        constexpr const char *feeHistogramTimer = "feeHistogramTimer";
-        constexpr int feeHistogramTimerInterval = 30 * 1000; // every 30 seconds
-        conns += connect(this, &Controller::upToDate, this, [this] {
-            callOnTimerSoon(feeHistogramTimerInterval, feeHistogramTimer, [this]{
-                storage->refreshMempoolHistogram();
-                return true;
-            }, false, Qt::TimerType::VeryCoarseTimer);
-        });
-        // disable the timer if downloading blocks and restart it later when up-to-date
-        conns += connect(this, &Controller::synchronizing, this, [this]{ stopTimer(feeHistogramTimer); });
-    }
-
     start();  // start our thread
 }
 
 void Controller::cleanup()
 {
     stopFlag = true;
+    if (!zmqNotifiers.empty() && _thread.isRunning())
+        // the notifiers live in our thread, so they must be torn down there
+        Util::VoidFuncOnObjectNoThrow(this, [this]{ zmqNotifiers.clear(); }, 5000);
     stop();
+    zmqNotifiers.clear(); // in case the above didn't run (thread was not running)
     tasks.clear(); // deletes all tasks asap
     if (srvmgr) { Log("Stopping SrvMgr ... "); srvmgr->cleanup(); srvmgr.reset(); }
     if (bitcoindmgr) { Log("Stopping BitcoinDMgr ... "); bitcoindmgr->cleanup(); bitcoindmgr.reset(); }
@@ -290,13 +292,28 @@ struct DownloadBlocksTask : public CtlTask
     const bool TRACE = Trace::isEnabled();
 
     int q_ct = 0;
-    static constexpr int max_q = BitcoinDMgr::N_CLIENTS+1; // todo: tune this
+    /// height -> when we first asked bitcoind for it, for the latency samples we feed to Controller::downloadTaskGotBlock
+    robin_hood::unordered_flat_map<unsigned, double> reqTimes;
 
     static const int HEADER_SIZE;
 
     std::atomic<size_t> nTx = 0, nIns = 0, nOuts = 0;
 
     void do_get(unsigned height);
+    /// Called with each downloaded block: checks it against `hash`, deserializes it, and passes it to the Controller.
+    void gotBlock(unsigned height, const QByteArray &hash, const QByteArray &rawblock, const QString &method);
+
+    // -- REST mode (Controller::isRestEnabled()) --
+    // We use one /rest/headers request to learn the hashes for up to kRestHeadersMax heights at once, and then one
+    // binary /rest/block request per block. This is roughly half the bytes of the JSON-RPC hex, and it saves the
+    // hex-decode and the getblockhash round-trip per block.
+    static constexpr unsigned kRestHeadersMax = 2000; ///< bitcoind's limit for /rest/headers
+    std::map<unsigned, QByteArray> restHashes; ///< height -> block hash, only for heights this task will download
+    unsigned restHashesRequestedTo = 0; ///< we requested (or have) hashes for all of our heights below this one
+    std::vector<unsigned> restWaitingForHashes; ///< heights waiting for an in-flight /rest/headers request
+    void do_get_rest(unsigned height);
+    /// Called if a REST request failed. Disables REST and re-does `heights` via JSON-RPC.
+    void restFailed(const RPC::Message &errMsg, std::vector<unsigned> heights);
 
     // basically computes expectedCt. Use expectedCt member to get the actual expected ct. this is used only by c'tor as a utility function
     static size_t nToDL(unsigned from, unsigned to, unsigned stride)  { return size_t( (((to-from)+1) + stride-1) / qMax(stride, 1U) ); }
@@ -349,83 +366,183 @@ void DownloadBlocksTask::do_get(unsigned int bnum)
         }, msec, Qt::TimerType::PreciseTimer);
         return;
     }
+    reqTimes.emplace(bnum, Util::getTimeSecs()); // keeps the earliest time if this is a retry
+    if (ctl->isRestEnabled()) {
+        do_get_rest(bnum);
+        return;
+    }
     submitRequest("getblockhash", {bnum}, [this, bnum](const RPC::Message & resp){
         QVariant var = resp.result();
         const auto hash = Util::ParseHexFast(var.toByteArray());
         if (hash.length() == HashLen) {
             submitRequest("getblock", {var, false}, [this, bnum, hash](const RPC::Message & resp){
-                QVariant var = resp.result();
-                const auto rawblock = Util::ParseHexFast(var.toByteArray());
-                const auto header = rawblock.left(HEADER_SIZE); // we need a deep copy of this anyway so might as well take it now.
-                QByteArray chkHash;
-                if (bool sizeOk = header.length() == HEADER_SIZE; sizeOk && (chkHash = BTC::HashRev(header)) == hash) {
-                    auto ppb = PreProcessedBlock::makeShared(bnum, size_t(rawblock.size()), BTC::Deserialize<bitcoin::CBlock>(rawblock)); // this is here to test performance
-
-                    if (TRACE) Trace() << "block " << bnum << " size: " << rawblock.size() << " nTx: " << ppb->txInfos.size();
-                    // update some stats for /stats endpoint
-                    nTx += ppb->txInfos.size();
-                    nOuts += ppb->outputs.size();
-                    nIns += ppb->inputs.size();
-
-                    const size_t index = height2Index(bnum);
-                    ++goodCt;
-                    q_ct = qMax(q_ct-1, 0);
-                    lastProgress = double(index) / double(expectedCt);
-                    if (!(bnum % 1000) && bnum) {
-                        emit progress(lastProgress);
-                    }
-                    if (TRACE) Trace() << resp.method << ": header for height: " << bnum << " len: " << header.length();
-                    emit ctl->putBlock(this, ppb); // send the block off to the Controller thread for further processing and for save to db
-                    if (goodCt >= expectedCt) {
-                        // flag state to maybeDone to do checks when process() called again
-                        maybeDone = true;
-                        AGAIN();
-                        return;
-                    }
-                    while (goodCt + unsigned(q_ct) < expectedCt && q_ct < max_q) {
-                        // queue multiple at once
-                        AGAIN();
-                        ++q_ct;
-                    }
-                } else if (!sizeOk) {
-                    Warning() << resp.method << ": at height " << bnum << " header not valid (decoded size: " << header.length() << ")";
-                    errorCode = int(bnum);
-                    errorMessage = QString("bad size for height %1").arg(bnum);
-                    emit errored();
-                } else {
-                    Warning() << resp.method << ": at height " << bnum << " header not valid (expected hash: " << hash.toHex() << ", got hash: " << chkHash.toHex() << ")";
-                    errorCode = int(bnum);
-                    errorMessage = QString("hash mismatch for height %1").arg(bnum);
-                    emit errored();
-                }
-            });
+                gotBlock(bnum, hash, Util::ParseHexFast(resp.result().toByteArray()), resp.method);
+            }, BitcoinDMgr::Lane::Bulk);
         } else {
             Warning() << resp.method << ": at height " << bnum << " hash not valid (decoded size: " << hash.length() << ")";
             errorCode = int(bnum);
             errorMessage = QString("invalid hash for height %1").arg(bnum);
             emit errored();
         }
-    });
+    }, BitcoinDMgr::Lane::Bulk);
 }
 
 
+void DownloadBlocksTask::gotBlock(unsigned bnum, const QByteArray &hash, const QByteArray &rawblock, const QString &method)
+{
+    if (auto it = reqTimes.find(bnum); it != reqTimes.end()) {
+        ctl->downloadTaskGotBlock(Util::getTimeSecs() - it->second);
+        reqTimes.erase(it);
+    }
+    const auto header = rawblock.left(HEADER_SIZE); // we need a deep copy of this anyway so might as well take it now.
+    QByteArray chkHash;
+    if (bool sizeOk = header.length() == HEADER_SIZE; sizeOk && (chkHash = BTC::HashRev(header)) == hash) {
+        PreProcessedBlockPtr ppb;
+        try {
+            ppb = PreProcessedBlock::makeShared(bnum, rawblock); // parses the raw bytes directly, no CBlock
+        } catch (const std::exception &e) {
+            Warning() << method << ": at height " << bnum << " failed to parse block: " << e.what();
+            errorCode = int(bnum);
+            errorMessage = QString("bad block data for height %1").arg(bnum);
+            emit errored();
+            return;
+        }
+
+        if (TRACE) Trace() << "block " << bnum << " size: " << rawblock.size() << " nTx: " << ppb->txInfos.size();
+        // update some stats for /stats endpoint
+        nTx += ppb->txInfos.size();
+        nOuts += ppb->outputs.size();
+        nIns += ppb->inputs.size();
+
+        const size_t index = height2Index(bnum);
+        ++goodCt;
+        q_ct = qMax(q_ct-1, 0);
+        lastProgress = double(index) / double(expectedCt);
+        if (!(bnum % 1000) && bnum) {
+            emit progress(lastProgress);
+        }
+        if (TRACE) Trace() << method << ": header for height: " << bnum << " len: " << header.length();
+        emit ctl->putBlock(this, ppb); // send the block off to the Controller thread for further processing and for save to db
+        if (goodCt >= expectedCt) {
+            // flag state to maybeDone to do checks when process() called again
+            maybeDone = true;
+            AGAIN();
+            return;
+        }
+        const int max_q = int(ctl->downloadTaskMaxInFlight(stride)); // set by the Controller's download control loop
+        while (goodCt + unsigned(q_ct) < expectedCt && q_ct < max_q) {
+            // queue multiple at once
+            AGAIN();
+            ++q_ct;
+        }
+    } else if (!sizeOk) {
+        Warning() << method << ": at height " << bnum << " header not valid (decoded size: " << header.length() << ")";
+        errorCode = int(bnum);
+        errorMessage = QString("bad size for height %1").arg(bnum);
+        emit errored();
+    } else {
+        Warning() << method << ": at height " << bnum << " header not valid (expected hash: " << hash.toHex() << ", got hash: " << chkHash.toHex() << ")";
+        errorCode = int(bnum);
+        errorMessage = QString("hash mismatch for height %1").arg(bnum);
+        emit errored();
+    }
+}
+
+void DownloadBlocksTask::do_get_rest(unsigned bnum)
+{
+    if (auto it = restHashes.find(bnum); it != restHashes.end()) {
+        const QByteArray hash = it->second;
+        restHashes.erase(it);
+        submitRestRequest(QStringLiteral("/rest/block/%1.bin").arg(QString(hash.toHex())),
+                          [this, bnum, hash](const RPC::Message & resp) {
+            gotBlock(bnum, hash, resp.result().toByteArray(), QStringLiteral("rest/block"));
+        }, [this, bnum](const RPC::Message & err) { restFailed(err, {bnum}); }, BitcoinDMgr::Lane::Bulk);
+        return;
+    }
+    if (bnum < restHashesRequestedTo) {
+        // a /rest/headers request that covers this height is in flight; it will call us back
+        restWaitingForHashes.push_back(bnum);
+        return;
+    }
+    // We need the hash of this height. Get it, then get the headers from here on to learn the following hashes too.
+    const unsigned count = std::min(kRestHeadersMax, (to - bnum) + 1);
+    restHashesRequestedTo = bnum + count;
+    submitRequest("getblockhash", {bnum}, [this, bnum, count](const RPC::Message & resp){
+        const auto hash = Util::ParseHexFast(resp.result().toByteArray());
+        if (hash.length() != HashLen) {
+            Warning() << resp.method << ": at height " << bnum << " hash not valid (decoded size: " << hash.length() << ")";
+            errorCode = int(bnum);
+            errorMessage = QString("invalid hash for height %1").arg(bnum);
+            emit errored();
+            return;
+        }
+        submitRestRequest(QStringLiteral("/rest/headers/%1/%2.bin").arg(count).arg(QString(hash.toHex())),
+                          [this, bnum, count, hash](const RPC::Message & resp) {
+            // headers[i] is the header for height bnum + i (fewer than requested if bitcoind's tip is lower)
+            const QByteArray headers = resp.result().toByteArray();
+            const unsigned nHeaders = unsigned(headers.size() / HEADER_SIZE);
+            if (nHeaders == 0 || BTC::HashRev(headers.left(HEADER_SIZE)) != hash) {
+                restFailed(RPC::Message::makeError(0, QString("unexpected /rest/headers reply for height %1").arg(bnum)),
+                           {bnum});
+                return;
+            }
+            for (unsigned i = 0; i < nHeaders; ++i) {
+                if (const unsigned h = bnum + i; h <= to && (h - from) % stride == 0)
+                    restHashes[h] = BTC::HashRev(QByteArray::fromRawData(headers.constData() + i * unsigned(HEADER_SIZE),
+                                                                         HEADER_SIZE));
+            }
+            if (nHeaders < count)
+                // heights past what we got will need another /rest/headers request
+                restHashesRequestedTo = std::min(restHashesRequestedTo, bnum + nHeaders);
+            std::vector<unsigned> waiting;
+            waiting.swap(restWaitingForHashes);
+            do_get_rest(bnum);
+            for (const auto h : waiting)
+                do_get_rest(h);
+        }, [this, bnum](const RPC::Message & err) {
+            std::vector<unsigned> heights;
+            heights.swap(restWaitingForHashes);
+            heights.push_back(bnum);
+            restFailed(err, std::move(heights));
+        }, BitcoinDMgr::Lane::Bulk);
+    }, BitcoinDMgr::Lane::Bulk);
+}
+
+void DownloadBlocksTask::restFailed(const RPC::Message &err, std::vector<unsigned> heights)
+{
+    ctl->disableRest(QString("%1 %2").arg(err.errorCode()).arg(err.errorMessage()));
+    restHashes.clear();
+    restHashesRequestedTo = 0;
+    for (const auto h : heights)
+        do_get(h); // now that REST is disabled, these go via JSON-RPC
+}
+
 /// We use the "getrawmempool false" (nonverbose) call to get the initial list of mempool tx's.  This is the
 /// most efficient.  With fill mempools bitcoind CPU usage could spike to 100% if we use the verbose more.
 /// It turns out we don't need that verbose data anyway (such as a full ancestor count) -- it's enough to have a bool
 /// flag for "has unconfirmed parent tx", and be done with it.  Everything else we can calculate.
 struct SynchMempoolTask : public CtlTask
 {
-    SynchMempoolTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag)
-        : CtlTask(ctl_, "SynchMempool"), storage(storage), notifyFlag(notifyFlag)
+    SynchMempoolTask(Controller *ctl_, std::shared_ptr<Storage> storage, const std::atomic_bool & notifyFlag,
+                     int batchSize, int nBitcoinDClients, Controller::BatchLatencyStats & batchStats)
+        : CtlTask(ctl_, "SynchMempool"), storage(storage), notifyFlag(notifyFlag), batchSize(qMax(batchSize, 1)),
+          kMaxBatchesInFlight(2 * unsigned(qMax(nBitcoinDClients, 1))), batchStats(batchStats)
         { scriptHashesAffected.reserve(SubsMgr::kRecommendedPendingNotificationsReserveSize); }
     ~SynchMempoolTask() override;
     void process() override;
 
     const std::shared_ptr<Storage> storage;
     const std::atomic_bool & notifyFlag;
+    const int batchSize; ///< the max number of `getrawtransaction` requests we put in each bitcoind JSON-RPC batch
+    /// We keep up to this many download batches in flight at once: 2 per bitcoind connection, so that each connection
+    /// has its next batch queued up while we are busy with the reply to its previous batch.
+    const unsigned kMaxBatchesInFlight;
+    Controller::BatchLatencyStats & batchStats;
+    unsigned batchesInFlight = 0;
     bool isdlingtxs = false;
     Mempool::TxMap txsNeedingDownload, txsWaitingForResponse;
-    using DldTxsMap = robin_hood::unordered_flat_map<TxHash, std::pair<Mempool::TxRef, bitcoin::CTransactionRef>, HashHasher>;
+    /// tx hash -> (tx, raw tx bytes). Deserialization is deferred to processResults(), where it happens in parallel.
+    using DldTxsMap = robin_hood::unordered_flat_map<TxHash, std::pair<Mempool::TxRef, QByteArray>, HashHasher>;
     DldTxsMap txsDownloaded;
     unsigned expectedNumTxsDownloaded = 0;
     const bool TRACE = Trace::isEnabled(); // set this to true to print more debug
@@ -438,12 +555,13 @@ struct SynchMempoolTask : public CtlTask
         txsNeedingDownload.clear(); txsWaitingForResponse.clear();
         txsDownloaded.clear();
         expectedNumTxsDownloaded = 0;
+        batchesInFlight = 0;
         // Note: we don't clear "scriptHashesAffected" intentionally in case we are retrying. We want to accumulate
         // all the droppedTx scripthashes for each retry, so we never clear the set.
     }
 
     void doGetRawMempool();
-    void doDLNextTx();
+    void doDLNextBatches();
     void processResults();
 };
 
@@ -463,7 +581,7 @@ void SynchMempoolTask::process()
     if (!isdlingtxs)
         doGetRawMempool();
     else if (!txsNeedingDownload.empty()) {
-        doDLNextTx();
+        doDLNextBatches();
     } else if (txsWaitingForResponse.empty()) {
         try {
             processResults();
@@ -472,11 +590,9 @@ void SynchMempoolTask::process()
             emit errored();
             return;
         }
-    } else {
-        Error() << "Unexpected state in " << __PRETTY_FUNCTION__ << ". FIXME!";
-        emit errored();
-        return;
     }
+    // else: all the txs have been requested but some batches are still in flight; we will be called again when the
+    // next one completes.
 }
 
 
@@ -523,15 +639,75 @@ void SynchMempoolTask::processResults()
         emit errored();
         return;
     }
+    // This function works in phases so that the mempool is only locked exclusively for the final merge step (which
+    // takes time proportional to the number of new tx's and does no I/O). All the expensive work (deserialization,
+    // scripthash hashing, db lookups) happens first, in parallel in the thread pool, with no exclusive lock held.
+    constexpr size_t kMinTxsPerJob = 64, kMinPrevOutsPerJob = 256;
+    struct NewTx {
+        Mempool::TxRef tx;
+        QByteArray raw;
+        bitcoin::CTransactionRef ctx;
+        std::vector<HashX> outHashXs; ///< parallel to ctx->vout; empty for OP_RETURN outputs
+        std::vector<TXO> prevOuts; ///< parallel to ctx->vin
+    };
+    std::vector<NewTx> newTxs;
+    newTxs.reserve(txsDownloaded.size());
+    for (const auto & [hash, pair] : txsDownloaded) {
+        assert(hash == pair.first->hash);
+        newTxs.push_back({pair.first, pair.second, {}, {}, {}});
+    }
+
+    // Phase 1 (thread pool, no locks): deserialize, hash all output scripts, and note all prevouts
+    AppThreadPool()->parallelFor(newTxs.size(), kMinTxsPerJob, [&newTxs](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto & nt = newTxs[i];
+            nt.ctx = bitcoin::MakeTransactionRef(BTC::Deserialize<bitcoin::CMutableTransaction>(nt.raw));
+            nt.raw = QByteArray(); // no longer needed
+            nt.outHashXs.reserve(nt.ctx->vout.size());
+            for (const auto & out : nt.ctx->vout)
+                // UTXO only if it's not OP_RETURN
+                nt.outHashXs.push_back(!BTC::IsOpReturn(out.scriptPubKey) ? BTC::HashXFromCScript(out.scriptPubKey) : HashX());
+            nt.prevOuts.reserve(nt.ctx->vin.size());
+            for (const auto & in : nt.ctx->vin)
+                nt.prevOuts.push_back(TXO{BTC::Hash2ByteArrayRev(in.prevout.GetTxId()), IONum(in.prevout.GetN())});
+        }
+    });
+
+    // Phase 2 (shared lock): find the prevouts that are confirmed (not spending a mempool tx or another new tx)
+    std::vector<TXO> confirmedPrevOuts;
+    {
+        auto [mempool, lock] = storage->mempool(); // shared lock; readers are not blocked
+        for (const auto & nt : newTxs)
+            for (const auto & prevTXO : nt.prevOuts)
+                if (!txsDownloaded.count(prevTXO.txHash) && !mempool.txs.count(prevTXO.txHash))
+                    confirmedPrevOuts.push_back(prevTXO);
+    } // release mempool lock
+
+    // Phase 3 (thread pool, no locks): look up all the confirmed prevouts in the db using batched MultiGets
+    std::unordered_map<TXO, TXOInfo> confirmedInfos;
+    {
+        std::vector<std::optional<TXOInfo>> results(confirmedPrevOuts.size());
+        AppThreadPool()->parallelFor(confirmedPrevOuts.size(), kMinPrevOutsPerJob, [&](size_t begin, size_t end) {
+            auto res = storage->utxoGetFromDB(std::vector<TXO>(confirmedPrevOuts.begin() + std::ptrdiff_t(begin),
+                                                               confirmedPrevOuts.begin() + std::ptrdiff_t(end))); // may throw
+            std::move(res.begin(), res.end(), results.begin() + std::ptrdiff_t(begin));
+        });
+        confirmedInfos.reserve(results.size());
+        for (size_t i = 0; i < results.size(); ++i)
+            if (results[i].has_value())
+                confirmedInfos.emplace(std::move(confirmedPrevOuts[i]), std::move(*results[i]));
+    }
+
+    // Phase 4 (exclusive lock): merge the resolved data into the mempool
     size_t oldSize = 0, newSize = 0, oldNumAddresses = 0, newNumAddresses = 0;
     {
         auto [mempool, lock] = storage->mutableMempool(); // grab mempool struct exclusively
         oldSize = mempool.txs.size();
         oldNumAddresses = mempool.hashXTxs.size();
         // first, do new outputs for all tx's, and put the new tx's in the mempool struct
-        for (auto & [hash, pair] : txsDownloaded) {
-            auto & [tx, ctx] = pair;
-            assert(hash == tx->hash);
+        for (auto & nt : newTxs) {
+            auto & tx = nt.tx;
+            const auto & ctx = nt.ctx;
             mempool.txs[tx->hash] = tx; // save tx right now to map, since we need to find it later for possible spends, etc if subsequent tx's refer to this tx.
             IONum n = 0;
             const auto numTxo = ctx->vout.size();
@@ -541,10 +717,8 @@ void SynchMempoolTask::processResults()
                 tx->txos.resize(numTxo);
             }
             for (const auto & out : ctx->vout) {
-                const auto & script = out.scriptPubKey;
-                if (!BTC::IsOpReturn(script)) {
+                if (HashX sh = nt.outHashXs[n]; !sh.isEmpty()) {
                     // UTXO only if it's not OP_RETURN -- can't do 'continue' here as that would throw off the 'n' counter
-                    HashX sh = BTC::HashXFromCScript(out.scriptPubKey);
                     // the below is a hack to save memory by re-using the same shallow copy of 'sh' each time
                     auto hxit = mempool.hashXTxs.find(sh);
                     if (hxit != mempool.hashXTxs.end()) {
@@ -569,15 +743,15 @@ void SynchMempoolTask::processResults()
             assert(n == numTxo);
             // . <-- at this point the .txos vec is built, with everything isValid() except for the OP_RETURN outs, which are all !isValid()
         }
-        // next, do new inputs for all tx's, debiting/crediting either a mempool tx or querying db for the relevant utxo
-        for (auto & [hash, pair] : txsDownloaded) {
-            auto & [tx, ctx] = pair;
-            assert(hash == tx->hash);
+        // next, do new inputs for all tx's, debiting/crediting either a mempool tx or using the confirmed utxo info we
+        // looked up above
+        for (auto & nt : newTxs) {
+            auto & tx = nt.tx;
+            const auto & hash = tx->hash;
             IONum inNum = 0;
-            for (const auto & in : ctx->vin) {
-                const IONum prevN = IONum(in.prevout.GetN());
-                const TxHash prevTxId = BTC::Hash2ByteArrayRev(in.prevout.GetTxId());
-                const TXO prevTXO{prevTxId, prevN};
+            for (const auto & prevTXO : nt.prevOuts) {
+                const IONum prevN = prevTXO.outN;
+                const TxHash & prevTxId = prevTXO.txHash;
                 TXOInfo prevInfo;
                 QByteArray sh; // shallow copy of prevInfo.hashX
                 if (auto it = mempool.txs.find(prevTxId); it != mempool.txs.end()) {
@@ -591,20 +765,25 @@ void SynchMempoolTask::processResults()
                         throw InternalError(QString("FAILED TO FIND A VALID PREVIOUS TXOUTN %1:%2 IN MEMPOOL for TxHash: %3 (input %4)")
                                             .arg(QString(prevTxId.toHex())).arg(prevN).arg(QString(hash.toHex())).arg(inNum));
                     sh = prevInfo.hashX;
-                    tx->hashXs[sh].unconfirmedSpends[prevTXO] = prevInfo;
+                    // key the spend with a shallow copy of the parent's hash rather than the deserialized one
+                    tx->hashXs[sh].unconfirmedSpends[TXO{prevTxRef->hash, prevN}] = prevInfo;
                     prevTxRef->hashXs[sh].utxo.erase(prevN); // remove this spend from utxo set for prevTx in mempool
                     if (TRACE) Debug() << hash.toHex() << " unconfirmed spend: " << prevTXO.toString() << " " << prevInfo.amount.ToString().c_str();
                 } else {
                     // prev is a confirmed tx
-                    const auto optTXOInfo = storage->utxoGetFromDB(prevTXO, false); // this may also throw on low-level db error
-                    if (UNLIKELY(!optTXOInfo.has_value())) {
+                    if (auto cit = confirmedInfos.find(prevTXO); LIKELY(cit != confirmedInfos.end())) {
+                        prevInfo = cit->second;
+                    } else if (const auto optTXOInfo = storage->utxoGetFromDB(prevTXO, false); optTXOInfo.has_value()) {
+                        // Rare: the parent was in the mempool during phase 2 above but has since left it (a block
+                        // confirmed it), so we didn't look it up in the db above.
+                        prevInfo = *optTXOInfo;
+                    } else {
                         // Uh oh. If it wasn't in the mempool or in the db.. something is very wrong with our code.
                         // We will throw if missing, and the synch process aborts and hopefully we recover with a reorg
                         // or a new block or somesuch.
                         throw InternalError(QString("FAILED TO FIND PREVIOUS TX %1 IN EITHER MEMPOOL OR DB for TxHash: %2 (input %3)")
                                             .arg(prevTXO.toString()).arg(QString(hash.toHex())).arg(inNum));
                     }
-                    prevInfo = *optTXOInfo;
                     sh = prevInfo.hashX;
                     // hack to save memory by re-using existing sh QByteArray and/or forcing a shallow-copy
                     auto hxit = tx->hashXs.find(sh);
@@ -626,16 +805,17 @@ void SynchMempoolTask::processResults()
                 scriptHashesAffected.insert(sh);
                 ++inNum;
             }
-
-            // Now, compactify some data structures to take up less memory by rehashing thier unordered_maps/unordered_sets..
-            // we do this once for each new tx we see.. and it can end up saving tons of space. Note the below structures
-            // are either fixed in size or will only ever shrink as the mempool evolves so this is a good time to do this.
-            tx->hashXs.rehash(tx->hashXs.size());
+            // Now, trim the slack off the flat vectors built above. We do this once for each new tx we see. Note the
+            // below structures are either fixed in size or will only ever shrink as the mempool evolves (except
+            // for .utxo, which may regain items if a child is dropped -- rare) so this is a good time to do this.
+            tx->hashXs.shrink_to_fit();
             for (auto & [sh, ioinfo] : tx->hashXs) {
-                ioinfo.confirmedSpends.rehash(ioinfo.confirmedSpends.size());  // this is fixed once built
-                ioinfo.unconfirmedSpends.rehash(ioinfo.unconfirmedSpends.size()); // this is fixed once built
-                ioinfo.utxo.rehash(ioinfo.utxo.size()); // this may shrink but we rehash it once now to the largest size it will ever have
+                ioinfo.confirmedSpends.shrink_to_fit();  // this is fixed once built
+                ioinfo.unconfirmedSpends.shrink_to_fit(); // this is fixed once built (until its parents confirm)
+                ioinfo.utxo.shrink_to_fit();
             }
+            mempool.feeHistogramAdd(*tx); // the fee is final now that all inputs are accounted for
+            mempool.memBytesAdd(*tx); // and the tx is fully built
         }
 
         // now, sort and uniqueify data structures made temporarily inconsistent above (have dupes, are out-of-order)
@@ -651,65 +831,89 @@ void SynchMempoolTask::processResults()
         newSize = mempool.txs.size();
         newNumAddresses = mempool.hashXTxs.size();
     } // release mempool lock
+    if (!newTxs.empty())
+        storage->invalidateCachedResults(scriptHashesAffected); // drop cached get_history, etc results for these
     if (oldSize != newSize && Debug::isEnabled()) {
         Controller::printMempoolStatusToLog(newSize, newNumAddresses, true, true);
     }
     emit success();
 }
 
-void SynchMempoolTask::doDLNextTx()
+void SynchMempoolTask::doDLNextBatches()
 {
-    Mempool::TxRef tx;
-    if (auto it = txsNeedingDownload.begin(); it == txsNeedingDownload.end()) {
-        Error() << "FIXME -- txsNeedingDownload is empty in " << __func__;
-        emit errored();
-        return;
-    } else {
-        tx = it->second;
-        it = txsNeedingDownload.erase(it); // pop it off the front
-    }
-    assert(bool(tx));
-    const auto hashHex = Util::ToHexFast(tx->hash);
-    txsWaitingForResponse[tx->hash] = tx;
-    submitRequest("getrawtransaction", {hashHex, false}, [this, hashHex, tx](const RPC::Message & resp){
-        QByteArray txdata = resp.result().toString().toUtf8();
-        const int expectedLen = txdata.length() / 2;
-        txdata = Util::ParseHexFast(txdata);
-        if (txdata.length() != expectedLen) {
-            Error() << "Received tx data is of the wrong length -- bad hex? FIXME";
-            emit errored();
-            return;
-        } else if (BTC::HashRev(txdata) != tx->hash) {
-            Error() << "Received tx data appears to not match requested tx! FIXME!!";
-            emit errored();
-            return;
+    // Keep the pipeline full: pop up to batchSize txs at a time off the front of txsNeedingDownload and send each
+    // group as a single JSON-RPC batch. BitcoinDMgr spreads successive batches across all the bitcoind connections.
+    while (!txsNeedingDownload.empty() && batchesInFlight < kMaxBatchesInFlight) {
+        struct BatchState {
+            QHash<RPC::Message::Id, Mempool::TxRef> txsById;
+            int nItems = 0, nRemaining = 0;
+            qint64 t0 = 0;
+        };
+        auto state = std::make_shared<BatchState>();
+        RPC::Batch batch;
+        batch.reserve(qMin(batchSize, int(txsNeedingDownload.size())));
+        for (auto it = txsNeedingDownload.begin(); it != txsNeedingDownload.end() && batch.size() < batchSize; ) {
+            const Mempool::TxRef tx = it->second;
+            assert(bool(tx));
+            it = txsNeedingDownload.erase(it); // pop it off the front
+            txsWaitingForResponse[tx->hash] = tx;
+            const RPC::Message::Id id = IdMixin::newId();
+            state->txsById[id] = tx;
+            batch.push_back({id, QStringLiteral("getrawtransaction"), QVariantList{Util::ToHexFast(tx->hash), false}});
         }
-        tx->sizeBytes = unsigned(expectedLen); // save size now -- this is needed later to calculate fees and for everything else.
+        state->nItems = state->nRemaining = batch.size();
+        state->t0 = Util::getTimeNS();
+        ++batchesInFlight;
+        submitBatchRequest(batch, [this, state](const RPC::Message & resp){
+            const Mempool::TxRef tx = state->txsById.take(resp.id);
+            if (UNLIKELY(!tx)) {
+                Error() << "Received a reply for an unknown batch item (id: " << resp.id << ")! FIXME!";
+                emit errored();
+                return;
+            }
+            QByteArray txdata = resp.result().toString().toUtf8();
+            const int expectedLen = txdata.length() / 2;
+            txdata = Util::ParseHexFast(txdata);
+            if (txdata.length() != expectedLen) {
+                Error() << "Received tx data is of the wrong length -- bad hex? FIXME";
+                emit errored();
+                return;
+            } else if (BTC::HashRev(txdata) != tx->hash) {
+                Error() << "Received tx data appears to not match requested tx! FIXME!!";
+                emit errored();
+                return;
+            }
+            tx->sizeBytes = unsigned(expectedLen); // save size now -- this is needed later to calculate fees and for everything else.
 
-        if (TRACE)
-            Debug() << "got reply for tx: " << hashHex << " " << txdata.length() << " bytes";
+            if (TRACE)
+                Debug() << "got reply for tx: " << tx->hash.toHex() << " " << txdata.length() << " bytes";
 
-        {
-            // tmp mutable object will be moved into CTransactionRef below via a move constructor
-            bitcoin::CMutableTransaction ctx = BTC::Deserialize<bitcoin::CMutableTransaction>(txdata);
-            txsDownloaded[tx->hash] = {tx, bitcoin::MakeTransactionRef(std::move(ctx)) };
-        }
-        txsWaitingForResponse.erase(tx->hash);
-        AGAIN();
-    });
+            txsDownloaded[tx->hash] = {tx, txdata}; // deserialized later in processResults()
+            txsWaitingForResponse.erase(tx->hash);
+            if (--state->nRemaining == 0) {
+                // this batch is complete
+                batchStats.add(size_t(state->nItems), (Util::getTimeNS() - state->t0) / 1e6);
+                --batchesInFlight;
+                AGAIN();
+            }
+        });
+    }
 }
 
 void SynchMempoolTask::doGetRawMempool()
 {
     submitRequest("getrawmempool", {false}, [this](const RPC::Message & resp){
-        bool clearMempool = false; // this is set below in rare cases at the end of this lamba
-        Defer deferredClearMempoolIfNeeded(
-            [this, &clearMempool] {
-                if (clearMempool) {
+        Mempool::TxHashSet txsToDrop; // this is populated below in rare cases, and processed at the end of this lambda
+        Defer deferredDropTxsIfNeeded(
+            [this, &txsToDrop] {
+                if (!txsToDrop.empty()) {
                     auto [mempool, lock] = storage->mutableMempool(); // take the lock exclusively here
                     const auto sz = mempool.txs.size();
-                    mempool.clear();
-                    DebugM("Mempool cleared of ", sz, Util::Pluralize(" tx", sz));
+                    auto dropped = mempool.dropTxs(txsToDrop);
+                    storage->invalidateCachedResults(dropped); // drop cached get_history, etc results for these
+                    scriptHashesAffected.merge(std::move(dropped));
+                    const auto nDropped = sz - mempool.txs.size();
+                    DebugM("Mempool: dropped ", nDropped, Util::Pluralize(" tx", nDropped), ", ", mempool.txs.size(), " remain");
                 }
             });
         int newCt = 0;
@@ -719,60 +923,69 @@ void SynchMempoolTask::doGetRawMempool()
         // invariants will hold regardless.
         auto [mempool, lock] = storage->mempool();
         const auto oldCt = mempool.txs.size();
-        auto droppedTxs = Util::keySet<std::unordered_set<TxHash, HashHasher>>(mempool.txs);
+        // In the steady state nearly every txid in the reply is one we already have, so we decode each txid into a
+        // stack buffer and look it up via a shallow QByteArray view of that buffer. This way a TxHash is only
+        // allocated for new txs.
+        using HashBuf = std::array<char, HashLen>;
+        HashBuf buf;
+        const TxHash lookupKey = TxHash::fromRawData(buf.data(), HashLen); // NB: shares buf's memory
+        size_t nExisting = 0;
         for (const auto & var : txidList) {
-            const auto txidHex = var.toString().trimmed().toLower();
-            const TxHash hash = Util::ParseHexFast(txidHex.toUtf8());
-            if (hash.length() != HashLen) {
-                Error() << resp.method << ": got an empty tx hash";
+            if (!Util::ParseHexFastInPlace(var.toString(), buf.data(), buf.size())) {
+                Error() << resp.method << ": got a bad tx hash: " << var.toString();
                 emit errored();
                 return;
             }
-            static const QVariantList EmptyList; // avoid constructng this for each iteration
-            if (auto it = mempool.txs.find(hash); it != mempool.txs.end()) {
-                droppedTxs.erase(hash); // mark this tx as "not dropped" since it was in the mempool before and is in the mempool now.
-                if (TRACE) Debug() << "Existing mempool tx: " << hash.toHex();
+            if (mempool.txs.find(lookupKey) != mempool.txs.end()) {
+                ++nExisting;
+                if (TRACE) Debug() << "Existing mempool tx: " << lookupKey.toHex();
             } else {
+                TxHash hash(buf.data(), HashLen); // deep copy
                 if (TRACE) Debug() << "New mempool tx: " << hash.toHex();
                 ++newCt;
                 Mempool::TxRef tx = std::make_shared<Mempool::Tx>();
-                tx->hashXs.max_load_factor(1.0); // hopefully this will save some memory by expicitly setting it to 1.0
                 tx->hash = hash;
                 // Note: we end up calculating the fee ourselves since I don't trust doubles here. I wish bitcoind would have returned sats.. :(
-                txsNeedingDownload[hash] = tx;
+                if (auto raw = ctl->takeZmqRawTx(hash)) {
+                    // bitcoind already pushed us this tx via ZMQ "rawtx", no need to download it
+                    tx->sizeBytes = unsigned(raw->size());
+                    txsDownloaded[hash] = {std::move(tx), std::move(*raw)};
+                } else
+                    txsNeedingDownload[hash] = std::move(tx);
             }
             // at this point we have a valid tx ptr
         }
 
+        // bitcoind never lists a txid twice, so if we saw every one of our txs, nothing was dropped and we are done.
+        // Otherwise (rare), figure out which ones are missing by binary searching a sorted array of the reply's txids.
+        Mempool::TxHashSet droppedTxs;
+        if (UNLIKELY(nExisting != oldCt)) {
+            std::vector<HashBuf> sorted;
+            sorted.reserve(size_t(txidList.size()));
+            for (const auto & var : txidList) {
+                Util::ParseHexFastInPlace(var.toString(), buf.data(), buf.size()); // already validated above
+                sorted.push_back(buf);
+            }
+            std::sort(sorted.begin(), sorted.end());
+            for (const auto & [hash, tx] : mempool.txs) {
+                std::memcpy(buf.data(), hash.constData(), HashLen);
+                if (!std::binary_search(sorted.begin(), sorted.end(), buf))
+                    droppedTxs.insert(hash);
+            }
+        }
+
         if (UNLIKELY(!droppedTxs.empty())) {
-            // If tx's were dropped, we clear the mempool and try again. We also enqueue notifications for the dropped
-            // tx's.
+            // If tx's were dropped (evicted, replaced, or conflicted by a block), the Defer object at the top of this
+            // lambda removes just those tx's (and their descendants) from the mempool on function return, taking an
+            // exclusive lock.  The scripthashes they touched are added to scriptHashesAffected for notification.
+            // Note that txs confirmed in a block never end up here since Storage::addBlock already removed them.
             const bool recommendFullRetry = oldCt >= 2 && droppedTxs.size() >= oldCt/2; // more than 50% of the mempool tx's dropped out. something is funny. likely a new block arrived.
-            DebugM(droppedTxs.size(), " txs dropped from mempool, resetting mempool and trying again ...");
-            // NOTIFICATION
-            if (recommendFullRetry) {
-                // NOTIFICATION of all ...
-                scriptHashesAffected.merge(Util::keySet<decltype(scriptHashesAffected)>(mempool.hashXTxs));
-                DebugM("Will notify for all ", scriptHashesAffected.size(), " addresses of mempool for notificatons ...");
-            } else {
-                // just the dropped tx's
-                for (const auto & txid : droppedTxs) {
-                    if (auto it = mempool.txs.find(txid); it != mempool.txs.end()) {
-                        const auto & tx = it->second;
-                        if (tx) // paranoia: tx will always be a valid reference.
-                            scriptHashesAffected.merge(Util::keySet<decltype(scriptHashesAffected)>(tx->hashXs));
-                    }
-                }
-                DebugM("Will notify for ", scriptHashesAffected.size(), " addresses belonging to the dropped tx's for notificatons ...");
-            }
-            clearMempool = true; // Defer object at top of this lamba above will clear the mempool on function return (taking an exclusive lock) if this is true.
+            DebugM(droppedTxs.size(), " txs dropped from mempool");
+            txsToDrop.swap(droppedTxs);
             if (recommendFullRetry) {
                 emit retryRecommended(); // this is an exit point for this task
                 return;
             }
-            clear();
-            AGAIN();
-            return;
         }
 
         if (newCt)
@@ -800,8 +1013,17 @@ struct Controller::StateMachine
 
     std::atomic<unsigned> ppBlkHtNext = 0;  ///< the next unprocessed block height we need to process in series
 
-    // todo: tune this
-    const size_t DL_CONCURRENCY = qMax(Util::getNPhysicalProcessors()-1, 1U);//size_t(qMin(qMax(int(Util::getNPhysicalProcessors())-BitcoinDMgr::N_CLIENTS, BitcoinDMgr::N_CLIENTS), 32));
+    /// Sum of estimatedThisSizeBytes for all the blocks in ppBlocks. Written only in the Controller thread, read by
+    /// downloadTaskRecommendedThrottleTimeMsec() from the download tasks' threads.
+    std::atomic<size_t> ppBlocksBytes = 0;
+    /// Moving average of estimatedThisSizeBytes for the blocks downloaded so far, used to project the backlog size
+    std::atomic<size_t> avgBlockBytes = 0;
+    /// Hard cap on the backlog, regardless of the memory budget, so ppBlocks itself stays small for tiny blocks
+    static constexpr int maxBackLogBlocks = 10'000;
+
+    /// The number of DownloadBlocksTasks (each does its own block parsing, so this is CPU-bound). How many blocks they
+    /// keep in flight is up to Controller::dlTune().
+    const size_t DL_CONCURRENCY = qMax(Util::getNPhysicalProcessors()-1, 1U);
 
     size_t nTx = 0, nIns = 0, nOuts = 0, nSH = 0;
 
@@ -829,31 +1051,129 @@ unsigned Controller::downloadTaskRecommendedThrottleTimeMsec(unsigned bnum) cons
 {
     std::shared_lock g(smLock); // this lock guarantees that 'sm' won't be deleted from underneath us
     if (sm) {
-        int maxBackLog = 1000; // <--- TODO: have this be a more dynamic value based on current average blocksize.
-        if (sm->net == BTC::Net::MainNet) {
-            // mainnet
-            if (bnum > 150000) // beyond this height the blocks are starting to be big enough that we want to not eat memory.
-                maxBackLog = 250;
-            else if (bnum > 550000) // beyond this height we may start to see 32MB blocks in the future
-                maxBackLog = 100;
-        } else {
-            // testnet
-            if (bnum > 1300000) // beyond this height 32MB blocks may be common, esp. in the future
-                maxBackLog = 100;
-        }
-
-        const int diff = int(bnum) - int(sm->ppBlkHtNext.load()); // note: ppBlkHtNext is not guarded by the lock but it is an atomic value, so that's fine.
-        if ( diff > maxBackLog ) {
+        // note: ppBlkHtNext & friends are not guarded by the lock but they are atomic values, so that's fine.
+        const int diff = int(bnum) - int(sm->ppBlkHtNext.load());
+        // The blocks we need next are never held back, no matter the budget, or we could stall.
+        if (diff <= int(sm->DL_CONCURRENCY))
+            return 0u;
+        // The backlog may hold as many blocks as fit in the memory budget at the current average block size.
+        const size_t budget = size_t(options->blockDLMemMB) * 1'000'000;
+        const size_t avg = std::max(sm->avgBlockBytes.load(), size_t(1));
+        const int maxBackLog = int(std::clamp<size_t>(budget / avg, sm->DL_CONCURRENCY, sm->maxBackLogBlocks));
+        if (diff > maxBackLog || sm->ppBlocksBytes.load() >= budget) {
             // Make the backoff time be from 10ms to 50ms, depending on how far in the future this block height is from
             // what we are processing.  The hope is that this enforces some order on future block arrivals and also
             // prevents excessive polling for blocks that are too far ahead of us.
-            return std::min(10u + 5*unsigned(diff - maxBackLog - 1), 50u); // TODO: also have this be tuneable.
+            return std::min(10u + 5*unsigned(std::max(diff - maxBackLog - 1, 0)), 50u);
         }
-
     }
     return 0u;
 }
 
+void Controller::downloadTaskGotBlock(double secs)
+{
+    std::lock_guard g(dlTunerLock);
+    dlTuner.addLatencySample(secs);
+}
+
+unsigned Controller::downloadTaskMaxInFlight(unsigned nTasks) const
+{
+    std::lock_guard g(dlTunerLock);
+    nTasks = std::max(nTasks, 1u);
+    return std::max((dlTuner.window + nTasks - 1) / nTasks, 1u);
+}
+
+void Controller::dlTuneReset(unsigned nTasks)
+{
+    std::lock_guard g(dlTunerLock);
+    dlTuner.reset(nTasks, unsigned(options->bdNClients) + 1, Util::getTimeSecs());
+}
+
+void Controller::dlTune(unsigned nCommitted)
+{
+    assert(sm);
+    std::lock_guard g(dlTunerLock);
+    auto & t = dlTuner;
+    const unsigned prev = t.window;
+    if (t.tune(Util::getTimeSecs(), nCommitted, sm->ppBlocks.size(), sm->ppBlocksBytes.load(),
+               size_t(options->blockDLMemMB) * 1'000'000) && t.window != prev)
+        DebugM("Block download window: ", prev, " -> ", t.window, " (", t.lastAction, ", latency: ",
+               QString::number(t.latencyAvg * 1e3, 'f', 1), " msec, commit rate: ",
+               QString::number(t.commitRate, 'f', 1), " blocks/sec)");
+}
+
+void Controller::DLTuner::reset(unsigned nTasks, unsigned perTask, double now)
+{
+    minWindow = std::max(nTasks, 1u);
+    maxWindow = minWindow * perTask * 2;
+    if (!window)
+        window = minWindow * perTask; // start where the old fixed setting was
+    window = std::clamp(window, minWindow, maxWindow);
+    nSamples = nCommitted = nCommittedAtLastTune = 0;
+    latencyBase = commitRate = 0.;
+    grewLast = false;
+    lastTuneTs = now;
+}
+
+void Controller::DLTuner::addLatencySample(double secs)
+{
+    latencyAvg = nSamples++ ? latencyAvg * 0.9 + secs * 0.1 : secs;
+}
+
+bool Controller::DLTuner::tune(double now, unsigned nCommittedNow, size_t backlogBlocks, size_t backlogBytes,
+                               size_t budgetBytes)
+{
+    nCommitted += nCommittedNow;
+    const double elapsed = now - lastTuneTs;
+    if (elapsed < kIntervalSecs || !nSamples)
+        return false;
+    const double prevCommitRate = commitRate;
+    commitRate = (nCommitted - nCommittedAtLastTune) / elapsed;
+    nCommittedAtLastTune = nCommitted;
+    lastTuneTs = now;
+    if (latencyBase <= 0. || latencyAvg < latencyBase)
+        latencyBase = latencyAvg;
+    else
+        latencyBase += kBaseAlpha * (latencyAvg - latencyBase);
+
+    const unsigned prev = window;
+    if (backlogBytes >= budgetBytes / 2 || backlogBlocks > 2 * size_t(window)) {
+        // Storage can't keep up with what we already have; more downloads in flight would just sit in memory.
+        window -= std::max(window / 8, 1u);
+        lastAction = "decrease (storage-bound)";
+    } else if (latencyAvg > 2. * latencyBase) {
+        // bitcoind is queueing our requests; back off multiplicatively
+        window -= std::max(window / 4, 1u);
+        lastAction = "decrease (bitcoind latency)";
+    } else if (backlogBlocks < size_t(window)) {
+        if (grewLast && commitRate < prevCommitRate * 1.05) {
+            // The last increase didn't buy us any commit throughput, so downloads aren't what's limiting us (block
+            // parsing or Storage is). Don't keep widening; we probe again next interval.
+            lastAction = "hold (commit rate flat)";
+        } else {
+            // Storage is (nearly) waiting on downloads and bitcoind looks fine: open up additively
+            window += std::max(minWindow / 2, 1u);
+            lastAction = "increase";
+        }
+    } else
+        lastAction = "hold";
+    window = std::clamp(window, minWindow, maxWindow);
+    grewLast = window > prev;
+    return true;
+}
+
+QVariantMap Controller::DLTuner::toMap() const
+{
+    return QVariantMap{
+        { "window", window },
+        { "window bounds", QVariantList{ minWindow, maxWindow } },
+        { "latency (msec)", QString::number(latencyAvg * 1e3, 'f', 1) },
+        { "latency baseline (msec)", QString::number(latencyBase * 1e3, 'f', 1) },
+        { "commit rate (blocks/sec)", QString::number(commitRate, 'f', 1) },
+        { "last action", lastAction },
+    };
+}
+
 void Controller::rmTask(CtlTask *t)
 {
     if (auto it = tasks.find(t); it != tasks.end()) {
@@ -1015,6 +1335,7 @@ void Controller::process(bool beSilentIfUpToDate)
         sm->lastProgTs = Util::getTimeSecs();
         sm->ppBlkHtNext = sm->startheight = unsigned(base);
         sm->endHeight = unsigned(sm->ht);
+        dlTuneReset(unsigned(nTasks));
         for (size_t i = 0; i < nTasks; ++i) {
             add_DLHeaderTask(unsigned(base + i), unsigned(sm->ht), nTasks);
         }
@@ -1055,6 +1376,16 @@ void Controller::process(bool beSilentIfUpToDate)
             sm.reset();  // great success!
         }
         enablePollTimer = true;
+        // This synch may have been triggered early (see triggerProcess) rather than by the poll timer, so re-arm the
+        // poll timer from now.
+        stopTimer(pollTimerName);
+        if (pendingProcess) {
+            // a trigger arrived while we were busy, synch again right away
+            pendingProcess = false;
+            polltimeout = 0;
+        } else if (zmqIsHealthy())
+            // bitcoind tells us when something happens, so poll much less often (but still poll, as a safety net)
+            polltimeout = std::max(polltimeout, kZmqHealthyPollTimeMS);
     } else if (sm->state == State::IBD) {
         {
             std::lock_guard g(smLock);
@@ -1066,7 +1397,8 @@ void Controller::process(bool beSilentIfUpToDate)
         emit synchFailure();
     } else if (sm->state == State::SynchMempool) {
         // ...
-        auto task = newTask<SynchMempoolTask>(true, this, storage, masterNotifySubsFlag);
+        auto task = newTask<SynchMempoolTask>(true, this, storage, masterNotifySubsFlag, options->bdBatchSize, options->bdNClients,
+                                              mempoolBatchStats);
         task->threadObjectDebugLifecycle = Trace::isEnabled(); // suppress verbose lifecycle prints unless trace mode
         connect(task, &CtlTask::success, this, [this, task]{
             if (UNLIKELY(!sm || isTaskDeleted(task) || sm->state != State::SynchingMempool))
@@ -1088,6 +1420,111 @@ void Controller::process(bool beSilentIfUpToDate)
         callOnTimerSoonNoRepeat(polltimeout, pollTimerName, [this]{if (!sm) process(true);});
 }
 
+void Controller::on_started()
+{
+    ThreadObjectMixin::on_started();
+    // Note: options were validated at startup; if we get here with zmq endpoints then this build has ZMQ support.
+    for (auto it = options->zmqEndpoints.cbegin(); it != options->zmqEndpoints.cend(); ++it) {
+        auto zn = std::make_unique<ZmqSubNotifier>();
+        QString errMsg;
+        if (!zn->start(it.value(), it.key(), &errMsg)) {
+            Warning() << "ZMQ: failed to subscribe to \"" << it.key() << "\" at " << it.value() << ": " << errMsg
+                      << " (will rely on polling bitcoind)";
+            continue;
+        }
+        connect(zn.get(), &ZmqSubNotifier::gotMessage, this, &Controller::zmqOnMessage);
+        Log() << "ZMQ: subscribed to \"" << it.key() << "\" at " << it.value();
+        zmqNotifiers.push_back(std::move(zn));
+    }
+}
+
+void Controller::zmqOnMessage(const QString &topic, const QByteArray &body)
+{
+    if (topic == QLatin1String("hashblock")) {
+        DebugM("ZMQ: new block ", Util::ToHexFast(body));
+        {
+            // txs in the cache that were confirmed will never be asked for, so just start over
+            std::lock_guard g(zmqRawTxsLock);
+            zmqRawTxs.clear();
+            zmqRawTxsBytes = 0;
+        }
+        triggerProcess(false);
+    } else if (topic == QLatin1String("sequence")) {
+        // body: 32-byte hash, 1-byte label, and for labels 'A' and 'R' an 8-byte mempool sequence number
+        const char label = body.size() > HashLen ? body.at(HashLen) : 0;
+        if (label == 'C' || label == 'D')
+            triggerProcess(false); // block connected / disconnected
+        else if (label == 'A' || label == 'R')
+            triggerProcess(true); // tx added to / removed from mempool
+    } else if (topic == QLatin1String("rawtx")) {
+        if (!body.isEmpty()) {
+            std::lock_guard g(zmqRawTxsLock);
+            if (zmqRawTxsBytes + size_t(body.size()) > kZmqRawTxsMaxBytes) {
+                // nobody is consuming these (perhaps the mempool synch is failing), so don't let them pile up
+                DebugM("ZMQ: rawtx cache full (", zmqRawTxs.size(), " txs), clearing");
+                zmqRawTxs.clear();
+                zmqRawTxsBytes = 0;
+            }
+            if (const auto [it, inserted] = zmqRawTxs.emplace(BTC::HashRev(body), body); inserted)
+                zmqRawTxsBytes += size_t(body.size());
+        }
+        triggerProcess(true);
+    } else if (topic == QLatin1String("hashtx")) {
+        triggerProcess(true);
+    }
+}
+
+void Controller::triggerProcess(bool throttle)
+{
+    if (stopFlag || lostConn)
+        return;
+    if (sm) {
+        // a synch is in progress, and it may have already missed what bitcoind just told us about
+        pendingProcess = true;
+        return;
+    }
+    if (throttle)
+        callOnTimerSoonNoRepeat(kTxTriggerMinMS, triggerTimerName, [this]{ if (!sm) process(true); });
+    else {
+        stopTimer(triggerTimerName);
+        process(true);
+    }
+}
+
+void Controller::notifyFromBitcoind(bool newBlock)
+{
+    Util::AsyncOnObject(this, [this, newBlock]{
+        DebugM("Got ", newBlock ? "block" : "wallet", " notification from bitcoind");
+        triggerProcess(!newBlock);
+    });
+}
+
+bool Controller::zmqIsHealthy() const
+{
+    bool haveBlockTopic = false;
+    double lastMsg = 0.;
+    for (const auto & zn : zmqNotifiers) {
+        if (!zn->isRunning())
+            continue;
+        if (zn->topic() == QLatin1String("hashblock") || zn->topic() == QLatin1String("sequence"))
+            haveBlockTopic = true;
+        lastMsg = std::max(lastMsg, zn->lastMessageTime());
+    }
+    return haveBlockTopic && lastMsg > 0. && Util::getTimeSecs() - lastMsg <= kZmqQuietSecs;
+}
+
+std::optional<QByteArray> Controller::takeZmqRawTx(const TxHash &txid)
+{
+    std::optional<QByteArray> ret;
+    std::lock_guard g(zmqRawTxsLock);
+    if (auto it = zmqRawTxs.find(txid); it != zmqRawTxs.end()) {
+        zmqRawTxsBytes -= std::min(zmqRawTxsBytes, size_t(it->second.size()));
+        ret.emplace(std::move(it->second));
+        zmqRawTxs.erase(it);
+    }
+    return ret;
+}
+
 // runs in our thread as the slot for putBlock
 void Controller::on_putBlock(CtlTask *task, PreProcessedBlockPtr p)
 {
@@ -1098,7 +1535,14 @@ void Controller::on_putBlock(CtlTask *task, PreProcessedBlockPtr p)
         DebugM("Ignoring putBlocks request for block ", p->height, " -- state is not \"DownloadingBlocks\" but rather is: \"", sm->stateStr(), "\"");
         return;
     }
-    sm->ppBlocks[p->height] = p;
+    auto & slot = sm->ppBlocks[p->height];
+    if (UNLIKELY(slot)) // paranoia: a dupe; keep the byte tally right
+        sm->ppBlocksBytes -= std::min(sm->ppBlocksBytes.load(), slot->estimatedThisSizeBytes);
+    slot = p;
+    // memory accounting for downloadTaskRecommendedThrottleTimeMsec()
+    const size_t bytes = p->estimatedThisSizeBytes, avg = sm->avgBlockBytes.load();
+    sm->ppBlocksBytes += bytes;
+    sm->avgBlockBytes = avg ? (avg * 15 + bytes) / 16 : bytes;
     process_DownloadingBlocks();
 }
 
@@ -1154,6 +1598,7 @@ void Controller::process_DownloadingBlocks()
 
         ++sm->ppBlkHtNext;
         sm->ppBlocks.erase(it); // remove immediately from q
+        sm->ppBlocksBytes -= std::min(sm->ppBlocksBytes.load(), ppb->estimatedThisSizeBytes);
 
         // process & add it if it's good
         if ( ! process_VerifyAndAddBlock(ppb) )
@@ -1170,6 +1615,8 @@ void Controller::process_DownloadingBlocks()
 
     }
 
+    dlTune(ct);
+
     // testing debug
     //if (auto backlog = sm->ppBlocks.size(); backlog < 100 || ct > 100) {
     //    DebugM("ppblk - processed: ", ct, ", backlog: ", backlog);
@@ -1269,17 +1716,69 @@ void CtlTask::on_failure(const RPC::Message::Id &id, const QString &msg)
     errorMessage = msg;
     emit errored();
 }
-quint64 CtlTask::submitRequest(const QString &method, const QVariantList &params, const BitcoinDMgr::ResultsF &resultsFunc)
+quint64 CtlTask::submitRequest(const QString &method, const QVariantList &params, const BitcoinDMgr::ResultsF &resultsFunc,
+                               BitcoinDMgr::Lane lane)
 {
     quint64 id = IdMixin::newId();
     ctl->bitcoindmgr->submitRequest(this, id, method, params,
                                     resultsFunc,
                                     [this](const RPC::Message &r){on_error(r);},
-                                    [this](const RPC::Message::Id &id, const QString &msg){on_failure(id, msg);});
+                                    [this](const RPC::Message::Id &id, const QString &msg){on_failure(id, msg);},
+                                    lane);
     return id;
 }
 
 
+void CtlTask::submitBatchRequest(const RPC::Batch &batch, const BitcoinDMgr::ResultsF &resultsFunc)
+{
+    ctl->bitcoindmgr->submitBatchRequest(this, batch,
+                                         resultsFunc,
+                                         [this](const RPC::Message &r){on_error(r);},
+                                         [this](const RPC::Message::Id &id, const QString &msg){on_failure(id, msg);});
+}
+
+quint64 CtlTask::submitRestRequest(const QString &path, const BitcoinDMgr::ResultsF &resultsFunc,
+                                   const BitcoinDMgr::ErrorF &errorFunc, BitcoinDMgr::Lane lane)
+{
+    quint64 id = IdMixin::newId();
+    ctl->bitcoindmgr->submitRestRequest(this, id, path,
+                                        resultsFunc,
+                                        errorFunc,
+                                        [this](const RPC::Message::Id &id, const QString &msg){on_failure(id, msg);},
+                                        lane);
+    return id;
+}
+
+void Controller::disableRest(const QString &reason)
+{
+    if (restEnabled.exchange(false))
+        Warning() << "bitcoind REST request failed (" << reason << "), will use JSON-RPC to download blocks instead."
+                  << " Make sure bitcoind was started with -rest=1, or set bitcoind_rest = false.";
+}
+
+void Controller::BatchLatencyStats::add(size_t nItemsInBatch, double msec)
+{
+    // Note: there is only ever 1 writer (the SynchMempoolTask thread), so load/store here is fine.
+    ++nBatches;
+    nItems += nItemsInBatch;
+    totalMSec = totalMSec.load() + msec;
+    lastMSec = msec;
+    if (msec > maxMSec.load())
+        maxMSec = msec;
+}
+
+QVariantMap Controller::BatchLatencyStats::toMap() const
+{
+    const auto n = nBatches.load();
+    const auto MSecStr = [](double msec) { return QString("%1 msec").arg(QString::number(msec, 'f', 3)); };
+    return {
+        { "nBatches", qulonglong(n) },
+        { "nTxs", qulonglong(nItems.load()) },
+        { "latency (avg)", n ? QVariant(MSecStr(totalMSec.load() / double(n))) : QVariant() },
+        { "latency (max)", n ? QVariant(MSecStr(maxMSec.load())) : QVariant() },
+        { "latency (last)", n ? QVariant(MSecStr(lastMSec.load())) : QVariant() },
+    };
+}
 
 // --- Controller stats
 auto Controller::stats() const -> Stats
@@ -1327,6 +1826,7 @@ auto Controller::stats() const -> Stats
             m3["in-memory (est.)"] = QString("%1 MiB").arg(QString::number(double(backlogInMemoryBytes) / 1e6, 'f', 3));
             m3["block bytes"] = QString("%1 MiB").arg(QString::number(double(backlogBytes) / 1e6, 'f', 3));
             m3["numTxs"] = qulonglong(backlogTxs);
+            m3["budget"] = QString("%1 MiB").arg(options->blockDLMemMB);
             m2["BackLog"] = m3;
         } else {
             m2["BackLog"] = QVariant(); // null
@@ -1334,6 +1834,42 @@ auto Controller::stats() const -> Stats
         m["StateMachine"] = m2;
     } else
         m["StateMachine"] = QVariant(); // null
+    {
+        std::lock_guard g(dlTunerLock);
+        m["Block download"] = dlTuner.toMap();
+    }
+    m["Mempool download batches"] = mempoolBatchStats.toMap();
+    if (!zmqNotifiers.empty()) {
+        QVariantMap mz;
+        const auto now = Util::getTimeSecs();
+        for (const auto & zn : zmqNotifiers) {
+            const auto last = zn->lastMessageTime();
+            mz[zn->topic()] = QVariantMap{
+                { "address", zn->address() },
+                { "running", zn->isRunning() },
+                { "messages", qulonglong(zn->messagesReceived()) },
+                { "last message", last > 0. ? QVariant(QString("%1 sec ago").arg(QString::number(now - last, 'f', 1))) : QVariant() },
+            };
+        }
+        {
+            std::lock_guard g(zmqRawTxsLock);
+            mz["rawtx cache"] = QVariantMap{
+                { "numTxs", qulonglong(zmqRawTxs.size()) },
+                { "bytes", qulonglong(zmqRawTxsBytes) },
+            };
+        }
+        mz["healthy"] = zmqIsHealthy();
+        m["ZMQ"] = mz;
+    }
+    {
+        auto [mempool, lock] = storage->mempool(); // shared lock
+        const size_t nTxs = mempool.txs.size(), nBytes = mempool.estimatedMemoryBytes();
+        m["Mempool memory (est.)"] = QVariantMap{
+            { "numTxs", qulonglong(nTxs) },
+            { "total", QString("%1 MiB").arg(QString::number(double(nBytes) / 1e6, 'f', 3)) },
+            { "bytes per tx (est.)", nTxs ? qulonglong(nBytes / nTxs) : 0ULL },
+        };
+    }
     m["activeTimers"] = activeTimerMapForStats();
     QVariantList l;
     { // task list
@@ -1438,24 +1974,20 @@ auto Controller::debug(const StatsParams &p) const -> Stats // from StatsMixin
                 const auto vl = Util::toList<QVariantList>(inf.utxo);
 #endif
                 ret["utxos"] = vl;
-                ret["utxos (BucketCount)"] = qlonglong(inf.utxo.bucket_count());
-                ret["utxos (LoadFactor)"] = QString::number(double(inf.utxo.load_factor()), 'f', 4);
                 QVariantMap cs;
                 for (const auto & [txo, info] : inf.confirmedSpends)
                     cs[txo.toString()] = TXOInfo2Map(info);
                 ret["confirmedSpends"] = cs;
-                ret["confirmedSpends (LoadFactor)"] = QString::number(double(inf.confirmedSpends.load_factor()), 'f', 4);
                 QVariantMap us;
                 for (const auto & [txo, info] : inf.unconfirmedSpends)
                     us[txo.toString()] = TXOInfo2Map(info);
                 ret["unconfirmedSpends"] = us;
-                ret["unconfirmedSpends (LoadFactor)"] = QString::number(double(inf.unconfirmedSpends.load_factor()), 'f', 4);
                 return ret;
             };
             for (const auto & [sh, ioinfo] : tx->hashXs)
                 hxs[sh.toHex()] = IOInfo2Map(ioinfo);
             m["hashXs"] = hxs;
-            m["hashXs (LoadFactor)"] = QString::number(double(tx->hashXs.load_factor()), 'f', 4);
+            m["estimatedMemoryBytes"] = qulonglong(tx->estimatedMemoryBytes());
 
             txs[hash.toHex()] = m;
         }
@@ -1533,3 +2065,284 @@ void Controller::dumpScriptHashes(const QString &fileName) const
           <<" (" << QString::number(outFile.size()/1e6, 'f', 3) << " MiB)";
     emit dumpScriptHashesComplete();
 }
+
+void Controller::exportSnapshot(const QString &fileName) const
+{
+    if (!storage)
+        throw InternalError("Snapshot: Storage is not started");
+    Log() << "Snapshot: exporting database to \"" << fileName << "\" (this may take some time) ...";
+    const auto t0 = Util::getTimeSecs();
+    const auto nBytes = storage->exportSnapshot(fileName);
+    Log() << "Snapshot: wrote " << QString::number(nBytes/1e6, 'f', 3) << " MB to \"" << fileName << "\""
+          << " in " << QString::number(Util::getTimeSecs() - t0, 'f', 1) << " seconds";
+    emit exportSnapshotComplete();
+}
+
+#ifdef ENABLE_TESTS
+#include "Json.h"
+
+#include <QElapsedTimer>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <cmath>
+#include <functional>
+#include <set>
+#include <string>
+
+CtlTask *Controller::testDownloadBlocks(const std::shared_ptr<BitcoinDMgr> &mgr, unsigned from, unsigned to)
+{
+    bitcoindmgr = mgr;
+    dlTuneReset(1);
+    return newTask<DownloadBlocksTask>(false, from, to, 1u, this);
+}
+
+namespace {
+    void testDLTuner() {
+        const auto Check = [](bool b, const QString &what) {
+            if (!b) throw Exception(QString("dltuner: check failed: %1").arg(what));
+        };
+        const auto Is = [](const char *action, const char *expected) { return std::string(action) == expected; };
+        Controller::DLTuner t;
+        double now = 1000.;
+        t.reset(4, 3, now);
+        Check(t.minWindow == 4 && t.maxWindow == 24 && t.window == 12, "initial bounds");
+        // one tuning step, preceded by `nSamples` latency samples of `latency` seconds; Storage is idle
+        const auto Step = [&](double latency, int nSamples = 10) {
+            for (int i = 0; i < nSamples; ++i)
+                t.addLatencySample(latency);
+            now += Controller::DLTuner::kIntervalSecs;
+            return t.tune(now, 20, 0, 0, 1'000'000);
+        };
+
+        // steady, low latency: the window opens up and never backs off
+        for (int i = 0; i < 20; ++i) {
+            Check(Step(0.05), "step ran");
+            Check(!Is(t.lastAction, "decrease (bitcoind latency)"), "no back-off at steady latency");
+        }
+        Check(t.window > 12, "window grew");
+        Check(std::abs(t.latencyBase - 0.05) < 1e-9, "baseline is the steady latency");
+        Check(!t.tune(now + Controller::DLTuner::kIntervalSecs / 4, 1, 0, 0, 1'000'000), "too-soon step is skipped");
+
+        // latency triples: the window must shrink every step, down to its floor, and the baseline must not chase the
+        // new level within that time (it used to, in ~5 steps, which disabled the back-off)
+        for (int i = 0; i < 10; ++i) {
+            const unsigned prev = t.window;
+            Step(0.15);
+            Check(Is(t.lastAction, "decrease (bitcoind latency)"), QString("back-off at step %1 after the rise").arg(i));
+            Check(t.window < prev || t.window == t.minWindow, QString("window shrank at step %1").arg(i));
+        }
+        Check(t.window == t.minWindow, "window at its floor");
+        Check(t.latencyBase < 0.075, "baseline still low after 10 steps");
+
+        // if the higher latency persists (e.g. bigger blocks), the baseline eventually takes it as the new normal
+        for (int i = 0; i < 300; ++i)
+            Step(0.15);
+        Check(!Is(t.lastAction, "decrease (bitcoind latency)") && t.latencyBase > 0.14, "baseline caught up");
+
+        // and it follows a drop right away
+        Step(0.05, 200);
+        Check(t.latencyBase == t.latencyAvg && t.latencyBase < 0.051, "baseline follows latency down");
+
+        Log() << "dltuner: test passed";
+    }
+
+    const auto test_dltuner = App::registerTest("dltuner", &testDLTuner);
+
+    QByteArray HttpReply(const QByteArray &status, const QByteArray &contentType, const QByteArray &body) {
+        QByteArray ret = "HTTP/1.1 " + status + "\r\n";
+        if (!contentType.isEmpty())
+            ret += "Content-Type: " + contentType + "\r\n";
+        ret += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+        return ret;
+    }
+
+    /// A stand-in for bitcoind on a local port, serving a chain of coinbase-only blocks. It answers the JSON-RPC calls
+    /// that BitcoinDMgr and DownloadBlocksTask make, and the /rest/headers and /rest/block GETs. The REST paths in
+    /// `restFail` get a bare 404 instead, as from a bitcoind started without -rest.
+    class FakeBitcoinD {
+    public:
+        std::vector<QByteArray> blocks; ///< serialized
+        std::vector<QByteArray> hashes; ///< hex, as bitcoind shows them
+        std::set<QString> restFail;
+        QStringList requests; ///< "GET <path>" or "<method> <first param>", in the order they arrived
+
+        explicit FakeBitcoinD(unsigned nBlocks) {
+            bitcoin::uint256 prevHash;
+            for (unsigned h = 0; h < nBlocks; ++h) {
+                bitcoin::CMutableTransaction cb;
+                cb.nVersion = 1;
+                cb.vin.emplace_back(bitcoin::COutPoint(), bitcoin::CScript() << std::vector<uint8_t>(4, uint8_t(h)));
+                cb.vout.emplace_back(int64_t(5'000'000'000) * bitcoin::Amount::satoshi(),
+                                     bitcoin::CScript() << bitcoin::opcodetype::OP_TRUE);
+                bitcoin::CBlock block;
+                block.nVersion = 0x20000000;
+                block.hashPrevBlock = prevHash;
+                block.nTime = 1600000000 + h;
+                block.nBits = 0x207fffff;
+                block.vtx.push_back(bitcoin::MakeTransactionRef(std::move(cb)));
+                prevHash = block.GetHash();
+                blocks.push_back(BTC::Serialize(block));
+                hashes.push_back(BTC::Hash2ByteArrayRev(prevHash).toHex());
+            }
+            if (!server.listen(QHostAddress::LocalHost, 0))
+                throw Exception("failed to listen: " + server.errorString());
+            QObject::connect(&server, &QTcpServer::newConnection, &server, [this] {
+                while (QTcpSocket *sock = server.nextPendingConnection()) {
+                    auto buf = std::make_shared<QByteArray>();
+                    QObject::connect(sock, &QTcpSocket::readyRead, sock, [this, sock, buf] { onReadyRead(sock, *buf); });
+                }
+            });
+        }
+
+        quint16 port() const { return server.serverPort(); }
+
+        int count(const QString &prefix) const {
+            return int(std::count_if(requests.begin(), requests.end(), [&prefix](const QString &r) { return r.startsWith(prefix); }));
+        }
+
+    private:
+        QTcpServer server;
+
+        void onReadyRead(QTcpSocket *sock, QByteArray &buf) {
+            buf += sock->readAll();
+            for (int hdrEnd; (hdrEnd = buf.indexOf("\r\n\r\n")) >= 0; ) {
+                const auto lines = buf.left(hdrEnd).split('\n');
+                int contentLength = 0;
+                for (const auto & line : lines)
+                    if (line.toLower().startsWith("content-length:"))
+                        contentLength = line.mid(15).trimmed().toInt();
+                if (buf.size() < hdrEnd + 4 + contentLength)
+                    break;
+                sock->write(reply(lines.front().trimmed(), buf.mid(hdrEnd + 4, contentLength)));
+                buf.remove(0, hdrEnd + 4 + contentLength);
+            }
+        }
+
+        QByteArray reply(const QByteArray &requestLine, const QByteArray &body) {
+            const auto FindHash = [this](const QByteArray &hex) { return size_t(std::find(hashes.begin(), hashes.end(), hex) - hashes.begin()); };
+            if (const auto toks = requestLine.split(' '); toks.value(0) == "GET") {
+                const QString path = QString::fromUtf8(toks.value(1));
+                requests.push_back("GET " + path);
+                if (restFail.count(path))
+                    return HttpReply("404 Not Found", {}, {});
+                // /rest/block/<hash>.bin or /rest/headers/<count>/<hash>.bin
+                const QStringList parts = path.split('/');
+                const size_t h = FindHash(parts.last().left(parts.last().size() - 4).toUtf8());
+                if (!parts.last().endsWith(".bin") || h >= hashes.size())
+                    return HttpReply("404 Not Found", "text/plain", "Block not found\r\n");
+                if (parts.size() == 4 && parts[2] == "block")
+                    return HttpReply("200 OK", "application/octet-stream", blocks[h]);
+                if (parts.size() == 5 && parts[2] == "headers") {
+                    QByteArray headers;
+                    for (size_t i = h; i < blocks.size() && i < h + parts[3].toUInt(); ++i)
+                        headers += blocks[i].left(BTC::GetBlockHeaderSize());
+                    return HttpReply("200 OK", "application/octet-stream", headers);
+                }
+                return HttpReply("400 Bad Request", "text/plain", "Invalid URI format\r\n");
+            }
+            const QVariantMap req = Json::parseUtf8(body, Json::ParseOption::RequireObject).toMap();
+            const QString method = req.value("method").toString();
+            const QVariantList params = req.value("params").toList();
+            requests.push_back(method + " " + params.value(0).toString());
+            const QByteArray id = QByteArray::number(req.value("id").toULongLong());
+            const auto Result = [&id](const QByteArray &json) {
+                return HttpReply("200 OK", "application/json", R"({"result":)" + json + R"(,"error":null,"id":)" + id + "}\n");
+            };
+            const auto RpcError = [&id](int code, const QByteArray &msg) {
+                return HttpReply("500 Internal Server Error", "application/json",
+                                 R"({"result":null,"error":{"code":)" + QByteArray::number(code) + R"(,"message":")" + msg
+                                 + R"("},"id":)" + id + "}\n");
+            };
+            if (method == "ping")
+                return Result("null");
+            if (method == "getnetworkinfo")
+                return Result(R"({"version":260000,"subversion":"/Bitcoin Cash Node:26.0.0/","relayfee":0.00001,"warnings":""})");
+            if (method == "getblockhash") {
+                if (const size_t h = params.value(0).toUInt(); h < hashes.size())
+                    return Result('"' + hashes[h] + '"');
+                return RpcError(-8, "Block height out of range");
+            }
+            if (method == "getblock") {
+                if (const size_t h = FindHash(params.value(0).toByteArray()); h < hashes.size())
+                    return Result('"' + blocks[h].toHex() + '"');
+                return RpcError(-5, "Block not found");
+            }
+            return RpcError(-32601, "Method not found");
+        }
+    };
+
+    /// DownloadBlocksTask against FakeBitcoinD, via a real BitcoinDMgr: all over REST, and falling back to JSON-RPC
+    /// (and disabling REST) when a /rest/block or the /rest/headers request fails.
+    void testRestDownload() {
+        const auto Check = [](bool b, const QString &what) {
+            if (!b) throw Exception(QString("restdl: check failed: %1").arg(what));
+        };
+        // Runs the event loop until `done` returns true, or until `msec` have passed
+        const auto WaitFor = [](const std::function<bool()> &done, int msec) {
+            QElapsedTimer t;
+            t.start();
+            while (!done() && t.elapsed() < msec)
+                QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            return done();
+        };
+        constexpr unsigned nBlocks = 12;
+        FakeBitcoinD bitcoind(nBlocks);
+
+        // Downloads all the blocks with a fresh Controller and BitcoinDMgr, and checks that they all arrived intact.
+        // Returns whether REST is still enabled afterwards.
+        const auto Download = [&](const QString &what) {
+            auto options = std::make_shared<Options>();
+            options->bitcoindRest = true;
+            Controller ctl(options);
+            auto mgr = std::make_shared<BitcoinDMgr>("127.0.0.1", bitcoind.port(), "user", "pass", false, 1);
+            std::atomic_bool connected = false;
+            QObject::connect(mgr.get(), &BitcoinDMgr::gotFirstGoodConnection, &ctl, [&connected]{ connected = true; });
+            mgr->startup();
+            Check(WaitFor([&]{ return bool(connected); }, 5000), what + ": connected to bitcoind");
+
+            std::map<unsigned, QByteArray> got; // height -> block hash (hex)
+            int result = -1;
+            QObject::connect(&ctl, &Controller::putBlock, &ctl, [&got](CtlTask *, PreProcessedBlockPtr ppb) {
+                got[ppb->height] = BTC::Hash2ByteArrayRev(ppb->header.GetHash()).toHex();
+            });
+            CtlTask *task = ctl.testDownloadBlocks(mgr, 0, nBlocks - 1);
+            // the task deletes itself (via Controller::rmTask) when it finishes, so we don't touch it after this
+            QObject::connect(task, &CtlTask::success, &ctl, [&result]{ result = 1; });
+            QObject::connect(task, &CtlTask::errored, &ctl, [&result]{ result = 0; });
+            Check(WaitFor([&]{ return result >= 0; }, 10000) && result == 1, what + ": download succeeded");
+            Check(got.size() == nBlocks, what + ": got all blocks");
+            for (const auto & [height, hash] : got)
+                Check(height < nBlocks && hash == bitcoind.hashes[height], what + QString(": block %1 intact").arg(height));
+            return ctl.isRestEnabled();
+        };
+
+        // 1. all over REST: one /rest/headers request for all the hashes, then one /rest/block request per block
+        bitcoind.requests.clear();
+        Check(Download("REST"), "REST: still enabled");
+        Check(bitcoind.count("GET /rest/headers/") == 1 && bitcoind.count("GET /rest/block/") == int(nBlocks)
+              && bitcoind.count("getblock ") == 0, "REST: no JSON-RPC downloads");
+
+        // 2. one /rest/block request fails: that block is re-requested with getblock, and REST is disabled. The blocks
+        //    before it were requested (and answered) over REST first.
+        constexpr unsigned failHeight = 5;
+        bitcoind.requests.clear();
+        bitcoind.restFail = { "/rest/block/" + bitcoind.hashes[failHeight] + ".bin" };
+        Check(!Download("block 404"), "block 404: REST disabled");
+        Check(bitcoind.requests.contains("getblock " + bitcoind.hashes[failHeight]), "block 404: failed block re-requested");
+        for (unsigned h = 0; h < failHeight; ++h)
+            Check(bitcoind.count("getblock " + bitcoind.hashes[h]) == 0, QString("block 404: block %1 over REST").arg(h));
+
+        // 3. the /rest/headers request fails: everything goes via getblockhash + getblock
+        bitcoind.requests.clear();
+        bitcoind.restFail = { QString("/rest/headers/%1/%2.bin").arg(nBlocks).arg(QString(bitcoind.hashes[0])) };
+        Check(!Download("headers 404"), "headers 404: REST disabled");
+        Check(bitcoind.count("GET /rest/headers/") == 1 && bitcoind.count("GET /rest/block/") == 0
+              && bitcoind.count("getblock ") == int(nBlocks), "headers 404: all blocks via JSON-RPC");
+
+        Log() << "restdl: test passed";
+    }
+
+    const auto test_restdl = App::registerTest("restdl", &testRestDownload);
+} // namespace
+#endif
@@ -29,12 +29,15 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <tuple>
 #include <shared_mutex>
 #include <type_traits>
 #include <vector>
 
 class CtlTask;
+class ZmqSubNotifier;
 
 class Controller : public Mgr, public ThreadObjectMixin, public TimersByNameMixin, public ProcessAgainMixin
 {
@@ -56,6 +59,12 @@ public:
     /// This function is not intended to be used by code outside this subsystem -- it is intended to be called by the
     /// internal DownloadBlocksTask only.
     unsigned downloadTaskRecommendedThrottleTimeMsec(unsigned forBlockHeight) const;
+    /// Thread-safe. Called by DownloadBlocksTask for each block it receives, with how long bitcoind took to serve it
+    /// (from the first request for that height to the reply). Feeds the download control loop (see dlTune()).
+    void downloadTaskGotBlock(double secs);
+    /// Thread-safe. The number of block requests each of `nTasks` DownloadBlocksTasks may keep in flight, as currently
+    /// set by the download control loop.
+    unsigned downloadTaskMaxInFlight(unsigned nTasks) const;
 
     QVariantMap statsDebug(const QMap<QString, QString> & params) const;
 
@@ -63,6 +72,30 @@ public:
     /// for debug printing when it receives new mempool tx's.
     static void printMempoolStatusToLog(size_t newSize, size_t numAddresses, bool useDebugLogger, bool force = false);
 
+    /// Latency stats for the JSON-RPC batches that SynchMempoolTask uses to download new mempool txs. Written only
+    /// from the (single) SynchMempoolTask's thread; read by stats().
+    struct BatchLatencyStats {
+        std::atomic<quint64> nBatches = 0, nItems = 0;
+        std::atomic<double> totalMSec = 0., maxMSec = 0., lastMSec = 0.;
+        void add(size_t nItemsInBatch, double msec);
+        QVariantMap toMap() const;
+    };
+
+    /// Thread-safe. If bitcoind pushed us the raw bytes of `txid` via the "rawtx" ZMQ topic (and we still have them),
+    /// returns them and forgets them. Used by SynchMempoolTask to skip the `getrawtransaction` round-trip.
+    std::optional<QByteArray> takeZmqRawTx(const TxHash &txid);
+
+    /// Thread-safe. True if DownloadBlocksTask should download blocks via bitcoind's binary REST interface rather than
+    /// via JSON-RPC (see the `bitcoind_rest` conf option). Latched to false by disableRest().
+    bool isRestEnabled() const { return restEnabled.load(std::memory_order_relaxed); }
+    /// Thread-safe. Called if a REST request to bitcoind failed; we fall back to JSON-RPC for the rest of this run.
+    void disableRest(const QString &reason);
+
+    /// Thread-safe. Tells us that bitcoind has something new for us (called by the /blocknotify and /walletnotify
+    /// endpoints of the stats HTTP server, which bitcoind's -blocknotify / -walletnotify can hit). If `newBlock` is
+    /// true we synch right away, otherwise at most every kTxTriggerMinMS. Either way the poll timer is re-armed.
+    void notifyFromBitcoind(bool newBlock);
+
 signals:
     /// Emitted whenever bitcoind is detected to be up-to-date, and everything is synched up.
     /// note this is not emitted during regular polling, but only after `synchronizing` was emitted previously.
@@ -88,10 +121,16 @@ signals:
     /// Emitted only iff the user specified --dump-sh on the CLI. This is emitted once the script hash dump has completed.
     void dumpScriptHashesComplete() const;
 
+    /// Emitted only iff the user specified --export-snapshot on the CLI, once the snapshot has been written. The App
+    /// exits in response, so an export-only run does not go on to serve clients.
+    void exportSnapshotComplete() const;
+
 protected:
     Stats stats() const override; // from StatsMixin
     Stats debug(const StatsParams &) const override; // from StatsMixin
 
+    void on_started() override; ///< from ThreadObjectMixin -- starts the ZMQ notifiers (if any are configured)
+
 protected slots:
     void process(bool beSilentIfUpToDate); ///< generic callback to advance state
     void process() override { process(false); } ///< from ProcessAgainMixin
@@ -149,11 +188,102 @@ private:
     /// notifies subscribed clients (if any).
     std::atomic_bool masterNotifySubsFlag = false;
 
+    BatchLatencyStats mempoolBatchStats; ///< updated by SynchMempoolTask, shown in stats()
+
+    std::atomic_bool restEnabled; ///< initted in c'tor from options->bitcoindRest, see isRestEnabled()
+
+    // -- Block download control loop --
+    /// State of the AIMD loop that sizes the block download window. It widens the window while Storage is waiting on
+    /// downloads, and narrows it when bitcoind's latency climbs or when Storage is the bottleneck anyway. A widening that
+    /// didn't raise the Storage commit rate is not repeated back-to-back, since then downloads aren't the limit. Persists
+    /// across synchs. Guarded by dlTunerLock, since latency samples arrive from the download tasks' threads.
+#ifdef ENABLE_TESTS
+public: // so that the "dltuner" test can drive it directly
+#endif
+    struct DLTuner {
+        unsigned window = 0; ///< target number of blocks in flight across all download tasks (0 = not yet set)
+        unsigned minWindow = 0, maxWindow = 0; ///< bounds for `window`, set by reset()
+        double latencyAvg = 0.; ///< moving average of per-block bitcoind latency, in seconds
+        /// Our estimate of bitcoind's unloaded latency. It follows latencyAvg straight down, but up only as a slow
+        /// EWMA (kBaseAlpha per tuning step, a time constant of ~100 steps), so that bigger blocks don't read as
+        /// overload while a sudden latency rise still trips the back-off for a good while.
+        double latencyBase = 0.;
+        size_t nSamples = 0; ///< latency samples since reset()
+        size_t nCommitted = 0, nCommittedAtLastTune = 0; ///< blocks added to Storage since reset()
+        double commitRate = 0.; ///< blocks/sec added to Storage over the last tuning interval
+        bool grewLast = false; ///< true if the previous tuning step widened the window (its effect shows in commitRate)
+        double lastTuneTs = 0.;
+        const char *lastAction = "none";
+
+        static constexpr double kIntervalSecs = 2.0; ///< minimum time between tuning steps
+        static constexpr double kBaseAlpha = 0.01; ///< weight of latencyAvg when latencyBase moves up
+
+        /// Starts a synch with `nTasks` download tasks, each of which may use up to `perTask` bitcoind connections.
+        void reset(unsigned nTasks, unsigned perTask, double now);
+        /// Feeds one per-block latency sample (in seconds) into latencyAvg.
+        void addLatencySample(double secs);
+        /// One step of the control loop, given that `nCommitted` more blocks were just added to Storage and that
+        /// `backlogBlocks` downloaded blocks totalling `backlogBytes` are waiting to be added (`budgetBytes` being
+        /// the memory budget for those). Does nothing and returns false if it's too soon since the last step.
+        bool tune(double now, unsigned nCommitted, size_t backlogBlocks, size_t backlogBytes, size_t budgetBytes);
+
+        QVariantMap toMap() const;
+    };
+#ifdef ENABLE_TESTS
+private:
+#endif
+    DLTuner dlTuner;
+    mutable std::mutex dlTunerLock;
+    /// Called when a synch starts downloading blocks with `nTasks` DownloadBlocksTasks.
+    void dlTuneReset(unsigned nTasks);
+    /// Called from process_DownloadingBlocks with the number of blocks just committed. Adjusts the window at most
+    /// every DLTuner::kIntervalSecs.
+    void dlTune(unsigned nCommitted);
+
+    // -- Early synch triggers (ZMQ notifications, /blocknotify) --
+    /// Set if a trigger arrived while a synch was in progress; process() then re-runs right away.
+    bool pendingProcess = false;
+    static constexpr auto triggerTimerName = "triggerProcess";
+    /// tx notifications trigger a mempool synch at most this often (block notifications always trigger one at once)
+    static constexpr int kTxTriggerMinMS = 250;
+    /// Calls process() now, or as soon as the current synch completes. If `throttle` is true, coalesces calls so
+    /// that process() runs at most every kTxTriggerMinMS.
+    void triggerProcess(bool throttle);
+
+    // -- ZMQ push notifications from bitcoind (optional, see the zmq_* conf options) --
+    /// One subscriber per configured topic. Created in on_started() and destroyed in cleanup(), both in our thread.
+    std::vector<std::unique_ptr<ZmqSubNotifier>> zmqNotifiers;
+    /// While ZMQ is healthy (see zmqIsHealthy), we poll bitcoind this often (at most), rather than every polltimeMS.
+    static constexpr int kZmqHealthyPollTimeMS = 30'000;
+    /// ZMQ is considered to have gone quiet if no message arrived for this long; we then poll normally again.
+    static constexpr double kZmqQuietSecs = 60.;
+    /// txid -> raw tx bytes from the "rawtx" topic, consumed by takeZmqRawTx(). Cleared on each new block, or if it
+    /// grows beyond kZmqRawTxsMaxBytes.
+    robin_hood::unordered_flat_map<TxHash, QByteArray, HashHasher> zmqRawTxs;
+    size_t zmqRawTxsBytes = 0;
+    mutable std::mutex zmqRawTxsLock; ///< guards the above two
+    static constexpr size_t kZmqRawTxsMaxBytes = 64 * 1024 * 1024;
+
+    void zmqOnMessage(const QString &topic, const QByteArray &body);
+    /// True if we are subscribed to a block topic and some ZMQ message arrived within the last kZmqQuietSecs.
+    bool zmqIsHealthy() const;
+
     /// takes locks, prints to Log() every 30 seconds if there were changes
     void printMempoolStatusToLog() const;
 
     /// If --dump-sh was specified on CLI, this will execute at startup() time right after storage has been loaded. May throw.
     void dumpScriptHashes(const QString &fileName) const;
+
+    /// If --export-snapshot was specified on CLI, this will execute at startup() time right after storage has been
+    /// loaded (and before we connect to bitcoind, so the db is quiescent). May throw.
+    void exportSnapshot(const QString &fileName) const;
+
+#ifdef ENABLE_TESTS
+public:
+    /// For the "restdl" test: starts a DownloadBlocksTask for heights [from, to] using `mgr`, with no StateMachine
+    /// and no Storage (the blocks only come out of the putBlock signal).
+    CtlTask *testDownloadBlocks(const std::shared_ptr<BitcoinDMgr> &mgr, unsigned from, unsigned to);
+#endif
 };
 
 /// Abstract base class for our private internal tasks. Concrete implementations are in Controller.cpp.
@@ -201,7 +331,15 @@ protected:
     virtual void on_error(const RPC::Message &);
     virtual void on_failure(const RPC::Message::Id &, const QString &msg);
 
-    quint64 submitRequest(const QString &method, const QVariantList &params, const BitcoinDMgr::ResultsF &resultsFunc);
+    quint64 submitRequest(const QString &method, const QVariantList &params, const BitcoinDMgr::ResultsF &resultsFunc,
+                          BitcoinDMgr::Lane lane = BitcoinDMgr::Lane::Interactive);
+    /// Like submitRequest, but sends all of `batch` as a single JSON-RPC batch. `resultsFunc` is called once per item.
+    void submitBatchRequest(const RPC::Batch &batch, const BitcoinDMgr::ResultsF &resultsFunc);
+    /// Like submitRequest, but does a GET of `path` on bitcoind's REST interface. The results func gets the raw body
+    /// as a QByteArray in result(). REST errors go to `errorFunc` rather than on_error, so callers can fall back.
+    quint64 submitRestRequest(const QString &path, const BitcoinDMgr::ResultsF &resultsFunc,
+                              const BitcoinDMgr::ErrorF &errorFunc,
+                              BitcoinDMgr::Lane lane = BitcoinDMgr::Lane::Interactive);
 
     Controller * const ctl;  ///< initted in c'tor. Is always valid since all tasks' lifecycles are managed by the Controller.
 };
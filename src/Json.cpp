@@ -128,6 +128,12 @@ namespace {
             throw Json::Error("Variant is not valid");
         }
 
+        if (typ >= QMetaType::User && v.userType() == qMetaTypeId<Json::PreSerialized>()) {
+            // already JSON, copy it as-is
+            write(v.value<Json::PreSerialized>().json);
+            return;
+        }
+
         switch(typ) {
         case QMetaType::QByteArray: {
             const auto ba = v.toByteArray();
@@ -288,6 +294,47 @@ namespace Json {
         return serialize(v, compact ? 0 : 4); // may throw on low-level error or if !v.isValid()
     }
 
+    Builder::Builder(int reserveBytes) { if (reserveBytes > 0) buf.reserve(reserveBytes); }
+    Builder & Builder::beginArray() { preValue(); buf.append('['); needComma = false; return *this; }
+    Builder & Builder::endArray() { buf.append(']'); needComma = true; return *this; }
+    Builder & Builder::beginObject() { preValue(); buf.append('{'); needComma = false; return *this; }
+    Builder & Builder::endObject() { buf.append('}'); needComma = true; return *this; }
+    Builder & Builder::key(const char *k) {
+        preValue();
+        buf.append('"').append(k).append("\":", 2);
+        needComma = false;
+        return *this;
+    }
+    Builder & Builder::value(int64_t n) {
+        preValue();
+        // hand-rolled itoa to avoid a temporary QByteArray (or snprintf) per number
+        char tmp[24], *end = tmp + sizeof(tmp), *p = end;
+        uint64_t u = n < 0 ? uint64_t(0) - uint64_t(n) : uint64_t(n);
+        do { *--p = char('0' + u % 10); u /= 10; } while (u);
+        if (n < 0) *--p = '-';
+        buf.append(p, int(end - p));
+        needComma = true;
+        return *this;
+    }
+    Builder & Builder::nullValue() { preValue(); buf.append(NullLiteral); needComma = true; return *this; }
+    Builder & Builder::hexValue(const QByteArray &bytes) {
+        preValue();
+        const int pos = buf.size(), hexLen = bytes.size() * 2;
+        buf.resize(pos + hexLen + 2);
+        char *out = buf.data() + pos;
+        out[0] = '"';
+        Util::ToHexFastInPlace(bytes, out + 1, size_t(hexLen));
+        out[hexLen + 1] = '"';
+        needComma = true;
+        return *this;
+    }
+    PreSerialized Builder::take() {
+        PreSerialized ret{std::move(buf)};
+        buf = QByteArray();
+        needComma = false;
+        return ret;
+    }
+
 } // end namespace Json
 
 namespace {
@@ -562,15 +609,91 @@ namespace {
 
 #include <cstdlib>
 #include <cstdint>
+#include <random>
 
 namespace Json {
 namespace {
+    /// Returns a deterministic corpus of `n` request lines resembling what Electrum clients send us.
+    std::vector<QByteArray> makeRequestCorpus(int n) {
+        std::mt19937_64 rng(42);
+        const auto RandHex = [&rng](int nBytes) {
+            QByteArray b(nBytes, Qt::Uninitialized);
+            for (auto & c : b) c = char(rng() & 0xff);
+            return b.toHex();
+        };
+        std::vector<QByteArray> ret;
+        ret.reserve(size_t(n));
+        for (int i = 0; i < n; ++i) {
+            QByteArray method, params;
+            switch (rng() % 10) {
+            case 0: case 1: case 2: method = "blockchain.scripthash.subscribe"; params = "\"" + RandHex(32) + "\""; break;
+            case 3: case 4: method = "blockchain.scripthash.get_history"; params = "\"" + RandHex(32) + "\""; break;
+            case 5: method = "blockchain.scripthash.listunspent"; params = "\"" + RandHex(32) + "\""; break;
+            case 6: method = "blockchain.transaction.get"; params = "\"" + RandHex(32) + "\", " + (rng() & 1 ? "true" : "false"); break;
+            case 7: method = "blockchain.transaction.broadcast"; params = "\"" + RandHex(226) + "\""; break;
+            case 8: method = "server.version"; params = "\"Electron Cash 4.2.4\", [\"1.4\", \"1.4.2\"]"; break;
+            default: method = "server.ping"; break;
+            }
+            ret.push_back("{\"jsonrpc\": \"2.0\", \"method\": \"" + method + "\", \"params\": [" + params + "], \"id\": "
+                          + QByteArray::number(i) + "}");
+        }
+        return ret;
+    }
+
+    void benchRequests(int iters) {
+        const auto corpus = makeRequestCorpus(10'000);
+        std::size_t total = 0;
+        for (const auto & line : corpus) total += line.size();
+        Log() << "---";
+        Log() << "Request corpus: " << corpus.size() << " lines, " << total << " bytes";
+        const auto Run = [&](const char *what, auto && func) {
+            const double t0 = Util::getTimeSecs();
+            for (int i = 0; i < iters; ++i)
+                for (const auto & line : corpus)
+                    func(line);
+            const double el = Util::getTimeSecs() - t0;
+            Log() << what << " - total: " << el << " secs - per-iter: "
+                  << QString::asprintf("%1.16g", (el/iters) * 1e3) << " msec - "
+                  << QString::asprintf("%1.1f", (double(corpus.size()) * iters) / el) << " req/sec";
+        };
+        // sanity check: the fast path must produce exactly what the generic path produces
+        for (const auto & line : corpus) {
+            QVariant a, b;
+            if (!detail::parse(a, line) || !detail::parseGeneric(b, line) || a != b)
+                throw Exception(QString("Fast path and generic parser disagree on: %1").arg(QString(line)));
+        }
+        Run("Custom lib parse (default)", [](const QByteArray &line) {
+            QVariant v;
+            if (!detail::parse(v, line)) throw Exception("Parse failed");
+        });
+        Run("Custom lib parse (generic)", [](const QByteArray &line) {
+            QVariant v;
+            if (!detail::parseGeneric(v, line)) throw Exception("Parse failed");
+        });
+        Run("Qt Json parse", [](const QByteArray &line) {
+            if (QJsonDocument::fromJson(line).toVariant().isNull()) throw Exception("Parse failed");
+        });
+    }
+
     void bench() {
+        int iters = 10;
+        {
+            auto itenv = std::getenv("ITERS");
+            if (itenv) {
+                bool ok;
+                iters = QString(itenv).toInt(&ok);
+                if (!ok || iters <= 0)
+                    throw BadArgs("Expected ITERS= to be a positive integer");
+            }
+        }
+        benchRequests(iters);
+
         const char * const dir = std::getenv("DATADIR");
         if (!dir) {
-            Warning() << "Json benchmark requires the DATADIR environment variable, which should be a directory on the "
-                         "filesystem containing *.json files to use for the benchmark.";
-            throw Exception("No DATADIR specified");
+            Log() << "---";
+            Log() << "Set the DATADIR environment variable to a directory on the filesystem containing *.json files to "
+                     "also benchmark parsing and serializing of those files.";
+            return;
         }
         QDir dataDir(dir);
         if (!dataDir.exists()) throw BadArgs(QString("DATADIR '%1' does not exist").arg(dir));
@@ -590,16 +713,6 @@ namespace {
         Log() << "Read " << total << " bytes total";
         std::vector<QVariant> parsed;
         parsed.reserve(fileData.size());
-        int iters = 10;
-        {
-            auto itenv = std::getenv("ITERS");
-            if (itenv) {
-                bool ok;
-                iters = QString(itenv).toInt(&ok);
-                if (!ok || iters <= 0)
-                    throw BadArgs("Expected ITERS= to be a positive integer");
-            }
-        }
         Log() << "---";
         Log() << "Benching custom Json lib parse: Iterating " << iters << " times ...";
         double t0 = Util::getTimeSecs();
@@ -719,9 +832,89 @@ namespace {
             auto hh = parseUtf8(json, ParseOption::RequireObject).toMap();
             json = toUtf8(hh["mapkey"], true, SerOption::BareNullOk);
             if (json != expect3) throw Exception(QString("Json \"mapkey\" does not match\nexcpected:\n%1\n\ngot:\n%2").arg(expect3).arg(QString(json)));
+            // Builder output, embedded via PreSerialized, must match what the equivalent QVariant tree serializes to
+            Builder b;
+            b.beginArray();
+            for (const int64_t n : {int64_t(0), int64_t(-1), std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()}) {
+                b.beginObject().key("a").hexValue(QByteArray("\x00\xab\xff", 3)).key("b").value(n).key("c").nullValue();
+                b.key("d").beginArray().endArray().endObject();
+            }
+            b.endArray();
+            const QVariant pre = QVariant::fromValue(b.take());
+            QVariantList vl;
+            for (const qlonglong n : {qlonglong(0), qlonglong(-1), std::numeric_limits<qlonglong>::min(), std::numeric_limits<qlonglong>::max()})
+                vl.push_back(QVariantMap{{"a", QString("00abff")}, {"b", n}, {"c", QVariant{}}, {"d", QVariantList{}}});
+            const QByteArray expect4 = toUtf8(QVariantMap{{"r", vl}}, true);
+            Log() << "Builder -> JSON: " << (json=toUtf8(QVariantMap{{"r", pre}}, true));
+            if (json != expect4) throw Exception(QString("Json does not match, excpected: %1").arg(QString(expect4)));
             Log() << "Basic tests: passed";
         }
         // /end basic tests
+        // the flat-object fast path must produce exactly what the generic parser does, and must leave anything nested
+        // (or malformed) to it
+        {
+            enum class Want { Fast, Fallback, Invalid };
+            struct Case {
+                QByteArray json;
+                Want want;
+                QVariant s; ///< if not null: the expected value of key "s"
+            };
+            std::vector<Case> cases = {
+                {R"({"s":"a\"b\\c\/d\b\f\n\r\tz","id":1})", Want::Fast, QString("a\"b\\c/d\b\f\n\r\tz")},
+                {R"({"s":"\u00e9\u4e2d\ud83d\ude00","t":")" "\xc3\xa9" R"("})", Want::Fast,
+                 QString::fromUtf8("\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80")},
+                {R"({"s":1,"s":"two","id":1,"s":"three"})", Want::Fast, QString("three")}, // dupe keys: last one wins
+                {R"( {"a":[],"b":true,"c":false,"d":null,"e":-1.5e3,"f":18446744073709551615,"g":["x",2,null]} )", Want::Fast, {}},
+                {"{}", Want::Fast, {}},
+                {R"({"params":[{"a":1}],"id":1})", Want::Fallback, {}},
+                {R"({"s":{"b":[1,2]},"s":"x"})", Want::Fallback, QString("x")},
+                {R"({"a":[[1]]})", Want::Fallback, {}},
+                {R"([{"a":1}])", Want::Fallback, {}},
+                {R"({"a":1,})", Want::Invalid, {}},
+                {R"({"a" 1})", Want::Invalid, {}},
+                {R"({"a":1} x)", Want::Invalid, {}},
+                {R"({"s":"\ud83d"})", Want::Invalid, {}},        // lone surrogate
+                {R"({"s":"\ude00\ud83d"})", Want::Invalid, {}}, // surrogates in the wrong order
+            };
+            // strings long enough for the 16-byte scan, with the first char it must stop at in every position
+            struct Special {
+                QByteArray json;
+                QString decoded;
+                Want want;
+            };
+            const Special specials[] = {
+                {"", "", Want::Fast},
+                {R"(\")", "\"", Want::Fast},
+                {R"(\u00e9)", QString::fromUtf8("\xc3\xa9"), Want::Fast},
+                {"\xc3\xa9", QString::fromUtf8("\xc3\xa9"), Want::Fast},
+                {R"(\ud83d\ude00)", QString::fromUtf8("\xf0\x9f\x98\x80"), Want::Fast},
+                {"\x01", "", Want::Invalid},
+            };
+            for (const int len : {15, 16, 17, 31, 32, 33, 64, 100}) {
+                QByteArray hex;
+                for (int i = 0; i < len; ++i)
+                    hex += "0123456789abcdef"[(i * 7) % 16];
+                for (int pos = 0; pos <= len; ++pos)
+                    for (const auto & sp : specials)
+                        cases.push_back({"{\"s\":\"" + hex.left(pos) + sp.json + hex.mid(pos) + "\",\"id\":1}", sp.want,
+                                         sp.want == Want::Invalid ? QVariant{} : QVariant(QString(hex.left(pos)) + sp.decoded + QString(hex.mid(pos)))});
+                cases.push_back({"{\"s\":\"" + hex, Want::Invalid, {}}); // unterminated
+            }
+            for (const auto & c : cases) {
+                const auto Fail = [&c](const char *what) {
+                    throw Exception(QString("Fast path check failed (%1) for: %2").arg(what, QString::fromUtf8(c.json)));
+                };
+                QVariant flat, generic, dflt;
+                const bool okFlat = detail::parseFlatObject(flat, c.json), okGeneric = detail::parseGeneric(generic, c.json);
+                const bool okDflt = detail::parse(dflt, c.json);
+                if (okGeneric != (c.want != Want::Invalid)) Fail("generic parser accepts");
+                if (okFlat != (c.want == Want::Fast)) Fail("fast path taken");
+                if (okFlat && flat != generic) Fail("fast path result");
+                if (okDflt != okGeneric || dflt != generic) Fail("default parser result");
+                if (!c.s.isNull() && generic.toMap().value("s") != c.s) Fail("value of \"s\"");
+            }
+            Log() << "Fast path vs generic parser: " << cases.size() << " cases passed";
+        }
         const char *dir = std::getenv("DATADIR");
         if (!dir) dir = "test/json";
         QDir dataDir(dir);
@@ -21,9 +21,12 @@
 #include "Common.h"
 
 #include <QByteArray>
+#include <QMetaType>
 #include <QString>
 #include <QVariant>
 
+#include <cstdint>
+
 /// As of version 1.2.1, we implemented our own JSON serializer and parser.
 /// Qt's JSON parser/serializer had a hard limit of ~128MB on json documents.
 /// See: https://bugreports.qt.io/browse/QTBUG-47629
@@ -50,4 +53,41 @@ namespace Json {
     /// Serialization, may throw Error, may throw std::exception on low-level error (bad_alloc, etc).
     /// Will throw also if given an empty QVariant{}, unless BareNullOk is specified.
     extern QByteArray toUtf8(const QVariant &, bool compact = false, SerOption = SerOption::NoBareNull);
+
+    /// A JSON value that has already been serialized. When it appears (wrapped in a QVariant) anywhere inside the
+    /// QVariant passed to toUtf8(), its bytes are copied to the output verbatim. This lets large results be written
+    /// directly as JSON text (see Builder below) and still be passed around as a QVariant, e.g. as an RPC result.
+    /// The bytes are not validated: `json` must hold exactly one valid, compact JSON value.
+    struct PreSerialized {
+        QByteArray json;
+    };
+
+    /// Append-only, compact JSON writer, for building a PreSerialized value directly without first building a tree of
+    /// QVariantLists and QVariantMaps. The caller is responsible for the structure being well-formed (each begin*
+    /// having its end*, each object value being preceded by key()); separating commas are inserted automatically.
+    class Builder {
+    public:
+        explicit Builder(int reserveBytes = 0);
+
+        Builder & beginArray();
+        Builder & endArray();
+        Builder & beginObject();
+        Builder & endObject();
+        /// `k` is written as-is, so it must not need any JSON escaping.
+        Builder & key(const char *k);
+        Builder & value(int64_t);
+        Builder & nullValue();
+        /// Writes `bytes` as a lowercase hex-encoded JSON string, encoding it in place in the output buffer.
+        Builder & hexValue(const QByteArray &bytes);
+
+        /// The JSON written so far. The builder is empty afterwards.
+        PreSerialized take();
+
+    private:
+        QByteArray buf;
+        bool needComma = false; ///< true if the next value is a sibling of the previous one
+        void preValue() { if (needComma) buf.append(','); }
+    };
 }
+
+Q_DECLARE_METATYPE(Json::PreSerialized);
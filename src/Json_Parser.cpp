@@ -42,6 +42,10 @@
 #include <utility>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace {
 
 enum jtokentype {
@@ -371,6 +375,24 @@ jtokentype getJsonToken(QByteArray &tokenVal, unsigned &consumed, const char *ra
             };
 
             static const auto FastPathParseSimpleString = [](const char *& raw, const char * const end) -> FastPath {
+#if defined(__SSE2__)
+                // Skip ahead 16 bytes at a time until we hit a block containing a byte that is interesting to
+                // the scalar loop below.  The signed compare against 0x20 flags both control chars and any byte
+                // >= 0x80, since the latter are negative when viewed as int8.  The scalar loop then classifies
+                // the byte we stopped at.  Scripthashes and txids (64 hex chars) are usually consumed entirely
+                // by this loop.
+                const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\'), space = _mm_set1_epi8(0x20);
+                for (; end - raw >= 16; raw += 16) {
+                    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(raw));
+                    const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                                      _mm_cmpeq_epi8(v, bslash)),
+                                                         _mm_cmplt_epi8(v, space));
+                    if (const int mask = _mm_movemask_epi8(special)) {
+                        raw += __builtin_ctz(unsigned(mask));
+                        break;
+                    }
+                }
+#endif
                 for (; raw < end; ++raw) {
                     const uint8_t ch = uint8_t(*raw);
                     if (ch == '"') {
@@ -515,6 +537,20 @@ struct Container {
     QVariant toVariant() const;
 };
 
+/// Returns the object key `key` as a QString. The keys of a JSON-RPC message, which appear in every single request,
+/// are returned as shallow copies of static strings, so that building the QVariantMap for a request doesn't allocate
+/// a new QString for each of its keys.
+QString keyToString(const QByteArray &key)
+{
+    static const std::array<QString, 9> rpcKeys = {{ "id", "method", "params", "jsonrpc", "result", "error", "code",
+                                                     "message", "data" }};
+    for (const auto & k : rpcKeys)
+        if (k.size() == key.size() && k == QLatin1String(key.constData(), key.size()))
+            return k;
+    // We use this C string syntax because it's faster & more accurate. (QString quirks)
+    return QString::fromUtf8(key.constData(), key.size());
+}
+
 /// recursively scours this container and its sub-containers and builds the proper QVariant / nesting
 QVariant Container::toVariant() const {
     QVariant ret;
@@ -600,21 +636,111 @@ QVariant Container::toVariant() const {
     case Obj: {
         // NB: pair.first in entries may be a deep or shallow copy of the data in `bytes`
         QVariantMap vm;
-        for (const auto & [key, cont] : entries) {
-            // We use this C string syntax because it's faster & more accurate. (QString quirks)
-            vm[QString::fromUtf8(key.constData(), key.size())] = cont.toVariant();
-        }
+        for (const auto & [key, cont] : entries)
+            vm[keyToString(key)] = cont.toVariant();
         ret = vm;
         break;
     }
     }
     return ret;
 }
+QVariant scalarToVariant(jtokentype tok, QByteArray &tokenVal)
+{
+    switch (tok) {
+    case JTOK_KW_TRUE: return true;
+    case JTOK_KW_FALSE: return false;
+    case JTOK_NUMBER: return Container{Container::Num, std::move(tokenVal), {}, {}}.toVariant();
+    case JTOK_STRING: return Container{Container::Str, std::move(tokenVal), {}, {}}.toVariant();
+    default: return QVariant{};
+    }
+}
+
 } // end anonymous namespace
 
 namespace Json {
 namespace detail {
+/// Fast path for the common case of a single object whose values are all scalars or arrays of scalars, e.g.:
+/// {"jsonrpc":"2.0","method":"blockchain.scripthash.subscribe","params":["<64 hex chars>"],"id":42}
+///
+/// This is what nearly every Electrum client request looks like.  We build the QVariantMap directly from the
+/// token stream, skipping the intermediate Container tree.  Returns false if the document is not of this shape
+/// *or* if it is malformed -- in either case the caller should fall back to the generic parser, which is the
+/// authority on what is and isn't valid JSON.  The resulting QVariant is identical to what parseGeneric()
+/// would have produced.
+bool parseFlatObject(QVariant &out, const QByteArray &bytes)
+{
+    QByteArray tokenVal;
+    unsigned consumed;
+    const char *raw = bytes.constData();
+    const char * const end = raw + bytes.size();
+    const auto next = [&] {
+        const jtokentype tok = getJsonToken(tokenVal, consumed, raw, end);
+        raw += consumed;
+        return tok;
+    };
+
+    if (next() != JTOK_OBJ_OPEN)
+        return false;
+
+    QVariantMap vm;
+    try {
+        jtokentype tok = next();
+        if (tok != JTOK_OBJ_CLOSE) {
+            while (true) {
+                if (tok != JTOK_STRING)
+                    return false;
+                QString key = keyToString(tokenVal);
+                if (next() != JTOK_COLON)
+                    return false;
+                tok = next();
+                if (tok == JTOK_ARR_OPEN) {
+                    QVariantList vl;
+                    tok = next();
+                    if (tok != JTOK_ARR_CLOSE) {
+                        while (true) {
+                            if (!jsonTokenIsValue(tok))
+                                return false; // nested container or malformed
+                            vl.push_back(scalarToVariant(tok, tokenVal));
+                            tok = next();
+                            if (tok == JTOK_ARR_CLOSE)
+                                break;
+                            if (tok != JTOK_COMMA)
+                                return false;
+                            tok = next();
+                        }
+                    }
+                    vm[key] = std::move(vl);
+                } else if (jsonTokenIsValue(tok)) {
+                    vm[key] = scalarToVariant(tok, tokenVal); // last one wins on dupe keys, same as parseGeneric()
+                } else
+                    return false; // nested object or malformed
+                tok = next();
+                if (tok == JTOK_OBJ_CLOSE)
+                    break;
+                if (tok != JTOK_COMMA)
+                    return false;
+                tok = next();
+            }
+        }
+    } catch (const std::exception &) {
+        return false; // let the generic parser deal with it and report
+    }
+
+    if (next() != JTOK_NONE)
+        return false; // trailing garbage
+
+    out = std::move(vm);
+    return true;
+}
+
 bool parse(QVariant &out, const QByteArray &bytes)
+{
+    if (parseFlatObject(out, bytes))
+        return true;
+    return parseGeneric(out, bytes);
+}
+
+bool parseGeneric(QVariant &out, const QByteArray &bytes)
 {
     enum ExpectBits : uint32_t {
         EXP_OBJ_NAME = 1U << 0,
@@ -23,6 +23,14 @@
 
 namespace Json {
 namespace detail {
+    /// Parses `json` into `out`, returning false on malformed input. Small flat objects (such as typical
+    /// Electrum client requests) take a fast path that avoids building an intermediate tree; everything else
+    /// goes to parseGeneric().
     extern bool parse(QVariant &out, const QByteArray &json);
+    /// The full parser, without the flat-object fast path. Exposed mainly for tests and benchmarks.
+    extern bool parseGeneric(QVariant &out, const QByteArray &json);
+    /// The fast path on its own: returns false (leaving `out` untouched) if `json` is not a flat object or is
+    /// malformed. Exposed for tests.
+    extern bool parseFlatObject(QVariant &out, const QByteArray &json);
 }
 }
@@ -22,26 +22,288 @@
 #include <functional>
 #include <map>
 
+namespace {
+    using TxPtrSet = std::unordered_set<const Mempool::Tx *>;
+
+    /// Returns the mempool txs that spend at least one output of `tx` (its direct children).  We don't keep explicit
+    /// child links, but a child necessarily appears in hashXTxs under the scripthash of the output it spends, so we
+    /// search there.
+    std::vector<Mempool::TxRef> directChildren(const Mempool &mempool, const Mempool::Tx &tx)
+    {
+        std::vector<Mempool::TxRef> ret;
+        TxPtrSet seen;
+        for (const auto & txo : tx.txos) {
+            if (!txo.isValid())
+                continue;
+            const auto it = mempool.hashXTxs.find(txo.hashX);
+            if (it == mempool.hashXTxs.end())
+                continue;
+            for (const auto & cand : it->second) {
+                if (!cand || cand.get() == &tx || !cand->hasUnconfirmedParentTx || seen.count(cand.get()))
+                    continue;
+                const auto hxit = cand->hashXs.find(txo.hashX);
+                if (hxit == cand->hashXs.end())
+                    continue;
+                for (const auto & [spentTxo, info] : hxit->second.unconfirmedSpends) {
+                    if (spentTxo.txHash == tx.hash) {
+                        seen.insert(cand.get());
+                        ret.push_back(cand);
+                        break;
+                    }
+                }
+            }
+        }
+        return ret;
+    }
+
+    /// Removes the txs in `removed` from the hashXTxs vectors of `hashXs`, erasing any entries left empty.
+    void eraseFromHashXTxs(Mempool::HashXTxMap &hashXTxs, const Mempool::HashXSet &hashXs, const TxPtrSet &removed)
+    {
+        for (const auto & sh : hashXs) {
+            const auto it = hashXTxs.find(sh);
+            if (it == hashXTxs.end())
+                continue;
+            auto & vec = it->second;
+            vec.erase(std::remove_if(vec.begin(), vec.end(), [&removed](const Mempool::TxRef &tx) {
+                return removed.count(tx.get()) != 0;
+            }), vec.end());
+            if (vec.empty())
+                hashXTxs.erase(it);
+        }
+    }
+} // namespace
+
+size_t Mempool::Tx::estimatedMemoryBytes() const
+{
+    using SpendsValue = SpendsMap::value_type;
+    size_t ret = sizeof(*this) + txos.capacity() * sizeof(TXOInfo)
+                 + hashXs.capacity() * sizeof(decltype(hashXs)::value_type);
+    for (const auto & [sh, ioinfo] : hashXs)
+        ret += (ioinfo.confirmedSpends.capacity() + ioinfo.unconfirmedSpends.capacity()) * sizeof(SpendsValue)
+               + ioinfo.utxo.capacity() * sizeof(IONum);
+    return ret;
+}
+
+size_t Mempool::estimatedMemoryBytes() const
+{
+    // robin_hood tables keep their load factor under 80%; derive the number of slots from the load factor
+    const auto numSlots = [](const auto &table) -> size_t {
+        const auto lf = table.load_factor();
+        return lf > 0.f ? size_t(double(table.size()) / double(lf)) : 0;
+    };
+    return sizeof(*this) + numSlots(txs) * (sizeof(TxMap::value_type) + 1)
+           + numSlots(hashXTxs) * (sizeof(void *) + 1) + hashXTxs.size() * sizeof(HashXTxMap::value_type)
+           + txsMemBytes;
+}
+
+auto Mempool::confirmedInBlock(const TxHashNumMap &confirmed, const BlockSpends &spends, BlockHeight height) -> HashXSet
+{
+    HashXSet affected;
+    {
+        // Any mempool tx spending an output the block spent is listed under that output's scripthash. Note that this
+        // checks the unconfirmed spends too: the block may confirm a parent and spend its output in some other tx.
+        TxHashSet conflicts;
+        for (const auto & sh : spends.hashXs) {
+            const auto it = hashXTxs.find(sh);
+            if (it == hashXTxs.end())
+                continue;
+            for (const auto & tx : it->second) {
+                const auto hxit = tx->hashXs.find(sh);
+                if (hxit == tx->hashXs.end() || confirmed.count(tx->hash))
+                    continue;
+                const auto Conflicts = [&spends](const Tx::SpendsMap &m) {
+                    return std::any_of(m.begin(), m.end(), [&spends](const auto &pair) { return spends.txos.count(pair.first) != 0; });
+                };
+                if (Conflicts(hxit->second.confirmedSpends) || Conflicts(hxit->second.unconfirmedSpends))
+                    conflicts.insert(tx->hash);
+            }
+        }
+        if (!conflicts.empty())
+            affected = dropTxs(conflicts);
+    }
+    TxPtrSet removedSet;
+    std::vector<TxRef> removed;
+    for (const auto & [txid, txNum] : confirmed) {
+        if (const auto it = txs.find(txid); it != txs.end() && it->second) {
+            removedSet.insert(it->second.get());
+            removed.push_back(it->second);
+        }
+    }
+    if (removed.empty())
+        return affected;
+
+    // find the surviving direct children before we modify anything (we need the hashXTxs map intact for this)
+    std::vector<TxRef> children;
+    {
+        TxPtrSet seen;
+        for (const auto & tx : removed)
+            for (auto & child : directChildren(*this, *tx))
+                if (!removedSet.count(child.get()) && seen.insert(child.get()).second)
+                    children.push_back(std::move(child));
+    }
+
+    // remove the confirmed txs
+    for (const auto & tx : removed) {
+        for (const auto & [sh, ioinfo] : tx->hashXs)
+            affected.insert(sh);
+        feeHistogramRemove(*tx);
+        memBytesRemove(*tx);
+        txs.erase(tx->hash);
+    }
+    eraseFromHashXTxs(hashXTxs, affected, removedSet);
+
+    // re-point the children's spends of now-confirmed outputs
+    HashXSet needsResort;
+    for (const auto & child : children) {
+        bool hasUnconfParent = false;
+        for (auto & [sh, ioinfo] : child->hashXs) {
+            for (auto it = ioinfo.unconfirmedSpends.begin(); it != ioinfo.unconfirmedSpends.end(); ) {
+                if (const auto cit = confirmed.find(it->first.txHash); cit != confirmed.end()) {
+                    TXOInfo info = it->second;
+                    info.confirmedHeight = height;
+                    info.txNum = cit->second;
+                    ioinfo.confirmedSpends.emplace(it->first, std::move(info));
+                    it = ioinfo.unconfirmedSpends.erase(it);
+                    affected.insert(sh);
+                } else
+                    ++it;
+            }
+            hasUnconfParent = hasUnconfParent || !ioinfo.unconfirmedSpends.empty();
+        }
+        if (child->hasUnconfirmedParentTx != hasUnconfParent) {
+            // this tx's sort key changed (see TxRefOrdering), so every hashXTxs vector it appears in must be re-sorted
+            child->hasUnconfirmedParentTx = hasUnconfParent;
+            for (const auto & [sh, ioinfo] : child->hashXs) {
+                affected.insert(sh);
+                needsResort.insert(sh);
+            }
+        }
+    }
+    for (const auto & sh : needsResort)
+        if (const auto it = hashXTxs.find(sh); it != hashXTxs.end())
+            std::sort(it->second.begin(), it->second.end(), TxRefOrdering{});
+
+    return affected;
+}
+
+auto Mempool::dropTxs(const TxHashSet &txids) -> HashXSet
+{
+    HashXSet affected;
+    TxPtrSet removedSet;
+    std::vector<TxRef> removed;
+    for (const auto & txid : txids) {
+        if (const auto it = txs.find(txid); it != txs.end() && it->second && removedSet.insert(it->second.get()).second)
+            removed.push_back(it->second);
+    }
+    // add all descendants, breadth-first (note: `removed` grows as we iterate)
+    for (size_t i = 0; i < removed.size(); ++i)
+        for (auto & child : directChildren(*this, *removed[i]))
+            if (removedSet.insert(child.get()).second)
+                removed.push_back(std::move(child));
+
+    for (const auto & tx : removed) {
+        for (const auto & [sh, ioinfo] : tx->hashXs) {
+            affected.insert(sh);
+            // return the outputs this tx spent to any surviving mempool parents
+            for (const auto & [spentTxo, info] : ioinfo.unconfirmedSpends)
+                if (const auto it = txs.find(spentTxo.txHash); it != txs.end() && !removedSet.count(it->second.get()))
+                    it->second->hashXs[sh].utxo.insert(spentTxo.outN);
+        }
+    }
+    for (const auto & tx : removed) {
+        feeHistogramRemove(*tx);
+        memBytesRemove(*tx);
+        txs.erase(tx->hash);
+    }
+    eraseFromHashXTxs(hashXTxs, affected, removedSet);
+
+    return affected;
+}
+
+auto Mempool::undoBlock(const HashXSet &blockHashXs, TxNum txNum0) -> HashXSet
+{
+    // Any such spend must be of an output created by the block, so it is listed under one of the block's scripthashes.
+    TxHashSet stale;
+    for (const auto & sh : blockHashXs) {
+        const auto it = hashXTxs.find(sh);
+        if (it == hashXTxs.end())
+            continue;
+        for (const auto & tx : it->second) {
+            const auto hxit = tx->hashXs.find(sh);
+            if (hxit == tx->hashXs.end())
+                continue;
+            for (const auto & [spentTxo, info] : hxit->second.confirmedSpends) {
+                if (info.txNum >= txNum0) {
+                    stale.insert(tx->hash);
+                    break;
+                }
+            }
+        }
+    }
+    if (stale.empty())
+        return HashXSet{};
+    return dropTxs(stale);
+}
+
+void Mempool::memBytesAdd(Tx &tx)
+{
+    memBytesRemove(tx); // in case it was counted before
+    // the tx itself, its shared_ptr control block, and its entry in the hashXTxs vector of each of its scripthashes
+    tx.memBytesCounted = unsigned(tx.estimatedMemoryBytes() + 2 * sizeof(void *) + tx.hashXs.size() * sizeof(TxRef));
+    txsMemBytes += tx.memBytesCounted;
+}
+
+void Mempool::memBytesRemove(Tx &tx)
+{
+    txsMemBytes -= std::min(txsMemBytes, size_t(tx.memBytesCounted));
+    tx.memBytesCounted = 0;
+}
+
+namespace {
+    unsigned feeRateOf(const Mempool::Tx &tx) {
+        return unsigned(tx.fee / bitcoin::Amount::satoshi()) // sats
+               /  std::max(tx.sizeBytes, 1u); // per byte
+    }
+} // namespace
+
+void Mempool::feeHistogramAdd(Tx &tx)
+{
+    if (tx.inFeeHistogram)
+        return;
+    tx.inFeeHistogram = true;
+    feeRateSizes[feeRateOf(tx)] += tx.sizeBytes; // accumulate size by feeRate
+    ++feeRateSizesVersion;
+}
+
+void Mempool::feeHistogramRemove(Tx &tx)
+{
+    if (!tx.inFeeHistogram)
+        return; // can happen if SynchMempoolTask aborted before it could add this tx, e.g. its inputs were unresolved
+    tx.inFeeHistogram = false;
+    ++feeRateSizesVersion;
+    const auto it = feeRateSizes.find(feeRateOf(tx));
+    if (UNLIKELY(it == feeRateSizes.end()))
+        return; // should never happen
+    if (it->second > tx.sizeBytes)
+        it->second -= tx.sizeBytes;
+    else
+        feeRateSizes.erase(it); // clamp at zero
+}
+
 auto Mempool::calcCompactFeeHistogram(double binSize) const -> FeeHistogramVec
 {
     // this algorithm is taken from:
     // https://github.com/Electron-Cash/electrumx/blob/fbd00416d804c286eb7de856e9399efb07a2ceaf/electrumx/server/mempool.py#L139
     FeeHistogramVec ret;
-    std::map<unsigned, unsigned, std::greater<unsigned>> histogram; // sorted map, descending order by key
+    const auto & histogram = feeRateSizes; // sorted map, descending order by key
 
-    for (const auto & [txid, tx] : txs) {
-        const auto feeRate = unsigned(tx->fee / bitcoin::Amount::satoshi()) // sats
-                             /  std::max(tx->sizeBytes, 1u); // per byte
-        histogram[feeRate] += tx->sizeBytes; // accumulate size by feeRate
-    }
-
-    // now, compact the bins
+    // compact the bins
     ret.reserve(8);
     unsigned cumSize = 0;
     double r = 0.;
 
     for (const auto & [feeRate, size] : histogram) {
-        cumSize += size;
+        cumSize += unsigned(size);
         if (cumSize + r > binSize) {
             ret.push_back(FeeHistogramItem{feeRate, cumSize});
             r += double(cumSize) - binSize;
@@ -52,3 +314,218 @@ auto Mempool::calcCompactFeeHistogram(double binSize) const -> FeeHistogramVec
     ret.shrink_to_fit(); // save memory
     return ret;
 }
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+namespace {
+    /// Returns a distinct, recognizable 32-byte hash for `n` (used for both txids and scripthashes below).
+    QByteArray TestHash(unsigned n, char tag = 't') {
+        QByteArray ret(HashLen, '\0');
+        ret[0] = tag;
+        ret[1] = char(n & 0xff);
+        ret[2] = char((n >> 8) & 0xff);
+        return ret;
+    }
+
+    void testFeeHistogram() {
+        const auto MakeTx = [](unsigned n, unsigned sizeBytes, int64_t feeSats) {
+            auto tx = std::make_shared<Mempool::Tx>();
+            tx->hash = TestHash(n);
+            tx->sizeBytes = sizeBytes;
+            tx->fee = feeSats * bitcoin::Amount::satoshi();
+            return tx;
+        };
+        Mempool mempool;
+        const auto Expect = [&mempool](const Mempool::FeeRateSizeMap &expected, const char *when) {
+            if (mempool.feeRateSizes != expected)
+                throw Exception(QString("Unexpected fee histogram bins %1").arg(when));
+        };
+        auto a = MakeTx(1, 250, 2500), b = MakeTx(2, 500, 5000), c = MakeTx(3, 100, 1000), d = MakeTx(4, 1000, 2000);
+        for (const auto & tx : {a, b, c, d})
+            mempool.txs[tx->hash] = tx;
+        mempool.feeHistogramAdd(*a);
+        mempool.feeHistogramAdd(*b);
+        mempool.feeHistogramAdd(*d);
+        mempool.feeHistogramAdd(*a); // no-op: already added
+        Expect({{10, 750}, {2, 1000}}, "after adding");
+        if (mempool.txsMemBytes != 0)
+            throw Exception("The fee histogram touched the running total of mempool memory");
+        for (const auto & tx : {a, b, d})
+            mempool.memBytesAdd(*tx);
+        mempool.memBytesAdd(*a); // re-counts a, replacing what it counted before
+        if (!a->memBytesCounted || mempool.txsMemBytes != a->memBytesCounted + b->memBytesCounted + d->memBytesCounted)
+            throw Exception("Unexpected running total of mempool memory after adding");
+        const auto v0 = mempool.feeRateSizesVersion;
+
+        // c shares a's and b's bin, but it was never added (e.g. its inputs were never resolved): dropping it must
+        // leave the bin, and the version, alone
+        mempool.dropTxs({c->hash});
+        mempool.feeHistogramRemove(*c);
+        Expect({{10, 750}, {2, 1000}}, "after dropping a tx that was never added");
+        if (mempool.feeRateSizesVersion != v0 || mempool.txs.count(c->hash))
+            throw Exception("Dropping a tx that was never added changed the histogram version, or didn't drop it");
+
+        mempool.dropTxs({a->hash});
+        mempool.feeHistogramRemove(*a); // no-op: already removed
+        Expect({{10, 500}, {2, 1000}}, "after dropping a");
+        if (mempool.feeRateSizesVersion == v0)
+            throw Exception("Dropping a tx did not change the histogram version");
+        const auto hist = mempool.calcCompactFeeHistogram(600.);
+        if (hist.size() != 1 || hist[0].feeRate != 2 || hist[0].cumulativeSize != 1500)
+            throw Exception("Unexpected compact fee histogram");
+
+        mempool.dropTxs({b->hash, d->hash});
+        Expect({}, "after dropping everything");
+        if (mempool.txsMemBytes != 0)
+            throw Exception("Unexpected running total of mempool memory after dropping everything");
+        Log() << "mempool_feehist: test passed";
+    }
+
+    const auto test_feehist = App::registerTest("mempool_feehist", &testFeeHistogram);
+
+    /// A mempool built up tx by tx the way SynchMempoolTask builds it.
+    struct TestMempool {
+        Mempool mempool;
+        static constexpr TxNum kConfirmedTxNum = 7; ///< the TxNum of any confirmed output spent by a test tx
+
+        /// Adds tx `n`, which spends `ins` (outputs of mempool txs or, if the tx isn't in the mempool, confirmed
+        /// outputs) and pays to the scripthashes `outs`. The input scripthashes must match the outputs they spend.
+        Mempool::TxRef add(unsigned n, const std::vector<std::pair<TXO, HashX>> &ins, const std::vector<HashX> &outs) {
+            auto tx = std::make_shared<Mempool::Tx>();
+            tx->hash = TestHash(n);
+            tx->sizeBytes = 200;
+            for (const auto & [txo, sh] : ins) {
+                const TXOInfo info{1000 * bitcoin::Amount::satoshi(), sh, {}, 0};
+                if (auto it = mempool.txs.find(txo.txHash); it != mempool.txs.end()) {
+                    tx->hashXs[sh].unconfirmedSpends.emplace(txo, info);
+                    tx->hasUnconfirmedParentTx = true;
+                    if (it->second->hashXs[sh].utxo.erase(txo.outN) != 1)
+                        throw Exception("Bad test: the parent doesn't have an unspent output with that scripthash");
+                } else
+                    tx->hashXs[sh].confirmedSpends.emplace(txo, TXOInfo{info.amount, sh, 1u, kConfirmedTxNum});
+            }
+            for (const auto & sh : outs) {
+                tx->hashXs[sh].utxo.insert(IONum(tx->txos.size()));
+                tx->txos.push_back(TXOInfo{1000 * bitcoin::Amount::satoshi(), sh, {}, 0});
+            }
+            mempool.txs[tx->hash] = tx;
+            for (const auto & [sh, ioinfo] : tx->hashXs) {
+                auto & txvec = mempool.hashXTxs[sh];
+                txvec.push_back(tx);
+                std::sort(txvec.begin(), txvec.end(), Mempool::TxRefOrdering{});
+            }
+            mempool.feeHistogramAdd(*tx);
+            mempool.memBytesAdd(*tx);
+            return tx;
+        }
+
+        /// Throws unless the mempool holds exactly the txs `ns` and its hashXTxs index is consistent with them.
+        void check(const std::set<unsigned> &ns, const QString &when) const {
+            const auto Fail = [&when](const QString &what) { throw Exception(QString("%1: %2").arg(when, what)); };
+            if (mempool.txs.size() != ns.size())
+                Fail(QString("expected %1 txs, got %2").arg(ns.size()).arg(mempool.txs.size()));
+            size_t nEntries = 0;
+            for (const auto n : ns) {
+                const auto it = mempool.txs.find(TestHash(n));
+                if (it == mempool.txs.end())
+                    Fail(QString("tx %1 is missing").arg(n));
+                for (const auto & [sh, ioinfo] : it->second->hashXs) {
+                    const auto hxit = mempool.hashXTxs.find(sh);
+                    if (hxit == mempool.hashXTxs.end() || std::count(hxit->second.begin(), hxit->second.end(), it->second) != 1)
+                        Fail(QString("tx %1 is not indexed under one of its scripthashes").arg(n));
+                    ++nEntries;
+                }
+            }
+            size_t memBytes = 0;
+            for (const auto & [txid, tx] : mempool.txs)
+                memBytes += tx->memBytesCounted;
+            if (memBytes != mempool.txsMemBytes || (!ns.empty() && !memBytes))
+                Fail("txsMemBytes doesn't match the txs in the mempool");
+            size_t nIndexed = 0;
+            for (const auto & [sh, txvec] : mempool.hashXTxs) {
+                nIndexed += txvec.size();
+                if (!std::is_sorted(txvec.begin(), txvec.end(), Mempool::TxRefOrdering{}))
+                    Fail("a hashXTxs entry is not sorted");
+            }
+            if (nIndexed != nEntries)
+                Fail("hashXTxs indexes txs that are not in the mempool");
+        }
+    };
+
+    /// Mempool::confirmedInBlock: confirming a parent only, a parent and a child, and a block that conflicts with
+    /// mempool txs (by spending a confirmed output they spend, or the output of a newly confirmed parent).
+    void testConfirmedInBlock() {
+        const auto SH = [](unsigned n) { return TestHash(n, 's'); };
+        const TXO confirmedA{TestHash(900), 0}, confirmedZ{TestHash(901), 0};
+        const auto Out = [](unsigned txN, IONum n) { return TXO{TestHash(txN), n}; };
+        // P (1) spends a confirmed output and pays to scripthashes 2 and 3. C1 (2) spends P:0, C2 (3) spends P:1,
+        // G (4) spends C1:0. Z (5) spends another confirmed output.
+        const auto Build = [&](TestMempool &t) {
+            t.add(1, {{confirmedA, SH(1)}}, {SH(2), SH(3)});
+            t.add(2, {{Out(1, 0), SH(2)}}, {SH(4)});
+            t.add(3, {{Out(1, 1), SH(3)}}, {SH(5)});
+            t.add(4, {{Out(2, 0), SH(4)}}, {SH(6)});
+            t.add(5, {{confirmedZ, SH(7)}}, {SH(8)});
+            t.check({1, 2, 3, 4, 5}, "build");
+        };
+        const auto ExpectRepointed = [&](const TestMempool &t, unsigned txN, const HashX &sh, const TXO &txo, TxNum txNum) {
+            const auto & tx = t.mempool.txs.at(TestHash(txN));
+            const auto & ioinfo = tx->hashXs.find(sh)->second;
+            const auto it = ioinfo.confirmedSpends.find(txo);
+            if (it == ioinfo.confirmedSpends.end() || it->second.txNum != txNum || it->second.confirmedHeight != 10u
+                    || ioinfo.unconfirmedSpends.count(txo))
+                throw Exception(QString("tx %1's spend of %2 was not re-pointed to the block").arg(txN).arg(txo.toString()));
+        };
+        constexpr BlockHeight height = 10;
+
+        {   // the block confirms P, spending only P's input
+            TestMempool t;
+            Build(t);
+            Mempool::BlockSpends spends;
+            spends.txos = {confirmedA};
+            spends.hashXs = {SH(1)};
+            const auto affected = t.mempool.confirmedInBlock({{TestHash(1), 100}}, spends, height);
+            t.check({2, 3, 4, 5}, "confirm parent only");
+            ExpectRepointed(t, 2, SH(2), Out(1, 0), 100);
+            ExpectRepointed(t, 3, SH(3), Out(1, 1), 100);
+            if (t.mempool.txs.at(TestHash(2))->hasUnconfirmedParentTx || t.mempool.txs.at(TestHash(3))->hasUnconfirmedParentTx
+                    || !t.mempool.txs.at(TestHash(4))->hasUnconfirmedParentTx)
+                throw Exception("confirm parent only: hasUnconfirmedParentTx not recalculated");
+            if (affected != Mempool::HashXSet{SH(1), SH(2), SH(3), SH(4), SH(5)})
+                throw Exception("confirm parent only: unexpected affected set");
+        }
+        {   // the block confirms P and C1
+            TestMempool t;
+            Build(t);
+            Mempool::BlockSpends spends;
+            spends.txos = {confirmedA, Out(1, 0)};
+            spends.hashXs = {SH(1), SH(2)};
+            t.mempool.confirmedInBlock({{TestHash(1), 100}, {TestHash(2), 101}}, spends, height);
+            t.check({3, 4, 5}, "confirm parent and child");
+            ExpectRepointed(t, 3, SH(3), Out(1, 1), 100);
+            ExpectRepointed(t, 4, SH(4), Out(2, 0), 101);
+            if (t.mempool.txs.at(TestHash(4))->hasUnconfirmedParentTx)
+                throw Exception("confirm parent and child: hasUnconfirmedParentTx not recalculated");
+        }
+        {   // the block confirms P, but spends P:0 in a tx other than C1, and also spends Z's confirmed input
+            TestMempool t;
+            Build(t);
+            Mempool::BlockSpends spends;
+            spends.txos = {confirmedA, Out(1, 0), confirmedZ};
+            spends.hashXs = {SH(1), SH(2), SH(7)};
+            const auto affected = t.mempool.confirmedInBlock({{TestHash(1), 100}}, spends, height);
+            t.check({3}, "conflicting spends"); // C1 and Z conflict, G is C1's child
+            ExpectRepointed(t, 3, SH(3), Out(1, 1), 100);
+            for (unsigned n = 1; n <= 8; ++n)
+                if (!affected.count(SH(n)))
+                    throw Exception("conflicting spends: unexpected affected set");
+            if (t.mempool.feeRateSizes != Mempool::FeeRateSizeMap{{0, 200}})
+                throw Exception("conflicting spends: fee histogram not updated");
+        }
+        Log() << "mempool_confirm: test passed";
+    }
+
+    const auto test_confirm = App::registerTest("mempool_confirm", &testConfirmedInBlock);
+} // namespace
+#endif
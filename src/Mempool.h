@@ -19,11 +19,13 @@
 #pragma once
 
 #include "BlockProcTypes.h"
+#include "SortedVec.h"
 #include "TXO.h"
 
 #include "bitcoin/amount.h"
 #include "robin_hood/robin_hood.h"
 
+#include <functional> // for std::greater
 #include <list>
 #include <map>
 #include <memory>
@@ -45,6 +47,10 @@ struct Mempool
         unsigned sizeBytes = 0;
         bitcoin::Amount fee{bitcoin::Amount::zero()}; ///< we calculate this fee ourselves since in the past I noticed we get a funny value sometimes that's off by 1 or 2 sats --  which I suspect is due limitations of doubles, perhaps?
         bool hasUnconfirmedParentTx = false; ///< If true, this tx depends on another tx in the mempool. This is fixed once calculated properly by the SynchMempoolTask in Controller.cpp
+        bool inFeeHistogram = false; ///< Set by Mempool::feeHistogramAdd, cleared by feeHistogramRemove. A tx dropped before it was added must not be subtracted.
+        /// What this tx added to Mempool::txsMemBytes in memBytesAdd, so that the same amount is subtracted later
+        /// even if the tx has changed since. 0 if it was never counted.
+        unsigned memBytesCounted = 0;
 
         /// These are all the txos in this tx. Once set-up, this doesn't change (unlike IOInfo.utxo).
         /// Note that this vector is always sized to the number of txouts in the tx. It may, however, contain !isValid
@@ -52,9 +58,14 @@ struct Mempool
         /// vector should check if txos[i].isValid().
         std::vector<TXOInfo> txos;
 
+        /// Spends are kept in flat sorted vectors rather than hash tables: they are tiny, fixed once the tx is
+        /// processed, and a node-based map costs a heap allocation per entry plus a bucket array per map.
+        using SpendsMap = SortedVecMap<TXO, TXOInfo>;
+        using UtxoSet = SortedVecSet<IONum>;
+
         struct IOInfo {
-            /// spends. .confirmedSpends here affects get_balance. We use unordered_map here because it wastes less space than robin_hood on fixed-sized maps
-            std::unordered_map<TXO, TXOInfo>
+            /// spends. .confirmedSpends here affects get_balance.
+            SpendsMap
                 /// Spends of txo's from the db (confirmed) utxoset.
                 /// - Items here get _subtracted_ from the "unconfirmed" in RPC get_balance.
                 /// - Items appearing here also suppress confirmed utxo items from appearing in RPC listunspent (since they are spent in mempool).
@@ -66,7 +77,7 @@ struct Mempool
             /// the mempool evolves if new descendants appear that spend these txos (those descendants will list the
             /// item that gets deleted from here in their own IOInfo::unconfirmedSpends map).
             /// + Items here get _added_ to the "unconfirmed" balance in RPC get_balance.
-            std::unordered_set<IONum> utxo; ///< IONums which are indices into the txos vector declared above. We use an unordered_set here because it's more efficient than a regular set, and we don't care about order anyway.
+            UtxoSet utxo; ///< IONums which are indices into the txos vector declared above, in ascending order.
         };
 
         bool operator<(const Tx &o) const {
@@ -79,9 +90,14 @@ struct Mempool
             return hash < o.hash;
         }
 
-        /// This should always contain all the HashX's involved in this tx. Note the use of unordered_map which can
-        /// save space vs. robin_hood for immutable maps (which this is, once built)
-        std::unordered_map<HashX, IOInfo, HashHasher> hashXs;
+        /// This should always contain all the HashX's involved in this tx. This map is immutable once built, so a
+        /// flat sorted vector is the most compact choice. The HashX keys are shallow copies of the ones in
+        /// Mempool::hashXTxs (see SynchMempoolTask in Controller.cpp), so each distinct scripthash is stored once.
+        SortedVecMap<HashX, IOInfo> hashXs;
+
+        /// Returns an estimate of the heap + inline memory used by this tx, excluding the (shared) QByteArray data of
+        /// its hashes.
+        size_t estimatedMemoryBytes() const;
     };
 
     using TxRef = std::shared_ptr<Tx>;
@@ -120,10 +136,65 @@ struct Mempool
         const auto txsSize = txs.size(), hxSize = hashXTxs.size();
         txs.clear();
         hashXTxs.clear();
+        feeRateSizes.clear();
+        ++feeRateSizesVersion;
+        txsMemBytes = 0;
         txs.reserve(size_t(txsSize*0.75));
         hashXTxs.reserve(size_t(hxSize*0.75));
     }
 
+    /// Returns an estimate of the memory used by the mempool data structures: all the txs plus the overhead of
+    /// the `txs` and `hashXTxs` tables. It is worked out from sizeof and container sizes, not measured from the
+    /// allocator. O(1): the per-tx part is the running total `txsMemBytes`. Used for the stats display. Call this with
+    /// the mempool lock held.
+    size_t estimatedMemoryBytes() const;
+    /// Sum of Tx::memBytesCounted for the txs in the mempool. Kept by memBytesAdd & memBytesRemove below.
+    size_t txsMemBytes = 0;
+
+    /// Call these with the mempool lock held exclusively. Add counts `tx` into `txsMemBytes`; call it once the tx is
+    /// fully built and in `txs` (SynchMempoolTask and Storage::loadMempool do this). Calling it again re-counts the
+    /// tx. Remove is called for you by confirmedInBlock and dropTxs as they erase txs from `txs`, and subtracts
+    /// exactly what Add counted (nothing, for a tx that was never counted).
+    void memBytesAdd(Tx &tx);
+    void memBytesRemove(Tx &tx);
+
+    // -- Incremental update support (used by Storage::addBlock and by SynchMempoolTask in Controller.cpp) --
+
+    /// A set of scripthashes. Returned by the functions below to indicate which scripthashes changed.
+    using HashXSet = std::unordered_set<HashX, HashHasher>;
+    using TxHashSet = std::unordered_set<TxHash, HashHasher>;
+    /// TxHash -> TxNum for txs that were just confirmed in a block
+    using TxHashNumMap = std::unordered_map<TxHash, TxNum, HashHasher>;
+
+    /// The outputs spent by the inputs of a block, and the scripthashes of those outputs.
+    struct BlockSpends {
+        std::unordered_set<TXO> txos;
+        HashXSet hashXs;
+    };
+
+    /// Called by Storage::addBlock (with the mempool lock held exclusively), rather than clearing the entire mempool
+    /// for each new block.  First drops the mempool txs (other than those in `confirmed`) that spend any of
+    /// `spends.txos`, along with their descendants: these conflict with the block, and bitcoind will have evicted
+    /// them.  This includes a tx spending an output of a newly confirmed parent that the block itself spends in
+    /// another tx.  Then removes the txs in `confirmed` (which maps txids to their new TxNums) from the mempool.
+    /// Surviving mempool txs that spent outputs of those txs get those spends moved from IOInfo::unconfirmedSpends
+    /// to IOInfo::confirmedSpends (re-pointed at `height` and the new TxNum), and their hasUnconfirmedParentTx flag is
+    /// recalculated.  Returns the set of scripthashes whose mempool state changed.
+    HashXSet confirmedInBlock(const TxHashNumMap &confirmed, const BlockSpends &spends, BlockHeight height);
+
+    /// Removes the txs in `txids` as well as all of their mempool descendants (txids not in the mempool are
+    /// ignored).  Surviving mempool parents of removed txs get the spent outputs returned to their IOInfo::utxo sets.
+    /// Returns the set of scripthashes whose mempool state changed.  Call this with the mempool lock held exclusively.
+    HashXSet dropTxs(const TxHashSet &txids);
+
+    /// Called by Storage::undoLatestBlock (with the mempool lock held exclusively), rather than clearing the entire
+    /// mempool on reorg.  Drops the txs that spent outputs of the block being undone (whose txs start at `txNum0` and
+    /// involve the scripthashes `blockHashXs`), along with their descendants, since their IOInfo::confirmedSpends
+    /// now point to outputs that are no longer confirmed.  All other txs are unaffected and are kept.  The dropped txs
+    /// (and the txs of the undone block) will be re-added by the next mempool synch.  Returns the set of scripthashes
+    /// whose mempool state changed.
+    HashXSet undoBlock(const HashXSet &blockHashXs, TxNum txNum0);
+
     // -- Fee histogram support (used by mempool.get_fee_histogram RPC) --
 
     struct FeeHistogramItem {
@@ -131,8 +202,23 @@ struct Mempool
         unsigned cumulativeSize = 0; // bin size, cumulative bytes
     };
     using FeeHistogramVec = std::vector<FeeHistogramItem>;
-    /// This function is potentially going to take a couple of ms at worst on very large mempools.  Even a 1.5k tx
-    /// mempool takes under 1 ms on average hardware, so it's very fast. Storage calls this in refreshMempoolHistogram
-    /// from a periodic background task kicked off in Controller.
+    /// Maps feeRate (sats/B, truncated) -> total size in bytes of all the mempool txs paying that rate, in
+    /// descending feeRate order.  This is maintained incrementally as txs enter and leave the mempool (see
+    /// feeHistogramAdd & feeHistogramRemove below), so that the compact histogram is always current.
+    using FeeRateSizeMap = std::map<unsigned, uint64_t, std::greater<unsigned>>;
+    FeeRateSizeMap feeRateSizes;
+    /// Incremented every time `feeRateSizes` changes, so that the compact histogram may be cached until it does
+    /// (see Storage::mempoolHistogram).
+    uint64_t feeRateSizesVersion = 0;
+
+    /// Call these with the mempool lock held exclusively. Add must be called once the tx's fee and size are final
+    /// (SynchMempoolTask does this). Remove is called for you by confirmedInBlock and dropTxs, and only subtracts
+    /// txs that were added (see Tx::inFeeHistogram). Both are no-ops if the tx is already in the respective state.
+    void feeHistogramAdd(Tx &tx);
+    void feeHistogramRemove(Tx &tx);
+
+    /// Compacts `feeRateSizes` into the format expected by the mempool.get_fee_histogram RPC. This is O(number of
+    /// distinct fee rates in the mempool), which is typically a few hundred at most, so it's very cheap. Storage
+    /// calls this from mempoolHistogram(), with the mempool lock held in shared mode.
     FeeHistogramVec calcCompactFeeHistogram(double binSize = 1e5 /* binSize in bytes */) const;
 };
@@ -123,6 +123,7 @@ QVariantMap Options::toMap() const
     m["subnets_to_exclude_from_per_ip_limits"] = l;
     m["max_buffer"] = maxBuffer.load();
     m["max_history"] = maxHistory;
+    m["max_batch"] = maxBatch;
     m["workqueue"] = workQueue;
     m["worker_threads"] = workerThreads;
     m["max_pending_connections"] = maxPendingConnections;
@@ -139,6 +140,18 @@ QVariantMap Options::toMap() const
     // bitcoind_throttle params
     const auto [hi, lo, decay] = bdReqThrottleParams.load();
     m["bitcoind_throttle"] = QVariantList{ hi, lo, decay };
+    m["bitcoind_clients"] = bdNClients;
+    m["bitcoind_batch_size"] = bdBatchSize;
+    m["persist_mempool"] = persistMempool;
+    m["bitcoind_rest"] = bitcoindRest;
+    m["block_download_mem"] = blockDLMemMB;
+    m["result_cache_mem"] = resultCacheMB;
+    {
+        QVariantMap zm;
+        for (auto it = zmqEndpoints.cbegin(); it != zmqEndpoints.cend(); ++it)
+            zm[QString("zmq_%1").arg(it.key())] = it.value();
+        m["zmq"] = zm;
+    }
     // max_subs_per_ip & max_subs
     m["max_subs_per_ip"] = qlonglong(maxSubsPerIP);
     m["max_subs"] = qlonglong(maxSubsGlobally);
@@ -29,6 +29,7 @@
 #include <QVariantMap>
 
 #include <algorithm>
+#include <array>
 #include <limits>
 #include <mutex>
 #include <optional>
@@ -130,12 +131,14 @@ public:
     // Max history & max buffer
     static constexpr int defaultMaxBuffer = 4'000'000, maxBufferMin = 64'000, maxBufferMax = 100'000'000;
     static constexpr int defaultMaxHistory = 125'000, maxHistoryMin = 1000, maxHistoryMax = 100'000'000;
+    static constexpr int defaultMaxBatch = 345, maxBatchMin = 1, maxBatchMax = 20'000;
 
     static constexpr bool isMaxBufferSettingInBounds(int m) { return m >= maxBufferMin && m <= maxBufferMax; }
     static constexpr int clampMaxBufferSetting(int m) { return std::max(std::min(m, maxBufferMax), maxBufferMin); }
 
     std::atomic_int maxBuffer = defaultMaxBuffer; ///< this can be set at runtime by FulcrumAdmin as of Fulcrum 1.0.4, hence why it's an atomic.
     int maxHistory = defaultMaxHistory;
+    int maxBatch = defaultMaxBatch; ///< comes from config 'max_batch'. The max number of items in a client's JSON-RPC batch request.
 
     // Work queue options as configured by user; these are the saved values from config (if any) and are not
     // necessarily the options used in practice (those can be determined by querying the Util::ThreadPool).
@@ -176,6 +179,40 @@ public:
     /// Comes from a triplet in config, if specified e.g.: "bitcoind_throttle = 50, 20, 10"
     AtomicBdReqThrottleParams bdReqThrottleParams;
 
+    static constexpr int defaultBDNClients = 3, minBDNClients = 1, maxBDNClients = 32;
+    /// The number of simultaneous JSON-RPC connections we keep open to bitcoind. Comes from config `bitcoind_clients`.
+    int bdNClients = defaultBDNClients;
+
+    static constexpr int defaultBDBatchSize = 100, minBDBatchSize = 1, maxBDBatchSize = 5000;
+    /// The number of `getrawtransaction` requests per JSON-RPC batch used when downloading new mempool txs from
+    /// bitcoind. Comes from config `bitcoind_batch_size`.
+    int bdBatchSize = defaultBDBatchSize;
+
+    /// If true, the mempool is saved to the datadir on clean shutdown and re-loaded on startup (if still valid for
+    /// the chain tip). Comes from config `persist_mempool`.
+    bool persistMempool = true;
+
+    /// If true, blocks are downloaded from bitcoind's binary REST interface (/rest/headers and /rest/block, needs
+    /// bitcoind -rest=1) rather than as hex via JSON-RPC. Falls back to JSON-RPC if REST fails. Comes from config
+    /// `bitcoind_rest`.
+    bool bitcoindRest = false;
+
+    static constexpr int defaultBlockDLMemMB = 512, minBlockDLMemMB = 16, maxBlockDLMemMB = 1024 * 1024;
+    /// Memory budget, in MB, for downloaded blocks that are waiting to be added to the db (as estimated by
+    /// PreProcessedBlock::estimatedThisSizeBytes). Block downloads slow down once the backlog would exceed this.
+    /// Comes from config `block_download_mem`.
+    int blockDLMemMB = defaultBlockDLMemMB;
+
+    static constexpr int defaultResultCacheMB = 64, minResultCacheMB = 0, maxResultCacheMB = 2000;
+    /// Memory budget, in MB, for the serialized results of get_history, get_mempool, get_balance and listunspent
+    /// (see Storage::getCachedResult). 0 disables the cache. Comes from config `result_cache_mem`.
+    int resultCacheMB = defaultResultCacheMB;
+
+    /// ZMQ topic -> endpoint address, e.g. "hashblock" -> "tcp://127.0.0.1:28332". Comes from the optional config
+    /// keys `zmq_hashblock`, `zmq_hashtx`, `zmq_rawtx`, and `zmq_sequence`. Empty if ZMQ is not used.
+    QMap<QString, QString> zmqEndpoints;
+    static constexpr std::array<const char *, 4> zmqTopics = { "hashblock", "hashtx", "rawtx", "sequence" };
+
     static constexpr int64_t defaultMaxSubsPerIP = 50'000, maxSubsPerIPMin = 500, maxSubsPerIPMax = std::numeric_limits<int>::max()/2; // 50k, 500, 10^30 (~1bln) respectively
     static constexpr int64_t defaultMaxSubsGlobally = 10'000'000, maxSubsGloballyMin = 5000, maxSubsGloballyMax = std::numeric_limits<int>::max(); // 10 mln, 5k, 10^31 (~2bln) respectively
     int64_t maxSubsPerIP = defaultMaxSubsPerIP; // 50k subs per IP ought to be plenty. User can set this in `max_subs_per_ip` in conf.
@@ -184,6 +221,8 @@ public:
     static constexpr bool isMaxSubsGloballySettingInBounds(int64_t m) { return m >= maxSubsGloballyMin && m <= maxSubsGloballyMax; }
 
     QString dumpScriptHashes;  ///< if specified, a file path to which to dump all scripthashes as JSON, corresponds to --dump-sh CLI arg
+    QString exportSnapshot; ///< if specified, a file path to which to write a portable db snapshot after loading, corresponds to --export-snapshot CLI arg
+    QString importSnapshot; ///< if specified, a snapshot file to load into an empty datadir before startup, corresponds to --import-snapshot CLI arg
 
     struct DBOpts {
         static constexpr int defaultMaxOpenFiles = -1, maxOpenFilesMin = 20, maxOpenFilesMax = INT_MAX;
@@ -23,12 +23,25 @@
 #include <QHostAddress>
 #include <QSslSocket>
 
+#include <algorithm>
 #include <type_traits>
 
 namespace RPC {
 
     const QString jsonRpcVersion("2.0");
-    namespace { const QString rpcDot("rpc."); } // "static"
+    namespace {
+        const QString rpcDot("rpc.");
+
+        /// Returns true if the first non-whitespace byte in `json` is '[', that is: it looks like a JSON array.
+        bool looksLikeJsonArray(const QByteArray &json) {
+            for (const char c : json) {
+                if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+                    continue;
+                return c == '[';
+            }
+            return false;
+        }
+    } // "static"
 
     /*static*/ const QString Message::s_code("code");
     /*static*/ const QString Message::s_data("data");
@@ -65,13 +78,18 @@ namespace RPC {
             throw InvalidError(QString("Error parsing JSON key \"%1\": %2").arg(s_id).arg(e.what()));
         }
 
+        // The number of keys the object would have had if it had included "jsonrpc".
+        int nKeys = map.count();
+        bool jsonRpcKeyMissing = false;
         if (QString ver; !v1 && (ver=ret.jsonRpcVersion()) != RPC::jsonRpcVersion) {// we ignore this key in v1
             if (!ver.isEmpty())
                 throw InvalidError(QString("Expected jsonrpc version %1").arg(RPC::jsonRpcVersion));
             // It turns out Electron Cash doesn't even send this key, even though JSON 2.0 spec specifies it. We accept
-            // requests without it if the key is missing entirely, and "fake" it so below code works (what follows is
-            // code that was originally written assuming the key is there).
-            ret.data[s_jsonrpc] = RPC::jsonRpcVersion;
+            // requests without it if the key is missing entirely, and account for it in the key counts below. We
+            // deliberately do not insert it into ret.data since that would detach (deep copy) the map on every such
+            // request.
+            jsonRpcKeyMissing = true;
+            ++nKeys;
         }
 
         if (auto var = map.value(s_method);
@@ -95,13 +113,14 @@ namespace RPC {
                 if (int code = errmap.value(s_code).toInt(&ok); !ok || errmap.value(s_code).toString() != QString::number(code))
                     throw InvalidError("Expected error code to be an integer");
                 static const KeySet required{ s_id, s_error, s_jsonrpc };
-                if (required !=
 #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-                        KeySet::fromList(ret.data.keys())
+                KeySet keys = KeySet::fromList(ret.data.keys());
 #else
-                        Util::toCont<KeySet>(ret.data.keys())
+                KeySet keys = Util::toCont<KeySet>(ret.data.keys());
 #endif
-                    )
+                if (jsonRpcKeyMissing)
+                    keys.insert(s_jsonrpc);
+                if (required != keys)
                     throw InvalidError("Error response not valid");
             }
         }
@@ -110,7 +129,7 @@ namespace RPC {
             const bool hasParams = ret.hasParams();
             if (!v1) {
                 const int n_ok = hasParams ? 4 : 3;
-                if (ret.data.count() != n_ok)
+                if (nKeys != n_ok)
                     throw InvalidError("Invalid request");
             }
             if (hasParams && !ret.isParamsMap() && !ret.isParamsList())
@@ -120,7 +139,7 @@ namespace RPC {
             const bool hasParams = ret.hasParams();
             if (!v1) {
                 const int n_ok = hasParams ? 3 : 2;
-                if (ret.data.count() != n_ok)
+                if (nKeys != n_ok)
                     throw InvalidError("Invalid notification");
             }
             if (hasParams && !ret.isParamsMap() && !ret.isParamsList())
@@ -129,7 +148,7 @@ namespace RPC {
         else if (ret.isResponse()) {
             if (!v1) {
                 const int n_ok = 3;
-                if (ret.data.count() != n_ok)
+                if (nKeys != n_ok)
                     throw InvalidError("Invalid response");
             }
         }
@@ -241,6 +260,8 @@ namespace RPC {
         // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendRequest, this, &ConnectionBase::_sendRequest));
         // connection will be auto-disconnected on socket disconnect
+        connectedConns.push_back(connect(this, &ConnectionBase::sendRequestBatch, this, &ConnectionBase::_sendRequestBatch));
+        // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendNotification, this, &ConnectionBase::_sendNotification));
         // connection will be auto-disconnected on socket disconnect
         connectedConns.push_back(connect(this, &ConnectionBase::sendError, this, &ConnectionBase::_sendError));
@@ -253,6 +274,9 @@ namespace RPC {
         AbstractConnection::on_disconnected(); // will auto-disconnect all QMetaObject::Connections appearing in connectedConns
         nUnansweredLifetime += quint64(idMethodMap.size());
         idMethodMap.clear();
+        batchReplySlots.clear(); // nobody left to send the replies to
+        pendingBatches.clear();
+        heldNotifications.clear();
     }
 
     auto ConnectionBase::stats() const -> Stats
@@ -264,6 +288,15 @@ namespace RPC {
         m["nNotificationsSent"] = nNotificationsSent;
         m["nUnansweredRequests"] = nUnansweredLifetime + quint64(idMethodMap.size()); // we may care about this
         m["nErrorReplies"] = nErrorReplies;
+        if (nBatchesSent || nBatchRepliesReceived) {
+            m["nBatchesSent"] = nBatchesSent;
+            m["nBatchRepliesReceived"] = nBatchRepliesReceived;
+        }
+        if (nBatchRequestsReceived) {
+            m["nBatchRequestsReceived"] = nBatchRequestsReceived;
+            m["nBatchRequestItemsReceived"] = nBatchRequestItemsReceived;
+            m["nBatchRequestItemsPending"] = batchReplySlots.size();
+        }
         return m;
     }
 
@@ -280,7 +313,7 @@ namespace RPC {
             Error() << __func__ << " method: " << method << "; Unable to generate request JSON! FIXME!";
             return;
         }
-        if (idMethodMap.size() >= MAX_UNANSWERED_REQUESTS) {  // prevent memory leaks in case of misbehaving peer
+        if (nUnansweredRequests() >= MAX_UNANSWERED_REQUESTS) {  // prevent memory leaks in case of misbehaving peer
             Warning() << "Closing connection because too many unanswered requests for: " << prettyName();
             do_disconnect();
             return;
@@ -292,6 +325,40 @@ namespace RPC {
         // below send() ends up calling do_write immediately (which is connected to send)
         emit send( wrapForSend(jsonData) );
     }
+    void ConnectionBase::_sendRequestBatch(const Batch & batch)
+    {
+        if (status != Connected || !socket) {
+            DebugM(__func__, " (", batch.size(), " items); Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
+            // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
+            do_disconnect();
+            return;
+        }
+        if (batch.isEmpty())
+            return;
+        if (nUnansweredRequests() + batch.size() > MAX_UNANSWERED_REQUESTS) {  // prevent memory leaks in case of misbehaving peer
+            Warning() << "Closing connection because too many unanswered requests for: " << prettyName();
+            do_disconnect();
+            return;
+        }
+        QVariantList items;
+        items.reserve(batch.size());
+        for (const auto & item : batch)
+            items.push_back(Message::makeRequest(item.id, item.method, item.params, v1).data);
+        QByteArray jsonData;
+        try { jsonData = Json::toUtf8(items, true); } catch (...) {}
+        if (jsonData.isEmpty()) {
+            Error() << __func__ << " (" << batch.size() << " items); Unable to generate batch request JSON! FIXME!";
+            return;
+        }
+        for (const auto & item : batch)
+            idMethodMap[item.id] = item.method; // remember method sent out to associate it back.
+
+        TraceM("Sending batch json: ", Util::Ellipsify(jsonData));
+        nRequestsSent += quint64(batch.size());
+        ++nBatchesSent;
+        // below send() ends up calling do_write immediately (which is connected to send)
+        emit send( wrapForSend(jsonData) );
+    }
     void ConnectionBase::_sendNotification(const QString &method, const QVariant & params)
     {
         if (status != Connected || !socket) {
@@ -313,6 +380,11 @@ namespace RPC {
             Error() << __func__ << " method: " << method << "; Unable to generate notification JSON! FIXME!";
             return;
         }
+        if (!pendingBatches.empty()) {
+            // hold it until the batches the peer is waiting on have been answered (see HeldNotification)
+            heldNotifications.push_back({json, pendingBatches});
+            return;
+        }
         TraceM("Sending json: ", Util::Ellipsify(json));
         ++nNotificationsSent;
         // below send() ends up calling do_write immediately (which is connected to send)
@@ -329,8 +401,10 @@ namespace RPC {
         const QByteArray json = Message::makeError(code, msg, reqId, v1).toJsonUtf8();
         TraceM("Sending json: ", Util::Ellipsify(json));
         ++nErrorsSent;
-        // below send() ends up calling do_write immediately (which is connected to send)
-        emit send( wrapForSend(json) );
+        if (batchReplySlots.isEmpty() || !fillBatchSlot(reqId, json, disc)) {
+            // below send() ends up calling do_write immediately (which is connected to send)
+            emit send( wrapForSend(json) );
+        }
         if (disc) {
             do_disconnect(true); // graceful disconnect
         }
@@ -350,10 +424,241 @@ namespace RPC {
         }
         TraceM("Sending result json: ", Util::Ellipsify(json));
         ++nResultsSent;
+        if (!batchReplySlots.isEmpty() && fillBatchSlot(reqid, json))
+            return; // part of a batch; sent along with the rest of the batch
+        // below send() ends up calling do_write immediately (which is connected to send)
+        emit send( wrapForSend(json) );
+    }
+
+    bool ConnectionBase::fillBatchSlot(const Message::Id & reqid, const QByteArray & json, bool flushNow)
+    {
+        if (reqid.isNull())
+            return false;
+        const auto it = batchReplySlots.find(reqid);
+        if (it == batchReplySlots.end())
+            return false;
+        const auto [batch, slot] = it.value();
+        batchReplySlots.erase(it);
+        batch->replies[slot] = json;
+        if (flushNow) {
+            // send what we have now (we are about to disconnect) and forget about the rest of this batch
+            for (auto it2 = batchReplySlots.begin(); it2 != batchReplySlots.end(); ) {
+                if (it2.value().first == batch)
+                    it2 = batchReplySlots.erase(it2);
+                else
+                    ++it2;
+            }
+            batch->nOutstanding = 0;
+            flushBatch(*batch);
+        } else if (--batch->nOutstanding == 0)
+            flushBatch(*batch);
+        return true;
+    }
+
+    void ConnectionBase::flushBatch(PendingBatch & batch)
+    {
+        batch.flushed = true;
+        pendingBatches.erase(std::remove_if(pendingBatches.begin(), pendingBatches.end(),
+                                            [&batch](const auto &b){ return b.get() == &batch; }),
+                             pendingBatches.end());
+        Defer releaseHeld([this]{ sendHeldNotifications(); }); // must run after the batch reply below is sent
+        QByteArray json;
+        int n = 0;
+        int size = 2;
+        for (const auto & reply : batch.replies)
+            size += reply.size() + 1;
+        json.reserve(size);
+        json.append('[');
+        for (const auto & reply : batch.replies) {
+            if (reply.isEmpty())
+                continue; // notification; no reply
+            if (n++)
+                json.append(',');
+            json.append(reply);
+        }
+        json.append(']');
+        if (!n)
+            return; // JSON-RPC 2.0: a batch of only notifications gets no reply at all
+        if (status != Connected || !socket)
+            return;
+        TraceM("Sending batch json (", n, " replies): ", Util::Ellipsify(json));
         // below send() ends up calling do_write immediately (which is connected to send)
         emit send( wrapForSend(json) );
     }
 
+    void ConnectionBase::sendHeldNotifications()
+    {
+        while (!heldNotifications.empty()) {
+            const auto & waitsFor = heldNotifications.front().waitsFor;
+            if (!std::all_of(waitsFor.begin(), waitsFor.end(), [](const auto &b){ return b->flushed; }))
+                break; // keep them in order: everything behind this one waits too
+            const QByteArray json = std::move(heldNotifications.front().json);
+            heldNotifications.pop_front();
+            if (status != Connected || !socket)
+                continue;
+            TraceM("Sending held json: ", Util::Ellipsify(json));
+            ++nNotificationsSent;
+            emit send( wrapForSend(json) );
+        }
+    }
+
+    void ConnectionBase::dispatchMessage(Message & message)
+    {
+        static const auto ValidateParams = [](const Message &msg, const Method &m) {
+            if (!msg.hasParams()) {
+                if ( (m.opt_kwParams.has_value() && !m.opt_kwParams->isEmpty())
+                     || (m.opt_nPosParams.has_value() && m.opt_nPosParams->first != 0) )
+                    throw InvalidParameters("Missing required params");
+            } else if (msg.isParamsList()) {
+                // positional args specified
+                if (!m.opt_nPosParams.has_value())
+                    throw InvalidParameters("Postional params are not supported for this method");
+                const unsigned num = unsigned(msg.paramsList().count());
+                auto [minParams, maxParams] = *m.opt_nPosParams;
+                if (maxParams < minParams) maxParams = minParams;
+                if (num < minParams)
+                    throw InvalidParameters(QString("Expected at least %1 %2 for %3, got %4 instead")
+                                            .arg(minParams).arg(Util::Pluralize("parameter", minParams))
+                                            .arg(m.method).arg(num));
+                if (num > maxParams)
+                    throw InvalidParameters(QString("Expected at most %1 %2 for %3, got %4 instead")
+                                            .arg(maxParams).arg(Util::Pluralize("parameter", maxParams))
+                                            .arg(m.method).arg(num));
+            } else if (msg.isParamsMap()) {
+                // named args specified
+                if (!m.opt_kwParams.has_value())
+                    throw InvalidParameters("Named params are not supported for this method");
+                const auto nameset =
+ #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
+                        KeySet::fromList(msg.paramsMap().keys()); // TODO: this is not the most efficient -- for now this isn't used except for AdminServer, so it's fine.
+ #else
+                        Util::toCont<KeySet>(msg.paramsMap().keys());
+ #endif
+                const auto & kwSet = *m.opt_kwParams;
+                if (m.allowUnknownNamedParams) {
+                    if (!(kwSet - nameset).isEmpty())
+                        throw InvalidParameters("Required parameters missing");
+                } else {
+                    if (nameset != kwSet)
+                        throw InvalidParameters("Unknown or missing parameters");
+                }
+            }
+        };
+
+        if (message.isError()) {
+            // error message
+            ++nErrorReplies;
+            // don't leak the request -- an error response is an answer! Remove from map.
+            message.method = idMethodMap.take(message.id);
+            if (!message.id.isNull() && message.method.isEmpty())
+                // Hmm. Error with no corresponding request id.. log that fact to debug log
+                DebugM("Got unexpected error reply for id: ", message.id);
+            emit gotErrorMessage(id, message);
+        } else if (message.isNotif()) {
+            try {
+                const auto it = methods.find(message.method);
+                if (it == methods.end())
+                    throw UnknownMethod("Unknown method");
+                const Method & m = it.value();
+                if (m.allowsNotifications) {
+                    ValidateParams(message, m);
+                    emit gotMessage(id, message);
+                } else {
+                    throw Exception(QString("Ignoring unexpected notification"));
+                }
+            } catch (const Exception & e) {
+                // Note: we emit peerError here so that the tally of number of errors goes up and we eventually disconnect the offending peer.
+                // This should not cause an error message to be sent to the peer.
+                emit peerError(this->id, lastPeerError=QString("Error processing notification '%1' from %2: %3").arg(message.method, prettyName(), e.what()));
+            }
+        } else if (message.isRequest()) {
+            const auto it = methods.find(message.method);
+            const Method *m = it != methods.end() ? &it.value() : nullptr;
+            if (!m || !m->allowsRequests)
+                throw UnknownMethod(QString("Unsupported request: %1").arg(message.method));
+            ValidateParams(message, *m);
+            emit gotMessage(id, message);
+        } else if (message.isResponse()) {
+            QString meth = idMethodMap.take(message.id);
+            if (meth.isEmpty()) {
+                throw BadPeer(QString("Unexpected response (id: %1)").arg(message.id.toString()));
+            }
+            message.method = meth;
+            emit gotMessage(id, message);
+        } else {
+            // Not a Request and not a Response or Notification or Error. Not JSON-RPC 2.0.
+            throw InvalidRequest("Invalid JSON");
+        }
+    }
+
+    namespace {
+        /// Maps an exception thrown while parsing/dispatching a peer's message to the JSON-RPC error code we reply with
+        int errorCodeForException(const Exception &e) {
+            // TODO: clean this up. It's rather inelegant. :/
+            if (dynamic_cast<const Json::ParseError *>(&e)) return Code_ParseError;
+            if (dynamic_cast<const ConnectionBase::InvalidParameters *>(&e)) return Code_InvalidParams;
+            if (dynamic_cast<const ConnectionBase::UnknownMethod *>(&e)) return Code_MethodNotFound;
+            if (dynamic_cast<const ConnectionBase::InvalidRequest *>(&e) || dynamic_cast<const InvalidError *>(&e))
+                return Code_InvalidRequest;
+            return Code_Custom;
+        }
+    } // namespace
+
+    void ConnectionBase::processBatchRequest(const QByteArray &json)
+    {
+        const QVariantList items = Json::parseUtf8(json, Json::ParseOption::RequireArray).toList(); // may throw
+        if (items.isEmpty())
+            throw InvalidRequest("Empty batch");
+        if (maxBatchItems > 0 && items.size() > maxBatchItems)
+            throw InvalidRequest(QString("Batch too large (the limit is %1 items)").arg(maxBatchItems));
+        if (nUnansweredRequests() + items.size() > MAX_UNANSWERED_REQUESTS)
+            throw InvalidRequest(QString("Too many unanswered requests (the limit is %1)").arg(MAX_UNANSWERED_REQUESTS));
+        ++nBatchRequestsReceived;
+        nBatchRequestItemsReceived += quint64(items.size());
+        auto batch = std::make_shared<PendingBatch>();
+        batch->replies.resize(items.size());
+        pendingBatches.push_back(batch);
+        // Hold an extra outstanding count while dispatching, so that items which are answered synchronously from
+        // within gotMessage() can't cause the batch to be written out before all of its items have been dispatched.
+        batch->nOutstanding = 1;
+        for (int i = 0; i < items.size(); ++i) {
+            Message::Id msgId;
+            bool registered = false;
+            try {
+                if (QMetaType::Type(items[i].type()) != QMetaType::QVariantMap)
+                    throw InvalidRequest("Batch item is not a JSON object");
+                Message message = Message::fromJsonData(items[i].toMap(), &msgId, v1); // may throw
+                if (message.isNotif()) {
+                    dispatchMessage(message); // notifications get no reply
+                    continue;
+                }
+                if (!message.isRequest())
+                    throw InvalidRequest("Batch item is not a request");
+                // we can only route a reply back to its slot by id, so ids must be present and unique
+                if (message.id.isNull())
+                    throw InvalidRequest("Batch request id may not be null");
+                if (batchReplySlots.contains(message.id))
+                    throw InvalidRequest(QString("Duplicate request id: %1").arg(message.id.toString()));
+                batchReplySlots.insert(message.id, {batch, i});
+                ++batch->nOutstanding;
+                registered = true;
+                dispatchMessage(message); // may throw
+            } catch (const Exception &e) {
+                const QByteArray reply = Message::makeError(errorCodeForException(e), QString(e.what()).left(120),
+                                                            msgId, v1).toJsonUtf8();
+                ++nErrorsSent;
+                if (registered && batchReplySlots.contains(msgId)) {
+                    batchReplySlots.remove(msgId);
+                    --batch->nOutstanding;
+                }
+                batch->replies[i] = reply;
+                emit peerError(id, lastPeerError=e.what());
+            }
+        }
+        if (--batch->nOutstanding == 0)
+            flushBatch(*batch); // everything was answered synchronously (or was an error or notification)
+    }
+
     void ConnectionBase::processJson(const QByteArray &json)
     {
         if (ignoreNewIncomingMessages) {
@@ -365,105 +670,30 @@ namespace RPC {
         }
         Message::Id msgId;
         try {
-            Message message = Message::fromUtf8(json, &msgId, v1); // may throw
-
-            static const auto ValidateParams = [](const Message &msg, const Method &m) {
-                if (!msg.hasParams()) {
-                    if ( (m.opt_kwParams.has_value() && !m.opt_kwParams->isEmpty())
-                         || (m.opt_nPosParams.has_value() && m.opt_nPosParams->first != 0) )
-                        throw InvalidParameters("Missing required params");
-                } else if (msg.isParamsList()) {
-                    // positional args specified
-                    if (!m.opt_nPosParams.has_value())
-                        throw InvalidParameters("Postional params are not supported for this method");
-                    const unsigned num = unsigned(msg.paramsList().count());
-                    auto [minParams, maxParams] = *m.opt_nPosParams;
-                    if (maxParams < minParams) maxParams = minParams;
-                    if (num < minParams)
-                        throw InvalidParameters(QString("Expected at least %1 %2 for %3, got %4 instead")
-                                                .arg(minParams).arg(Util::Pluralize("parameter", minParams))
-                                                .arg(m.method).arg(num));
-                    if (num > maxParams)
-                        throw InvalidParameters(QString("Expected at most %1 %2 for %3, got %4 instead")
-                                                .arg(maxParams).arg(Util::Pluralize("parameter", maxParams))
-                                                .arg(m.method).arg(num));
-                } else if (msg.isParamsMap()) {
-                    // named args specified
-                    if (!m.opt_kwParams.has_value())
-                        throw InvalidParameters("Named params are not supported for this method");
-                    const auto nameset =
- #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-                            KeySet::fromList(msg.paramsMap().keys()); // TODO: this is not the most efficient -- for now this isn't used except for AdminServer, so it's fine.
- #else
-                            Util::toCont<KeySet>(msg.paramsMap().keys());
- #endif
-                    const auto & kwSet = *m.opt_kwParams;
-                    if (m.allowUnknownNamedParams) {
-                        if (!(kwSet - nameset).isEmpty())
-                            throw InvalidParameters("Required parameters missing");
-                    } else {
-                        if (nameset != kwSet)
-                            throw InvalidParameters("Unknown or missing parameters");
-                    }
-                }
-            };
-
-            if (message.isError()) {
-                // error message
-                ++nErrorReplies;
-                // don't leak the request -- an error response is an answer! Remove from map.
-                message.method = idMethodMap.take(message.id);
-                if (!message.id.isNull() && message.method.isEmpty())
-                    // Hmm. Error with no corresponding request id.. log that fact to debug log
-                    DebugM("Got unexpected error reply for id: ", message.id);
-                emit gotErrorMessage(id, message);
-            } else if (message.isNotif()) {
-                try {
-                    const auto it = methods.find(message.method);
-                    if (it == methods.end())
-                        throw UnknownMethod("Unknown method");
-                    const Method & m = it.value();
-                    if (m.allowsNotifications) {
-                        ValidateParams(message, m);
-                        emit gotMessage(id, message);
-                    } else {
-                        throw Exception(QString("Ignoring unexpected notification"));
-                    }
-                } catch (const Exception & e) {
-                    // Note: we emit peerError here so that the tally of number of errors goes up and we eventually disconnect the offending peer.
-                    // This should not cause an error message to be sent to the peer.
-                    emit peerError(this->id, lastPeerError=QString("Error processing notification '%1' from %2: %3").arg(message.method, prettyName(), e.what()));
+            if (acceptBatchReplies && looksLikeJsonArray(json)) {
+                // batch reply: a JSON array of response/error objects, one for each request in a batch we sent
+                const QVariantList items = Json::parseUtf8(json, Json::ParseOption::RequireArray).toList(); // may throw
+                if (items.isEmpty())
+                    throw InvalidRequest("Empty batch reply");
+                ++nBatchRepliesReceived;
+                for (const auto & item : items) {
+                    if (QMetaType::Type(item.type()) != QMetaType::QVariantMap)
+                        throw InvalidRequest("Batch reply item is not a JSON object");
+                    Message message = Message::fromJsonData(item.toMap(), &msgId, v1); // may throw
+                    if (!message.isResponse() && !message.isError())
+                        throw InvalidRequest("Batch reply item is not a response");
+                    dispatchMessage(message); // may throw
                 }
-            } else if (message.isRequest()) {
-                const auto it = methods.find(message.method);
-                const Method *m = it != methods.end() ? &it.value() : nullptr;
-                if (!m || !m->allowsRequests)
-                    throw UnknownMethod(QString("Unsupported request: %1").arg(message.method));
-                ValidateParams(message, *m);
-                emit gotMessage(id, message);
-            } else if (message.isResponse()) {
-                QString meth = idMethodMap.take(message.id);
-                if (meth.isEmpty()) {
-                    throw BadPeer(QString("Unexpected response (id: %1)").arg(message.id.toString()));
-                }
-                message.method = meth;
-                emit gotMessage(id, message);
+            } else if (acceptBatchRequests && looksLikeJsonArray(json)) {
+                // batch request: a JSON array of request (or notification) objects
+                processBatchRequest(json); // may throw
             } else {
-                // Not a Request and not a Response or Notification or Error. Not JSON-RPC 2.0.
-                throw InvalidRequest("Invalid JSON");
+                Message message = Message::fromUtf8(json, &msgId, v1); // may throw
+                dispatchMessage(message); // may throw
             }
             lastGood = Util::getTime(); // update "lastGood" as this is used to determine if stale or not.
         } catch (const Exception &e) {
-            // TODO: clean this up. It's rather inelegant. :/
-            const bool wasJsonParse = dynamic_cast<const Json::ParseError *>(&e);
-            const bool wasUnk = dynamic_cast<const UnknownMethod *>(&e);
-            const bool wasInv = dynamic_cast<const InvalidRequest *>(&e) || dynamic_cast<const InvalidError *>(&e);
-            const bool wasInvParms = dynamic_cast<const InvalidParameters *>(&e);
-            int code = Code_Custom;
-            if (wasJsonParse) code = Code_ParseError;
-            else if (wasInvParms) code = Code_InvalidParams;
-            else if (wasUnk) code = Code_MethodNotFound;
-            else if (wasInv) code = Code_InvalidRequest;
+            const int code = errorCodeForException(e);
             bool doDisconnect = errorPolicy & ErrorPolicyDisconnect;
             if (errorPolicy & ErrorPolicySendErrorMessage) {
                 emit sendError(doDisconnect, code, QString(e.what()).left(120), msgId);
@@ -648,9 +878,14 @@ namespace RPC {
         QString statusMsg;
         QString contentType;
         int contentLength = 0;
-        QByteArray content = "";
+        /// Sized to contentLength when we enter READING_CONTENT; the body is read straight into it, with no
+        /// intermediate buffers or reallocations (this matters for multi-megabyte blocks).
+        QByteArray content;
+        int nContentRead = 0;
+        Message::Id restId; ///< if not null, this reply is to a REST request (see sendRestGet) rather than to JSON-RPC
         bool logBad = false;
         bool gotLength = false;
+        bool isRest() const { return !restId.isNull(); }
         void clear() { *this = StateMachine(); }
     };
     void HttpConnection::on_readyRead()
@@ -672,6 +907,11 @@ namespace RPC {
                 data = data.simplified();
                 TraceM(__func__, " Got: ", data);
                 if (sm->state == St::BEGIN) {
+                    // figure out which request this reply is for: JSON-RPC (null id), or REST
+                    if (!pendingReplies.empty()) {
+                        sm->restId = pendingReplies.front();
+                        pendingReplies.pop_front();
+                    }
                     // read "HTTP/1.1 200 OK" line
                     auto toks = data.split(' ');
                     if (toks.size() < 3) {
@@ -688,7 +928,7 @@ namespace RPC {
                         // ERROR here, expected integer code
                         throw Exception(QString("Could not parse status code: %1").arg(QString(code)));
                     }
-                    if (sm->status != 200 && sm->status != 500) { // bitcoind sends 200 on results= and 500 on error= RPC messages. Everything else is unexpected.
+                    if (sm->status != 200 && sm->status != 500 && !sm->isRest()) { // bitcoind sends 200 on results= and 500 on error= RPC messages. Everything else is unexpected. (REST errors are passed on to the requester.)
                         Warning() << "Got HTTP status " << sm->status << " " << msg
                                   << (!Trace::isEnabled() ? "; will log the rest of this HTTP response" : "");
                         sm->logBad = true;
@@ -717,7 +957,7 @@ namespace RPC {
                                                 s_close("close"), s_keep_alive("keep-alive");
                         if (name == s_content_type) {
                             sm->contentType = QString::fromUtf8(value);
-                            if (sm->contentType.compare(s_application_json, Qt::CaseInsensitive) != 0) {
+                            if (!sm->isRest() && sm->contentType.compare(s_application_json, Qt::CaseInsensitive) != 0) {
                                 Warning() << "Got unexpected content type: " << sm->contentType << (!Trace::isEnabled() ? "; will log the rest of this HTTP response" : "");
                                 sm->logBad = true;
                             }
@@ -748,40 +988,47 @@ namespace RPC {
                     } else {
                         // caught EMPTY line -- this signifies end of header
                         // empty line, advance state
-                        if (sm->contentType.isEmpty() || !sm->gotLength) { // enforce server must send us both content-type and content-length, otherwise throw
+                        // enforce server must send us both content-type and content-length, otherwise throw. (bitcoind
+                        // omits content-type on some REST errors e.g. the 404 it sends if -rest is off, so for REST
+                        // replies we only require content-length.)
+                        if ((sm->contentType.isEmpty() && !sm->isRest()) || !sm->gotLength) {
                             // this is an error condition
                             throw Exception("Premature header end; did not receive BOTH content-type and content-length");
                         }
+                        sm->content.resize(sm->contentLength); // may throw bad_alloc; contentLength <= MAX_BUFFER
                         sm->state = St::READING_CONTENT;
                     }
                 } // end if state == St::HEADER
             } // end while
-            while (sm->state == St::READING_CONTENT && socket->bytesAvailable() > 0 && sm->content.length() < sm->contentLength ) {
-                // state READING_CONTENT is not linefeed based but expects sm->contentLenght bytes. read at most that many bytes.
-                const qint64 n2read = qMin(socket->bytesAvailable(), qint64(sm->contentLength - sm->content.length()));
-                if (QByteArray buf = socket->read(n2read); !buf.isEmpty()) {
-                    nReceived += buf.size();
-                    sm->content += buf;
+            while (sm->state == St::READING_CONTENT && socket->bytesAvailable() > 0 && sm->nContentRead < sm->contentLength ) {
+                // state READING_CONTENT is not linefeed based but expects sm->contentLenght bytes. read at most that
+                // many bytes, directly into the (pre-sized) content buffer.
+                const qint64 n2read = qMin(socket->bytesAvailable(), qint64(sm->contentLength - sm->nContentRead));
+                if (const qint64 n = socket->read(sm->content.data() + sm->nContentRead, n2read); n > 0) {
+                    nReceived += quint64(n);
+                    sm->nContentRead += int(n);
                 } else {
                     // read 0 bytes, but bytesAvailable was >0, must mean there was some sort of error
                     throw Exception("Read 0 bytes from socket");
                 }
             }
-            if (sm->state == St::READING_CONTENT && sm->content.length() >= sm->contentLength) {
+            if (sm->state == St::READING_CONTENT && sm->nContentRead >= sm->contentLength) {
                 // got a full content packet!
-                const QByteArray json = sm->content;
-                if (sm->content.length() > sm->contentLength) {
-                    // this shouldn't happen. if we get here, likely below code will fail with nonsense and connection will be killed. this is here
-                    // just as a sanity check.
-                    Error() << "Content buffer has extra stuff at the end. Bug in code. FIXME! Crud was: '"
-                            << sm->content.mid(sm->contentLength) << "'";
+                const QByteArray content = std::move(sm->content);
+                const auto restId = sm->restId;
+                const int httpStatus = sm->status;
+                const QString statusMsg = sm->statusMsg;
+                if (restId.isNull()) {
+                    if (bool trace = Trace::isEnabled(); sm->logBad && !trace)
+                        Warning() << sm->status << " (content): " << content.trimmed();
+                    else if (trace)
+                        Trace() << "cl: " << sm->contentLength << " inbound JSON: " << content.trimmed();
                 }
-                if (bool trace = Trace::isEnabled(); sm->logBad && !trace)
-                    Warning() << sm->status << " (content): " << json.trimmed();
-                else if (trace)
-                    Trace() << "cl: " << sm->contentLength << " inbound JSON: " << json.trimmed();
                 sm->clear(); // reset back to BEGIN state, empty buffers, clean slate.
-                processJson(json);
+                if (restId.isNull())
+                    processJson(content);
+                else
+                    processRestReply(restId, httpStatus, statusMsg, content);
                 // If bytesAvailable .. schedule a callback to this function again since we did a partial read just now,
                 // and the socket's buffers still have data.
                 if (auto avail = socket->bytesAvailable(); avail > 0 && avail <= MAX_BUFFER) {
@@ -810,6 +1057,7 @@ namespace RPC {
         static const QByteArray AUTH("Authorization: Basic ");
         static const QByteArray CONTENT_TYPE("Content-Type: application/json-rpc");
         static const QByteArray CONTENT_LENGTH("Content-Length: ");
+        pendingReplies.emplace_back(); // every request we send gets exactly one reply; null id = JSON-RPC
         const QByteArray suffix = !data.endsWith(SLASHN) ? NL : EMPTY;
         const bool addHost = !header.host.isEmpty(),
                    addAuth = !header.authCookie.isEmpty();
@@ -872,8 +1120,433 @@ namespace RPC {
             header.host = trimmed.toUtf8();
     }
 
+    void HttpConnection::on_connected()
+    {
+        ConnectionBase::on_connected();
+        // start with a clean slate on the new socket
+        pendingReplies.clear();
+        if (sm) sm->clear();
+        // connection will be auto-disconnected on socket disconnect
+        connectedConns.push_back(connect(this, &HttpConnection::sendRestGet, this, &HttpConnection::_sendRestGet));
+    }
+
+    void HttpConnection::on_disconnected()
+    {
+        ConnectionBase::on_disconnected();
+        pendingReplies.clear();
+        if (sm) sm->clear();
+    }
+
+    auto HttpConnection::stats() const -> Stats
+    {
+        auto m = ConnectionBase::stats().toMap();
+        if (nRestRequestsSent) {
+            m["nRestRequestsSent"] = nRestRequestsSent;
+            m["nRestBytesReceived"] = nRestBytesReceived;
+        }
+        return m;
+    }
+
+    void HttpConnection::_sendRestGet(const Message::Id & reqid, const QString & path)
+    {
+        if (status != Connected || !socket) {
+            DebugM(__func__, " path: ", path, "; Not connected! ", "(id: ", this->id, "), forcing on_disconnect ...");
+            // the below ensures socket cleanup code runs.  This guarantees a disconnect & cleanup on bad socket state.
+            do_disconnect();
+            return;
+        }
+        if (reqid.isNull() || !path.startsWith('/')) {
+            Error() << __func__ << " path: " << path << "; Bad arguments! FIXME!";
+            return;
+        }
+        if (pendingReplies.size() >= size_t(MAX_UNANSWERED_REQUESTS)) {  // prevent memory leaks in case of misbehaving peer
+            Warning() << "Closing connection because too many unanswered requests for: " << prettyName();
+            do_disconnect();
+            return;
+        }
+        static const QByteArray NL("\r\n"), GET("GET "), HTTP11(" HTTP/1.1"), HOST("Host: "),
+                                AUTH("Authorization: Basic ");
+        QByteArray payload;
+        payload.reserve(256);
+        payload += GET; payload += path.toUtf8(); payload += HTTP11; payload += NL;
+        if (!header.host.isEmpty()) {
+            payload += HOST; payload += header.host; payload += NL;
+        }
+        if (!header.authCookie.isEmpty()) {
+            // bitcoind's REST interface doesn't need this, but it doesn't hurt and other implementations may want it
+            payload += AUTH; payload += header.authCookie; payload += NL;
+        }
+        payload += NL;
+        pendingReplies.push_back(reqid);
+        TraceM("Sending REST request: ", path);
+        ++nRestRequestsSent;
+        // below send() ends up calling do_write immediately (which is connected to send)
+        emit send(payload);
+    }
+
+    void HttpConnection::processRestReply(const Message::Id & reqid, int httpStatus, const QString & statusMsg,
+                                          const QByteArray & body)
+    {
+        lastGood = Util::getTime(); // update "lastGood" as this is used to determine if stale or not.
+        nRestBytesReceived += quint64(body.size());
+        if (httpStatus == 200) {
+            Message msg = Message::makeResponse(reqid, body, v1);
+            msg.method = QStringLiteral("rest");
+            emit gotMessage(id, msg);
+        } else {
+            // bitcoind sends a short text/plain explanation with most REST errors; use it if it's there
+            QString errMsg = QString::fromUtf8(body).trimmed();
+            if (errMsg.isEmpty())
+                errMsg = statusMsg;
+            Message msg = Message::makeError(httpStatus, errMsg, reqid, v1);
+            msg.method = QStringLiteral("rest");
+            ++nErrorReplies;
+            emit gotErrorMessage(id, msg);
+        }
+    }
+
 } // end namespace RPC
 
+#ifdef ENABLE_TESTS
+#include "App.h"
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTcpServer>
+#include <QTimer>
+
+#include <functional>
+#include <tuple>
+#include <vector>
+
+namespace {
+    /// A server-side connection like Server's Client, wrapping an already-connected socket.
+    class TestConn : public RPC::ElectrumConnection {
+    public:
+        TestConn(const RPC::MethodMap & mm, QTcpSocket *sock, int maxBatch) : RPC::ElectrumConnection(mm, 1) {
+            socket = sock;
+            sock->setParent(this);
+            status = Connected;
+            errorPolicy = ErrorPolicySendErrorMessage;
+            acceptBatchRequests = true;
+            maxBatchItems = maxBatch;
+            on_connected();
+        }
+        int unanswered() const { return nUnansweredRequests(); }
+    };
+
+    /// Loopback test of JSON-RPC 2.0 batch requests: item dispatch, reply slot filling, flushing as a single array,
+    /// the per-batch item limit, and holding back notifications until the batch replies they follow are written.
+    void testBatch()
+    {
+        QTcpServer server;
+        if (!server.listen(QHostAddress::LocalHost, 0))
+            throw Exception("failed to listen: " + server.errorString());
+        QTcpSocket peer;
+        peer.connectToHost(QHostAddress::LocalHost, server.serverPort());
+        {
+            QEventLoop loop;
+            QObject::connect(&server, &QTcpServer::newConnection, &loop, &QEventLoop::quit);
+            QTimer::singleShot(5000, &loop, &QEventLoop::quit); // timeout
+            if (!server.hasPendingConnections())
+                loop.exec();
+        }
+        QTcpSocket *sock = server.nextPendingConnection();
+        if (!sock)
+            throw Exception("failed to accept loopback connection");
+
+        RPC::MethodMap methods;
+        methods["echo"] = RPC::Method{"echo", true, false};
+        methods["later"] = RPC::Method{"later", true, false};
+        methods["notif"] = RPC::Method{"notif", false, true};
+        constexpr int maxBatch = 4;
+        auto *conn = new TestConn(methods, sock, maxBatch);
+        Defer delConn([conn]{ delete conn; });
+        int nNotifsReceived = 0;
+        QObject::connect(conn, &RPC::ConnectionBase::gotMessage, conn, [conn, &nNotifsReceived](IdMixin::Id, const RPC::Message &m) {
+            if (m.method == "echo")
+                emit conn->sendResult(m.id, m.paramsList());
+            else if (m.method == "later") {
+                // answered asynchronously, and sends a notification right before the reply (as a subscribe would)
+                QTimer::singleShot(20, conn, [conn, reqId = m.id] {
+                    emit conn->sendNotification("note", QVariantList{reqId.toString()});
+                    emit conn->sendResult(reqId, "late");
+                });
+            } else if (m.method == "notif")
+                ++nNotifsReceived;
+        });
+
+        QList<QByteArray> lines;
+        const auto Transact = [&](const QByteArray &request, int nLines) {
+            lines.clear();
+            peer.write(request + "\n");
+            QEventLoop loop;
+            QTimer timeout;
+            QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+            QObject::connect(&peer, &QTcpSocket::readyRead, &loop, [&] {
+                while (peer.canReadLine())
+                    lines.push_back(peer.readLine().trimmed());
+                if (lines.size() >= nLines)
+                    loop.quit();
+            });
+            timeout.start(5000);
+            loop.exec();
+            QObject::disconnect(&peer, &QTcpSocket::readyRead, &loop, nullptr);
+            if (lines.size() != nLines)
+                throw Exception(QString("expected %1 reply lines to %2, got %3").arg(nLines).arg(QString(request)).arg(lines.size()));
+        };
+        const auto Parse = [](const QByteArray &line) { return Json::parseUtf8(line, Json::ParseOption::AcceptAnyValue); };
+        const auto Ids = [](const QVariantList &replies) {
+            QStringList ret;
+            for (const auto & r : replies)
+                ret.push_back(r.toMap().value("id").toString());
+            return ret;
+        };
+        const auto Check = [](bool ok, const char *what) { if (!ok) throw Exception(QString("batch test failed: %1").arg(what)); };
+
+        // 1. synchronously answered items plus a notification: one array, in item order, no slot for the notification
+        Transact(R"([{"jsonrpc":"2.0","method":"echo","params":[1],"id":1},)"
+                 R"({"jsonrpc":"2.0","method":"notif","params":[]},)"
+                 R"({"jsonrpc":"2.0","method":"echo","params":[2],"id":"two"}])", 1);
+        {
+            const auto replies = Parse(lines[0]).toList();
+            Check(replies.size() == 2 && Ids(replies) == QStringList{"1", "two"}, "sync batch ids");
+            Check(replies[1].toMap().value("result").toList() == QVariantList{2}, "sync batch result");
+            Check(nNotifsReceived == 1, "batch notification dispatched");
+            Check(conn->unanswered() == 0, "sync batch slots released");
+        }
+        // 2. bad items get error replies in their own slots; the rest of the batch is still answered
+        //    (id 1 is still unanswered when its duplicate is dispatched, since "later" answers asynchronously)
+        Transact(R"([{"jsonrpc":"2.0","method":"later","params":[],"id":1},5,)"
+                 R"({"jsonrpc":"2.0","method":"nosuch","params":[],"id":3},)"
+                 R"({"jsonrpc":"2.0","method":"echo","params":[],"id":1}])", 2);
+        {
+            const auto replies = Parse(lines[0]).toList();
+            Check(replies.size() == 4, "bad items batch size");
+            Check(replies[0].toMap().value("result").toString() == "late", "good item answered");
+            Check(replies[1].toMap().contains("error") && replies[1].toMap().value("id").isNull(), "non-object item error");
+            Check(replies[2].toMap().contains("error") && Ids(replies)[2] == "3", "unknown method error");
+            Check(replies[3].toMap().contains("error"), "duplicate id error");
+        }
+        // 3. asynchronously answered items: the batch waits for the last reply, and a notification sent while the
+        //    batch was pending is held back until after the batch reply
+        Transact(R"([{"jsonrpc":"2.0","method":"later","params":[],"id":10},)"
+                 R"({"jsonrpc":"2.0","method":"echo","params":[],"id":11}])", 2);
+        {
+            const auto replies = Parse(lines[0]).toList();
+            Check(replies.size() == 2 && Ids(replies) == QStringList{"10", "11"}, "async batch ids");
+            Check(replies[0].toMap().value("result").toString() == "late", "async batch result");
+            const auto notif = Parse(lines[1]).toMap();
+            Check(notif.value("method").toString() == "note" && !notif.contains("id"), "held notification follows batch");
+            Check(conn->unanswered() == 0, "async batch slots released");
+        }
+        // 4. a batch over the item limit is rejected with one error, and the connection stays up
+        Transact(R"([{"jsonrpc":"2.0","method":"echo","params":[],"id":1},{"jsonrpc":"2.0","method":"echo","params":[],"id":2},)"
+                 R"({"jsonrpc":"2.0","method":"echo","params":[],"id":3},{"jsonrpc":"2.0","method":"echo","params":[],"id":4},)"
+                 R"({"jsonrpc":"2.0","method":"echo","params":[],"id":5}])", 1);
+        {
+            const auto err = Parse(lines[0]).toMap();
+            Check(err.contains("error") && err.value("id").isNull(), "oversized batch single error");
+            Check(conn->isGood(), "connection survives oversized batch");
+        }
+        // 5. a plain (non-batch) request and notification are unaffected
+        Transact(R"({"jsonrpc":"2.0","method":"echo","params":[7],"id":99})", 1);
+        Check(Parse(lines[0]).toMap().value("result").toList() == QVariantList{7}, "non-batch request");
+
+        Log() << "batch test passed";
+    }
+
+    const auto test_ = App::registerTest("rpcbatch", &testBatch);
+
+    /// Message::fromUtf8 validation of the keys in a JSON-RPC object, with and without the (optional, in practice)
+    /// "jsonrpc" key.
+    void testMessage()
+    {
+        enum class Kind { Request, Notif, Response, Error, Invalid };
+        const std::vector<std::tuple<QByteArray, Kind, bool>> cases = { // json, expected kind, v1
+            {R"({"jsonrpc":"2.0","method":"m","params":[1],"id":1})", Kind::Request, false},
+            {R"({"method":"m","params":[1],"id":1})", Kind::Request, false},
+            {R"({"jsonrpc":"2.0","method":"m","id":"x"})", Kind::Request, false},
+            {R"({"method":"m","id":"x"})", Kind::Request, false},
+            {R"({"jsonrpc":"2.0","method":"m","params":{"a":1}})", Kind::Notif, false},
+            {R"({"method":"m","params":[]})", Kind::Notif, false},
+            {R"({"jsonrpc":"2.0","method":"m"})", Kind::Notif, false},
+            {R"({"method":"m"})", Kind::Notif, false},
+            {R"({"jsonrpc":"2.0","result":1,"id":1})", Kind::Response, false},
+            {R"({"result":null,"id":1})", Kind::Response, false},
+            {R"({"jsonrpc":"2.0","error":{"code":-32600,"message":"x"},"id":1})", Kind::Error, false},
+            {R"({"error":{"code":1,"message":"x","data":[2]},"id":null})", Kind::Error, false},
+            // an extra key, whether or not "jsonrpc" is there to make up the count
+            {R"({"jsonrpc":"2.0","method":"m","params":[],"id":1,"x":1})", Kind::Invalid, false},
+            {R"({"method":"m","params":[],"id":1,"x":1})", Kind::Invalid, false},
+            {R"({"method":"m","id":1,"x":1})", Kind::Invalid, false},
+            {R"({"method":"m","x":1})", Kind::Invalid, false},
+            {R"({"result":1,"id":1,"x":1})", Kind::Invalid, false},
+            {R"({"error":{"code":1,"message":"x"},"id":1,"x":1})", Kind::Invalid, false},
+            {R"({"error":{"code":1,"message":"x"},"result":1})", Kind::Invalid, false},
+            {R"({"error":{"code":1,"message":"x","x":1},"id":1})", Kind::Invalid, false},
+            {R"({"error":{"code":1.5,"message":"x"},"id":1})", Kind::Invalid, false},
+            {R"({"error":{"code":1},"id":1})", Kind::Invalid, false},
+            {R"({"jsonrpc":"1.0","method":"m","id":1})", Kind::Invalid, false},
+            {R"({"jsonrpc":"","method":"m","id":1})", Kind::Invalid, false},
+            {R"({"method":"rpc.m","id":1})", Kind::Invalid, false},
+            {R"({"id":1})", Kind::Invalid, false},
+            // v1 doesn't care about extra keys, nor about "jsonrpc"
+            {R"({"method":"m","params":[],"id":1,"x":1})", Kind::Request, true},
+            {R"({"jsonrpc":"1.0","result":1,"error":null,"id":1})", Kind::Response, true},
+        };
+        for (const auto & [json, kind, v1] : cases) {
+            const auto Fail = [&json = json](const QString &what) {
+                throw Exception(QString("%1: %2").arg(QString(json), what));
+            };
+            RPC::Message m;
+            try {
+                m = RPC::Message::fromUtf8(json, nullptr, v1);
+            } catch (const RPC::InvalidError &e) {
+                if (kind != Kind::Invalid) Fail(QString("unexpectedly rejected (%1)").arg(e.what()));
+                continue;
+            }
+            if (kind == Kind::Invalid) Fail("unexpectedly accepted");
+            const Kind got = m.isRequest() ? Kind::Request : m.isNotif() ? Kind::Notif : m.isResponse() ? Kind::Response : m.isError() ? Kind::Error : Kind::Invalid;
+            if (got != kind) Fail(QString("parsed as kind %1, expected %2").arg(int(got)).arg(int(kind)));
+            if (!json.contains("jsonrpc") && m.data.contains(RPC::Message::s_jsonrpc))
+                Fail("\"jsonrpc\" was added to the message data");
+        }
+        Log() << "rpcmessage: " << cases.size() << " cases; test passed";
+    }
+    const auto test2_ = App::registerTest("rpcmessage", &testMessage);
+
+    /// A client-side HttpConnection wrapping an already-connected socket, set up like BitcoinD.
+    class TestHttpConn : public RPC::HttpConnection {
+    public:
+        explicit TestHttpConn(QTcpSocket *sock) : RPC::HttpConnection(RPC::MethodMap{}, 2) {
+            socket = sock;
+            sock->setParent(this);
+            status = Connected;
+            setV1(true); // bitcoind uses jsonrpc v1
+            on_connected();
+        }
+    };
+
+    /// Loopback test of REST GETs pipelined with JSON-RPC requests on one HttpConnection, against canned bitcoind
+    /// replies: each reply goes to the request it answers (HTTP/1.1 replies arrive in request order), binary bodies
+    /// come through intact, and a REST error goes to gotErrorMessage with the HTTP status as its code, leaving the
+    /// connection usable.
+    void testRest()
+    {
+        const auto Check = [](bool ok, const char *what) { if (!ok) throw Exception(QString("rpcrest: check failed: %1").arg(what)); };
+        // Runs the event loop until `done` returns true, or until 5 seconds have passed
+        const auto WaitFor = [](const std::function<bool()> &done) {
+            QElapsedTimer t;
+            t.start();
+            while (!done() && t.elapsed() < 5000)
+                QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            return done();
+        };
+
+        QTcpServer server;
+        if (!server.listen(QHostAddress::LocalHost, 0))
+            throw Exception("failed to listen: " + server.errorString());
+        auto *sock = new QTcpSocket(&server);
+        sock->connectToHost(QHostAddress::LocalHost, server.serverPort());
+        if (!sock->waitForConnected(5000) || (!server.hasPendingConnections() && !server.waitForNewConnection(5000)))
+            throw Exception("failed to make a loopback connection");
+        QTcpSocket *bitcoind = server.nextPendingConnection(); // owned by `server`
+        auto *conn = new TestHttpConn(sock); // takes ownership of `sock`
+        Defer delConn([conn]{ delete conn; });
+
+        struct Reply {
+            RPC::Message::Id id;
+            QString method;
+            bool ok = false;
+            QVariant result;
+            int errorCode = 0;
+            QString errorMessage;
+        };
+        std::vector<Reply> replies;
+        QObject::connect(conn, &RPC::ConnectionBase::gotMessage, conn, [&replies](IdMixin::Id, const RPC::Message &m) {
+            replies.push_back(Reply{m.id, m.method, true, m.result(), 0, {}});
+        });
+        QObject::connect(conn, &RPC::ConnectionBase::gotErrorMessage, conn, [&replies](IdMixin::Id, const RPC::Message &m) {
+            replies.push_back(Reply{m.id, m.method, false, {}, m.errorCode(), m.errorMessage()});
+        });
+
+        // the fake bitcoind: reads whole HTTP requests, and answers with canned replies
+        QByteArray inbuf;
+        const auto ReadRequests = [&](int n) {
+            QStringList ret; // the request lines
+            WaitFor([&] {
+                inbuf += bitcoind->readAll();
+                for (int hdrEnd; (hdrEnd = inbuf.indexOf("\r\n\r\n")) >= 0; ) {
+                    const auto lines = inbuf.left(hdrEnd).split('\n');
+                    int contentLength = 0;
+                    for (const auto & line : lines)
+                        if (line.toLower().startsWith("content-length:"))
+                            contentLength = line.mid(15).trimmed().toInt();
+                    if (inbuf.size() < hdrEnd + 4 + contentLength)
+                        break;
+                    ret.push_back(QString::fromUtf8(lines.front().trimmed()));
+                    inbuf.remove(0, hdrEnd + 4 + contentLength);
+                }
+                return ret.size() >= n;
+            });
+            return ret;
+        };
+        const auto HttpReply = [](const QByteArray &status, const QByteArray &contentType, const QByteArray &body) {
+            QByteArray ret = "HTTP/1.1 " + status + "\r\n";
+            if (!contentType.isEmpty())
+                ret += "Content-Type: " + contentType + "\r\n";
+            ret += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+            return ret;
+        };
+
+        // 1. REST, JSON-RPC, REST (404), REST, all written before any reply arrives; the replies are then sent back to
+        //    back, with binary bodies that look like HTTP, and a body bigger than what one read returns
+        const QByteArray bodyA = QByteArray("\0\x01", 2) + "\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n" + QByteArray(1, '\xff');
+        QByteArray bodyD(1'000'000, Qt::Uninitialized);
+        for (int i = 0; i < bodyD.size(); ++i)
+            bodyD[i] = char((i * 7) ^ (i >> 8));
+        const RPC::Message::Id idA(int64_t(1)), idB(int64_t(2)), idC(int64_t(3)), idD(int64_t(4));
+        emit conn->sendRestGet(idA, "/rest/block/a.bin");
+        emit conn->sendRequest(idB, "getblockcount");
+        emit conn->sendRestGet(idC, "/rest/block/c.bin");
+        emit conn->sendRestGet(idD, "/rest/block/d.bin");
+        Check(ReadRequests(4) == QStringList{"GET /rest/block/a.bin HTTP/1.1", "POST / HTTP/1.1",
+                                             "GET /rest/block/c.bin HTTP/1.1", "GET /rest/block/d.bin HTTP/1.1"},
+              "requests written in order");
+        bitcoind->write(HttpReply("200 OK", "application/octet-stream", bodyA)
+                        + HttpReply("200 OK", "application/json", R"({"result":123,"error":null,"id":2})" "\n")
+                        + HttpReply("404 Not Found", "text/plain", "c not found\r\n")
+                        + HttpReply("200 OK", "application/octet-stream", bodyD));
+        Check(WaitFor([&]{ return replies.size() >= 4; }) && replies.size() == 4, "all four replies delivered");
+        Check(replies[0].id == idA && replies[0].ok && replies[0].method == "rest" && replies[0].result.toByteArray() == bodyA,
+              "binary REST reply");
+        Check(replies[1].id == idB && replies[1].ok && replies[1].method == "getblockcount" && replies[1].result.toInt() == 123,
+              "JSON-RPC reply between REST replies");
+        Check(replies[2].id == idC && !replies[2].ok && replies[2].errorCode == 404 && replies[2].errorMessage == "c not found",
+              "REST error reply");
+        Check(replies[3].id == idD && replies[3].ok && replies[3].result.toByteArray() == bodyD, "large REST reply");
+
+        // 2. a 404 with no body and no content type (bitcoind started without -rest), then JSON-RPC still works
+        replies.clear();
+        const RPC::Message::Id idE(int64_t(5)), idF(int64_t(6));
+        emit conn->sendRestGet(idE, "/rest/headers/1/e.bin");
+        emit conn->sendRequest(idF, "getblockcount");
+        Check(ReadRequests(2).size() == 2, "second round of requests");
+        bitcoind->write(HttpReply("404 Not Found", {}, {})
+                        + HttpReply("200 OK", "application/json", R"({"result":124,"error":null,"id":6})" "\n"));
+        Check(WaitFor([&]{ return replies.size() >= 2; }) && replies.size() == 2, "both replies delivered");
+        Check(replies[0].id == idE && !replies[0].ok && replies[0].errorCode == 404 && replies[0].errorMessage == "Not Found",
+              "empty REST error reply");
+        Check(replies[1].id == idF && replies[1].ok && replies[1].result.toInt() == 124, "JSON-RPC reply after a REST error");
+        Check(conn->isGood(), "connection survives REST errors");
+
+        Log() << "rpcrest: test passed";
+    }
+    const auto test3_ = App::registerTest("rpcrest", &testRest);
+} // namespace
+#endif
+
 #if 0
 // TESTING
 #include <iostream>
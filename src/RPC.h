@@ -28,11 +28,14 @@
 #include <QSet>
 #include <QString>
 #include <QVariant>
+#include <QVector>
 
+#include <deque>
 #include <memory>
 #include <optional>
 #include <utility> // for std::pair
 #include <variant>
+#include <vector>
 
 namespace WebSocket { class Wrapper; } ///< fwd decl
 
@@ -186,6 +189,16 @@ namespace RPC {
         QString jsonRpcVersion() const { return data.value(s_jsonrpc).toString(); }
     };
 
+    /// One request within a JSON-RPC batch. See ConnectionBase::sendRequestBatch.
+    struct BatchItem
+    {
+        Message::Id id;
+        QString method;
+        QVariantList params;
+    };
+    /// A JSON-RPC batch: a list of requests that are sent to the peer as a single JSON array.
+    using Batch = QVector<BatchItem>;
+
 
     using MethodMap = QHash<QString, Method>;
 
@@ -282,6 +295,10 @@ namespace RPC {
     signals:
         /// call (emit) this to send a request to the peer
         void sendRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params = QVariantList());
+        /// call (emit) this to send several requests to the peer as a single JSON array. Each item's reply arrives
+        /// individually via gotMessage() or gotErrorMessage() (in whatever order the peer chose). Only subclasses
+        /// that set acceptBatchReplies = true can parse the resulting array reply.
+        void sendRequestBatch(const RPC::Batch & batch);
         /// call (emit) this to send a notification to the peer
         void sendNotification(const QString &method, const QVariant & params);
         /// call (emit) this to send a request to the peer
@@ -303,6 +320,8 @@ namespace RPC {
         /// Actual implentation that prepares the request. Is connected to sendRequest() above. Runs in this object's
         /// thread context. Eventually calls send() -> do_write() (from superclass).
         virtual void _sendRequest(const RPC::Message::Id & reqid, const QString &method, const QVariantList & params = QVariantList());
+        /// Actual implementation of sendRequestBatch, runs in our thread context.
+        virtual void _sendRequestBatch(const RPC::Batch & batch);
         // ditto for notifications
         virtual void _sendNotification(const QString &method, const QVariant & params);
         /// Actual implementation of sendError, runs in our thread context.
@@ -338,13 +357,69 @@ namespace RPC {
 
         bool v1 = false; // if true, will generate v1 style messages and respond to v1 only
 
+        /// If true, processJson() also accepts a top-level JSON array whose elements are each a response or error
+        /// reply to a request we sent via sendRequestBatch(). Only clients that send batches should set this.
+        bool acceptBatchReplies = false;
+
+        /// If true, processJson() also accepts a top-level JSON array of requests from the peer (a JSON-RPC 2.0 batch).
+        /// Each item is dispatched via gotMessage() as usual, and the replies to all of the items are collected and
+        /// written back to the peer as a single JSON array once the last one has been answered via sendResult() or
+        /// sendError(). Outstanding batched requests count toward MAX_UNANSWERED_REQUESTS. Only server-side
+        /// connections should set this.
+        bool acceptBatchRequests = false;
+        /// If > 0, a batch request with more items than this is rejected as a whole with a single error reply.
+        int maxBatchItems = 0;
+
+        /// The number of requests we are waiting on: ones we sent the peer (idMethodMap) plus batch items the peer
+        /// sent us that are not yet answered. This is what is checked against MAX_UNANSWERED_REQUESTS.
+        int nUnansweredRequests() const { return idMethodMap.size() + batchReplySlots.size(); }
+
         QString lastPeerError;
         quint64 nRequestsSent = 0, nNotificationsSent = 0, nResultsSent = 0, nErrorsSent = 0;
         quint64 nErrorReplies = 0, nUnansweredLifetime = 0;
+        quint64 nBatchesSent = 0, nBatchRepliesReceived = 0;
+        quint64 nBatchRequestsReceived = 0, nBatchRequestItemsReceived = 0;
 
         /// New in 1.0.1: This is latched to true in Client::on_disconnect to signal that the client is being
         /// disconnected and to just throw away any future messages from this client.
         bool ignoreNewIncomingMessages = false;
+
+    private:
+        /// A batch request from the peer that is still being answered. See acceptBatchRequests.
+        struct PendingBatch {
+            QVector<QByteArray> replies; ///< one slot per batch item, in item order; left empty for items that get no reply
+            int nOutstanding = 0; ///< the number of slots still waiting on a sendResult() or sendError()
+            bool flushed = false; ///< set by flushBatch()
+        };
+        /// The id of each not-yet-answered batched request -> its batch and its slot within that batch
+        QHash<Message::Id, std::pair<std::shared_ptr<PendingBatch>, int>> batchReplySlots;
+        /// The batches received from the peer that have not yet been written out, oldest first.
+        std::vector<std::shared_ptr<PendingBatch>> pendingBatches;
+        /// A notification that was sent while batches were pending. It is held back until all of the batches in
+        /// `waitsFor` have been written out, so that e.g. a status notification can't overtake the reply to the
+        /// blockchain.scripthash.subscribe batch item that set it up.
+        struct HeldNotification {
+            QByteArray json;
+            std::vector<std::shared_ptr<PendingBatch>> waitsFor;
+        };
+        std::deque<HeldNotification> heldNotifications; ///< in the order they were sent
+
+        /// Called by processJson() for a JSON array when acceptBatchRequests is true. Throws only if the batch as a
+        /// whole is bad; errors for individual items become error replies within the batch.
+        void processBatchRequest(const QByteArray & json);
+        /// If `reqid` belongs to a pending batch, stores `json` as its reply, writes out the batch if that was the
+        /// last reply it was waiting on (or right away if `flushNow` is true), and returns true. Otherwise returns
+        /// false and the caller should send `json` on its own.
+        bool fillBatchSlot(const Message::Id & reqid, const QByteArray & json, bool flushNow = false);
+        /// Writes all of the replies collected so far for `batch` to the peer as a single JSON array, then sends any
+        /// held notifications that were only waiting on this batch.
+        void flushBatch(PendingBatch & batch);
+        /// Sends the notifications at the front of heldNotifications whose batches have all been written out.
+        void sendHeldNotifications();
+
+        /// Called by processJson() for each parsed message (once per element for batch replies). Validates the
+        /// message against `methods` and emits the appropriate signal. Throws on error.
+        void dispatchMessage(Message & message);
     };
 
     /// Concrete class. For Electrum Cash style JSON RPC.
@@ -407,9 +482,27 @@ namespace RPC {
         /// emitted when the other side (usually bitcoind) didn't accept our auth cookie.
         void authFailure(HttpConnection *me);
 
+        /// Call (emit) this to do an HTTP GET of `path` (e.g. "/rest/block/<hash>.bin") on the same connection as our
+        /// JSON-RPC requests (bitcoind serves its REST interface on the RPC port). The reply is delivered, in order
+        /// with respect to the other replies on this connection, via gotMessage() as a response to `reqid` whose
+        /// result() is the raw body as a QByteArray; or via gotErrorMessage() with the HTTP status as the error code
+        /// (e.g. 404 if bitcoind was not started with -rest). `reqid` must not be null.
+        void sendRestGet(const RPC::Message::Id & reqid, const QString & path);
+
+    protected slots:
+        /// Actual implementation of sendRestGet, runs in our thread context.
+        void _sendRestGet(const RPC::Message::Id & reqid, const QString & path);
+
     protected:
         void on_readyRead() override;
         QByteArray wrapForSend(const QByteArray &) override;
+        /// chains to base, connects sendRestGet to _sendRestGet
+        void on_connected() override;
+        /// chains to base, forgets about pending replies
+        void on_disconnected() override;
+
+        /// adds REST stats
+        Stats stats() const override;
 
     private:
         /// These end up verbatim in the HTTP/1.1 POST header.
@@ -417,6 +510,13 @@ namespace RPC {
             QByteArray authCookie; ///< "Authorization: Basic <cookie>"
             QByteArray host; ///< "Host: <host>"; caller should set this if acting as a client
         } header;
+        /// The HTTP replies we are waiting for, in the order the requests were written to the socket (HTTP/1.1 replies
+        /// arrive in request order). A null Id is a JSON-RPC request; anything else is the reqid of a sendRestGet().
+        std::deque<Message::Id> pendingReplies;
+        quint64 nRestRequestsSent = 0, nRestBytesReceived = 0;
+        /// Delivers a complete REST reply via gotMessage() or gotErrorMessage()
+        void processRestReply(const Message::Id & reqid, int httpStatus, const QString & statusMsg, const QByteArray & body);
+
         struct StateMachine;
         using SMDel = std::function<void(StateMachine *)>;
         std::unique_ptr<StateMachine, SMDel> sm; ///< we need to declare this with a deleter otherwise subclasses won't be able to inherit from us because StateMachine is a private, opaque struct; the need for a deleter is due to implementation details of how unique_ptr works with opaque types.
@@ -427,3 +527,4 @@ namespace RPC {
 /// So that Qt signal/slots work with this type.  Metatypes are also registered at startup via qRegisterMetatype
 Q_DECLARE_METATYPE(RPC::Message);
 Q_DECLARE_METATYPE(RPC::Message::Id);
+Q_DECLARE_METATYPE(RPC::Batch);
@@ -38,6 +38,9 @@ namespace ServerMisc
     inline constexpr double kMaxSubsWarningsRateLimitSecs = 0.251;
     /// The rate limit for suppression of dupe per-IP "max subs" warnings to log.
     inline constexpr double kMaxSubsPerIPWarningsRateLimitSecs = 1.0;
+    /// The maximum number of scripthashes accepted by a single call to one of the blockchain.scripthash.*_many
+    /// extension methods. Advertised to clients in server.features as "scripthash_many_max".
+    inline constexpr int kMaxScripthashesPerManyCall = 500;
     /// This key is used in the stats() map for each Server instance to save bloom filter info
     inline constexpr auto kBloomFiltersKey = "bloom filters";
 }
@@ -43,6 +43,7 @@
 #include <QTimer>
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
@@ -184,7 +185,7 @@ void SimpleHttpServer::on_newConnection(QTcpSocket *sock)
                 //DebugM(sockName, " Got line: ", line);
                 if (QString loc = sock->property("req-loc").toString(); loc.isEmpty()) {
                     auto toks = line.split(' ');
-                    if (toks.length() != 3 || (toks[0] != "GET" && toks[1] != "POST") || toks[2] != "HTTP/1.1")
+                    if (toks.length() != 3 || (toks[0] != "GET" && toks[0] != "POST") || toks[2] != "HTTP/1.1")
                         throw Exception(QString("Invalid request: %1").arg(line));
                     TraceM(sockName, " ", line);
                     sock->setProperty("req-loc", toks[1]);
@@ -199,6 +200,7 @@ void SimpleHttpServer::on_newConnection(QTcpSocket *sock)
                     auto & response = req.response;
                     req.httpVersion = ver;
                     req.method = meth == "GET" ? Method::GET : Method::POST;
+                    req.peerAddress = sock->peerAddress();
                     auto vmap = sock->property("req-header").toMap();
                     for (auto it = vmap.begin(); it != vmap.end(); ++it)
                         // save header
@@ -337,6 +339,15 @@ namespace {
     /// used internally by RPC methods. Given a hashHex, ensure it's 32 bytes (or DataLen) of hash data and nothing else.
     /// Returns DataLen (default=32) bytes of valid hex decoded data or an empty QByteArray on failure.
     QByteArray validateHashHex(const QString & hashHex, const int DataLen = HashLen) {
+        if (hashHex.size() == DataLen*2) {
+            // Common case: exactly the right number of characters. Decode straight into the result buffer, which
+            // is the only allocation on this path.
+            QByteArray ret(DataLen, Qt::Uninitialized);
+            if (!Util::ParseHexFastInPlace(hashHex, ret.data(), size_t(DataLen)))
+                ret.clear();
+            return ret;
+        }
+        // Otherwise, be lenient about surrounding whitespace and trailing junk, as we always have been.
         QByteArray ret = hashHex.trimmed().left(DataLen*2).toUtf8();
         // ugh, QByteArray returns dummy bytes at the end if it can't fully parse. So we have to check the original
         // hash byte length as well.
@@ -396,6 +407,8 @@ QVariant ServerBase::stats() const
         clientList.append(QVariantMap({{name, map}}));
     }
     m["clients"] = clientList;
+    m["inFlightQueries"] = inFlightQueries.size();
+    m["nCoalescedRequests"] = inFlightQueries.nCoalesced();
     return QVariantMap{{prettyName(), m}};
 }
 
@@ -529,7 +542,7 @@ Client *
 ServerBase::newClient(QTcpSocket *sock)
 {
     const auto clientId = newId();
-    auto ret = clientsById[clientId] = new Client(rpcMethods(), clientId, sock, options->maxBuffer.load());
+    auto ret = clientsById[clientId] = new Client(rpcMethods(), clientId, sock, options->maxBuffer.load(), options->maxBatch);
     const auto addr = ret->peerAddress();
 
     ret->perIPData = Client::PerIPDataHolder_Temp::take(sock); // take ownership of the PerIPData ref, implicitly delete the temp holder attacked to the socket
@@ -563,6 +576,7 @@ ServerBase::newClient(QTcpSocket *sock)
         if (nSubsIP == 0 && c->nShSubs)
             DebugM("PerIP: ", addr.toString(), " is no longer subscribed to any scripthashes");
         --c->perIPData->nClients; // decrement client counter
+        inFlightQueries.waiterGone(clientId); // so that work only it was waiting for may be skipped
         // tell SrvMgr this client is gone so it can decrement its clients-per-ip count.
         emit clientDisconnected(clientId, addr);
     };
@@ -701,15 +715,20 @@ namespace {
 ServerBase::RPCError::~RPCError() {}
 ServerBase::RPCErrorWithDisconnect::~RPCErrorWithDisconnect() {}
 
+namespace {
+    /// The outcome of an async `work` functor, shared by the work and completion lambdas in generic_do_async et al.
+    struct AsyncResErr {
+        QVariant results;
+        bool error = false, doDisconnect = false;
+        QString errMsg;
+        int errCode = 0;
+    };
+}
+
 void ServerBase::generic_do_async(Client *c, const RPC::Message::Id &reqId, const std::function<QVariant ()> &work, int priority)
 {
     if (LIKELY(work)) {
-        struct ResErr {
-            QVariant results;
-            bool error = false, doDisconnect = false;
-            QString errMsg;
-            int errCode = 0;
-        };
+        using ResErr = AsyncResErr;
 
         auto reserr = std::make_shared<ResErr>(); ///< shared with lambda for both work and completion. this is how they communicate.
 
@@ -745,6 +764,115 @@ void ServerBase::generic_do_async(Client *c, const RPC::Message::Id &reqId, cons
         Error() << "INTERNAL ERROR: work must be valid! FIXME!";
 }
 
+struct SingleFlight::Flight
+{
+    std::vector<Waiter> waiters; ///< everyone awaiting the result
+    /// How many of `waiters` have not gone yet, or -1 once the work was skipped because there were none left. Only
+    /// the worker thread ever moves it from 0 to -1, and after that nobody may attach to this flight.
+    std::atomic_int nLive = 0;
+};
+
+bool SingleFlight::submit(ThreadPool *pool, QObject *context, const QByteArray &key, const Waiter &waiter,
+                          const WorkFunc &work, const DoneFunc &done, int priority)
+{
+    if (auto it = flights.find(key); it != flights.end()) {
+        auto & flight = *it.value();
+        for (int n = flight.nLive.load(); n >= 0; ) {
+            if (flight.nLive.compare_exchange_weak(n, n + 1)) {
+                flight.waiters.push_back(waiter);
+                ++nCoalesced_;
+                return false;
+            }
+        }
+        // else: the work was skipped, start over with a new flight (which replaces that one below)
+    }
+    auto flight = std::make_shared<Flight>();
+    flight->waiters.push_back(waiter);
+    flight->nLive = 1;
+    flights.insert(key, flight);
+
+    auto failMsg = std::make_shared<std::optional<QString>>();
+    // Runs in context's thread. Detaches the flight and hands its waiters to `done`.
+    const auto finish = [this, key, flight, failMsg, done] {
+        if (auto it = flights.find(key); it != flights.end() && it.value() == flight)
+            flights.erase(it);
+        done(flight->waiters, *failMsg);
+    };
+    pool->submitWork(
+        context,
+        [flight, work]{
+            if (int n = 0; flight->nLive.compare_exchange_strong(n, -1))
+                return; // everyone who wanted this has gone
+            work();
+        },
+        finish,
+        [finish, failMsg](const QString &what) {
+            *failMsg = what;
+            finish();
+        },
+        priority
+    );
+    return true;
+}
+
+void SingleFlight::waiterGone(IdMixin::Id clientId)
+{
+    for (const auto & flight : std::as_const(flights))
+        for (const auto & w : flight->waiters)
+            // nLive can't be 0 here while w is live, so it can't concurrently go from 0 to -1 either
+            if (w.first == clientId && flight->nLive.load() > 0)
+                --flight->nLive;
+}
+
+void ServerBase::generic_do_async_coalesced(Client *c, const RPC::Message::Id &reqId, const QByteArray &key,
+                                            const AsyncWorkFunc &work, int priority)
+{
+    if (UNLIKELY(!work)) {
+        Error() << "INTERNAL ERROR: work must be valid! FIXME!";
+        return;
+    }
+    auto reserr = std::make_shared<AsyncResErr>();
+    inFlightQueries.submit(
+        asyncThreadPool ? asyncThreadPool : ::AppThreadPool(),
+        this, // <--- completion runs in our context, since the client that started this may leave before it's done
+        key, {c->id, reqId},
+        // runs in worker thread, must not access anything other than reserr and work
+        [reserr, work]{
+            try {
+                QVariant result = work();
+                reserr->results.swap( result ); // constant-time copy
+            } catch (const RPCError & e) {
+                reserr->error = true;
+                reserr->doDisconnect = e.disconnect;
+                reserr->errMsg = e.what();
+                reserr->errCode = e.code;
+            }
+        },
+        // runs in our thread: sends the outcome to all of the waiters that are still connected
+        [this, reserr](const std::vector<SingleFlight::Waiter> &waiters, const std::optional<QString> &failMsg) {
+            if (failMsg) {
+                // other exceptions or a full work queue -- everybody gets "internal error: <message>"
+                reserr->error = true;
+                reserr->doDisconnect = false;
+                reserr->errMsg = QString("internal error: %1").arg(*failMsg);
+                reserr->errCode = RPC::Code_InternalError;
+            }
+            for (size_t i = 0; i < waiters.size(); ++i) {
+                const auto & [clientId, id] = waiters[i];
+                Client *client = getClient(clientId);
+                if (!client)
+                    continue; // client went away in the meantime
+                if (reserr->error)
+                    // only the request that started the work gets disconnected for it
+                    emit client->sendError(i == 0 && reserr->doDisconnect, reserr->errCode, reserr->errMsg, id);
+                else
+                    emit client->sendResult(id, reserr->results);
+            }
+        },
+        priority
+    );
+}
+
 void ServerBase::generic_async_to_bitcoind(Client *c, const RPC::Message::Id & reqId, const QString &method,
                                            const QVariantList & params,
                                            const BitcoinDSuccessFunc & successFunc,
@@ -942,6 +1070,11 @@ QVariantMap Server::makeFeaturesDictForConnection(AbstractConnection *c, const Q
     r["protocol_min"] = ServerMisc::MinProtocolVersion.toString();
     r["protocol_max"] = ServerMisc::MaxProtocolVersion.toString();
     r["hash_function"] = ServerMisc::HashFunction;
+    r["scripthash_many_max"] = ServerMisc::kMaxScripthashesPerManyCall; // we support the blockchain.scripthash.*_many extension methods
+    // get_history accepts optional from_height & to_height args, returning at most this many items. This is the
+    // Electrum Cash 1.5 form, offered as an extension on every connection (like scripthash_many_max above), since
+    // we don't speak the rest of protocol 1.5 and so never negotiate it.
+    r["history_range_max"] = opts.maxHistory;
 
     QVariantMap hmap, hmapTor;
     if (opts.publicTcp.has_value())
@@ -1253,7 +1386,119 @@ HashX Server::parseFirstShParamCommon(const RPC::Message &m) const
         throw RPCError("Invalid scripthash");
     return sh;
 }
+std::vector<HashX> Server::parseFirstShListParamCommon(const RPC::Message &m) const
+{
+    QVariantList l(m.paramsList());
+    assert(!l.isEmpty());
+    if (QMetaType::Type(l.front().type()) != QMetaType::QVariantList)
+        throw RPCError("Expected a list of scripthashes");
+    const QVariantList shList = l.front().toList();
+    if (shList.isEmpty())
+        throw RPCError("Empty scripthash list");
+    if (shList.size() > ServerMisc::kMaxScripthashesPerManyCall)
+        throw RPCError(QString("Too many scripthashes (the limit is %1)").arg(ServerMisc::kMaxScripthashesPerManyCall),
+                       RPC::Code_App_LimitExceeded);
+    std::vector<HashX> ret;
+    ret.reserve(size_t(shList.size()));
+    for (const auto & var : shList) {
+        HashX sh = validateHashHex( var.toString() );
+        if (sh.length() != HashLen)
+            throw RPCError(QString("Invalid scripthash: %1").arg(var.toString().left(HashLen * 2 + 2)));
+        ret.push_back(std::move(sh));
+    }
+    return ret;
+}
 // ---
+namespace {
+    // The below format the Storage results for the blockchain.scripthash.* and *_many methods
+    QVariantMap BalanceToVariant(const std::pair<bitcoin::Amount, bitcoin::Amount> &bal) {
+        const auto & [amt, uamt] = bal;
+        /* Note: ElectrumX protocol docs are incorrect. They claim a string in coin units is returned here.
+         * It is not. Instead a number in satoshis is returned!
+         * Incorrect docs: https://electrumx.readthedocs.io/en/latest/protocol-methods.html#blockchain-scripthash-get-balance */
+        return QVariantMap{
+          { "confirmed" , qlonglong(amt / amt.satoshi()) },
+          { "unconfirmed" , qlonglong(uamt / uamt.satoshi()) },
+        };
+    }
+    // Histories and utxo lists can be huge, so they are written straight to JSON text rather than building a
+    // QVariantMap per item. Keys are written in the (sorted) order a QVariantMap would have produced them in.
+    constexpr int kHistoryItemJsonSizeEstimate = 96, kUnspentItemJsonSizeEstimate = 112;
+    void WriteHistory(Json::Builder &b, const Storage::History &items) {
+        b.beginArray();
+        for (const auto & item : items) {
+            b.beginObject();
+            if (item.fee.has_value())
+                b.key("fee").value(*item.fee / bitcoin::Amount::satoshi());
+            b.key("height").value(item.height);
+            b.key("tx_hash").hexValue(item.hash);
+            b.endObject();
+        }
+        b.endArray();
+    }
+    void WriteUnspent(Json::Builder &b, const Storage::UnspentItems &items) {
+        b.beginArray();
+        for (const auto & item : items) {
+            b.beginObject();
+            b.key("height").value(item.height); // confirmed height. Is 0 for mempool tx regardless of unconf. parent status. Note this differs from get_mempool or get_history where -1 is used for unconf. parent.
+            b.key("tx_hash").hexValue(item.hash);
+            b.key("tx_pos").value(item.tx_pos);
+            b.key("value").value(item.value / item.value.satoshi()); // amount (int64) in satoshis
+            b.endObject();
+        }
+        b.endArray();
+    }
+    QVariant HistoryToVariant(const Storage::History &items) {
+        Json::Builder b(int(std::min<size_t>(items.size() * kHistoryItemJsonSizeEstimate + 2, std::numeric_limits<int>::max() / 2)));
+        WriteHistory(b, items);
+        return QVariant::fromValue(b.take());
+    }
+    QVariant UnspentToVariant(const Storage::UnspentItems &items) {
+        Json::Builder b(int(std::min<size_t>(items.size() * kUnspentItemJsonSizeEstimate + 2, std::numeric_limits<int>::max() / 2)));
+        WriteUnspent(b, items);
+        return QVariant::fromValue(b.take());
+    }
+    /// The result of blockchain.scripthash.subscribe: `null` if the status is empty, otherwise the hex encoded status.
+    QVariant StatusToVariant(const StatusHash &status) {
+        QVariant ret;
+        if (!status.isEmpty())
+            ret = QString(Util::ToHexFast(status));
+        return ret;
+    }
+
+    using CachedResultKind = Storage::CachedResultKind;
+    /// If `storage` has a cached result for (kind, sh), sends it to the client and returns true.
+    bool SendCachedResult(Client *c, const RPC::Message &m, const Storage &storage, CachedResultKind kind, const HashX &sh) {
+        auto cached = storage.getCachedResult(kind, sh);
+        if (!cached)
+            return false;
+        emit c->sendResult(m.id, QVariant::fromValue(Json::PreSerialized{std::move(*cached)}));
+        return true;
+    }
+    /// A cache-miss scripthash query, ready to be passed to generic_do_async_coalesced.
+    struct CachedQuery {
+        QByteArray flightKey; ///< kind + scripthash + cache generation: identical for identical concurrent queries
+        std::function<QVariant()> work; ///< wraps the query so its result is serialized and saved to the cache
+    };
+    /// Call this before scheduling the work so that the cache generation is read before the query runs.
+    CachedQuery MakeCachedQuery(Storage *storage, CachedResultKind kind, const HashX &sh, std::function<QVariant()> work) {
+        CachedQuery ret;
+        const uint64_t gen = storage->resultCacheGeneration();
+        ret.flightKey.reserve(1 + sh.size() + int(sizeof(gen)));
+        ret.flightKey.append(char(kind)).append(sh).append(reinterpret_cast<const char *>(&gen), int(sizeof(gen)));
+        ret.work = [storage, kind, sh, work = std::move(work), gen] {
+            const QVariant res = work();
+            Json::PreSerialized ser;
+            if (res.userType() == qMetaTypeId<Json::PreSerialized>())
+                ser = res.value<Json::PreSerialized>();
+            else
+                ser.json = Json::toUtf8(res, true);
+            storage->putCachedResult(kind, sh, ser.json, gen);
+            return QVariant::fromValue(std::move(ser));
+        };
+        return ret;
+    }
+}
 void Server::rpc_blockchain_scripthash_get_balance(Client *c, const RPC::Message &m)
 {
     const auto sh = parseFirstShParamCommon(m);
@@ -1266,35 +1511,19 @@ void Server::rpc_blockchain_address_get_balance(Client *c, const RPC::Message &m
 }
 void Server::impl_get_balance(Client *c, const RPC::Message &m, const HashX &sh)
 {
-    generic_do_async(c, m.id, [sh, this] {
-        const auto [amt, uamt] = storage->getBalance(sh);
-        /* Note: ElectrumX protocol docs are incorrect. They claim a string in coin units is returned here.
-         * It is not. Instead a number in satoshis is returned!
-         * Incorrect docs: https://electrumx.readthedocs.io/en/latest/protocol-methods.html#blockchain-scripthash-get-balance */
-        QVariantMap resp{
-          { "confirmed" , qlonglong(amt / amt.satoshi()) },
-          { "unconfirmed" , qlonglong(uamt / uamt.satoshi()) },
-        };
-        return resp;
+    if (SendCachedResult(c, m, *storage, CachedResultKind::Balance, sh))
+        return;
+    auto q = MakeCachedQuery(storage.get(), CachedResultKind::Balance, sh, [sh, this] {
+        return BalanceToVariant(storage->getBalance(sh));
     });
+    generic_do_async_coalesced(c, m.id, q.flightKey, q.work);
 }
 
 /// called from get_mempool and get_history to retrieve the mempool for a hashx synchronously.  Returns the
 /// QVariantMap suitable for placing into the resulting response.
-QVariantList Server::getHistoryCommon(const HashX &sh, bool mempoolOnly)
-{
-    QVariantList resp;
-    const auto items = storage->getHistory(sh, !mempoolOnly, true); // these are already sorted
-    for (const auto & item : items) {
-        QVariantMap m{
-            { "tx_hash" , Util::ToHexFast(item.hash) },
-            { "height", int(item.height) },
-        };
-        if (item.fee.has_value())
-            m["fee"] = qlonglong(*item.fee / bitcoin::Amount::satoshi());
-        resp.push_back(m);
-    }
-    return resp;
+QVariant Server::getHistoryCommon(const HashX &sh, bool mempoolOnly)
+{
+    return HistoryToVariant(storage->getHistory(sh, !mempoolOnly, true)); // these are already sorted
 }
 
 void Server::rpc_blockchain_scripthash_get_history(Client *c, const RPC::Message &m)
@@ -1309,9 +1538,33 @@ void Server::rpc_blockchain_address_get_history(Client *c, const RPC::Message &m
 }
 void Server::impl_get_history(Client *c, const RPC::Message &m, const HashX &sh)
 {
-    generic_do_async(c, m.id, [sh, this] {
+    if (const QVariantList l = m.paramsList(); l.size() > 1) {
+        // ranged request: get_history(scripthash, from_height=0, to_height=-1). Only the confirmed history in blocks
+        // [from_height, to_height) is returned, plus the mempool if to_height is -1. The MaxHistory limit applies to
+        // the size of the result only, so clients can page through histories larger than that.
+        bool ok;
+        const int fromHeight = l[1].toInt(&ok);
+        if (!ok || fromHeight < 0)
+            throw RPCError("Invalid from_height");
+        int toHeight = -1;
+        if (l.size() > 2 && (toHeight = l[2].toInt(&ok), !ok || toHeight < -1))
+            throw RPCError("Invalid to_height");
+        generic_do_async(c, m.id, [sh, fromHeight, toHeight, this] {
+            const auto optTo = toHeight < 0 ? std::optional<unsigned>{} : std::optional<unsigned>{unsigned(toHeight)};
+            try {
+                return HistoryToVariant(storage->getHistoryRange(sh, unsigned(fromHeight), optTo)); // already sorted
+            } catch (const HistoryTooLarge &e) {
+                throw RPCError(e.what(), RPC::Code_App_LimitExceeded);
+            }
+        });
+        return;
+    }
+    if (SendCachedResult(c, m, *storage, CachedResultKind::History, sh))
+        return;
+    auto q = MakeCachedQuery(storage.get(), CachedResultKind::History, sh, [sh, this] {
         return getHistoryCommon(sh, false);
     });
+    generic_do_async_coalesced(c, m.id, q.flightKey, q.work);
 }
 
 void Server::rpc_blockchain_scripthash_get_mempool(Client *c, const RPC::Message &m)
@@ -1331,9 +1584,12 @@ void Server::rpc_blockchain_address_get_scripthash(Client *c, const RPC::Message
 }
 void Server::impl_get_mempool(Client *c, const RPC::Message &m, const HashX &sh)
 {
-    generic_do_async(c, m.id, [sh, this] {
+    if (SendCachedResult(c, m, *storage, CachedResultKind::Mempool, sh))
+        return;
+    auto q = MakeCachedQuery(storage.get(), CachedResultKind::Mempool, sh, [sh, this] {
         return getHistoryCommon(sh, true);
     });
+    generic_do_async_coalesced(c, m.id, q.flightKey, q.work);
 }
 void Server::rpc_blockchain_scripthash_listunspent(Client *c, const RPC::Message &m)
 {
@@ -1347,19 +1603,12 @@ void Server::rpc_blockchain_address_listunspent(Client *c, const RPC::Message &m
 }
 void Server::impl_listunspent(Client *c, const RPC::Message &m, const HashX &sh)
 {
-    generic_do_async(c, m.id, [sh, this] {
-        QVariantList resp;
-        const auto items = storage->listUnspent(sh); // these are already sorted
-        for (const auto & item : items) {
-            resp.push_back(QVariantMap{
-                { "tx_hash" , Util::ToHexFast(item.hash) },
-                { "tx_pos"  , item.tx_pos },
-                { "height", item.height },  // confirmed height. Is 0 for mempool tx regardless of unconf. parent status. Note this differs from get_mempool or get_history where -1 is used for unconf. parent.
-                { "value", qlonglong(item.value / item.value.satoshi()) }, // amount (int64) in satoshis
-            });
-        }
-        return resp;
+    if (SendCachedResult(c, m, *storage, CachedResultKind::Unspent, sh))
+        return;
+    auto q = MakeCachedQuery(storage.get(), CachedResultKind::Unspent, sh, [sh, this] {
+        return UnspentToVariant(storage->listUnspent(sh)); // these are already sorted
     });
+    generic_do_async_coalesced(c, m.id, q.flightKey, q.work);
 }
 void Server::rpc_blockchain_scripthash_subscribe(Client *c, const RPC::Message &m)
 {
@@ -1374,6 +1623,25 @@ void Server::rpc_blockchain_address_subscribe(Client *c, const RPC::Message &m)
     impl_sh_subscribe(c, m, sh, addrStr);
 }
 void Server::impl_sh_subscribe(Client *c, const RPC::Message &m, const HashX &sh, const std::optional<QString> &optAlias)
+{
+    const auto optStatus = subscribeCommon(c, m.method, sh, optAlias); // may throw RPCError
+    if (!optStatus.has_value()) {
+        // no known/cached status -- do the work ourselves asynch in the thread pool.
+        generic_do_async(c, m.id, [sh, this] {
+            const auto status = storage->subs()->getFullStatus(sh);
+            storage->subs()->maybeCacheStatusResult(sh, status);
+            return StatusToVariant(status); // if empty we return `null`, otherwise we return hex encoded bytes as the immediate status.
+        });
+    } else {
+        // SubsMgr reported a cached status -- immediately return that as the result!
+        // commented out because it is spammy
+        //DebugM("Sending cached status to client for scripthash: ", Util::ToHexFast(sh), " status: ", Util::ToHexFast(*optStatus));
+        //
+        emit c->sendResult(m.id, StatusToVariant(*optStatus)); ///<  may be 'null' if status was empty (indicates no history for scripthash)
+    }
+}
+std::optional<QByteArray> Server::subscribeCommon(Client *c, const QString &notifMethod, const HashX &sh,
+                                                  const std::optional<QString> &optAlias)
 {
     const auto CheckSubsLimit = [c, &sh, this](int64_t nShSubs, bool doUnsub) {
         if (UNLIKELY(nShSubs > options->maxSubsPerIP)) {
@@ -1411,7 +1679,7 @@ void Server::impl_sh_subscribe(Client *c, const RPC::Message &m, const HashX &sh
 
     SubsMgr::SubscribeResult result;
     try {
-        const auto MkNotifierLambda = [c, &m, &optAlias]() -> StatusCallback {
+        const auto MkNotifierLambda = [c, &notifMethod, &optAlias]() -> StatusCallback {
             // We return two different lambdas, based on whether there is an opAddr alias specified or not.
             // The reason for doing it this way is that were we to capture the 'alias' as an empty value in the lambda
             // always, then in the blockchain.scripthash.subscribe case we would be wasting minimally ~16 bytes of
@@ -1427,7 +1695,7 @@ void Server::impl_sh_subscribe(Client *c, const RPC::Message &m, const HashX &sh
             if (!optAlias.has_value()) { // common case
                 // regular blockchain.scripthash.subscribe callback does no aliasing/rewriting and simply echoes the sh back to client as hex.
                 ret =
-                    [c, method=m.method](const HashX &sh, const StatusHash &status) {
+                    [c, method=notifMethod](const HashX &sh, const StatusHash &status) {
                         QVariant statusHexMaybeNull; // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
                         if (!status.isEmpty())
                             statusHexMaybeNull = Util::ToHexFast(status);
@@ -1437,7 +1705,7 @@ void Server::impl_sh_subscribe(Client *c, const RPC::Message &m, const HashX &sh
             } else {
                 // When notifying, blockchain.address.subscribe callback must rewrite the sh arg -> the original address argument given by the client.
                 ret =
-                    [c, method=m.method, alias=optAlias->toUtf8()](const HashX &, const StatusHash &status) {
+                    [c, method=notifMethod, alias=optAlias->toUtf8()](const HashX &, const StatusHash &status) {
                         QVariant statusHexMaybeNull; // if empty we simply notify as 'null' (this is unlikely in practice but may happen on reorg)
                         if (!status.isEmpty())
                             statusHexMaybeNull = Util::ToHexFast(status);
@@ -1468,27 +1736,102 @@ void Server::impl_sh_subscribe(Client *c, const RPC::Message &m, const HashX &sh
         // (in practice it won't be a huge problem).
         CheckSubsLimit( ++c->perIPData->nShSubs, true ); // may throw RPCError
     }
-    if (!optStatus.has_value()) {
-        // no known/cached status -- do the work ourselves asynch in the thread pool.
-        generic_do_async(c, m.id, [sh, this] {
-            QVariant ret;
-            const auto status = storage->subs()->getFullStatus(sh);
-            storage->subs()->maybeCacheStatusResult(sh, status);
-            if (!status.isEmpty()) // if empty we return `null`, otherwise we return hex encoded bytes as the immediate status.
-                ret = Util::ToHexFast(status);
-            return ret;
-        });
-    } else {
-        // SubsMgr reported a cached status -- immediately return that as the result!
-        QVariant result;
-        if (!optStatus->isEmpty())
-            // not empty, so we return the hex-encoded string
-            result = QString(Util::ToHexFast(*optStatus));
-        // commented out because it is spammy
-        //DebugM("Sending cached status to client for scripthash: ", Util::ToHexFast(sh), " status: ", result.toString());
-        //
-        emit c->sendResult(m.id, result); ///<  may be 'null' if status was empty (indicates no history for scripthash)
+    return optStatus;
+}
+// --- blockchain.scripthash.*_many extension methods. These take a single argument: a list of scripthashes. The
+//     storage lookups for all of them are done together (see Storage::getHistories et al), and the result is a list
+//     parallel to the argument, each item of which is what the corresponding non-"_many" method would have returned.
+void Server::rpc_blockchain_scripthash_get_balance_many(Client *c, const RPC::Message &m)
+{
+    auto shs = parseFirstShListParamCommon(m);
+    generic_do_async(c, m.id, [shs = std::move(shs), this] {
+        QVariantList resp;
+        for (const auto & bal : storage->getBalances(shs))
+            resp.push_back(BalanceToVariant(bal));
+        return resp;
+    });
+}
+void Server::rpc_blockchain_scripthash_get_history_many(Client *c, const RPC::Message &m)
+{
+    auto shs = parseFirstShListParamCommon(m);
+    generic_do_async(c, m.id, [shs = std::move(shs), this] {
+        std::vector<Storage::History> hists;
+        try {
+            hists = storage->getHistories(shs, true, true); // these are already sorted
+        } catch (const HistoryTooLarge &e) {
+            throw RPCError(e.what(), RPC::Code_App_LimitExceeded);
+        }
+        size_t nItems = 0;
+        for (const auto & hist : hists)
+            nItems += hist.size();
+        Json::Builder b(int(std::min<size_t>(nItems * kHistoryItemJsonSizeEstimate + hists.size() * 3, std::numeric_limits<int>::max() / 2)));
+        b.beginArray();
+        for (const auto & hist : hists)
+            WriteHistory(b, hist);
+        b.endArray();
+        return QVariant::fromValue(b.take());
+    });
+}
+void Server::rpc_blockchain_scripthash_listunspent_many(Client *c, const RPC::Message &m)
+{
+    auto shs = parseFirstShListParamCommon(m);
+    generic_do_async(c, m.id, [shs = std::move(shs), this] {
+        std::vector<Storage::UnspentItems> lists;
+        try {
+            lists = storage->listUnspents(shs); // these are already sorted
+        } catch (const HistoryTooLarge &e) {
+            throw RPCError(e.what(), RPC::Code_App_LimitExceeded);
+        }
+        size_t nItems = 0;
+        for (const auto & items : lists)
+            nItems += items.size();
+        Json::Builder b(int(std::min<size_t>(nItems * kUnspentItemJsonSizeEstimate + lists.size() * 3, std::numeric_limits<int>::max() / 2)));
+        b.beginArray();
+        for (const auto & items : lists)
+            WriteUnspent(b, items);
+        b.endArray();
+        return QVariant::fromValue(b.take());
+    });
+}
+void Server::rpc_blockchain_scripthash_subscribe_many(Client *c, const RPC::Message &m)
+{
+    static const QString kNotifMethod("blockchain.scripthash.subscribe"); // notifications look like those of a regular subscribe
+    const auto shs = parseFirstShListParamCommon(m);
+    std::vector<std::optional<StatusHash>> statuses;
+    statuses.reserve(shs.size());
+    // Note: if a subscription limit is hit part-way through, the error is returned for the whole call, and the
+    // scripthashes subscribed before that point remain subscribed (just as if they had been subscribed one at a time).
+    for (const auto & sh : shs)
+        statuses.push_back(subscribeCommon(c, kNotifMethod, sh)); // may throw RPCError
+    std::vector<HashX> uncached; // the scripthashes SubsMgr had no cached status for
+    std::vector<size_t> uncachedPos; // uncached[k] is shs[uncachedPos[k]]
+    for (size_t i = 0; i < shs.size(); ++i) {
+        if (!statuses[i].has_value()) {
+            uncached.push_back(shs[i]);
+            uncachedPos.push_back(i);
+        }
+    }
+    const auto MkResult = [](const std::vector<std::optional<StatusHash>> &sts) {
+        QVariantList resp;
+        for (const auto & status : sts)
+            resp.push_back(StatusToVariant(status.value_or(StatusHash{})));
+        return resp;
+    };
+    if (uncached.empty()) {
+        // all statuses were cached -- immediately return them as the result
+        emit c->sendResult(m.id, MkResult(statuses));
+        return;
     }
+    // compute the missing statuses together, asynch in the thread pool
+    generic_do_async(c, m.id, [uncached = std::move(uncached), uncachedPos = std::move(uncachedPos),
+                               statuses = std::move(statuses), MkResult, this]() mutable {
+        const auto full = storage->subs()->getFullStatuses(uncached);
+        for (size_t k = 0; k < uncached.size(); ++k) {
+            storage->subs()->maybeCacheStatusResult(uncached[k], full[k]);
+            statuses[uncachedPos[k]] = full[k];
+        }
+        return MkResult(statuses);
+    });
 }
 void Server::rpc_blockchain_scripthash_unsubscribe(Client *c, const RPC::Message &m)
 {
@@ -1834,7 +2177,7 @@ HEY_COMPILER_PUT_STATIC_HERE(Server::StaticData::registry){
     { {"server.version",                    true,               false,    PR{0,2},                    },          MP(rpc_server_version) },
 
     { {"blockchain.address.get_balance",    true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_balance) },
-    { {"blockchain.address.get_history",    true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_history) },
+    { {"blockchain.address.get_history",    true,               false,    PR{1,3},                    },          MP(rpc_blockchain_address_get_history) },
     { {"blockchain.address.get_mempool",    true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_mempool) },
     { {"blockchain.address.get_scripthash", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_get_scripthash) },
     { {"blockchain.address.listunspent",    true,               false,    PR{1,1},                    },          MP(rpc_blockchain_address_listunspent) },
@@ -1848,11 +2191,15 @@ HEY_COMPILER_PUT_STATIC_HERE(Server::StaticData::registry){
     { {"blockchain.relayfee",               true,               false,    PR{0,0},                    },          MP(rpc_blockchain_relayfee) },
 
     { {"blockchain.scripthash.get_balance", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_balance) },
-    { {"blockchain.scripthash.get_history", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_history) },
+    { {"blockchain.scripthash.get_history", true,               false,    PR{1,3},                    },          MP(rpc_blockchain_scripthash_get_history) },
     { {"blockchain.scripthash.get_mempool", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_mempool) },
     { {"blockchain.scripthash.listunspent", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_listunspent) },
     { {"blockchain.scripthash.subscribe",   true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_subscribe) },
     { {"blockchain.scripthash.unsubscribe", true,               false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_unsubscribe) },
+    { {"blockchain.scripthash.get_balance_many", true,          false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_balance_many) },
+    { {"blockchain.scripthash.get_history_many", true,          false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_get_history_many) },
+    { {"blockchain.scripthash.listunspent_many", true,          false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_listunspent_many) },
+    { {"blockchain.scripthash.subscribe_many", true,            false,    PR{1,1},                    },          MP(rpc_blockchain_scripthash_subscribe_many) },
 
     { {"blockchain.transaction.broadcast",  true,               false,    PR{1,1},                    },          MP(rpc_blockchain_transaction_broadcast) },
     { {"blockchain.transaction.get",        true,               false,    PR{1,2},                    },          MP(rpc_blockchain_transaction_get) },
@@ -2377,7 +2724,7 @@ void AdminServer::StaticData::init() { InitStaticDataCommon(dispatchTable, metho
 
 /*static*/ std::atomic_size_t Client::numClients{0}, Client::numClientsMax{0}, Client::numClientsCtr{0};
 
-Client::Client(const RPC::MethodMap & mm, IdMixin::Id id_in, QTcpSocket *sock, int maxBuffer)
+Client::Client(const RPC::MethodMap & mm, IdMixin::Id id_in, QTcpSocket *sock, int maxBuffer, int maxBatch)
     : RPC::ElectrumConnection(mm, id_in, sock, /* ensure sane --> */ qMax(maxBuffer, Options::maxBufferMin))
 {
     ++numClientsCtr;
@@ -2397,6 +2744,8 @@ Client::Client(const RPC::MethodMap & mm, IdMixin::Id id_in, QTcpSocket *sock, i
     pingtime_ms = int(stale_threshold); // this determines how often the pingtimer fires
     status = Connected ; // we are always connected at construction time.
     errorPolicy = ErrorPolicySendErrorMessage;
+    acceptBatchRequests = true; // each batch item is dispatched to onMessage() individually; replies go out as one array
+    maxBatchItems = maxBatch;
     setObjectName(QStringLiteral("Client.%1").arg(id_in));
     on_connected();
     Log() << "New " << prettyName(false, false) << ", " << N << Util::Pluralize(QStringLiteral(" client"), N) << " total";
@@ -2438,3 +2787,100 @@ void Client::do_ping()
         return;
     }
 }
+
+#ifdef ENABLE_TESTS
+#include <QEventLoop>
+#include <QTemporaryDir>
+
+#include <condition_variable>
+#include <map>
+
+namespace {
+    /// Identical concurrent cache-miss queries share one run of their work and each gets its result, a query made
+    /// after a cache invalidation doesn't join one from before it, and work that nobody waits for anymore is skipped.
+    void testSingleFlight() {
+        QTemporaryDir dir;
+        if (!dir.isValid())
+            throw Exception("Unable to create a temporary directory");
+        auto options = std::make_shared<Options>();
+        options->datadir = dir.path();
+        auto storage = std::make_unique<Storage>(options); // goes away before `dir`
+        storage->startup();
+
+        ThreadPool pool;
+        pool.setMaxThreadCount(2); // the two blocking queries below take both threads, so that a third one has to wait
+        QObject context;
+        SingleFlight flights;
+
+        // the queries block until released, so that the submits below all happen while they are in flight
+        std::mutex mut;
+        std::condition_variable cond;
+        bool released = false;
+        const auto Release = [&] {
+            {
+                std::lock_guard g(mut);
+                released = true;
+            }
+            cond.notify_all();
+        };
+        Defer releaseAtExit(Release); // so that `pool` isn't left waiting on a blocked worker if we throw
+        std::atomic_int nRuns = 0;
+        const auto Query = [&](const HashX &sh) {
+            return MakeCachedQuery(storage.get(), CachedResultKind::Balance, sh, [&] {
+                const int n = ++nRuns;
+                std::unique_lock g(mut);
+                cond.wait(g, [&] { return released; });
+                return QVariant(n);
+            });
+        };
+        std::map<IdMixin::Id, QByteArray> replies; // clientId -> the json it got
+        int nDone = 0;
+        QEventLoop loop;
+        const auto Submit = [&](const CachedQuery &q, IdMixin::Id clientId) {
+            auto result = std::make_shared<QByteArray>();
+            return flights.submit(&pool, &context, q.flightKey, {clientId, RPC::Message::Id(int64_t(clientId))},
+                                  [result, work = q.work] { *result = work().value<Json::PreSerialized>().json; },
+                                  [&, result](const std::vector<SingleFlight::Waiter> &waiters, const std::optional<QString> &failMsg) {
+                                      for (const auto & [clientId, id] : waiters)
+                                          replies[clientId] = failMsg ? failMsg->toUtf8() : *result;
+                                      if (++nDone == 3)
+                                          loop.quit();
+                                  });
+        };
+        const HashX sh(HashLen, 's'), sh2(HashLen, 't');
+        const auto q1 = Query(sh), q1b = Query(sh);
+        if (q1.flightKey != q1b.flightKey)
+            throw Exception("Identical queries have different keys");
+        if (!Submit(q1, 1) || Submit(q1b, 2))
+            throw Exception("An identical query in flight was not joined");
+        storage->invalidateCachedResults({sh});
+        const auto q2 = Query(sh);
+        if (q2.flightKey == q1.flightKey || !Submit(q2, 3))
+            throw Exception("A query made after an invalidation joined one made before it");
+        if (!Submit(Query(sh2), 4))
+            throw Exception("A different query joined a flight");
+        flights.waiterGone(4);
+        if (flights.size() != 3 || flights.nCoalesced() != 1)
+            throw Exception("Unexpected number of flights");
+
+        Release();
+        QTimer::singleShot(5000, &loop, &QEventLoop::quit); // timeout
+        if (nDone < 3)
+            loop.exec();
+        if (nDone != 3 || flights.size() != 0)
+            throw Exception(QString("Only %1 of 3 flights finished").arg(nDone));
+        if (nRuns != 2)
+            throw Exception(QString("The queries ran %1 times, expected 2").arg(nRuns.load()));
+        if (replies[1].isEmpty() || replies[1] != replies[2] || replies[3].isEmpty() || replies[3] == replies[1])
+            throw Exception("The waiters did not get the right replies");
+        if (!replies[4].isEmpty())
+            throw Exception("A query nobody was waiting for was not skipped");
+        // the result computed before the invalidation was not cached, the one after it was
+        if (storage->getCachedResult(CachedResultKind::Balance, sh) != replies[3])
+            throw Exception("The cache holds a result computed before the invalidation");
+        Log() << "singleflight: test passed";
+    }
+
+    const auto test_singleflight = App::registerTest("singleflight", &testSingleFlight);
+} // namespace
+#endif
@@ -38,6 +38,7 @@
 #include <optional>
 #include <shared_mutex>
 #include <type_traits>
+#include <vector>
 
 struct TcpServerError : public Exception
 {
@@ -106,6 +107,7 @@ public:
         QHash<QString, QString> header; // headers that came in
         QString endPoint; // eg /stats
         QString queryString; // eg everything after the ? bla=1&foo=bar
+        QHostAddress peerAddress; // the address of the client that sent this request
 
         struct Response {
             int status = 200;
@@ -136,6 +138,36 @@ class QSslSocket;
 class Storage;
 class ThreadPool;
 
+/// Single-flight scheduling of thread pool work, used by ServerBase::generic_do_async_coalesced: identical concurrent
+/// queries (those with the same key) share one run of their work. Not thread-safe: it must only be used from the
+/// thread that the `context` passed to submit() lives in.
+class SingleFlight
+{
+public:
+    using Waiter = std::pair<IdMixin::Id, RPC::Message::Id>; ///< (clientId, reqId)
+    /// Runs in a worker thread. May throw, in which case DoneFunc gets the exception's message.
+    using WorkFunc = std::function<void()>;
+    /// Runs in `context`'s thread once a flight is done, with all of its waiters. waiters.front() is the one whose
+    /// request started it. `failMsg` is set if the work threw, or if it could not be scheduled at all.
+    using DoneFunc = std::function<void(const std::vector<Waiter> &waiters, const std::optional<QString> &failMsg)>;
+
+    /// If a flight for `key` is in progress, attaches `waiter` to it and returns false. Otherwise submits `work` to
+    /// `pool` and returns true; `done` is then called when it finishes. If all of the waiters are gone (see
+    /// waiterGone()) by the time the work gets to run, the work is skipped, and `done` is called without a result.
+    bool submit(ThreadPool *pool, QObject *context, const QByteArray &key, const Waiter &waiter, const WorkFunc &work,
+                const DoneFunc &done, int priority = 0);
+    /// Call this when client `clientId` goes away, so that work that nobody is waiting for anymore can be skipped.
+    void waiterGone(IdMixin::Id clientId);
+
+    int size() const { return flights.size(); } ///< the number of flights in progress
+    quint64 nCoalesced() const { return nCoalesced_; } ///< the number of waiters that were attached to a flight in progress
+
+private:
+    struct Flight;
+    QHash<QByteArray, std::shared_ptr<Flight>> flights;
+    quint64 nCoalesced_ = 0;
+};
+
 /// Base class for the Electrum-server-style linefeed-based JSON-RPC service.
 ///
 /// This base class knows how to handle clients and how to dispatch messages. It offers all the facilities an RPC
@@ -274,6 +306,14 @@ protected:
     /// any errors to the client. The `work` functor may throw RPCError, in which case code and message will be
     /// sent instead.  Note that all other exceptions also end up sent to the client as "internal error: MESSAGE".
     void generic_do_async(Client *client, const RPC::Message::Id &reqId,  const AsyncWorkFunc & work, int priority = 0);
+    /// Like generic_do_async, but "single-flight": if work for the same `key` is already in progress on behalf of any
+    /// client of this server, the client is attached to it and gets the same result (or error) when it finishes,
+    /// rather than `work` being scheduled again. The caller must ensure that `key` covers everything that the result
+    /// depends on (method, params, and the state of the chain/mempool). The work is skipped if every client waiting
+    /// for it has disconnected before it runs. An RPCError with `disconnect` set disconnects only the client whose
+    /// request started the work; the others just get the error.
+    void generic_do_async_coalesced(Client *client, const RPC::Message::Id &reqId, const QByteArray &key,
+                                    const AsyncWorkFunc & work, int priority = 0);
     void generic_async_to_bitcoind(Client *client,
                                    const RPC::Message::Id & reqId,  ///< the original client request id
                                    const QString &method, ///< bitcoind method to invoke
@@ -285,6 +325,10 @@ protected:
     /// threadpool. Otherwise the app-global ::AppThreadPool()  will be used for generic_do_async().
     ThreadPool *asyncThreadPool = nullptr;
 
+private:
+    /// Work in progress for generic_do_async_coalesced. Only accessed from this object's thread.
+    SingleFlight inFlightQueries;
+protected:
     /// pointer to the shared Options object -- app-wide configuration settings. Owned and controlled by the App instance.
     const std::shared_ptr<const Options> options;
     /// pointer to shared Storage object -- owned and controlled by the Controller instance
@@ -364,6 +408,11 @@ private:
     void rpc_blockchain_scripthash_listunspent(Client *, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_subscribe(Client *, const RPC::Message &); // fully implemented
     void rpc_blockchain_scripthash_unsubscribe(Client *, const RPC::Message &); // fully implemented
+    // scripthash, extension methods taking a list of scripthashes (see server.features "scripthash_many_max")
+    void rpc_blockchain_scripthash_get_balance_many(Client *, const RPC::Message &); // fully implemented
+    void rpc_blockchain_scripthash_get_history_many(Client *, const RPC::Message &); // fully implemented
+    void rpc_blockchain_scripthash_listunspent_many(Client *, const RPC::Message &); // fully implemented
+    void rpc_blockchain_scripthash_subscribe_many(Client *, const RPC::Message &); // fully implemented
     // transaction
     void rpc_blockchain_transaction_broadcast(Client *, const RPC::Message &); // fully implemented
     void rpc_blockchain_transaction_get(Client *, const RPC::Message &); // fully implemented
@@ -383,6 +432,11 @@ private:
     void impl_sh_subscribe(Client *, const RPC::Message &, const HashX &scriptHash,
                            const std::optional<QString> & aliasUsedForNotifications = {});
     void impl_sh_unsubscribe(Client *, const RPC::Message &, const HashX &scriptHash);
+    /// Used by impl_sh_subscribe and rpc_blockchain_scripthash_subscribe_many. Subscribes the client to scriptHash,
+    /// enforcing the per-IP and global subscription limits, such that notifications go out as `notifMethod`. Returns
+    /// the cached status hash for scriptHash, if SubsMgr had one. Throws RPCError if a limit was reached.
+    std::optional<QByteArray> subscribeCommon(Client *, const QString &notifMethod, const HashX &scriptHash,
+                                              const std::optional<QString> & aliasUsedForNotifications = {});
     /// Commonly used by above methods.  Takes the first address argument in the m.paramsList() and converts it to
     /// a scripthash, returning the raw bytes.  Will throw RPCError on invalid argument.
     /// It is assumed the caller already ensured m.paramsList() has at least 1 item in it (which the RPC machinery
@@ -395,6 +449,9 @@ private:
     /// does normally if the params spec is correctly written).  Validation is done on the argument, however, and
     /// it will throw RPCError in all parse/failure cases and only ever returns a valid scripthash on success.
     HashX parseFirstShParamCommon(const RPC::Message &m) const;
+    /// Like the above, but for the *_many methods: the first argument must be a non-empty list of at most
+    /// ServerMisc::kMaxScripthashesPerManyCall scripthash hex strings. Throws RPCError on invalid argument.
+    std::vector<HashX> parseFirstShListParamCommon(const RPC::Message &m) const;
 
 
     /// Basically a namespace for our rpc dispatch tables, etc
@@ -418,8 +475,8 @@ private:
     HeadersBranchAndRootPair getHeadersBranchAndRoot(unsigned height, unsigned cp_height);
 
     /// called from get_mempool and get_history to retrieve the mempool and/or history for a hashx synchronously.
-    /// Returns the QVariantMap suitable for placing into the resulting response.
-    QVariantList getHistoryCommon(const HashX & sh, bool mempoolOnly);
+    /// Returns the result as pre-serialized JSON (a Json::PreSerialized), suitable for sending as the response.
+    QVariant getHistoryCommon(const HashX & sh, bool mempoolOnly);
 
     double lastSubsWarningPrintTime = 0.; ///< used internally to rate-limit "max subs exceeded" message spam to log
 
@@ -544,7 +601,7 @@ protected:
     friend class ::ServerBase;
     friend class ::Server;
     /// NB: sock should be in an already connected state.
-    explicit Client(const RPC::MethodMap & methods, IdMixin::Id id, QTcpSocket *sock, int maxBuffer);
+    explicit Client(const RPC::MethodMap & methods, IdMixin::Id id, QTcpSocket *sock, int maxBuffer, int maxBatch);
 public:
     ~Client() override;
 
@@ -16,6 +16,7 @@
 // along with this program (see LICENSE.txt).  If not, see
 // <https://www.gnu.org/licenses/>.
 //
+#include "App.h"
 #include "BTC.h"
 #include "CostCache.h"
 #include "Mempool.h"
@@ -23,22 +24,30 @@
 #include "RecordFile.h"
 #include "Storage.h"
 #include "SubsMgr.h"
+#include "ThreadPool.h"
 
 #include <rocksdb/db.h>
 #include <rocksdb/iterator.h>
 #include <rocksdb/merge_operator.h>
 #include <rocksdb/options.h>
 #include <rocksdb/slice.h>
+#include <rocksdb/sst_file_writer.h>
 #include <rocksdb/table.h>
 
 #include <QByteArray>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
 #include <QVector> // we use this for the Height2Hash cache to save on memcopies since it's implicitly shared.
 
 #include <algorithm>
 #include <atomic>
 #include <cstring> // for memcpy
+#include <deque>
+#include <future>
+#include <limits>
 #include <list>
 #include <optional>
 #include <shared_mutex>
@@ -69,6 +78,8 @@ namespace {
     static const rocksdb::Slice kMeta{"meta"}, kDirty{"dirty"}, kUtxoCount{"utxo_count"},
                                 kTrue(reinterpret_cast<const char *>(&trueMem), sizeof(trueMem)),
                                 kFalse(reinterpret_cast<const char *>(&falseMem), sizeof(trueMem));
+    // RecordFile magic bytes for the "headers" and "txnum2txhash" files
+    static constexpr uint32_t kHeadersFileMagic = 0x00f026a1, kTxNumsFileMagic = 0x000012e2;
 
     // serialize/deser -- for basic types we use QDataStream, but we also have specializations at the end of this file
     template <typename Type>
@@ -277,6 +288,48 @@ namespace {
         return GenericDBGet<RetType, safeScalar>(db, k, false, errMsgPrefix, extraDataOk, ropts).value();
     }
 
+    /// Like GenericDBGet, but looks up all of `keysIn` with a single rocksdb MultiGet call, which batches the
+    /// memtable, block cache and file lookups. Returns a vector parallel to `keysIn` where missing keys are an optional
+    /// that is !has_value(). Throws on any other error. Only supports RetTypes that are deserialized via Deserialize().
+    template <typename RetType, typename KeyType>
+    std::vector<std::optional<RetType>> GenericDBMultiGet(rocksdb::DB *db, const std::vector<KeyType> & keysIn,
+                                                          const QString & errorMsgPrefix = QString(),
+                                                          const rocksdb::ReadOptions & ropts = rocksdb::ReadOptions())
+    {
+        static_assert(!std::is_scalar_v<RetType> && !std::is_base_of_v<QByteArray, RetType>,
+                      "GenericDBMultiGet only supports types that are deserialized via Deserialize()");
+        std::vector<std::optional<RetType>> ret(keysIn.size());
+        if (keysIn.empty())
+            return ret;
+        if (UNLIKELY(!db)) throw InternalError("GenericDBMultiGet was passed a null pointer!");
+        std::vector<QByteArray> keyBytes; // keeps the serialized keys alive for as long as the slices below need them
+        std::vector<rocksdb::Slice> keys;
+        keyBytes.reserve(keysIn.size());
+        keys.reserve(keysIn.size());
+        for (const auto & k : keysIn) {
+            keyBytes.push_back(Serialize(k));
+            keys.push_back(ToSlice(keyBytes.back()));
+        }
+        std::vector<std::string> values;
+        const auto statuses = db->MultiGet(ropts, keys, &values);
+        for (size_t i = 0; i < statuses.size(); ++i) {
+            const auto & status = statuses[i];
+            if (status.IsNotFound())
+                continue;
+            else if (!status.ok())
+                throw DatabaseError(QString("%1: %2")
+                                    .arg(!errorMsgPrefix.isEmpty() ? errorMsgPrefix : QString("Error reading a key from db %1").arg(DBName(db)))
+                                    .arg(StatusString(status)));
+            bool ok;
+            ret[i].emplace( Deserialize<RetType>(FromSlice(values[i]), &ok) );
+            if (!ok)
+                throw DatabaseSerializationError(
+                            QString("%1: Key was retrieved ok, but data could not be deserialized")
+                            .arg(!errorMsgPrefix.isEmpty() ? errorMsgPrefix : QString("Error deserializing an object from db %1").arg(DBName(db))));
+        }
+        return ret;
+    }
+
     /// Throws on all errors. Otherwise writes to db.
     template <bool safeScalar = false, typename KeyType, typename ValueType>
     void GenericDBPut
@@ -520,19 +573,49 @@ struct Storage::Pvt
                            height2HashesHits = 0, height2HashesMisses = 0;
     } lruCacheStats;
 
+    /// Serialized JSON results of scripthash queries, keyed by CachedResultKind byte + HashX. Null if the cache is
+    /// disabled via `result_cache_mem = 0`.
+    std::unique_ptr<CostCache<QByteArray, QByteArray>> resultCache;
+    static unsigned resultCacheItemCost(const QByteArray &key, const QByteArray &json) {
+        return unsigned(decltype(resultCache)::element_type::itemOverheadBytes() + size_t(key.size()) + size_t(json.size()));
+    }
+    static QByteArray resultCacheKey(CachedResultKind kind, const HashX &hashX) {
+        QByteArray key;
+        key.reserve(hashX.size() + 1);
+        key.append(char(kind));
+        key.append(hashX);
+        return key;
+    }
+    std::mutex resultCacheGenLock; ///< serializes putCachedResult() against the invalidate functions
+    std::atomic<uint64_t> resultCacheGen = 0; ///< incremented (with the above lock held) on every invalidation
+    struct ResultCacheStats {
+        std::atomic_size_t hits = 0, misses = 0, invalidations = 0;
+    } resultCacheStats;
+
+    /// Incremented (with blocksLock held exclusively) by undoLatestBlock(). See getHistoryTail().
+    std::atomic<uint64_t> undoCount = 0;
+
+    /// mempoolHistogram() result, valid while mempool.feeRateSizesVersion == feeHistogramVersion. Guarded by the
+    /// mutex, which is taken with the mempool lock held (in shared mode).
+    std::mutex feeHistogramLock;
+    Mempool::FeeHistogramVec feeHistogram;
+    std::optional<uint64_t> feeHistogramVersion;
+
     /// this object is thread safe, but it needs to be initialized with headers before allowing client connections.
     std::unique_ptr<Merkle::Cache> merkleCache;
 
     HeaderHash genesisHash; // written-to once by either loadHeaders code or addBlock for block 0. Guarded by headerVerifierLock.
 
-    Mempool mempool; ///< app-wide mempool data -- does not get saved to db. Controller.cpp writes to this
-    Mempool::FeeHistogramVec mempoolFeeHistogram; ///< refreshed periodically by refreshMempoolHistogram()
+    Mempool mempool; ///< app-wide mempool data -- does not get saved to db. Controller.cpp writes to this, and addBlock prunes confirmed txs from it
     RWLock mempoolLock;
+    bool mempoolSaveArmed = false; ///< set at the end of startup(), cleared by saveMempool() so that it only runs once
 };
 
 Storage::Storage(const std::shared_ptr<const Options> & options_)
     : Mgr(nullptr), options(options_), subsmgr(new SubsMgr(options, this)), p(std::make_unique<Pvt>())
 {
+    if (options->resultCacheMB > 0)
+        p->resultCache = std::make_unique<CostCache<QByteArray, QByteArray>>(unsigned(options->resultCacheMB) * 1024u * 1024u);
     setObjectName("Storage");
     _thread.setObjectName(objectName());
 }
@@ -597,6 +680,10 @@ void Storage::startup()
 
     }  // /open db's
 
+    // import snapshot, if specified on CLI -- this must come before the meta check and the loadCheck*() calls below
+    if (!options->importSnapshot.isEmpty())
+        importSnapshot(options->importSnapshot);
+
     // load/check meta
     {
         Meta m_db;
@@ -632,6 +719,9 @@ void Storage::startup()
     loadCheckUTXOsInDB();
     // load check earliest undo to populate earliestUndoHeight
     loadCheckEarliestUndo();
+    // load the mempool saved at the last clean shutdown, if any -- this depends on the headers being loaded
+    loadMempool();
+    p->mempoolSaveArmed = true;
 
     start(); // starts our thread
 }
@@ -640,6 +730,7 @@ void Storage::cleanup()
 {
     stop(); // joins our thread
     if (subsmgr) subsmgr->cleanup();
+    saveMempool();
     // TODO: unsaved/"dirty state" detection here -- and forced save, if needed.
 }
 
@@ -670,6 +761,15 @@ auto Storage::stats() const -> Stats
         m["~misses"] = qlonglong(p->lruCacheStats.height2HashesMisses);
         caches["LRU Cache: Block Height -> TxHashes"] = m;
     }
+    if (p->resultCache) {
+        QVariantMap m;
+        m["nItems"] = p->resultCache->size();
+        m["Size bytes"] = p->resultCache->totalCost();
+        m["~hits"] = qlonglong(p->resultCacheStats.hits);
+        m["~misses"] = qlonglong(p->resultCacheStats.misses);
+        m["invalidations"] = qlonglong(p->resultCacheStats.invalidations);
+        caches["LRU Cache: Scripthash results"] = m;
+    }
     {
         const size_t nHashes = p->merkleCache->size(), bytes = nHashes * (HashLen + sizeof(HeaderHash));
         caches["merkleHeaders_Size"] = qulonglong(nHashes);
@@ -876,7 +976,7 @@ auto Storage::headersFromHeight(BlockHeight height, unsigned count, QString *err
 void Storage::loadCheckHeadersInDB()
 {
     assert(p->blockHeaderSize() > 0);
-    p->headersFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "headers", size_t(p->blockHeaderSize()), 0x00f026a1); // may throw
+    p->headersFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "headers", size_t(p->blockHeaderSize()), kHeadersFileMagic); // may throw
 
     Log() << "Verifying headers ...";
     uint32_t num = unsigned(p->headersFile->numRecords());
@@ -924,7 +1024,7 @@ void Storage::loadCheckHeadersInDB()
 void Storage::loadCheckTxNumsFileAndBlkInfo()
 {
     // may throw.
-    p->txNumsFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "txnum2txhash", HashLen, 0x000012e2);
+    p->txNumsFile = std::make_unique<RecordFile>(options->datadir + QDir::separator() + "txnum2txhash", HashLen, kTxNumsFileMagic);
     p->txNumNext = p->txNumsFile->numRecords();
     Debug() << "Read TxNumNext from file: " << p->txNumNext.load();
     TxNum ct = 0;
@@ -1139,6 +1239,13 @@ std::optional<TXOInfo> Storage::utxoGetFromDB(const TXO &txo, bool throwIfMissin
     return GenericDBGet<TXOInfo>(p->db.utxoset.get(), txo, !throwIfMissing, errMsgPrefix, false, p->db.defReadOpts);
 }
 
+std::vector<std::optional<TXOInfo>> Storage::utxoGetFromDB(const std::vector<TXO> &txos)
+{
+    assert(bool(p->db.utxoset));
+    static const QString errMsgPrefix("Failed to read a utxo from the utxo db");
+    return GenericDBMultiGet<TXOInfo>(p->db.utxoset.get(), txos, errMsgPrefix, p->db.defReadOpts);
+}
+
 int64_t Storage::utxoSetSize() const { return p->utxoCt; }
 double Storage::utxoSetSizeMiB() const {
     constexpr int64_t elemSize = TXO::serSize() + TXOInfo::serSize();
@@ -1231,12 +1338,6 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
     // take all locks now.. since this is a Big Deal. TODO: add more locks here?
     std::scoped_lock guard(p->blocksLock, p->headerVerifierLock, p->blkInfoLock, p->mempoolLock);
 
-    if (notify)
-        // mark ALL of mempool for notify so we can properly detect drops that weren't in block but also disappeared from mempool
-        notify->merge(Util::keySet<NotifySet>(p->mempool.hashXTxs));
-
-    p->mempool.clear(); // just make sure the mempool is clean
-
     const auto verifUndo = p->headerVerifier; // keep a copy of verifier state for undo purposes in case this fails
     // This object ensures that if an exception is thrown while we are in the below code, we undo the header verifier
     // and return it to its previous state.  Note the defer'd functor is called with the above scoped_lock held.
@@ -1497,10 +1598,41 @@ void Storage::addBlock(PreProcessedBlockPtr ppb, bool saveUndo, unsigned nReserv
         saveUtxoCt();
         setDirty(false);
 
+        // Update the mempool incrementally rather than clearing it.  This saves the SynchMempoolTask from having to
+        // re-download every tx still in the mempool after each block, and it keeps unconfirmed balances correct in
+        // the meantime.
+        if (!p->mempool.txs.empty()) {
+            Mempool::TxHashNumMap confirmed;
+            for (size_t i = 0; i < ppb->txInfos.size(); ++i)
+                if (const auto & hash = ppb->txInfos[i].hash; p->mempool.txs.count(hash))
+                    confirmed.emplace(hash, blockTxNum0 + i);
+            // Gather what the block spent, so that mempool txs that conflict with it are dropped (bitcoind will have
+            // evicted these and their descendants) rather than waiting for the next mempool synch.
+            Mempool::BlockSpends spends;
+            for (const auto & [hashX, ag] : ppb->hashXAggregated)
+                if (!ag.ins.empty() && p->mempool.hashXTxs.count(hashX))
+                    spends.hashXs.insert(hashX);
+            if (!spends.hashXs.empty()) {
+                spends.txos.reserve(ppb->inputs.size());
+                for (size_t i = 1; i < ppb->inputs.size(); ++i) // skip the coinbase input
+                    spends.txos.emplace(TXO{ppb->inputs[i].prevoutHash, ppb->inputs[i].prevoutN});
+            }
+            const auto nBefore = p->mempool.txs.size();
+            auto affected = p->mempool.confirmedInBlock(confirmed, spends, ppb->height);
+            if (const auto nDropped = nBefore - p->mempool.txs.size() - confirmed.size(); nDropped)
+                DebugM("addBlock: dropped ", nDropped, Util::Pluralize(" conflicting mempool tx", nDropped));
+            if (notify)
+                notify->merge(affected);
+        }
+
         undoVerifierOnScopeEnd.disable(); // indicate to the "Defer" object declared at the top of this function that it shouldn't undo anything anymore as we are happy now with the db state now.
     } /// release locks
 
-    // now, do notifications
+    // now, drop stale cached results and do notifications
+    if (notify)
+        invalidateCachedResults(*notify);
+    else
+        invalidateAllCachedResults();
     if (notify && subsmgr && !notify->empty())
         subsmgr->enqueueNotifications(std::move(*notify));
 }
@@ -1516,11 +1648,7 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
         // take all locks now.. since this is a Big Deal. TODO: add more locks here?
         std::scoped_lock guard(p->blocksLock, p->headerVerifierLock, p->blkInfoLock, p->mempoolLock);
 
-        if (notify)
-            // mark ALL of mempool for notify so we can detect drops that weren't in block but also disappeared from mempool properly
-            notify->merge(Util::keySet<UndoInfo::ScriptHashSet>(p->mempool.hashXTxs));
-
-        p->mempool.clear(); // make sure mempool is clean
+        ++p->undoCount; // TxNums from this block will be recycled, so tell getHistoryTail() callers their prefix is stale
 
         const auto t0 = Util::getTimeNS();
 
@@ -1566,6 +1694,12 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
 
             const auto txNum0 = undo.blkInfo.txNum0;
 
+            // Drop only the mempool txs that spent this block's outputs (and their descendants), rather than clearing
+            // the whole mempool. The rest of the mempool is still valid, so its scripthashes need no notification.
+            // The next mempool synch re-adds this block's txs and the dropped txs, notifying their scripthashes.
+            if (auto affected = p->mempool.undoBlock(undo.scriptHashes, txNum0); notify)
+                notify->merge(affected);
+
             // undo the scripthash histories
             for (const auto & sh : undo.scriptHashes) {
                 const QString shHex = Util::ToHexFast(sh);
@@ -1647,7 +1781,11 @@ BlockHeight Storage::undoLatestBlock(bool notifySubs)
               << ", in " << QString::number(elapsedms, 'f', 2) << " msec, new height now: " << prevHeight;
     } // release locks
 
-    // now, do notifications
+    // now, drop stale cached results and do notifications
+    if (notify)
+        invalidateCachedResults(*notify);
+    else
+        invalidateAllCachedResults();
     if (notify && subsmgr && !notify->empty())
         subsmgr->enqueueNotifications(std::move(*notify));
 
@@ -1724,6 +1862,55 @@ std::optional<unsigned> Storage::heightForTxNum(TxNum n) const
     return ret;
 }
 
+std::vector<TxHash> Storage::hashesForTxNums(const std::vector<TxNum> &nums) const
+{
+    std::vector<TxHash> ret(nums.size());
+    std::vector<TxNum> misses;
+    for (size_t i = 0; i < nums.size(); ++i) {
+        if (auto opt = p->lruNum2Hash.object(nums[i]); opt.has_value()) {
+            ret[i] = std::move(*opt);
+            ++p->lruCacheStats.num2HashHits;
+        } else
+            misses.push_back(nums[i]);
+    }
+    if (misses.empty())
+        return ret;
+    p->lruCacheStats.num2HashMisses += misses.size();
+    // read the misses front-to-back, each only once, with a single open of the file
+    std::sort(misses.begin(), misses.end());
+    misses.erase(std::unique(misses.begin(), misses.end()), misses.end());
+    QString errStr;
+    const auto recs = p->txNumsFile->readRandomRecords(misses, &errStr);
+    if (recs.size() != misses.size())
+        throw DatabaseError(QString("Error reading TxHash for TxNum %1: %2").arg(misses[recs.size()]).arg(errStr));
+    for (size_t i = 0; i < nums.size(); ++i) {
+        if (!ret[i].isEmpty())
+            continue;
+        const auto it = std::lower_bound(misses.begin(), misses.end(), nums[i]);
+        ret[i] = recs[size_t(it - misses.begin())];
+    }
+    for (size_t j = 0; j < misses.size(); ++j)
+        p->lruNum2Hash.insert(misses[j], recs[j], p->lruNum2HashSizeCalc());
+    return ret;
+}
+
+std::vector<std::optional<unsigned>> Storage::heightsForTxNums(const std::vector<TxNum> &nums) const
+{
+    std::vector<std::optional<unsigned>> ret(nums.size());
+    SharedLockGuard g(p->blkInfoLock);
+    for (size_t i = 0; i < nums.size(); ++i) {
+        const TxNum n = nums[i];
+        auto it = p->blkInfosByTxNum.upper_bound(n);  // O(logN) search; find the block *AFTER* n, then go backw on to find the block in range
+        if (it != p->blkInfosByTxNum.begin()) {
+            --it;
+            const auto & bi = p->blkInfos[it->second];
+            if (n >= bi.txNum0 && n < bi.txNum0+bi.nTx)
+                ret[i] = it->second;
+        }
+    }
+    return ret;
+}
+
 std::optional<TxHash> Storage::hashForHeightAndPos(BlockHeight height, unsigned posInBlock) const
 {
     std::optional<TxHash> ret;
@@ -1793,244 +1980,544 @@ std::vector<TxHash> Storage::txHashesForBlockInBitcoindMemoryOrder(BlockHeight h
 
 auto Storage::getHistory(const HashX & hashX, bool conf, bool unconf) const -> History
 {
-    History ret;
-    const size_t maxHistory = size_t(options->maxHistory);
-    if (hashX.length() != HashLen)
-        return ret;
     try {
+        return std::move(getHistories({hashX}, conf, unconf).front());
+    } catch (const std::exception &e) {
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+    }
+    return {};
+}
+
+auto Storage::getHistories(const std::vector<HashX> & hashXs, bool conf, bool unconf) const -> std::vector<History>
+{
+    std::vector<History> ret(hashXs.size());
+    std::vector<bool> tooLarge(hashXs.size()); // items whose confirmed history alone exceeds maxHistory are left empty
+    const size_t maxHistory = size_t(options->maxHistory);
+    const auto WarnTooLarge = [maxHistory](const HashX &hashX, size_t n) {
+        Warning(Log::Magenta) << "getHistory: " << QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
+                                                   .arg(QString(hashX.toHex())).arg(maxHistory).arg(n);
+    };
+    size_t nTotal = 0; // the number of items across all of the histories, which is also limited to MaxHistory
+    const auto CheckTotal = [&](size_t n) {
+        if (UNLIKELY((nTotal += n) > maxHistory))
+            throw HistoryTooLarge(QString("The combined history of %1 scripthashes exceeds MaxHistory of %2 items;"
+                                          " please request fewer scripthashes at a time")
+                                  .arg(hashXs.size()).arg(maxHistory));
+    };
+    {
         SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
         if (conf) {
             static const QString err("Error retrieving history for a script hash");
-            auto nums_opt = GenericDBGet<TxNumVec>(p->db.shist.get(), hashX, true, err, false, p->db.defReadOpts);
-            if (nums_opt.has_value()) {
-                auto & nums = *nums_opt;
+            std::vector<HashX> keys;
+            std::vector<size_t> keyPos; // keys[k] is hashXs[keyPos[k]]
+            keys.reserve(hashXs.size());
+            keyPos.reserve(hashXs.size());
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                if (hashXs[i].length() != HashLen)
+                    continue;
+                keys.push_back(hashXs[i]);
+                keyPos.push_back(i);
+            }
+            const auto numVecs = GenericDBMultiGet<TxNumVec>(p->db.shist.get(), keys, err, p->db.defReadOpts);
+            // Resolve the TxNums of all of the histories together: this takes the blkInfo lock once, and reads the
+            // txnum file once, for all of them.
+            TxNumVec allNums;
+            std::vector<std::pair<size_t, size_t>> ranges(hashXs.size()); // hashXs[i] -> [begin, end) in allNums
+            for (size_t k = 0; k < keys.size(); ++k) {
+                if (!numVecs[k].has_value())
+                    continue;
+                const auto & nums = *numVecs[k];
                 if (UNLIKELY(nums.size() > maxHistory)) {
-                    throw HistoryTooLarge(QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
-                                          .arg(QString(hashX.toHex())).arg(maxHistory).arg(nums.size()));
-                }
-                ret.reserve(nums.size());
-                // TODO: The below could use some optimization.  A batched version of both hashForTxNum and
-                // heightForTxNum are low-hanging fruit for optimization.  Each call to the below takes a shared lock
-                // then releases it, for each item.  I imagine batched versions would have significantly less overhead
-                // per item, which could add up to huge performance savings on large histories.  This is a very
-                // low hanging fruit for optimization -- thus I am leaving this comment here so I can remember to come
-                // back and optmize the below.  /TODO
-                for (auto num : nums) {
-                    auto hash = hashForTxNum(num).value(); // may throw, but that indicates some database inconsistency. we catch below
-                    auto height = heightForTxNum(num).value(); // may throw, same deal
-                    ret.emplace_back(HistoryItem{hash, int(height), {}});
+                    WarnTooLarge(keys[k], nums.size());
+                    tooLarge[keyPos[k]] = true;
+                    continue;
                 }
+                CheckTotal(nums.size()); // throws before we go on to resolve any of the TxNums
+                ranges[keyPos[k]] = {allNums.size(), allNums.size() + nums.size()};
+                allNums.insert(allNums.end(), nums.begin(), nums.end());
+            }
+            const auto hashes = hashesForTxNums(allNums); // may throw, but that indicates some database inconsistency
+            const auto heights = heightsForTxNums(allNums);
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                const auto [begin, end] = ranges[i];
+                auto & hist = ret[i];
+                hist.reserve(end - begin);
+                for (size_t j = begin; j < end; ++j)
+                    hist.emplace_back(HistoryItem{hashes[j], int(heights[j].value()), {}}); // .value() may throw, same deal
             }
         }
         if (unconf) {
             auto [mempool, lock] = this->mempool();
-            if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
-                const auto & txvec = it->second;
-                const size_t total = ret.size() + txvec.size();
-                if (UNLIKELY(total > maxHistory)) {
-                    throw HistoryTooLarge(QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
-                                          .arg(QString(hashX.toHex())).arg(maxHistory).arg(total));
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                if (tooLarge[i])
+                    continue;
+                if (auto it = mempool.hashXTxs.find(hashXs[i]); it != mempool.hashXTxs.end()) {
+                    auto & hist = ret[i];
+                    const auto & txvec = it->second;
+                    const size_t total = hist.size() + txvec.size();
+                    if (UNLIKELY(total > maxHistory)) {
+                        WarnTooLarge(hashXs[i], total);
+                        continue; // leave just the confirmed history
+                    }
+                    CheckTotal(txvec.size());
+                    hist.reserve(total);
+                    for (const auto & tx : txvec)
+                        hist.emplace_back(HistoryItem{tx->hash, tx->hasUnconfirmedParentTx ? -1 : 0, tx->fee});
                 }
-                ret.reserve(total);
-                for (const auto & tx : txvec)
-                    ret.emplace_back(HistoryItem{tx->hash, tx->hasUnconfirmedParentTx ? -1 : 0, tx->fee});
             }
         }
-    } catch (const std::exception &e) {
-        Warning(Log::Magenta) << __func__ << ": " << e.what();
     }
     return ret;
 }
 
-auto Storage::listUnspent(const HashX & hashX) const -> UnspentItems
+auto Storage::getHistoryTail(const HashX &hashX, size_t startIndex, TxNum prevTxNum, uint64_t undoCount) const -> HistoryTail
 {
-    UnspentItems ret;
-    if (hashX.length() != HashLen)
+    HistoryTail ret;
+    const size_t maxHistory = size_t(options->maxHistory);
+    SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
+    ret.undoCount = p->undoCount.load();
+    if (ret.undoCount != undoCount)
+        startIndex = 0; // a block was undone, the TxNums in the caller's prefix may have been recycled
+    static const QString err("Error retrieving history for a script hash");
+    auto nums = GenericDBGet<TxNumVec>(p->db.shist.get(), hashX, true, err, false, p->db.defReadOpts).value_or(TxNumVec{});
+    ret.nConfirmed = nums.size();
+    if (UNLIKELY(nums.size() > maxHistory)) {
+        ret.tooLarge = true;
         return ret;
+    }
+    if (!nums.empty())
+        ret.lastConfirmedTxNum = nums.back();
+    if (startIndex > 0 && startIndex <= nums.size() && nums[startIndex - 1] == prevTxNum) {
+        ret.startIndex = startIndex;
+        nums.erase(nums.begin(), nums.begin() + std::ptrdiff_t(startIndex));
+    }
+    const auto hashes = hashesForTxNums(nums);
+    const auto heights = heightsForTxNums(nums);
+    ret.confirmed.reserve(nums.size());
+    for (size_t i = 0; i < nums.size(); ++i)
+        ret.confirmed.emplace_back(HistoryItem{hashes[i], int(heights[i].value()), {}});
+
+    auto [mempool, lock] = this->mempool();
+    if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
+        if (const size_t total = ret.nConfirmed + it->second.size(); UNLIKELY(total > maxHistory)) {
+            // same as getHistories(): leave just the confirmed history
+            Warning(Log::Magenta) << "getHistory: " << QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
+                                                       .arg(QString(hashX.toHex())).arg(maxHistory).arg(total);
+            return ret;
+        }
+        ret.unconfirmed.reserve(it->second.size());
+        for (const auto & tx : it->second)
+            ret.unconfirmed.emplace_back(HistoryItem{tx->hash, tx->hasUnconfirmedParentTx ? -1 : 0, tx->fee});
+    }
+    return ret;
+}
+
+auto Storage::getHistoryRange(const HashX &hashX, unsigned fromHeight, std::optional<unsigned> toHeight) const -> History
+{
+    History ret;
+    const size_t maxHistory = size_t(options->maxHistory);
+    const auto ThrowTooLarge = [&](size_t n) {
+        throw HistoryTooLarge(QString("History for %1 in the requested range has %2 items, exceeding MaxHistory of %3;"
+                                      " please request a narrower height range")
+                              .arg(QString(Util::ToHexFast(hashX))).arg(n).arg(maxHistory));
+    };
+    SharedLockGuard g(p->blocksLock);  // makes sure history doesn't mutate from underneath our feet
+    // translate the height range to the TxNum range [numBegin, numEnd)
+    TxNum numBegin, numEnd;
+    {
+        SharedLockGuard g2(p->blkInfoLock);
+        const auto TxNumForHeight = [this](unsigned height) {
+            return height < p->blkInfos.size() ? p->blkInfos[height].txNum0 : p->txNumNext.load();
+        };
+        numBegin = TxNumForHeight(fromHeight);
+        numEnd = toHeight ? TxNumForHeight(*toHeight) : p->txNumNext.load();
+    }
+    if (numBegin < numEnd) {
+        // Read the raw serialized TxNumVec and decode only the slice we need from it. It is a series of 6-byte TxNums
+        // in blockchain order, thus sorted, so we can binary search it in-place.
+        rocksdb::PinnableSlice datum;
+        const auto status = p->db.shist->Get(p->db.defReadOpts, p->db.shist->DefaultColumnFamily(), ToSlice(hashX), &datum);
+        if (!status.ok() && !status.IsNotFound())
+            throw DatabaseError(QString("Error retrieving history for a script hash: %1").arg(StatusString(status)));
+        constexpr auto compactSize = CompactTXO::compactTxNumSize(); /* 6 */
+        if (UNLIKELY(datum.size() % compactSize))
+            throw DatabaseSerializationError("Error retrieving history for a script hash: data could not be deserialized");
+        const auto *base = reinterpret_cast<const std::byte *>(datum.data());
+        const size_t n = datum.size() / compactSize;
+        const auto NumAt = [base](size_t i) { return CompactTXO::txNumFromCompactBytes(base + i * compactSize); };
+        const auto LowerBound = [&NumAt, n](TxNum num) {
+            size_t lo = 0, hi = n;
+            while (lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (NumAt(mid) < num)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return lo;
+        };
+        const size_t begin = LowerBound(numBegin), end = LowerBound(numEnd);
+        if (end - begin > maxHistory)
+            ThrowTooLarge(end - begin);
+        TxNumVec nums;
+        nums.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i)
+            nums.push_back(NumAt(i));
+        const auto hashes = hashesForTxNums(nums);
+        const auto heights = heightsForTxNums(nums);
+        ret.reserve(nums.size());
+        for (size_t i = 0; i < nums.size(); ++i)
+            ret.emplace_back(HistoryItem{hashes[i], int(heights[i].value()), {}});
+    }
+    if (!toHeight) {
+        auto [mempool, lock] = this->mempool();
+        if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
+            const size_t total = ret.size() + it->second.size();
+            if (total > maxHistory)
+                ThrowTooLarge(total);
+            ret.reserve(total);
+            for (const auto & tx : it->second)
+                ret.emplace_back(HistoryItem{tx->hash, tx->hasUnconfirmedParentTx ? -1 : 0, tx->fee});
+        }
+    }
+    return ret;
+}
+
+auto Storage::listUnspent(const HashX & hashX) const -> UnspentItems
+{
     try {
-        const size_t maxHistory = size_t(options->maxHistory);
-        constexpr size_t iota = 10; // we initially reserve this many items in the returned array in order to prevent redundant allocations in the common case.
-        std::unordered_set<TXO> mempoolConfirmedSpends;
-        mempoolConfirmedSpends.reserve(iota);
-        ret.reserve(iota);
+        return std::move(listUnspents({hashX}).front());
+    } catch (const std::exception &e) {
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+    }
+    return {};
+}
+
+auto Storage::listUnspents(const std::vector<HashX> & hashXs) const -> std::vector<UnspentItems>
+{
+    std::vector<UnspentItems> ret(hashXs.size());
+    std::vector<bool> failed(hashXs.size()); // items that were invalid or too large are left empty
+    const auto Fail = [&ret, &failed](size_t i, const char *what) {
+        if (what)
+            Warning(Log::Magenta) << "listUnspent: " << what;
+        ret[i].clear();
+        failed[i] = true;
+    };
+    const size_t maxHistory = size_t(options->maxHistory);
+    const auto ThrowTotalTooLarge = [&hashXs, maxHistory] {
+        throw HistoryTooLarge(QString("The combined unspent history of %1 scripthashes exceeds MaxHistory of %2 items;"
+                                      " please request fewer scripthashes at a time")
+                              .arg(hashXs.size()).arg(maxHistory));
+    };
+    size_t nMempoolTotal = 0; // the number of mempool items across all of ret
+    {
+        constexpr size_t iota = 10; // we initially reserve this many items in each returned array in order to prevent redundant allocations in the common case.
+        std::vector<std::unordered_set<TXO>> mempoolConfirmedSpends(hashXs.size());
+        struct ConfirmedTXO { size_t pos; CompactTXO ctxo; }; ///< a confirmed utxo for hashXs[pos], still to be resolved
+        std::vector<ConfirmedTXO> ctxos;
+        for (auto & items : ret)
+            items.reserve(iota);
         {
             // take shared lock (ensure history doesn't mutate from underneath our feet)
             SharedLockGuard g(p->blocksLock);
             const TxNum veryHighTxNum = getTxNum() + 100000000;  // pick an absurdly high TxNum that is 100 million past current. This is a fudge so sorting works ok for unconfirmed tx's so that they appear at the end.
             {
-                // grab mempool utxos for scripthash -- we do mempool first so as to build the "mempoolConfirmedSpends" set as we iterate.
+                // grab mempool utxos for each scripthash -- we do mempool first so as to build the "mempoolConfirmedSpends" sets as we iterate.
                 auto [mempool, lock] = this->mempool(); // shared lock
-                if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
-                    const auto & txvec = it->second;
-                    for (const auto & tx : txvec) {
-                        if (!tx) {
-                            // defensive programming. should never happen
-                            Warning() << "Cannot find tx for sh " << hashX.toHex() << ". FIXME!!";
-                            continue;
-                        }
-                        if (auto it2 = tx->hashXs.find(hashX); LIKELY(it2 != tx->hashXs.end())) {
-                            const auto & ioinfo = it2->second;
-                            // make sure to put any confirmed spends we see now in the "mempool confirmed spends" set
-                            // so we know not to include them in the list of utxos from the DB later in this function!
-                            for (const auto & [txo, txoinfo] : ioinfo.confirmedSpends) {
-                                mempoolConfirmedSpends.insert(txo);
+                for (size_t i = 0; i < hashXs.size(); ++i) {
+                    const HashX & hashX = hashXs[i];
+                    if (hashX.length() != HashLen) {
+                        Fail(i, nullptr);
+                        continue;
+                    }
+                    auto it = mempool.hashXTxs.find(hashX);
+                    if (it == mempool.hashXTxs.end())
+                        continue;
+                    try {
+                        auto & items = ret[i];
+                        const auto & txvec = it->second;
+                        for (const auto & tx : txvec) {
+                            if (!tx) {
+                                // defensive programming. should never happen
+                                Warning() << "Cannot find tx for sh " << hashX.toHex() << ". FIXME!!";
+                                continue;
                             }
-                            for (const auto ionum : ioinfo.utxo) {
-                                if (decltype(tx->txos.cbegin()) it3;
-                                        LIKELY( ionum < tx->txos.size() && (it3 = tx->txos.cbegin() + ionum)->isValid() ))
-                                {
-                                    ret.emplace_back(UnspentItem{
-                                        { tx->hash, 0 /* always put 0 for height here */, tx->fee }, // base HistoryItem
-                                        ionum, // .tx_pos
-                                        it3->amount,  // .value
-                                        TxNum(1) + veryHighTxNum + TxNum(tx->hasUnconfirmedParentTx ? 1 : 0), // .txNum (this is fudged for sorting at the end properly)
-                                    });
-                                    if (UNLIKELY(ret.size() > maxHistory)) {
-                                        throw HistoryTooLarge(QString("Unspent history too large for %1, exceeds MaxHistory of %2")
-                                                              .arg(QString(hashX.toHex())).arg(maxHistory));
+                            if (auto it2 = tx->hashXs.find(hashX); LIKELY(it2 != tx->hashXs.end())) {
+                                const auto & ioinfo = it2->second;
+                                // make sure to put any confirmed spends we see now in the "mempool confirmed spends" set
+                                // so we know not to include them in the list of utxos from the DB later in this function!
+                                for (const auto & [txo, txoinfo] : ioinfo.confirmedSpends) {
+                                    mempoolConfirmedSpends[i].insert(txo);
+                                }
+                                for (const auto ionum : ioinfo.utxo) {
+                                    if (decltype(tx->txos.cbegin()) it3;
+                                            LIKELY( ionum < tx->txos.size() && (it3 = tx->txos.cbegin() + ionum)->isValid() ))
+                                    {
+                                        items.emplace_back(UnspentItem{
+                                            { tx->hash, 0 /* always put 0 for height here */, tx->fee }, // base HistoryItem
+                                            ionum, // .tx_pos
+                                            it3->amount,  // .value
+                                            TxNum(1) + veryHighTxNum + TxNum(tx->hasUnconfirmedParentTx ? 1 : 0), // .txNum (this is fudged for sorting at the end properly)
+                                        });
+                                        if (UNLIKELY(items.size() > maxHistory)) {
+                                            throw HistoryTooLarge(QString("Unspent history too large for %1, exceeds MaxHistory of %2")
+                                                                  .arg(QString(hashX.toHex())).arg(maxHistory));
+                                        }
+                                    } else {
+                                        // this should never happen!
+                                        Warning() << "Cannot find txo " << ionum << " for sh " << hashX.toHex() << " in tx " << tx->hash.toHex();
+                                        continue;
                                     }
-                                } else {
-                                    // this should never happen!
-                                    Warning() << "Cannot find txo " << ionum << " for sh " << hashX.toHex() << " in tx " << tx->hash.toHex();
-                                    continue;
                                 }
+                            } else {
+                                // defensive programming. should never happen
+                                Warning() << "Cannot find scripthash " << hashX.toHex() << " in tx 'hashX -> IOInfo' map for tx " << tx->hash.toHex() << ". FIXME!";
                             }
-                        } else {
-                            // defensive programming. should never happen
-                            Warning() << "Cannot find scripthash " << hashX.toHex() << " in tx 'hashX -> IOInfo' map for tx " << tx->hash.toHex() << ". FIXME!";
                         }
+                    } catch (const HistoryTooLarge &e) {
+                        Fail(i, e.what());
                     }
+                    if (UNLIKELY((nMempoolTotal += ret[i].size()) > maxHistory))
+                        ThrowTotalTooLarge();
                 }
             } // release mempool lock
             { // begin confirmed/db search
+                // A single iterator is re-used (re-seeked) for all of the scripthashes.
                 std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(p->db.defReadOpts));
-                const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
-
-                // Search table for all keys that start with hashx's bytes. Note: the loop end-condition is strange.
-                // See: https://github.com/facebook/rocksdb/wiki/Prefix-Seek-API-Changes#transition-to-the-new-usage
-                rocksdb::Slice key;
-                std::list<CompactTXO> ctxoList;
-                size_t ctxoListSize = 0;
-                // we do it this way as two separate loops in order to avoid the expensive heightForTxNum lookups below in
-                // the case where the history is huge.
-                for (iter->Seek(prefix); iter->Valid() && (key = iter->key()).starts_with(prefix); iter->Next()) {
-                    if (key.size() != HashLen + CompactTXO::serSize())
-                        // should never happen, indicates db corruption
-                        throw InternalError("Key size for hashx is invalid");
-                    const CompactTXO ctxo = CompactTXO::fromBytes(reinterpret_cast<const std::byte *>(key.data() + HashLen), CompactTXO::serSize());
-                    if (!ctxo.isValid())
-                        // should never happen, indicates db corruption
-                        throw InternalError("Deserialized CompactTXO is invalid");
-                    ctxoList.emplace_back(ctxo);
-                    if (UNLIKELY(++ctxoListSize + ret.size() > maxHistory)) {
-                        throw HistoryTooLarge(QString("Unspent history too large for %1, exceeds MaxHistory of %2")
-                                              .arg(QString(hashX.toHex())).arg(maxHistory));
+                for (size_t i = 0; i < hashXs.size(); ++i) {
+                    if (failed[i])
+                        continue;
+                    const HashX & hashX = hashXs[i];
+                    const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
+                    const size_t ctxosBegin = ctxos.size();
+                    try {
+                        // Search table for all keys that start with hashx's bytes. Note: the loop end-condition is strange.
+                        // See: https://github.com/facebook/rocksdb/wiki/Prefix-Seek-API-Changes#transition-to-the-new-usage
+                        rocksdb::Slice key;
+                        // we collect the ctxos first and resolve them all together below, in order to avoid the expensive
+                        // heightForTxNum lookups in the case where the history is huge.
+                        for (iter->Seek(prefix); iter->Valid() && (key = iter->key()).starts_with(prefix); iter->Next()) {
+                            if (key.size() != HashLen + CompactTXO::serSize())
+                                // should never happen, indicates db corruption
+                                throw InternalError("Key size for hashx is invalid");
+                            const CompactTXO ctxo = CompactTXO::fromBytes(reinterpret_cast<const std::byte *>(key.data() + HashLen), CompactTXO::serSize());
+                            if (!ctxo.isValid())
+                                // should never happen, indicates db corruption
+                                throw InternalError("Deserialized CompactTXO is invalid");
+                            ctxos.push_back({i, ctxo});
+                            if (UNLIKELY(ctxos.size() - ctxosBegin + ret[i].size() > maxHistory)) {
+                                throw HistoryTooLarge(QString("Unspent history too large for %1, exceeds MaxHistory of %2")
+                                                      .arg(QString(hashX.toHex())).arg(maxHistory));
+                            }
+                        }
+                    } catch (const HistoryTooLarge &e) {
+                        nMempoolTotal -= ret[i].size();
+                        ctxos.resize(ctxosBegin);
+                        Fail(i, e.what());
                     }
+                    if (UNLIKELY(ctxos.size() + nMempoolTotal > maxHistory))
+                        ThrowTotalTooLarge(); // before we go on to resolve any of the TxNums
                 }
-                for (const auto & ctxo : ctxoList) {
-                    static const QString err("Error retrieving the utxo for an unspent item");
-                    const auto hash = hashForTxNum(ctxo.txNum()).value(); // may throw, but that indicates some database inconsistency. we catch below
-                    const auto height = heightForTxNum(ctxo.txNum()).value(); // may throw, same deal
-                    const TXO txo{ hash, ctxo.N() };
-                    if (mempoolConfirmedSpends.count(txo))
+                // resolve all of the confirmed utxos of all of the scripthashes in one go
+                TxNumVec nums;
+                nums.reserve(ctxos.size());
+                for (const auto & c : ctxos)
+                    nums.push_back(c.ctxo.txNum());
+                const auto hashes = hashesForTxNums(nums); // may throw, but that indicates some database inconsistency
+                const auto heights = heightsForTxNums(nums);
+                std::vector<TXO> txos;
+                std::vector<size_t> txoCtxoIdx; // txos[k] came from ctxos[txoCtxoIdx[k]]
+                txos.reserve(ctxos.size());
+                txoCtxoIdx.reserve(ctxos.size());
+                for (size_t j = 0; j < ctxos.size(); ++j) {
+                    TXO txo{ hashes[j], ctxos[j].ctxo.N() };
+                    if (mempoolConfirmedSpends[ctxos[j].pos].count(txo))
                         // Skip items that are spent in mempool. This fixes a bug in Fulcrum 1.0.2 or earlier where the
                         // confirmed spends in the mempool were still appearing in the listunspent utxos.
                         continue;
-                    auto info = GenericDBGetFailIfMissing<TXOInfo>(p->db.utxoset.get(), txo, err, false, p->db.defReadOpts); // may throw -- indicates db inconsistency
-                    ret.emplace_back(UnspentItem{
-                        { hash, int(height), {} }, // base HistoryItem
-                        txo.outN,  // .tx_pos
+                    txos.push_back(std::move(txo));
+                    txoCtxoIdx.push_back(j);
+                }
+                static const QString err("Error retrieving the utxo for an unspent item");
+                const auto infos = GenericDBMultiGet<TXOInfo>(p->db.utxoset.get(), txos, err, p->db.defReadOpts); // may throw
+                for (size_t k = 0; k < txos.size(); ++k) {
+                    const size_t j = txoCtxoIdx[k];
+                    if (UNLIKELY(!infos[k].has_value()))
+                        // indicates db inconsistency
+                        throw DatabaseError(QString("%1: %2 is missing").arg(err, txos[k].toString()));
+                    const auto & info = *infos[k];
+                    ret[ctxos[j].pos].emplace_back(UnspentItem{
+                        { txos[k].txHash, int(heights[j].value()), {} }, // base HistoryItem; .value() may throw, same deal
+                        txos[k].outN,  // .tx_pos
                         info.amount, // .value
                         info.txNum, // .txNum
                     });
                 }
             } // end confirmed/db search
         } // release blocks lock
-        std::sort(ret.begin(), ret.end());
-        if (const auto sz = ret.size(), cap = ret.capacity(); cap - sz > iota && sz > 0 && double(cap)/double(sz) > 1.20)
-            // we only do this if we're wasting enough space (at least iota, and at least 20% space wasted),
-            // otherwise we don't bother since this returned object is fairly ephemeral and for smallish disparities
-            // between capacity and size, it's fine.
-            ret.shrink_to_fit();
-    } catch (const std::exception &e) {
-        Warning(Log::Magenta) << __func__ << ": " << e.what();
+        for (auto & items : ret) {
+            std::sort(items.begin(), items.end());
+            if (const auto sz = items.size(), cap = items.capacity(); cap - sz > iota && sz > 0 && double(cap)/double(sz) > 1.20)
+                // we only do this if we're wasting enough space (at least iota, and at least 20% space wasted),
+                // otherwise we don't bother since this returned object is fairly ephemeral and for smallish disparities
+                // between capacity and size, it's fine.
+                items.shrink_to_fit();
+        }
     }
     return ret;
 }
 
 auto Storage::getBalance(const HashX &hashX) const -> std::pair<bitcoin::Amount, bitcoin::Amount>
 {
-    std::pair<bitcoin::Amount, bitcoin::Amount> ret;
-    if (hashX.length() != HashLen)
-        return ret;
     try {
+        return getBalances({hashX}).front();
+    } catch (const std::exception &e) {
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+    }
+    return {};
+}
+
+auto Storage::getBalances(const std::vector<HashX> &hashXs) const -> std::vector<std::pair<bitcoin::Amount, bitcoin::Amount>>
+{
+    std::vector<std::pair<bitcoin::Amount, bitcoin::Amount>> ret(hashXs.size());
+    {
         // take shared lock (ensure history doesn't mutate from underneath our feet)
         SharedLockGuard g(p->blocksLock);
         {
-            // confirmed -- read from db using an iterator
+            // confirmed -- read from db using an iterator, which is re-used (re-seeked) for each scripthash
             std::unique_ptr<rocksdb::Iterator> iter(p->db.shunspent->NewIterator(p->db.defReadOpts));
-            const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
-
-            // Search table for all keys that start with hashx's bytes. Note: the loop end-condition is strange.
-            // See: https://github.com/facebook/rocksdb/wiki/Prefix-Seek-API-Changes#transition-to-the-new-usage
-            rocksdb::Slice key;
-            for (iter->Seek(prefix); iter->Valid() && (key = iter->key()).starts_with(prefix); iter->Next()) {
-                if (key.size() != HashLen + CompactTXO::serSize())
-                    // should never happen, indicates db corruption
-                    throw InternalError(QString("Key size for scripthash %1 is invalid").arg(QString(hashX.toHex())));
-                const CompactTXO ctxo = CompactTXO::fromBytes(reinterpret_cast<const std::byte *>(key.data() + HashLen), CompactTXO::serSize());
-                if (!ctxo.isValid())
-                    // should never happen, indicates db corruption
-                    throw InternalError(QString("Deserialized CompactTXO is invalid for scripthash %1").arg(QString(hashX.toHex())));
-                bool ok;
-                const bitcoin::Amount amount = Deserialize<bitcoin::Amount>(FromSlice(iter->value()), &ok);
-                if (UNLIKELY(!ok))
-                    throw InternalError(QString("Bad amount in db for ctxo %1 (%2)").arg(ctxo.toString()).arg(QString(hashX.toHex())));
-                if (UNLIKELY(!bitcoin::MoneyRange(amount)))
-                    throw InternalError(QString("Out-of-range amount in db for ctxo %1: %2").arg(ctxo.toString()).arg(amount / amount.satoshi()));
-                ret.first += amount; // tally the result
-            }
-            if (UNLIKELY(!bitcoin::MoneyRange(ret.first))) {
-                ret.first = bitcoin::Amount::zero();
-                throw InternalError(QString("Out-of-range total in db for getBalance on scripthash: %1").arg(QString(hashX.toHex())));
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                const HashX & hashX = hashXs[i];
+                if (hashX.length() != HashLen)
+                    continue;
+                auto & bal = ret[i];
+                try {
+                    const rocksdb::Slice prefix = ToSlice(hashX); // points to data in hashX
+
+                    // Search table for all keys that start with hashx's bytes. Note: the loop end-condition is strange.
+                    // See: https://github.com/facebook/rocksdb/wiki/Prefix-Seek-API-Changes#transition-to-the-new-usage
+                    rocksdb::Slice key;
+                    for (iter->Seek(prefix); iter->Valid() && (key = iter->key()).starts_with(prefix); iter->Next()) {
+                        if (key.size() != HashLen + CompactTXO::serSize())
+                            // should never happen, indicates db corruption
+                            throw InternalError(QString("Key size for scripthash %1 is invalid").arg(QString(hashX.toHex())));
+                        const CompactTXO ctxo = CompactTXO::fromBytes(reinterpret_cast<const std::byte *>(key.data() + HashLen), CompactTXO::serSize());
+                        if (!ctxo.isValid())
+                            // should never happen, indicates db corruption
+                            throw InternalError(QString("Deserialized CompactTXO is invalid for scripthash %1").arg(QString(hashX.toHex())));
+                        bool ok;
+                        const bitcoin::Amount amount = Deserialize<bitcoin::Amount>(FromSlice(iter->value()), &ok);
+                        if (UNLIKELY(!ok))
+                            throw InternalError(QString("Bad amount in db for ctxo %1 (%2)").arg(ctxo.toString()).arg(QString(hashX.toHex())));
+                        if (UNLIKELY(!bitcoin::MoneyRange(amount)))
+                            throw InternalError(QString("Out-of-range amount in db for ctxo %1: %2").arg(ctxo.toString()).arg(amount / amount.satoshi()));
+                        bal.first += amount; // tally the result
+                    }
+                    if (UNLIKELY(!bitcoin::MoneyRange(bal.first))) {
+                        bal.first = bitcoin::Amount::zero();
+                        throw InternalError(QString("Out-of-range total in db for getBalance on scripthash: %1").arg(QString(hashX.toHex())));
+                    }
+                } catch (const InternalError &e) {
+                    Warning(Log::Magenta) << "getBalance: " << e.what();
+                }
             }
         }
         {
             // unconfirmed -- check mempool
             auto [mempool, lock] = this->mempool(); // shared (read only) lock is held until scope end
-            if (auto it = mempool.hashXTxs.find(hashX); it != mempool.hashXTxs.end()) {
-                // for all tx's involving scripthash
-                bitcoin::Amount utxos, spends;
-                for (const auto & tx : it->second) {
-                    assert(bool(tx));
-                    auto it2 = tx->hashXs.find(hashX);
-                    if (UNLIKELY(it2 == tx->hashXs.end())) {
-                        throw InternalError(QString("scripthash %1 lists tx %2, which then lacks the IOInfo for said hashX! FIXME!")
-                                            .arg(QString(hashX.toHex())).arg(QString(tx->hash.toHex())));
-                    }
-                    auto & info = it2->second;
-                    for (const auto & [txo, txoinfo] : info.confirmedSpends)
-                        spends += txoinfo.amount;
-                    for (const auto ionum : info.utxo) {
-                        if (decltype(tx->txos.cbegin()) it3; UNLIKELY( ionum >= tx->txos.size()
-                                                                       || !(it3 = tx->txos.cbegin() + ionum)->isValid()) )
-                        {
-                            throw InternalError(QString("scripthash %1 lists tx %2, which then lacks a valid TXO IONum %3 for said hashX! FIXME!")
-                                                .arg(QString(hashX.toHex())).arg(QString(tx->hash.toHex())).arg(ionum));
-                        } else {
-                            utxos += it3->amount;
+            for (size_t i = 0; i < hashXs.size(); ++i) {
+                const HashX & hashX = hashXs[i];
+                auto it = mempool.hashXTxs.find(hashX);
+                if (it == mempool.hashXTxs.end())
+                    continue;
+                try {
+                    // for all tx's involving scripthash
+                    bitcoin::Amount utxos, spends;
+                    for (const auto & tx : it->second) {
+                        assert(bool(tx));
+                        auto it2 = tx->hashXs.find(hashX);
+                        if (UNLIKELY(it2 == tx->hashXs.end())) {
+                            throw InternalError(QString("scripthash %1 lists tx %2, which then lacks the IOInfo for said hashX! FIXME!")
+                                                .arg(QString(hashX.toHex())).arg(QString(tx->hash.toHex())));
+                        }
+                        auto & info = it2->second;
+                        for (const auto & [txo, txoinfo] : info.confirmedSpends)
+                            spends += txoinfo.amount;
+                        for (const auto ionum : info.utxo) {
+                            if (decltype(tx->txos.cbegin()) it3; UNLIKELY( ionum >= tx->txos.size()
+                                                                           || !(it3 = tx->txos.cbegin() + ionum)->isValid()) )
+                            {
+                                throw InternalError(QString("scripthash %1 lists tx %2, which then lacks a valid TXO IONum %3 for said hashX! FIXME!")
+                                                    .arg(QString(hashX.toHex())).arg(QString(tx->hash.toHex())).arg(ionum));
+                            } else {
+                                utxos += it3->amount;
+                            }
                         }
                     }
+                    ret[i].second = utxos - spends; // note this may not be MoneyRange (may be negative), which is ok.
+                } catch (const InternalError &e) {
+                    Warning(Log::Magenta) << "getBalance: " << e.what();
                 }
-                ret.second = utxos - spends; // note this may not be MoneyRange (may be negative), which is ok.
             }
         }
-    } catch (const std::exception &e) {
-        Warning(Log::Magenta) << __func__ << ": " << e.what();
     }
     return ret;
 }
 
+uint64_t Storage::resultCacheGeneration() const { return p->resultCacheGen.load(); }
+
+std::optional<QByteArray> Storage::getCachedResult(CachedResultKind kind, const HashX &hashX) const
+{
+    std::optional<QByteArray> ret;
+    if (p->resultCache) {
+        ret = p->resultCache->object(Pvt::resultCacheKey(kind, hashX));
+        if (ret)
+            ++p->resultCacheStats.hits;
+        else
+            ++p->resultCacheStats.misses;
+    }
+    return ret;
+}
+
+void Storage::putCachedResult(CachedResultKind kind, const HashX &hashX, const QByteArray &json, uint64_t generation)
+{
+    if (!p->resultCache)
+        return;
+    auto key = Pvt::resultCacheKey(kind, hashX);
+    const auto cost = Pvt::resultCacheItemCost(key, json);
+    std::lock_guard g(p->resultCacheGenLock);
+    if (generation != p->resultCacheGen.load())
+        return; // something was invalidated while the query ran, so `json` may already be stale
+    p->resultCache->insert(key, json, cost);
+}
+
+void Storage::invalidateCachedResults(const std::unordered_set<HashX, HashHasher> &hashXs)
+{
+    // Note: the generation is bumped even if the cache is disabled, since Server also uses it to tell apart
+    // otherwise-identical concurrent queries (see ServerBase::generic_do_async_coalesced).
+    std::lock_guard g(p->resultCacheGenLock);
+    ++p->resultCacheGen;
+    if (!p->resultCache)
+        return;
+    ++p->resultCacheStats.invalidations;
+    if (p->resultCache->isEmpty())
+        return;
+    for (const auto & hashX : hashXs)
+        for (const auto kind : {CachedResultKind::History, CachedResultKind::Mempool,
+                                CachedResultKind::Balance, CachedResultKind::Unspent})
+            p->resultCache->remove(Pvt::resultCacheKey(kind, hashX));
+}
+
+void Storage::invalidateAllCachedResults()
+{
+    std::lock_guard g(p->resultCacheGenLock);
+    ++p->resultCacheGen;
+    if (!p->resultCache)
+        return;
+    ++p->resultCacheStats.invalidations;
+    p->resultCache->clear();
+}
+
 std::vector<QByteArray> Storage::merkleCacheHelperFunc(unsigned int start, unsigned int count, QString *err)
 {
     auto vec = headersFromHeight_nolock_nocheck(start, count, err); // despite the name of this function, it does take a small lock internally and is thread-safe. we cannot use the public one as that would potentially cause a deadlock here
@@ -2101,24 +2588,271 @@ auto Storage::mutableMempool() -> std::pair<Mempool &, ExclusiveLockGuard>
     return {p->mempool, ExclusiveLockGuard{p->mempoolLock}};
 }
 
-void Storage::refreshMempoolHistogram()
+auto Storage::mempoolHistogram() const -> Mempool::FeeHistogramVec
 {
-    Mempool::FeeHistogramVec hist;
-    {
-        // shared lock
-        auto [mempool, lock] = this->mempool();
-        auto histTmp = mempool.calcCompactFeeHistogram();
-        hist.swap(histTmp);
+    auto [mempool, lock] = this->mempool(); // shared lock
+    std::lock_guard g(p->feeHistogramLock);
+    if (p->feeHistogramVersion != mempool.feeRateSizesVersion) {
+        p->feeHistogram = mempool.calcCompactFeeHistogram();
+        p->feeHistogramVersion = mempool.feeRateSizesVersion;
     }
-    // lock exclusively to do the final swap
-    ExclusiveLockGuard g(p->mempoolLock);
-    p->mempoolFeeHistogram.swap(hist);
+    return p->feeHistogram;
 }
 
-auto Storage::mempoolHistogram() const -> Mempool::FeeHistogramVec
+namespace {
+    /// Mempool file format used by Storage::saveMempool and Storage::loadMempool (all integers are little endian):
+    ///
+    ///   Header:   8-byte magic "FulcMemP", uint32 version, uint32 tip height, 32-byte tip hash, uint32 nTxs
+    ///   Per tx:   32-byte txid, uint32 sizeBytes, int64 fee (sats), uint8 hasUnconfirmedParentTx,
+    ///             uint32 nTxos, then per txo: uint8 isValid, followed by TXOInfo::toBytes() if valid
+    ///             uint32 nHashXs, then per hashX: 32-byte hashX,
+    ///                 uint32 nConfirmedSpends, then per spend: TXO::toBytes(), TXOInfo::toBytes()
+    ///                 uint32 nUnconfirmedSpends, then per spend: TXO::toBytes(), TXOInfo::toBytes()
+    ///                 uint32 nUtxos, then per utxo: uint16 IONum
+    ///   Trailer:  32-byte sha256 of everything above
+    ///
+    /// Like the TXOInfo serialization it uses, this file is not meant to be portable between machines.
+    namespace MempoolFile {
+        constexpr char kMagic[] = "FulcMemP";
+        constexpr int kMagicLen = 8;
+        constexpr uint32_t kVersion = 1;
+        const QString kFileName = "mempool.dat";
+
+        struct Writer {
+            QByteArray buf;
+            template <typename T>
+            void put(T val) {
+                const int pos = buf.size();
+                buf.resize(pos + int(sizeof(T)));
+                qToLittleEndian(val, buf.data() + pos);
+            }
+            void putBytes(const QByteArray &ba) { buf.append(ba); }
+            void putTXOInfo(const TXOInfo &info) {
+                if (UNLIKELY(!info.isValid()))
+                    throw InternalError("Attempted to save an invalid TXOInfo");
+                putBytes(info.toBytes());
+            }
+        };
+
+        struct Reader {
+            const char *cur, * const end;
+            Reader(const char *begin, const char *end_) : cur(begin), end(end_) {}
+            void need(size_t n) const {
+                if (UNLIKELY(size_t(end - cur) < n))
+                    throw DatabaseFormatError("truncated data");
+            }
+            template <typename T>
+            T get() {
+                need(sizeof(T));
+                const T ret = qFromLittleEndian<T>(cur);
+                cur += sizeof(T);
+                return ret;
+            }
+            QByteArray getBytes(size_t n) {
+                need(n);
+                QByteArray ret(cur, int(n));
+                cur += n;
+                return ret;
+            }
+            TXO getTXO() {
+                TXO ret = TXO::fromBytes(getBytes(TXO::serSize()));
+                if (UNLIKELY(!ret.isValid()))
+                    throw DatabaseFormatError("bad TXO");
+                return ret;
+            }
+            TXOInfo getTXOInfo() {
+                TXOInfo ret = TXOInfo::fromBytes(getBytes(TXOInfo::serSize()));
+                if (UNLIKELY(!ret.isValid()))
+                    throw DatabaseFormatError("bad TXOInfo");
+                return ret;
+            }
+        };
+    } // namespace MempoolFile
+} // namespace
+
+void Storage::saveMempool()
 {
-    SharedLockGuard g(p->mempoolLock);
-    return p->mempoolFeeHistogram;
+    if (!p->mempoolSaveArmed)
+        return; // startup() didn't complete, or we already ran
+    p->mempoolSaveArmed = false;
+    if (!options->persistMempool)
+        return;
+    using namespace MempoolFile;
+    const QString fileName = options->datadir + QDir::separator() + kFileName;
+    try {
+        const auto t0 = Util::getTimeNS();
+        const auto [height, tipHash] = latestTip();
+        if (height < 0)
+            return;
+        Writer w;
+        size_t nTxs = 0;
+        {
+            auto [mempool, lock] = this->mempool(); // shared lock
+            nTxs = mempool.txs.size();
+            if (!nTxs)
+                return;
+            w.buf.reserve(int(std::min(nTxs * 512, size_t(std::numeric_limits<int>::max() / 2))));
+            w.putBytes(QByteArray::fromRawData(kMagic, kMagicLen));
+            w.put(kVersion);
+            w.put(uint32_t(height));
+            w.putBytes(tipHash);
+            w.put(uint32_t(nTxs));
+            for (const auto & [txid, tx] : mempool.txs) {
+                w.putBytes(tx->hash);
+                w.put(uint32_t(tx->sizeBytes));
+                w.put(qint64(tx->fee / bitcoin::Amount::satoshi()));
+                w.put(uint8_t(tx->hasUnconfirmedParentTx ? 1 : 0));
+                w.put(uint32_t(tx->txos.size()));
+                for (const auto & info : tx->txos) {
+                    w.put(uint8_t(info.isValid() ? 1 : 0));
+                    if (info.isValid())
+                        w.putTXOInfo(info);
+                }
+                w.put(uint32_t(tx->hashXs.size()));
+                for (const auto & [sh, ioinfo] : tx->hashXs) {
+                    w.putBytes(sh);
+                    for (const auto *spends : { &ioinfo.confirmedSpends, &ioinfo.unconfirmedSpends }) {
+                        w.put(uint32_t(spends->size()));
+                        for (const auto & [txo, info] : *spends) {
+                            w.putBytes(txo.toBytes());
+                            w.putTXOInfo(info);
+                        }
+                    }
+                    w.put(uint32_t(ioinfo.utxo.size()));
+                    for (const IONum n : ioinfo.utxo)
+                        w.put(uint16_t(n));
+                }
+            }
+        }
+        w.putBytes(BTC::HashOnce(w.buf));
+
+        QSaveFile f(fileName);
+        if (!f.open(QIODevice::WriteOnly) || f.write(w.buf) != w.buf.size() || !f.commit())
+            throw InternalError(QString("failed to write \"%1\": %2").arg(fileName, f.errorString()));
+        Log() << "Saved mempool: " << nTxs << Util::Pluralize(" tx", nTxs) << ", "
+              << QString::number(w.buf.size() / 1e6, 'f', 3) << " MB in "
+              << QString::number((Util::getTimeNS() - t0) / 1e6, 'f', 3) << " msec";
+    } catch (const std::exception &e) {
+        Warning() << "Failed to save mempool: " << e.what();
+        QFile::remove(fileName); // just in case
+    }
+}
+
+void Storage::loadMempool()
+{
+    using namespace MempoolFile;
+    const QString fileName = options->datadir + QDir::separator() + kFileName;
+    if (!QFile::exists(fileName))
+        return;
+    // always delete the file once we've read it: if we crash later, it would otherwise be stale on the next startup
+    Defer deferredRemove([&fileName]{ QFile::remove(fileName); });
+    if (!options->persistMempool) {
+        Debug() << "Ignoring saved mempool file since persist_mempool is disabled";
+        return;
+    }
+    auto [mempool, lock] = mutableMempool();
+    try {
+        const auto t0 = Util::getTimeNS();
+        QByteArray data;
+        {
+            QFile f(fileName);
+            if (!f.open(QIODevice::ReadOnly))
+                throw DatabaseError(QString("cannot open file: %1").arg(f.errorString()));
+            data = f.readAll();
+        }
+        if (data.size() < kMagicLen + HashLen || std::memcmp(data.constData(), kMagic, kMagicLen) != 0)
+            throw DatabaseFormatError("bad magic");
+        const int payloadLen = data.size() - HashLen;
+        if (BTC::HashOnce(QByteArray::fromRawData(data.constData(), payloadLen)) != data.mid(payloadLen))
+            throw DatabaseFormatError("checksum mismatch");
+        Reader r(data.constData() + kMagicLen, data.constData() + payloadLen);
+        if (const auto version = r.get<uint32_t>(); version != kVersion)
+            throw DatabaseFormatError(QString("unsupported version %1").arg(version));
+        const auto height = r.get<uint32_t>();
+        const auto tipHash = r.getBytes(HashLen);
+        if (const auto [curHeight, curHash] = latestTip(); curHeight < 0 || uint32_t(curHeight) != height || curHash != tipHash) {
+            Log() << "Saved mempool is for a different chain tip (height: " << height << "), ignoring";
+            return;
+        }
+        const auto nTxs = r.get<uint32_t>();
+        std::vector<Mempool::TxRef> loaded;
+        loaded.reserve(nTxs);
+        // re-uses the hashXTxs keys so that each distinct scripthash is stored only once (see SynchMempoolTask)
+        const auto internHashX = [&mempool = mempool](HashX &sh) -> Mempool::HashXTxMap::mapped_type & {
+            auto it = mempool.hashXTxs.find(sh);
+            if (it == mempool.hashXTxs.end())
+                it = mempool.hashXTxs.emplace(sh, Mempool::HashXTxMap::mapped_type{}).first;
+            else
+                sh = it->first;
+            return it->second;
+        };
+        for (uint32_t i = 0; i < nTxs; ++i) {
+            auto tx = std::make_shared<Mempool::Tx>();
+            tx->hash = r.getBytes(HashLen);
+            tx->sizeBytes = r.get<uint32_t>();
+            tx->fee = int64_t(r.get<qint64>()) * bitcoin::Amount::satoshi();
+            tx->hasUnconfirmedParentTx = r.get<uint8_t>() != 0;
+            const auto nTxos = r.get<uint32_t>();
+            r.need(nTxos); // sanity check before we allocate
+            tx->txos.resize(nTxos);
+            for (auto & info : tx->txos) {
+                if (r.get<uint8_t>()) {
+                    info = r.getTXOInfo();
+                    internHashX(info.hashX);
+                }
+            }
+            const auto nHashXs = r.get<uint32_t>();
+            r.need(nHashXs);
+            tx->hashXs.reserve(nHashXs);
+            for (uint32_t j = 0; j < nHashXs; ++j) {
+                HashX sh = r.getBytes(HashLen);
+                internHashX(sh).push_back(tx);
+                auto & ioinfo = tx->hashXs[sh];
+                for (auto *spends : { &ioinfo.confirmedSpends, &ioinfo.unconfirmedSpends }) {
+                    const auto nSpends = r.get<uint32_t>();
+                    r.need(nSpends);
+                    spends->reserve(nSpends);
+                    for (uint32_t k = 0; k < nSpends; ++k) {
+                        const TXO txo = r.getTXO();
+                        TXOInfo info = r.getTXOInfo();
+                        info.hashX = sh;
+                        spends->emplace(txo, std::move(info));
+                    }
+                }
+                const auto nUtxos = r.get<uint32_t>();
+                r.need(nUtxos);
+                ioinfo.utxo.reserve(nUtxos);
+                for (uint32_t k = 0; k < nUtxos; ++k)
+                    ioinfo.utxo.insert(r.get<uint16_t>());
+            }
+            if (UNLIKELY(tx->hash.length() != HashLen || !mempool.txs.emplace(tx->hash, tx).second))
+                throw DatabaseFormatError("duplicate tx");
+            loaded.push_back(std::move(tx));
+        }
+        if (r.cur != r.end)
+            throw DatabaseFormatError("extra data at end of file");
+        // check that all the in-mempool parents are present and re-use their hashes in the spends' TXO keys (the
+        // ordering of the keys is unaffected since the values are equal)
+        for (const auto & tx : loaded) {
+            for (auto & [sh, ioinfo] : tx->hashXs) {
+                for (auto & [txo, info] : ioinfo.unconfirmedSpends) {
+                    const auto it = mempool.txs.find(txo.txHash);
+                    if (UNLIKELY(it == mempool.txs.end()))
+                        throw DatabaseFormatError(QString("missing parent tx %1").arg(QString(txo.txHash.toHex())));
+                    txo.txHash = it->second->hash;
+                }
+            }
+            mempool.feeHistogramAdd(*tx);
+            mempool.memBytesAdd(*tx);
+        }
+        for (auto & [sh, txs] : mempool.hashXTxs)
+            std::sort(txs.begin(), txs.end(), Mempool::TxRefOrdering{});
+        Log() << "Loaded saved mempool: " << nTxs << Util::Pluralize(" tx", nTxs) << " in "
+              << QString::number((Util::getTimeNS() - t0) / 1e6, 'f', 3) << " msec";
+    } catch (const std::exception &e) {
+        Warning() << "Failed to load saved mempool from " << fileName << ": " << e.what();
+        mempool.clear();
+    }
 }
 
 size_t Storage::dumpAllScriptHashes(QIODevice *outDev, unsigned int indent, unsigned int ilvl,
@@ -2170,6 +2904,396 @@ size_t Storage::dumpAllScriptHashes(QIODevice *outDev, unsigned int indent, unsi
     return ctr;
 }
 
+namespace {
+    /// Portable snapshot file format used by Storage::exportSnapshot and Storage::importSnapshot (all integers are
+    /// little endian):
+    ///
+    ///   File header:  8-byte magic "FulcSnap", uint32 version, uint16 platformBits
+    ///   Chunk:        uint8 section, uint32 nRecords, uint32 rawLen, uint32 compLen, 32-byte sha256(raw),
+    ///                 followed by compLen bytes of qCompress(raw)
+    ///   Trailer:      a chunk header with section == End, nRecords == the total number of chunks, and no payload
+    ///
+    /// For rocksdb sections, `raw` is a sequence of (uint32 keyLen, key, uint32 valLen, value) records in key order
+    /// (which is the db's iteration order), so that on import each chunk can be turned directly into an SST file and
+    /// ingested, rather than replayed through the write path.  For RecordFile sections, `raw` is simply nRecords
+    /// fixed-size records laid out one after another.
+    ///
+    /// Note that the keys and values themselves are copied verbatim from the db, so the snapshot is only portable
+    /// between machines sharing the same word size and byte order (see the SerializeScalar comments at the top of
+    /// this file). The platformBits field in the header guards against the former.
+    namespace Snapshot {
+        constexpr char kMagic[] = "FulcSnap";
+        constexpr int kMagicLen = 8;
+        constexpr uint32_t kVersion = 1;
+        constexpr int kHeaderLen = kMagicLen + sizeof(uint32_t) + sizeof(uint16_t);
+        constexpr int kChunkRawBytes = 32 * 1024 * 1024; ///< target uncompressed chunk size
+        constexpr int kCompressionLevel = 1; ///< zlib level -- we favor speed here since this is meant to be IO-bound
+
+        enum class Section : uint8_t {
+            Meta = 0, BlkInfo, UtxoSet, ScriptHashHistory, ScriptHashUnspent, Undo, // rocksdb tables
+            Headers = 0x10, TxNums, // RecordFiles
+            End = 0xff,
+        };
+        inline bool isRecordFileSection(Section s) { return s == Section::Headers || s == Section::TxNums; }
+
+        struct ChunkHeader {
+            Section section = Section::End;
+            uint32_t nRecords = 0, rawLen = 0, compLen = 0;
+            QByteArray checksum = QByteArray(HashLen, char(0)); ///< sha256 of the uncompressed data
+            static constexpr int serSize = 1 + 3*sizeof(uint32_t) + HashLen;
+
+            QByteArray serialize() const {
+                QByteArray ret(serSize, Qt::Uninitialized);
+                char *cur = ret.data();
+                *cur++ = char(section);
+                for (const uint32_t v : {nRecords, rawLen, compLen}) {
+                    qToLittleEndian(v, cur);
+                    cur += sizeof(v);
+                }
+                std::memcpy(cur, checksum.constData(), HashLen);
+                return ret;
+            }
+            static ChunkHeader deserialize(const QByteArray &ba) {
+                if (ba.size() != serSize)
+                    throw DatabaseFormatError("Snapshot: the file appears to be truncated");
+                ChunkHeader ret;
+                const char *cur = ba.constData();
+                ret.section = Section(uint8_t(*cur++));
+                for (uint32_t *v : {&ret.nRecords, &ret.rawLen, &ret.compLen}) {
+                    *v = qFromLittleEndian<uint32_t>(cur);
+                    cur += sizeof(*v);
+                }
+                ret.checksum = QByteArray(cur, HashLen);
+                return ret;
+            }
+        };
+
+        /// Called from a worker thread: compresses raw and returns the fully serialized chunk (header + payload).
+        QByteArray EncodeChunk(Section section, uint32_t nRecords, const QByteArray &raw) {
+            ChunkHeader h;
+            h.section = section;
+            h.nRecords = nRecords;
+            h.rawLen = uint32_t(raw.size());
+            h.checksum = BTC::HashOnce(raw);
+            const QByteArray comp = qCompress(raw, kCompressionLevel);
+            h.compLen = uint32_t(comp.size());
+            return h.serialize() + comp;
+        }
+
+        /// Called from a worker thread: decompresses & verifies a chunk payload, returning the raw data. Throws on error.
+        QByteArray DecodeChunk(const ChunkHeader &h, const QByteArray &comp) {
+            QByteArray raw = qUncompress(comp);
+            if (raw.size() != int(h.rawLen) || BTC::HashOnce(raw) != h.checksum)
+                throw DatabaseFormatError(QString("Snapshot: checksum mismatch for a chunk in section %1; the file is corrupt")
+                                          .arg(unsigned(h.section)));
+            return raw;
+        }
+
+        void AppendSized(QByteArray &raw, const rocksdb::Slice &s) {
+            char lenBuf[sizeof(uint32_t)];
+            qToLittleEndian(uint32_t(s.size()), lenBuf);
+            raw.append(lenBuf, sizeof(lenBuf));
+            raw.append(s.data(), int(s.size()));
+        }
+
+        /// Called from a worker thread: writes the (key, value) records in raw to a new SST file at path.
+        void WriteSstFile(const std::string &path, const rocksdb::Options &opts, const QByteArray &raw, uint32_t nRecords) {
+            rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), opts);
+            if (auto st = writer.Open(path); !st.ok())
+                throw DatabaseError(QString("Snapshot: failed to create SST file: %1").arg(StatusString(st)));
+            const char *cur = raw.constData(), * const end = cur + raw.size();
+            const auto readSized = [&cur, end](rocksdb::Slice &out) {
+                if (end - cur < int(sizeof(uint32_t)))
+                    return false;
+                const auto len = qFromLittleEndian<uint32_t>(cur);
+                cur += sizeof(len);
+                if (uint64_t(end - cur) < len)
+                    return false;
+                out = rocksdb::Slice(cur, len);
+                cur += len;
+                return true;
+            };
+            uint32_t n = 0;
+            for (rocksdb::Slice k, v; cur < end; ++n) {
+                if (!readSized(k) || !readSized(v))
+                    throw DatabaseFormatError("Snapshot: malformed chunk data; the file is corrupt");
+                if (auto st = writer.Put(k, v); !st.ok())
+                    throw DatabaseError(QString("Snapshot: failed to write to SST file: %1").arg(StatusString(st)));
+            }
+            if (n != nRecords)
+                throw DatabaseFormatError(QString("Snapshot: expected %1 records in chunk, got %2").arg(nRecords).arg(n));
+            if (auto st = writer.Finish(); !st.ok())
+                throw DatabaseError(QString("Snapshot: failed to finish SST file: %1").arg(StatusString(st)));
+        }
+
+        /// Submits func to the app-global ThreadPool, returning a future for its result. Exceptions thrown by func are
+        /// delivered via the future. If the pool's queue is full, func is run right here instead (as parallelFor does).
+        template <typename Func>
+        auto RunInPool(Func && func) -> std::future<std::invoke_result_t<Func>> {
+            auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Func>()>>(std::forward<Func>(func));
+            auto fut = task->get_future();
+            bool rejected = false; // only ever set synchronously by submitWork() below, if the queue is full
+            auto *pool = AppThreadPool();
+            if (LIKELY(pool))
+                pool->submitWork(pool, [task]{ (*task)(); }, {}, [&rejected](const QString &){ rejected = true; });
+            if (!pool || rejected)
+                (*task)();
+            return fut;
+        }
+
+        /// Waits for a RunInPool() result. A job the pool dropped without running (it does so when the app is shutting
+        /// down) shows up as a broken promise; we turn that into a readable error rather than a bare std::future_error.
+        template <typename T>
+        T Get(std::future<T> &fut) {
+            try {
+                return fut.get();
+            } catch (const std::future_error &e) {
+                throw InternalError(QString("Snapshot: a worker job was dropped before it ran (is the app shutting down?): %1")
+                                    .arg(QString(e.what())));
+            }
+        }
+
+        /// Memory we allow the chunks in flight to use. Each one holds up to 2x kChunkRawBytes (raw plus compressed).
+        constexpr size_t kInFlightBudgetBytes = size_t(512) * 1024 * 1024;
+        /// Max. number of chunks we keep in flight at once: 2 per core, but no more than fit kInFlightBudgetBytes
+        /// (8 chunks), so that memory use doesn't grow with the machine's core count.
+        size_t MaxInFlight() {
+            constexpr size_t budgetChunks = std::max(kInFlightBudgetBytes / (2 * size_t(kChunkRawBytes)), size_t(2));
+            return std::clamp(size_t(Util::getNVirtualProcessors()) * 2, size_t(2), budgetChunks);
+        }
+    } // namespace Snapshot
+} // namespace
+
+uint64_t Storage::exportSnapshot(const QString &fileName) const
+{
+    using Snapshot::Section;
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate))
+        throw BadArgs(QString("Snapshot: Output file \"%1\" could not be opened for writing").arg(fileName));
+
+    SharedLockGuard g{p->blocksLock};
+    uint64_t nBytes = 0;
+    uint32_t nChunks = 0;
+    const auto writeBytes = [&](const QByteArray &ba) {
+        if (f.write(ba) != ba.size())
+            throw InternalError(QString("Snapshot: failed to write to \"%1\": %2").arg(fileName, f.errorString()));
+        nBytes += uint64_t(ba.size());
+    };
+    {
+        QByteArray hdr(Snapshot::kMagic, Snapshot::kMagicLen);
+        hdr.resize(Snapshot::kHeaderLen);
+        qToLittleEndian(Snapshot::kVersion, hdr.data() + Snapshot::kMagicLen);
+        qToLittleEndian(uint16_t(sizeof(long)*8U), hdr.data() + Snapshot::kMagicLen + sizeof(uint32_t));
+        writeBytes(hdr);
+    }
+
+    // Chunks are compressed in parallel but must be written in order, so we keep a bounded FIFO of pending results.
+    std::deque<std::future<QByteArray>> pending;
+    const size_t maxInFlight = Snapshot::MaxInFlight();
+    const auto writeFront = [&] {
+        writeBytes(Snapshot::Get(pending.front()));
+        pending.pop_front();
+    };
+    const auto enqueue = [&](Section section, uint32_t nRecs, QByteArray &raw) {
+        pending.push_back(Snapshot::RunInPool([section, nRecs, raw]{ return Snapshot::EncodeChunk(section, nRecs, raw); }));
+        raw = QByteArray(); // detach from the copy captured above
+        ++nChunks;
+        while (pending.size() >= maxInFlight)
+            writeFront();
+    };
+
+    // rocksdb tables
+    const std::list<std::pair<Section, rocksdb::DB *>> dbs = {
+        { Section::Meta, p->db.meta.get() },
+        { Section::BlkInfo, p->db.blkinfo.get() },
+        { Section::UtxoSet, p->db.utxoset.get() },
+        { Section::ScriptHashHistory, p->db.shist.get() },
+        { Section::ScriptHashUnspent, p->db.shunspent.get() },
+        { Section::Undo, p->db.undo.get() },
+    };
+    rocksdb::ReadOptions ropts;
+    ropts.fill_cache = false; // this is a one-time bulk scan; don't evict useful blocks from the cache
+    for (const auto & [section, db] : dbs) {
+        std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(ropts));
+        if (!it) throw DatabaseError(QString("Snapshot: unable to obtain an iterator to db %1").arg(DBName(db)));
+        QByteArray raw;
+        uint32_t n = 0;
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            Snapshot::AppendSized(raw, it->key());
+            Snapshot::AppendSized(raw, it->value());
+            if (++n, raw.size() >= Snapshot::kChunkRawBytes) {
+                enqueue(section, n, raw);
+                n = 0;
+            }
+        }
+        if (!it->status().ok())
+            throw DatabaseError(QString("Snapshot: error iterating db %1: %2").arg(DBName(db), StatusString(it->status())));
+        if (n)
+            enqueue(section, n, raw);
+        Debug() << "Snapshot: " << DBName(db) << " done, " << nChunks << Util::Pluralize(" chunk", nChunks) << " so far";
+    }
+
+    // RecordFiles
+    const std::list<std::pair<Section, const RecordFile *>> rfs = {
+        { Section::Headers, p->headersFile.get() },
+        { Section::TxNums, p->txNumsFile.get() },
+    };
+    for (const auto & [section, rf] : rfs) {
+        const uint64_t total = rf->numRecords();
+        const size_t perChunk = std::max(size_t(1), Snapshot::kChunkRawBytes / rf->recordSize());
+        for (uint64_t i = 0; i < total; i += perChunk) {
+            const size_t count = size_t(std::min(uint64_t(perChunk), total - i));
+            QString err;
+            const auto recs = rf->readRecords(i, count, &err);
+            if (recs.size() != count)
+                throw DatabaseError(QString("Snapshot: failed to read from %1: %2").arg(rf->fileName(), err));
+            QByteArray raw;
+            raw.reserve(int(count * rf->recordSize()));
+            for (const auto & rec : recs)
+                raw.append(rec);
+            enqueue(section, uint32_t(count), raw);
+        }
+        Debug() << "Snapshot: " << QFileInfo(rf->fileName()).fileName() << " done, " << total << Util::Pluralize(" record", total);
+    }
+
+    while (!pending.empty())
+        writeFront();
+    Snapshot::ChunkHeader trailer;
+    trailer.nRecords = nChunks;
+    writeBytes(trailer.serialize());
+    if (!f.flush())
+        throw InternalError(QString("Snapshot: failed to flush \"%1\": %2").arg(fileName, f.errorString()));
+    return nBytes;
+}
+
+void Storage::importSnapshot(const QString &fileName)
+{
+    using Snapshot::Section;
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+        throw BadArgs(QString("Snapshot: Input file \"%1\" could not be opened for reading").arg(fileName));
+    {
+        const QByteArray hdr = f.read(Snapshot::kHeaderLen);
+        if (hdr.size() != Snapshot::kHeaderLen || hdr.left(Snapshot::kMagicLen) != QByteArray(Snapshot::kMagic, Snapshot::kMagicLen))
+            throw DatabaseFormatError(QString("Snapshot: \"%1\" does not appear to be a snapshot file").arg(fileName));
+        const auto version = qFromLittleEndian<uint32_t>(hdr.constData() + Snapshot::kMagicLen);
+        const auto bits = qFromLittleEndian<uint16_t>(hdr.constData() + Snapshot::kMagicLen + sizeof(uint32_t));
+        if (version != Snapshot::kVersion)
+            throw DatabaseFormatError(QString("Snapshot: unsupported snapshot version %1").arg(version));
+        if (bits != sizeof(long)*8U)
+            throw DatabaseFormatError(QString("Snapshot: snapshot was exported on a %1-bit platform, but this is a %2-bit"
+                                              " platform").arg(bits).arg(sizeof(long)*8U));
+    }
+
+    const QString datadir = options->datadir + QDir::separator();
+    auto headersFile = std::make_unique<RecordFile>(datadir + "headers", size_t(p->blockHeaderSize()), kHeadersFileMagic); // may throw
+    auto txNumsFile = std::make_unique<RecordFile>(datadir + "txnum2txhash", HashLen, kTxNumsFileMagic); // may throw
+    {
+        std::unique_ptr<rocksdb::Iterator> it(p->db.blkinfo->NewIterator(p->db.defReadOpts));
+        if (headersFile->numRecords() || txNumsFile->numRecords() || !it || (it->SeekToFirst(), it->Valid()))
+            throw DatabaseError(QString("Snapshot: refusing to import into a non-empty datadir (%1). Please specify an"
+                                        " empty datadir and try again.").arg(options->datadir));
+    }
+
+    Log() << "Snapshot: importing \"" << fileName << "\" (this may take some time) ...";
+    const auto t0 = Util::getTimeSecs();
+    // If we die in the middle of this, the next startup will refuse to proceed since the datadir is inconsistent.
+    setDirty(true);
+
+    const std::map<Section, std::pair<rocksdb::DB *, const rocksdb::Options *>> dbs = {
+        { Section::Meta, { p->db.meta.get(), &p->db.opts } },
+        { Section::BlkInfo, { p->db.blkinfo.get(), &p->db.opts } },
+        { Section::UtxoSet, { p->db.utxoset.get(), &p->db.opts } },
+        { Section::ScriptHashHistory, { p->db.shist.get(), &p->db.shistOpts } },
+        { Section::ScriptHashUnspent, { p->db.shunspent.get(), &p->db.opts } },
+        { Section::Undo, { p->db.undo.get(), &p->db.opts } },
+    };
+    const QString tmpDir = datadir + "snapshot_import";
+    QDir(tmpDir).removeRecursively();
+    if (!QDir().mkpath(tmpDir))
+        throw InternalError(QString("Snapshot: unable to create temporary directory %1").arg(tmpDir));
+    Defer removeTmpDir([&tmpDir]{ QDir(tmpDir).removeRecursively(); });
+
+    // Chunks are decompressed, verified, and (for rocksdb tables) turned into SST files in parallel. RecordFile chunks
+    // must be appended in order, so we keep a bounded FIFO of pending results and process them from the front.
+    struct Result {
+        Section section;
+        uint32_t nRecords;
+        QByteArray raw; ///< only used for RecordFile sections
+        std::string sstPath; ///< only used for rocksdb sections
+    };
+    std::deque<std::future<Result>> pending;
+    std::map<Section, std::vector<std::string>> sstFiles;
+    const size_t maxInFlight = Snapshot::MaxInFlight();
+    const auto processFront = [&] {
+        Result r = Snapshot::Get(pending.front());
+        pending.pop_front();
+        if (Snapshot::isRecordFileSection(r.section)) {
+            RecordFile & rf = r.section == Section::Headers ? *headersFile : *txNumsFile;
+            const int recsz = int(rf.recordSize());
+            if (r.raw.size() != int(r.nRecords) * recsz)
+                throw DatabaseFormatError(QString("Snapshot: unexpected chunk size for %1").arg(rf.fileName()));
+            auto batch = rf.beginBatchAppend(); // may throw
+            QString err;
+            for (int pos = 0; pos < r.raw.size(); pos += recsz)
+                if (!batch.append(QByteArray::fromRawData(r.raw.constData() + pos, recsz), &err))
+                    throw DatabaseError(QString("Snapshot: failed to append to %1: %2").arg(rf.fileName(), err));
+        } else
+            sstFiles[r.section].push_back(std::move(r.sstPath));
+    };
+
+    uint32_t nChunks = 0;
+    for (;;) {
+        const auto h = Snapshot::ChunkHeader::deserialize(f.read(Snapshot::ChunkHeader::serSize));
+        if (h.section == Section::End) {
+            if (h.nRecords != nChunks)
+                throw DatabaseFormatError("Snapshot: chunk count mismatch; the file is corrupt");
+            break;
+        }
+        const auto section = h.section;
+        const bool isRecordFile = Snapshot::isRecordFileSection(section);
+        if (!isRecordFile && !dbs.count(section))
+            throw DatabaseFormatError(QString("Snapshot: unknown section %1; the file is corrupt").arg(unsigned(section)));
+        const QByteArray comp = f.read(h.compLen);
+        if (comp.size() != int(h.compLen))
+            throw DatabaseFormatError("Snapshot: the file appears to be truncated");
+        if (isRecordFile) {
+            pending.push_back(Snapshot::RunInPool([h, comp]{
+                return Result{h.section, h.nRecords, Snapshot::DecodeChunk(h, comp), {}};
+            }));
+        } else {
+            const std::string path = QString("%1%2%3.sst").arg(tmpDir).arg(QDir::separator()).arg(nChunks, 8, 10, QChar('0')).toStdString();
+            pending.push_back(Snapshot::RunInPool([h, comp, path, dbOpts = dbs.at(section).second]{
+                Snapshot::WriteSstFile(path, *dbOpts, Snapshot::DecodeChunk(h, comp), h.nRecords);
+                return Result{h.section, h.nRecords, {}, path};
+            }));
+        }
+        if (0 == ++nChunks % 100)
+            Log() << "Snapshot: read " << nChunks << " chunks ...";
+        while (pending.size() >= maxInFlight)
+            processFront();
+    }
+    while (!pending.empty())
+        processFront();
+    if (!headersFile->flush() || !txNumsFile->flush())
+        throw DatabaseError("Snapshot: failed to flush the headers and/or txnum2txhash files");
+
+    for (const auto & [section, files] : sstFiles) {
+        rocksdb::DB *db = dbs.at(section).first;
+        rocksdb::IngestExternalFileOptions ifo;
+        ifo.move_files = true; // the SST files live on the same filesystem as the db, so this is a cheap link/rename
+        if (auto st = db->IngestExternalFile(files, ifo); !st.ok())
+            throw DatabaseError(QString("Snapshot: failed to ingest %1 files into db %2: %3")
+                                .arg(files.size()).arg(DBName(db), StatusString(st)));
+    }
+    // the ingested meta table carries its own (clear) dirty flag, but be explicit about it
+    setDirty(false);
+
+    Log() << "Snapshot: imported " << nChunks << Util::Pluralize(" chunk", nChunks) << ", " << headersFile->numRecords()
+          << Util::Pluralize(" header", headersFile->numRecords()) << " in "
+          << QString::number(Util::getTimeSecs() - t0, 'f', 1) << " seconds";
+}
+
 namespace {
     // specializations of Serialize/Deserialize
     template <> QByteArray Serialize(const Meta &m)
@@ -2435,3 +3559,884 @@ namespace {
     }
 
 } // end anon namespace
+
+#ifdef ENABLE_TESTS
+#include "bitcoin/transaction.h"
+
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <functional>
+#include <map>
+#include <set>
+
+namespace {
+    /// A Storage on a temporary datadir, to which the tests below add small synthetic blocks (and mempool txs). The
+    /// history, utxos and balance that each scripthash should have are worked out from the blocks independently of
+    /// Storage, so that its answers can be checked against them.
+    class TestChain {
+        QTemporaryDir dir;
+    public:
+        const std::shared_ptr<Options> options;
+        std::unique_ptr<Storage> storage;
+        std::vector<HashX> hashXs; ///< the scripthashes of `scripts`, which are all that the txs pay to
+
+        struct Utxo { HashX hashX; Storage::UnspentItem item; };
+        struct State {
+            std::map<TXO, Utxo> utxos;
+            std::map<HashX, Storage::History> histories; ///< confirmed only
+            TxNum txNumNext = 0;
+            bitcoin::uint256 prevBlockHash;
+        };
+        State state;
+        std::vector<Mempool::TxRef> mempoolTxs;
+
+        explicit TestChain(unsigned nScripts = 8, quint32 seed = 1)
+            : options(std::make_shared<Options>()), rng(seed)
+        {
+            if (!dir.isValid())
+                throw Exception("Unable to create a temporary directory");
+            options->datadir = dir.path();
+            storage = std::make_unique<Storage>(options);
+            storage->startup();
+            for (unsigned i = 0; i < nScripts; ++i) {
+                // p2pkh
+                scripts.push_back(bitcoin::CScript() << bitcoin::opcodetype::OP_DUP << bitcoin::opcodetype::OP_HASH160
+                                  << std::vector<uint8_t>(20, uint8_t(i)) << bitcoin::opcodetype::OP_EQUALVERIFY
+                                  << bitcoin::opcodetype::OP_CHECKSIG);
+                hashXs.push_back(BTC::HashXFromCScript(scripts.back()));
+            }
+        }
+        ~TestChain() { storage.reset(); } // must be closed before `dir` goes away
+
+        /// Adds a block with a coinbase plus `nTx` txs, each of which spends 1 or 2 of the utxos that the mempool
+        /// doesn't spend (including those of earlier txs in the block) and pays to 1 or 2 of the scripts.
+        void addBlock(unsigned nTx, bool notifySubs = false) {
+            const int height = int(undoStates.size());
+            undoStates.push_back(state);
+            bitcoin::CBlock block;
+            block.nVersion = 0x20000000;
+            block.hashPrevBlock = state.prevBlockHash;
+            block.nTime = 1600000000 + unsigned(height);
+            block.nBits = 0x1d00ffff;
+            std::set<TXO> spendable;
+            for (const auto & [txo, utxo] : state.utxos)
+                if (!mempoolSpends.count(txo))
+                    spendable.insert(txo);
+            for (unsigned i = 0; i <= nTx; ++i) {
+                bitcoin::CMutableTransaction tx;
+                tx.nVersion = 2;
+                std::vector<TXO> spent;
+                if (i == 0) {
+                    tx.vin.emplace_back(bitcoin::COutPoint(), bitcoin::CScript() << std::vector<uint8_t>(4, uint8_t(height)));
+                } else {
+                    // there is always something to spend: at least the outputs of the txs before this one
+                    for (unsigned j = 1 + rng.bounded(2u); j > 0 && !spendable.empty(); --j) {
+                        auto it = spendable.begin();
+                        std::advance(it, rng.bounded(quint32(spendable.size())));
+                        const TXO txo = *it;
+                        spendable.erase(it);
+                        spent.push_back(txo);
+                        bitcoin::uint256 prevHash;
+                        std::copy(txo.txHash.rbegin(), txo.txHash.rend(), reinterpret_cast<char *>(prevHash.begin()));
+                        tx.vin.emplace_back(bitcoin::COutPoint(prevHash, txo.outN), bitcoin::CScript() << std::vector<uint8_t>(72, uint8_t(i)));
+                    }
+                }
+                std::vector<size_t> outScripts;
+                for (unsigned j = 1 + rng.bounded(2u); j > 0; --j) {
+                    outScripts.push_back(rng.bounded(quint32(scripts.size())));
+                    tx.vout.emplace_back(int64_t(1 + rng.bounded(100'000'000)) * bitcoin::Amount::satoshi(), scripts[outScripts.back()]);
+                }
+                const auto txRef = bitcoin::MakeTransactionRef(std::move(tx));
+                const TxHash hash = BTC::Hash2ByteArrayRev(txRef->GetHash());
+                const TxNum txNum = state.txNumNext++;
+                std::set<HashX> touched;
+                for (const auto & txo : spent) {
+                    touched.insert(state.utxos.at(txo).hashX);
+                    state.utxos.erase(txo);
+                }
+                for (IONum n = 0; n < outScripts.size(); ++n) {
+                    const HashX & hashX = hashXs[outScripts[n]];
+                    touched.insert(hashX);
+                    const TXO txo{hash, n};
+                    state.utxos[txo] = Utxo{hashX, Storage::UnspentItem{{hash, height, {}}, n, txRef->vout[n].nValue, txNum}};
+                    spendable.insert(txo);
+                }
+                for (const auto & hashX : touched)
+                    state.histories[hashX].push_back(Storage::HistoryItem{hash, height, {}});
+                block.vtx.push_back(txRef);
+            }
+            state.prevBlockHash = block.GetHash();
+            const auto ppb = PreProcessedBlock::makeShared(unsigned(height), BTC::Serialize(block).size(), block);
+            storage->addBlock(ppb, true, 0, notifySubs);
+        }
+
+        /// Undoes the latest block, along with any mempool txs that spent its outputs and their mempool descendants.
+        void undoBlock(bool notifySubs = false) {
+            const TxNum txNum0 = undoStates.back().txNumNext;
+            storage->undoLatestBlock(notifySubs);
+            state = undoStates.back();
+            undoStates.pop_back();
+            std::set<TxHash> dropped;
+            for (auto it = mempoolTxs.begin(); it != mempoolTxs.end(); ) { // parents come before their children
+                bool drop = false;
+                for (const auto & [hashX, ioinfo] : (*it)->hashXs) {
+                    for (const auto & [txo, info] : ioinfo.confirmedSpends)
+                        drop = drop || info.txNum >= txNum0;
+                    for (const auto & [txo, info] : ioinfo.unconfirmedSpends)
+                        drop = drop || dropped.count(txo.txHash);
+                }
+                if (drop) {
+                    dropped.insert((*it)->hash);
+                    for (const auto & [hashX, ioinfo] : (*it)->hashXs)
+                        for (const auto & [txo, info] : ioinfo.confirmedSpends)
+                            mempoolSpends.erase(txo);
+                    it = mempoolTxs.erase(it);
+                } else
+                    ++it;
+            }
+        }
+
+        /// Adds a tx to the mempool that spends 1 or 2 confirmed utxos (of those for which `canSpend` returns true, if
+        /// given) and pays to 1 or 2 of the scripts.
+        Mempool::TxRef addMempoolTx(const std::function<bool(const Utxo &)> &canSpend = {}) {
+            auto tx = std::make_shared<Mempool::Tx>();
+            tx->hash = QByteArray(HashLen, Qt::Uninitialized);
+            for (auto & c : tx->hash)
+                c = char(rng.bounded(256));
+            tx->sizeBytes = 200 + rng.bounded(200u);
+            tx->fee = int64_t(tx->sizeBytes) * bitcoin::Amount::satoshi();
+            for (unsigned j = 1 + rng.bounded(2u); j > 0; --j) {
+                std::vector<TXO> candidates;
+                for (const auto & [txo, utxo] : state.utxos)
+                    if (!mempoolSpends.count(txo) && (!canSpend || canSpend(utxo)))
+                        candidates.push_back(txo);
+                if (candidates.empty())
+                    break;
+                const TXO & txo = candidates[rng.bounded(quint32(candidates.size()))];
+                const auto & item = state.utxos.at(txo);
+                tx->hashXs[item.hashX].confirmedSpends.emplace(txo, TXOInfo{item.item.value, item.hashX, unsigned(item.item.height), item.item.txNum});
+                mempoolSpends.insert(txo);
+            }
+            for (unsigned j = 1 + rng.bounded(2u); j > 0; --j) {
+                const HashX & hashX = hashXs[rng.bounded(quint32(hashXs.size()))];
+                tx->hashXs[hashX].utxo.insert(IONum(tx->txos.size()));
+                tx->txos.push_back(TXOInfo{int64_t(1 + rng.bounded(100'000)) * bitcoin::Amount::satoshi(), hashX, {}, 0});
+            }
+            insertMempoolTx(tx);
+            return tx;
+        }
+
+        /// Adds a tx to the mempool that spends one unspent output of the mempool tx `parent` and has `nOuts` outputs
+        /// paying to `payTo` (or to random scripts if it is empty), plus an OP_RETURN output. Note that dropMempoolTx
+        /// doesn't know to drop such a child along with its parent.
+        Mempool::TxRef addMempoolChild(const Mempool::TxRef &parent, unsigned nOuts, const HashX &payTo = {}) {
+            auto tx = std::make_shared<Mempool::Tx>();
+            tx->hash = QByteArray(HashLen, Qt::Uninitialized);
+            for (auto & c : tx->hash)
+                c = char(rng.bounded(256));
+            tx->sizeBytes = 200 + rng.bounded(200u);
+            tx->fee = int64_t(tx->sizeBytes) * bitcoin::Amount::satoshi();
+            tx->hasUnconfirmedParentTx = true;
+            {
+                auto [mempool, lock] = storage->mutableMempool();
+                const auto it = std::find_if(parent->hashXs.begin(), parent->hashXs.end(),
+                                             [](const auto &pair) { return !pair.second.utxo.empty(); });
+                if (it == parent->hashXs.end())
+                    throw Exception("Bad test: the parent has no unspent outputs");
+                const HashX hashX = it->first;
+                const IONum n = *it->second.utxo.begin();
+                it->second.utxo.erase(n);
+                tx->hashXs[hashX].unconfirmedSpends.emplace(TXO{parent->hash, n}, parent->txos[n]);
+            }
+            for (unsigned j = 0; j < nOuts; ++j) {
+                const HashX & hashX = !payTo.isEmpty() ? payTo : hashXs[rng.bounded(quint32(hashXs.size()))];
+                tx->hashXs[hashX].utxo.insert(IONum(tx->txos.size()));
+                tx->txos.push_back(TXOInfo{int64_t(1 + rng.bounded(100'000)) * bitcoin::Amount::satoshi(), hashX, {}, 0});
+            }
+            tx->txos.emplace_back(); // OP_RETURN: not a valid TXOInfo, and not listed under any scripthash
+            insertMempoolTx(tx);
+            return tx;
+        }
+
+        /// Closes `storage` (which saves the mempool, if enabled), calls `whileClosed`, and then opens it again on the
+        /// same datadir (which loads the saved mempool, if any).
+        void reopen(const std::function<void()> &whileClosed = {}) {
+            storage.reset();
+            if (whileClosed)
+                whileClosed();
+            storage = std::make_unique<Storage>(options);
+            storage->startup();
+        }
+
+        /// Drops `tx` from the mempool, as the mempool sync does when bitcoind no longer has it. Returns the scripthashes
+        /// that Mempool::dropTxs says were affected.
+        Mempool::HashXSet dropMempoolTx(const Mempool::TxRef &tx) {
+            for (const auto & [hashX, ioinfo] : tx->hashXs)
+                for (const auto & [txo, info] : ioinfo.confirmedSpends)
+                    mempoolSpends.erase(txo);
+            mempoolTxs.erase(std::find(mempoolTxs.begin(), mempoolTxs.end(), tx));
+            auto [mempool, lock] = storage->mutableMempool();
+            return mempool.dropTxs({tx->hash});
+        }
+
+        // -- what Storage should return
+        Storage::History expectedHistory(const HashX &hashX, bool conf = true, bool unconf = true) const {
+            Storage::History ret;
+            if (auto it = state.histories.find(hashX); conf && it != state.histories.end())
+                ret = it->second;
+            if (unconf) {
+                Storage::History mp;
+                for (const auto & tx : mempoolTxs)
+                    if (tx->hashXs.count(hashX))
+                        mp.push_back(Storage::HistoryItem{tx->hash, tx->hasUnconfirmedParentTx ? -1 : 0, tx->fee});
+                // same order as Mempool::TxRefOrdering: txs with unconfirmed parents last
+                std::sort(mp.begin(), mp.end(), [](const Storage::HistoryItem &a, const Storage::HistoryItem &b) {
+                    return std::make_pair(a.height < 0, a.hash) < std::make_pair(b.height < 0, b.hash);
+                });
+                ret.insert(ret.end(), mp.begin(), mp.end());
+            }
+            return ret;
+        }
+        Storage::UnspentItems expectedUnspent(const HashX &hashX) const {
+            Storage::UnspentItems ret;
+            for (const auto & [txo, utxo] : state.utxos)
+                if (utxo.hashX == hashX && !mempoolSpends.count(txo))
+                    ret.push_back(utxo.item);
+            for (const auto & tx : mempoolTxs)
+                if (auto it = tx->hashXs.find(hashX); it != tx->hashXs.end())
+                    for (const auto n : it->second.utxo)
+                        ret.push_back(Storage::UnspentItem{{tx->hash, 0, tx->fee}, n, tx->txos[n].amount, 0});
+            return ret;
+        }
+        std::pair<bitcoin::Amount, bitcoin::Amount> expectedBalance(const HashX &hashX) const {
+            std::pair<bitcoin::Amount, bitcoin::Amount> ret;
+            for (const auto & [txo, utxo] : state.utxos)
+                if (utxo.hashX == hashX)
+                    ret.first += utxo.item.value;
+            for (const auto & tx : mempoolTxs)
+                if (auto it = tx->hashXs.find(hashX); it != tx->hashXs.end()) {
+                    for (const auto & [txo, info] : it->second.confirmedSpends)
+                        ret.second -= info.amount;
+                    for (const auto n : it->second.utxo)
+                        ret.second += tx->txos[n].amount;
+                }
+            return ret;
+        }
+
+        /// Compares unspent items ignoring the order of the mempool ones, and their (fudged) txNum.
+        static bool sameUnspent(Storage::UnspentItems a, Storage::UnspentItems b) {
+            const auto Normalize = [](Storage::UnspentItems &v) {
+                for (auto & item : v)
+                    if (item.height <= 0) item.txNum = 0;
+                std::sort(v.begin(), v.end(), [](const Storage::UnspentItem &x, const Storage::UnspentItem &y) {
+                    const bool xm = x.height <= 0, ym = y.height <= 0;
+                    return std::tie(xm, x.txNum, x.hash, x.tx_pos) < std::tie(ym, y.txNum, y.hash, y.tx_pos);
+                });
+            };
+            Normalize(a);
+            Normalize(b);
+            return a == b;
+        }
+
+    private:
+        /// Puts `tx` in the mempool the way SynchMempoolTask does: indexed under each of its scripthashes, with its
+        /// vectors trimmed, and counted in the fee histogram and the memory total.
+        void insertMempoolTx(const Mempool::TxRef &tx) {
+            for (auto & [hashX, ioinfo] : tx->hashXs) {
+                ioinfo.confirmedSpends.shrink_to_fit();
+                ioinfo.unconfirmedSpends.shrink_to_fit();
+                ioinfo.utxo.shrink_to_fit();
+            }
+            tx->hashXs.shrink_to_fit();
+            tx->txos.shrink_to_fit();
+            auto [mempool, lock] = storage->mutableMempool();
+            mempool.txs[tx->hash] = tx;
+            for (const auto & [hashX, ioinfo] : tx->hashXs) {
+                auto & txvec = mempool.hashXTxs[hashX];
+                txvec.push_back(tx);
+                std::sort(txvec.begin(), txvec.end(), Mempool::TxRefOrdering{});
+            }
+            mempool.feeHistogramAdd(*tx);
+            mempool.memBytesAdd(*tx);
+            mempoolTxs.push_back(tx);
+        }
+
+        QRandomGenerator rng;
+        std::vector<bitcoin::CScript> scripts;
+        std::vector<State> undoStates; ///< the state before each block
+        std::set<TXO> mempoolSpends; ///< confirmed utxos spent by mempoolTxs
+    };
+
+    void testManyEquivalence() {
+        TestChain chain;
+        for (int i = 0; i < 6; ++i)
+            chain.addBlock(10);
+        for (int i = 0; i < 4; ++i)
+            chain.addMempoolTx();
+        auto & storage = *chain.storage;
+        const auto Fail = [](const QString &what, const HashX &hashX) {
+            throw Exception(QString("%1 mismatch for %2").arg(what, QString(hashX.toHex())));
+        };
+
+        // single-key lookups agree with what the blocks say
+        size_t maxHist = 0, maxUnspent = 0, nHist = 0, nUnspent = 0;
+        for (const auto & hashX : chain.hashXs) {
+            if (storage.getHistory(hashX, true, true) != chain.expectedHistory(hashX)) Fail("getHistory", hashX);
+            if (storage.getHistory(hashX, true, false) != chain.expectedHistory(hashX, true, false)) Fail("getHistory (confirmed)", hashX);
+            if (storage.getHistory(hashX, false, true) != chain.expectedHistory(hashX, false, true)) Fail("getHistory (mempool)", hashX);
+            if (!TestChain::sameUnspent(storage.listUnspent(hashX), chain.expectedUnspent(hashX))) Fail("listUnspent", hashX);
+            if (storage.getBalance(hashX) != chain.expectedBalance(hashX)) Fail("getBalance", hashX);
+            maxHist = std::max(maxHist, chain.expectedHistory(hashX).size());
+            // MaxHistory applies to the unspent items before those spent in the mempool are filtered out
+            size_t nRaw = chain.expectedUnspent(hashX).size();
+            for (const auto & tx : chain.mempoolTxs)
+                if (auto it = tx->hashXs.find(hashX); it != tx->hashXs.end())
+                    nRaw += it->second.confirmedSpends.size();
+            maxUnspent = std::max(maxUnspent, nRaw);
+            nHist += chain.expectedHistory(hashX).size();
+            nUnspent += nRaw;
+        }
+        if (maxHist == 0 || maxUnspent == 0 || nHist == maxHist || nUnspent == maxUnspent)
+            throw Exception("The test chain is too small to be useful");
+
+        // the batched lookups agree with the single-key ones, including for an invalid scripthash
+        auto keys = chain.hashXs;
+        keys.insert(keys.begin() + 1, QByteArray("bad"));
+        const auto hists = storage.getHistories(keys, true, true);
+        const auto unspents = storage.listUnspents(keys);
+        const auto balances = storage.getBalances(keys);
+        if (hists.size() != keys.size() || unspents.size() != keys.size() || balances.size() != keys.size())
+            throw Exception("Batched results are not parallel to their argument");
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (hists[i] != storage.getHistory(keys[i], true, true)) Fail("getHistories", keys[i]);
+            if (unspents[i] != storage.listUnspent(keys[i])) Fail("listUnspents", keys[i]);
+            if (balances[i] != storage.getBalance(keys[i])) Fail("getBalances", keys[i]);
+        }
+        if (!hists[1].empty() || !unspents[1].empty() || balances[1] != std::pair<bitcoin::Amount, bitcoin::Amount>{})
+            throw Exception("An invalid scripthash did not yield an empty result");
+
+        // MaxHistory limits the total across a batched call, which throws, without affecting the single-key lookups
+        chain.options->maxHistory = int(maxHist);
+        bool threw = false;
+        try { storage.getHistories(chain.hashXs, true, true); } catch (const HistoryTooLarge &) { threw = true; }
+        if (!threw) throw Exception("getHistories did not throw HistoryTooLarge when over the total limit");
+        for (const auto & hashX : chain.hashXs)
+            if (storage.getHistory(hashX, true, true) != chain.expectedHistory(hashX)) Fail("getHistory (at the limit)", hashX);
+        chain.options->maxHistory = int(maxUnspent);
+        threw = false;
+        try { storage.listUnspents(chain.hashXs); } catch (const HistoryTooLarge &) { threw = true; }
+        if (!threw) throw Exception("listUnspents did not throw HistoryTooLarge when over the total limit");
+        for (const auto & hashX : chain.hashXs)
+            if (!TestChain::sameUnspent(storage.listUnspent(hashX), chain.expectedUnspent(hashX))) Fail("listUnspent (at the limit)", hashX);
+
+        // ... and a single history over the limit is still empty, or confirmed-only if the mempool pushed it over
+        chain.options->maxHistory = int(maxHist) - 1;
+        for (const auto & hashX : chain.hashXs) {
+            const auto conf = chain.expectedHistory(hashX, true, false), all = chain.expectedHistory(hashX);
+            const auto expected = conf.size() > maxHist - 1 ? Storage::History{} : all.size() > maxHist - 1 ? conf : all;
+            if (storage.getHistory(hashX, true, true) != expected) Fail("getHistory (over the limit)", hashX);
+        }
+        Log() << "storage_many: " << chain.hashXs.size() << " scripthashes, " << nHist << " history items; test passed";
+    }
+
+    const auto test_many = App::registerTest("storage_many", &testManyEquivalence);
+
+    /// SubsMgr::getFullStatus, resuming from its midstate, agrees with the status computed the old way (formatted
+    /// with QTextStream and hashed in one go) from the full history, as blocks are added and undone.
+    void testStatusMidstate() {
+        TestChain chain;
+        for (int i = 0; i < 4; ++i)
+            chain.addBlock(10);
+        for (int i = 0; i < 3; ++i)
+            chain.addMempoolTx();
+        auto & storage = *chain.storage;
+        auto & subs = *storage.subs();
+        const HashX mempoolOnly(HashLen, 'm'), noHistory(HashLen, 'n');
+        {
+            // a mempool tx paying to a scripthash with no confirmed history, whose parent is unconfirmed (height -1)
+            auto tx = std::make_shared<Mempool::Tx>();
+            tx->hash = QByteArray(HashLen, 't');
+            tx->sizeBytes = 250;
+            tx->fee = 250 * bitcoin::Amount::satoshi();
+            tx->hasUnconfirmedParentTx = true;
+            tx->hashXs[mempoolOnly].utxo.insert(0);
+            tx->txos.push_back(TXOInfo{1000 * bitcoin::Amount::satoshi(), mempoolOnly, {}, 0});
+            auto [mempool, lock] = storage.mutableMempool();
+            mempool.txs[tx->hash] = tx;
+            mempool.hashXTxs[mempoolOnly].push_back(tx);
+        }
+        auto keys = chain.hashXs;
+        keys.push_back(mempoolOnly);
+        keys.push_back(noHistory);
+        const auto Legacy = [](const Storage::History &hist) {
+            if (hist.empty())
+                return StatusHash();
+            QString historyString;
+            {
+                QTextStream ts(&historyString, QIODevice::WriteOnly);
+                for (const auto & item : hist)
+                    ts << Util::ToHexFast(item.hash) << ":" << item.height << ":";
+            }
+            return BTC::HashOnce(historyString.toUtf8());
+        };
+        const auto Check = [&](const char *when) {
+            for (const auto & hashX : keys)
+                if (subs.getFullStatus(hashX) != Legacy(storage.getHistory(hashX, true, true)))
+                    throw Exception(QString("Status mismatch for %1 %2").arg(QString(hashX.toHex()), when));
+        };
+        if (!Legacy(storage.getHistory(noHistory, true, true)).isEmpty()
+                || storage.getHistory(mempoolOnly, true, true) != Storage::History{{QByteArray(HashLen, 't'), -1, 250 * bitcoin::Amount::satoshi()}})
+            throw Exception("Unexpected history for the extra scripthashes");
+
+        Check("when not subscribed");
+        for (const auto & hashX : keys)
+            subs.testSubscribe(hashX);
+        Check("on first use of the midstate");
+        Check("when resumed with nothing new");
+        chain.addBlock(6);
+        Check("when resumed after a block was added");
+        chain.addMempoolTx();
+        Check("when resumed after a mempool tx was added");
+        chain.undoBlock();
+        Check("after a block was undone");
+        // the TxNums of the undone block are recycled by different txs, so the old midstate must not be resumed
+        chain.undoBlock();
+        chain.addBlock(8);
+        Check("after a block was undone and replaced");
+        chain.addBlock(8);
+        Check("when resumed after the replacement");
+
+        // with a scripthash's confirmed history exactly at the limit, its mempool suffix is dropped and the status is
+        // of the confirmed history only; one below, it has no status at all
+        size_t nConf = 0;
+        for (const auto & hashX : chain.hashXs)
+            if (const auto n = chain.expectedHistory(hashX, true, false).size(); n < chain.expectedHistory(hashX).size())
+                nConf = std::max(nConf, n);
+        if (!nConf)
+            throw Exception("The test chain has no confirmed scripthash with mempool history");
+        chain.options->maxHistory = int(nConf);
+        Check("with the mempool over MaxHistory");
+        chain.options->maxHistory = int(nConf) - 1;
+        Check("with the confirmed history over MaxHistory");
+        Log() << "storage_status: " << keys.size() << " scripthashes; test passed";
+    }
+
+    const auto test_status = App::registerTest("storage_status", &testStatusMidstate);
+
+    /// The result cache: a result computed under a generation that was since invalidated is not cached, and adding a
+    /// block, undoing one, and the mempool sync each drop the cached results of exactly the scripthashes whose
+    /// results they changed.
+    void testResultCache() {
+        using Kind = Storage::CachedResultKind;
+        constexpr Kind kinds[] = { Kind::History, Kind::Mempool, Kind::Balance, Kind::Unspent };
+        TestChain chain;
+        for (int i = 0; i < 4; ++i)
+            chain.addBlock(6);
+        for (int i = 0; i < 2; ++i)
+            chain.addMempoolTx();
+        auto & storage = *chain.storage;
+        const QByteArray json = "[]";
+
+        // generations
+        const auto gen = storage.resultCacheGeneration();
+        storage.putCachedResult(Kind::History, chain.hashXs[0], json, gen);
+        if (storage.getCachedResult(Kind::History, chain.hashXs[0]) != json)
+            throw Exception("A result computed under the current generation was not cached");
+        storage.invalidateCachedResults({chain.hashXs[1]});
+        if (storage.resultCacheGeneration() == gen)
+            throw Exception("An invalidation did not bump the generation");
+        if (storage.getCachedResult(Kind::History, chain.hashXs[0]) != json)
+            throw Exception("An invalidation dropped a result for another scripthash");
+        storage.putCachedResult(Kind::Balance, chain.hashXs[0], json, gen);
+        if (storage.getCachedResult(Kind::Balance, chain.hashXs[0]))
+            throw Exception("A result computed under a stale generation was cached");
+
+        // Caches every kind of result for every scripthash, runs `op`, then checks that the results that are gone are
+        // exactly those of the scripthashes whose history, utxos or balance `op` changed.
+        using Snapshot = std::tuple<Storage::History, Storage::UnspentItems, std::pair<bitcoin::Amount, bitcoin::Amount>>;
+        const auto Expected = [&chain](const HashX &hashX) {
+            return Snapshot{chain.expectedHistory(hashX), chain.expectedUnspent(hashX), chain.expectedBalance(hashX)};
+        };
+        const auto Check = [&](const char *what, const std::function<void()> &op) {
+            std::map<HashX, Snapshot> before;
+            for (const auto & hashX : chain.hashXs) {
+                before[hashX] = Expected(hashX);
+                for (const auto kind : kinds)
+                    storage.putCachedResult(kind, hashX, json, storage.resultCacheGeneration());
+            }
+            op();
+            size_t nChanged = 0;
+            for (const auto & hashX : chain.hashXs) {
+                const bool changed = before[hashX] != Expected(hashX);
+                nChanged += changed;
+                for (const auto kind : kinds)
+                    if (storage.getCachedResult(kind, hashX).has_value() == changed)
+                        throw Exception(QString("%1: the cached '%2' result for %3 was %4").arg(what).arg(char(kind))
+                                        .arg(QString(hashX.toHex())).arg(changed ? "kept" : "dropped"));
+            }
+            if (!nChanged || nChanged == chain.hashXs.size())
+                throw Exception(QString("%1: the test chain is not useful, %2 scripthashes changed").arg(what).arg(nChanged));
+        };
+        Check("addBlock", [&] { chain.addBlock(1, true); });
+        Check("undoLatestBlock", [&] { chain.undoBlock(true); });
+        // the mempool sync invalidates the scripthashes of the txs it adds, and those that dropTxs() says it affected
+        Check("mempool add", [&] {
+            const auto tx = chain.addMempoolTx();
+            Mempool::HashXSet affected;
+            for (const auto & [hashX, ioinfo] : tx->hashXs)
+                affected.insert(hashX);
+            storage.invalidateCachedResults(affected);
+        });
+        Check("mempool drop", [&] { storage.invalidateCachedResults(chain.dropMempoolTx(chain.mempoolTxs.front())); });
+        Log() << "storage_resultcache: test passed";
+    }
+
+    const auto test_resultcache = App::registerTest("storage_resultcache", &testResultCache);
+
+    /// getHistoryRange returns the confirmed history in blocks [from, to), plus the mempool if `to` is unspecified,
+    /// and applies MaxHistory to the size of the slice only.
+    void testHistoryRange() {
+        TestChain chain;
+        constexpr unsigned nBlocks = 6;
+        for (unsigned i = 0; i < nBlocks; ++i)
+            chain.addBlock(5);
+        for (int i = 0; i < 3; ++i)
+            chain.addMempoolTx();
+        auto & storage = *chain.storage;
+        const auto Expected = [&chain](const HashX &hashX, unsigned from, std::optional<unsigned> to) {
+            Storage::History ret;
+            for (const auto & item : chain.expectedHistory(hashX, true, false))
+                if (unsigned(item.height) >= from && (!to || unsigned(item.height) < *to))
+                    ret.push_back(item);
+            if (!to)
+                for (const auto & item : chain.expectedHistory(hashX, false, true))
+                    ret.push_back(item);
+            return ret;
+        };
+        const auto Fail = [](const HashX &hashX, unsigned from, std::optional<unsigned> to, const char *what) {
+            throw Exception(QString("getHistoryRange(%1, %2, %3): %4").arg(QString(hashX.toHex())).arg(from)
+                            .arg(to ? QString::number(*to) : QString("none"), QString(what)));
+        };
+        size_t nItems = 0, maxSlice = 0;
+        for (const auto & hashX : chain.hashXs) {
+            // every range, including empty ones (from == to), from > to, and to past the tip
+            for (unsigned from = 0; from <= nBlocks + 1; ++from) {
+                for (unsigned to = 0; to <= nBlocks + 2; ++to) {
+                    const auto res = storage.getHistoryRange(hashX, from, to);
+                    if (res != Expected(hashX, from, to))
+                        Fail(hashX, from, to, "unexpected result");
+                    if (from >= to && !res.empty())
+                        Fail(hashX, from, to, "empty range is not empty");
+                    maxSlice = std::max(maxSlice, res.size());
+                }
+                if (storage.getHistoryRange(hashX, from, std::nullopt) != Expected(hashX, from, std::nullopt))
+                    Fail(hashX, from, std::nullopt, "unexpected result");
+            }
+            if (storage.getHistoryRange(hashX, 0, std::nullopt) != storage.getHistory(hashX, true, true))
+                Fail(hashX, 0, std::nullopt, "differs from getHistory");
+            nItems += chain.expectedHistory(hashX).size();
+        }
+        if (storage.getHistoryRange(QByteArray(HashLen, 'x'), 0, std::nullopt) != Storage::History{})
+            throw Exception("getHistoryRange of an unknown scripthash is not empty");
+
+        // an oversized slice throws, but a history larger than MaxHistory can still be paged through block by block
+        size_t maxBlock = 0;
+        for (const auto & hashX : chain.hashXs)
+            for (unsigned h = 0; h < nBlocks; ++h)
+                maxBlock = std::max(maxBlock, storage.getHistoryRange(hashX, h, h + 1).size());
+        if (maxBlock < 2 || maxBlock >= maxSlice)
+            throw Exception("The test chain is not useful for the MaxHistory checks");
+        chain.options->maxHistory = int(maxBlock);
+        for (const auto & hashX : chain.hashXs) {
+            Storage::History paged;
+            for (unsigned h = 0; h < nBlocks; ++h) {
+                const auto page = storage.getHistoryRange(hashX, h, h + 1);
+                paged.insert(paged.end(), page.begin(), page.end());
+            }
+            if (paged != chain.expectedHistory(hashX, true, false))
+                Fail(hashX, 0, nBlocks, "paging did not yield the whole history");
+            const bool over = chain.expectedHistory(hashX, true, false).size() > maxBlock;
+            bool threw = false;
+            try { storage.getHistoryRange(hashX, 0, nBlocks); } catch (const HistoryTooLarge &) { threw = true; }
+            if (threw != over)
+                Fail(hashX, 0, nBlocks, over ? "oversized slice did not throw HistoryTooLarge" : "threw HistoryTooLarge");
+        }
+        Log() << "storage_historyrange: " << nItems << " history items; test passed";
+    }
+
+    const auto test_historyrange = App::registerTest("storage_historyrange", &testHistoryRange);
+
+    /// Storage::exportSnapshot then Storage::importSnapshot into a fresh datadir: the imported db must answer
+    /// exactly like the original. A snapshot with a bad chunk checksum must be rejected.
+    void testSnapshot() {
+        TestChain chain;
+        constexpr unsigned nBlocks = 8;
+        for (unsigned i = 0; i < nBlocks; ++i)
+            chain.addBlock(2 + i);
+        QTemporaryDir dir;
+        if (!dir.isValid())
+            throw Exception("Unable to create a temporary directory");
+        const QString fileName = dir.filePath("snapshot.bin");
+        const auto nBytes = chain.storage->exportSnapshot(fileName);
+        if (!nBytes || uint64_t(QFileInfo(fileName).size()) != nBytes)
+            throw Exception("exportSnapshot returned an unexpected size");
+
+        // Returns a Storage started on a new, empty datadir named `name`, importing `snapshot`
+        const auto Import = [&dir](const QString &name, const QString &snapshot) {
+            auto options = std::make_shared<Options>();
+            options->datadir = dir.filePath(name);
+            options->importSnapshot = snapshot;
+            if (!QDir().mkpath(options->datadir))
+                throw Exception("Unable to create a datadir");
+            auto storage = std::make_unique<Storage>(options); // keeps a reference to `options`
+            storage->startup(); // imports
+            return storage;
+        };
+        {
+            const auto imported = Import("imported", fileName);
+            const auto & orig = *chain.storage;
+            if (imported->latestTip() != orig.latestTip() || imported->latestTip().first != int(nBlocks) - 1)
+                throw Exception("Imported tip differs");
+            if (imported->headersFromHeight(0, nBlocks) != orig.headersFromHeight(0, nBlocks)
+                    || imported->headersFromHeight(0, nBlocks).size() != nBlocks)
+                throw Exception("Imported headers differ");
+            for (const auto & hashX : chain.hashXs) {
+                const auto Fail = [&hashX](const char *what) {
+                    throw Exception(QString("Imported %1 differs for %2").arg(QString(what), QString(hashX.toHex())));
+                };
+                const auto hist = imported->getHistory(hashX, true, true);
+                if (hist != orig.getHistory(hashX, true, true) || hist != chain.expectedHistory(hashX))
+                    Fail("history");
+                const auto utxos = imported->listUnspent(hashX);
+                if (utxos != orig.listUnspent(hashX) || !TestChain::sameUnspent(utxos, chain.expectedUnspent(hashX)))
+                    Fail("listunspent");
+                if (imported->getBalance(hashX) != chain.expectedBalance(hashX))
+                    Fail("balance");
+            }
+        }
+
+        // flip a byte of the first chunk's checksum
+        const QString badName = dir.filePath("bad.bin");
+        {
+            QFile in(fileName), out(badName);
+            if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly))
+                throw Exception("Unable to copy the snapshot");
+            QByteArray data = in.readAll();
+            const int pos = Snapshot::kHeaderLen + Snapshot::ChunkHeader::serSize - HashLen;
+            data[pos] = char(data.at(pos) ^ 0x01);
+            out.write(data);
+        }
+        bool threw = false;
+        try {
+            Import("bad", badName);
+        } catch (const DatabaseFormatError &) {
+            threw = true;
+        }
+        if (!threw)
+            throw Exception("A snapshot with a bad checksum was imported");
+
+        Log() << "storage_snapshot: " << nBytes << " bytes; test passed";
+    }
+
+    const auto test_snapshot = App::registerTest("storage_snapshot", &testSnapshot);
+
+    /// A canonical listing of everything in `mempool`, for comparing two mempools that share no objects.
+    QStringList DescribeMempool(const Mempool &mempool) {
+        const auto InfoStr = [](const TXOInfo &info) { return info.isValid() ? QString(info.toBytes().toHex()) : QString("-"); };
+        QStringList ret;
+        std::map<TxHash, Mempool::TxRef> txs;
+        for (const auto & [hash, tx] : mempool.txs)
+            txs.emplace(hash, tx);
+        for (const auto & [hash, tx] : txs) {
+            ret << QString("tx %1 size=%2 fee=%3 parent=%4").arg(QString(hash.toHex())).arg(tx->sizeBytes)
+                       .arg(qint64(tx->fee / bitcoin::Amount::satoshi())).arg(int(tx->hasUnconfirmedParentTx));
+            for (const auto & info : tx->txos)
+                ret << "  txo " + InfoStr(info);
+            for (const auto & [hashX, ioinfo] : tx->hashXs) {
+                ret << "  hashX " + QString(hashX.toHex());
+                for (const auto & [txo, info] : ioinfo.confirmedSpends)
+                    ret << "    confirmed spend " + txo.toString() + " " + InfoStr(info);
+                for (const auto & [txo, info] : ioinfo.unconfirmedSpends)
+                    ret << "    unconfirmed spend " + txo.toString() + " " + InfoStr(info);
+                QStringList utxo;
+                for (const IONum n : ioinfo.utxo)
+                    utxo << QString::number(n);
+                ret << "    utxo " + utxo.join(",");
+            }
+        }
+        std::map<HashX, QStringList> hashXTxs;
+        for (const auto & [hashX, txvec] : mempool.hashXTxs)
+            for (const auto & tx : txvec)
+                hashXTxs[hashX] << QString(tx->hash.toHex());
+        for (const auto & [hashX, hashes] : hashXTxs)
+            ret << "hashXTxs " + QString(hashX.toHex()) + ": " + hashes.join(",");
+        return ret;
+    }
+
+    /// Storage::saveMempool on close then Storage::loadMempool on the next startup: the mempool must come back
+    /// identical. A saved file for a different tip, or a corrupted or truncated one, must be rejected, leaving the
+    /// mempool empty.
+    void testMempoolFile() {
+        TestChain chain;
+        for (unsigned i = 0; i < 5; ++i)
+            chain.addBlock(3 + i);
+        std::vector<Mempool::TxRef> parents;
+        for (unsigned i = 0; i < 4; ++i)
+            parents.push_back(chain.addMempoolTx());
+        const auto child = chain.addMempoolChild(parents[0], 3);
+        chain.addMempoolChild(parents[1], 3);
+        chain.addMempoolChild(child, 2); // a grandchild
+
+        QStringList desc;
+        Mempool::FeeRateSizeMap feeRateSizes;
+        size_t memBytes;
+        {
+            auto [mempool, lock] = chain.storage->mutableMempool();
+            // the parents' utxo vectors kept their capacity when the children spent from them, whereas the loader
+            // reserves exactly: trim them and count them again so that the memory totals are comparable
+            for (const auto & [hash, tx] : mempool.txs) {
+                for (auto & [hashX, ioinfo] : tx->hashXs)
+                    ioinfo.utxo.shrink_to_fit();
+                mempool.memBytesAdd(*tx);
+            }
+            desc = DescribeMempool(mempool);
+            feeRateSizes = mempool.feeRateSizes;
+            memBytes = mempool.txsMemBytes;
+            if (mempool.txs.size() != 7 || feeRateSizes.empty() || !memBytes)
+                throw Exception("Bad test: unexpected mempool");
+        }
+
+        const QString fileName = chain.options->datadir + QDir::separator() + MempoolFile::kFileName;
+        QByteArray saved;
+        const auto CheckLoaded = [&](const char *when) {
+            const auto Fail = [when](const QString &what) {
+                throw Exception(QString("%1 %2 differs from the saved one").arg(QString(when), what));
+            };
+            {
+                auto [mempool, lock] = chain.storage->mempool();
+                if (DescribeMempool(mempool) != desc) Fail("mempool");
+                if (mempool.feeRateSizes != feeRateSizes) Fail("fee histogram");
+                if (mempool.txsMemBytes != memBytes) Fail("txsMemBytes");
+            }
+            for (const auto & hashX : chain.hashXs) {
+                if (chain.storage->getHistory(hashX, true, true) != chain.expectedHistory(hashX))
+                    Fail("history of " + QString(hashX.toHex()));
+                if (!TestChain::sameUnspent(chain.storage->listUnspent(hashX), chain.expectedUnspent(hashX)))
+                    Fail("listunspent of " + QString(hashX.toHex()));
+                if (chain.storage->getBalance(hashX) != chain.expectedBalance(hashX))
+                    Fail("balance of " + QString(hashX.toHex()));
+            }
+            if (QFile::exists(fileName))
+                throw Exception("The mempool file was not deleted after loading");
+        };
+        chain.reopen([&] {
+            QFile f(fileName);
+            if (!f.open(QIODevice::ReadOnly))
+                throw Exception("The mempool was not saved");
+            saved = f.readAll();
+        });
+        CheckLoaded("The loaded");
+        chain.reopen(); // a loaded mempool saves the same way again
+        CheckLoaded("The reloaded");
+
+        // Each of these must be rejected
+        const auto WithChecksum = [](QByteArray payload) {
+            payload.append(BTC::HashOnce(payload));
+            return payload;
+        };
+        const QByteArray payload = saved.left(saved.size() - HashLen);
+        QByteArray otherTip = payload, badChecksum = saved;
+        const int tipHashPos = MempoolFile::kMagicLen + 8; // after the version and the height
+        otherTip[tipHashPos] = char(otherTip.at(tipHashPos) ^ 0x01);
+        badChecksum[badChecksum.size() - 1] = char(badChecksum.at(badChecksum.size() - 1) ^ 0x01);
+        const std::pair<const char *, QByteArray> bad[] = {
+            { "a different tip", WithChecksum(otherTip) },
+            { "a bad checksum", badChecksum },
+            { "truncated data", WithChecksum(payload.left(payload.size() / 2)) },
+            { "a truncated file", saved.left(saved.size() / 2) },
+        };
+        for (const auto & [what, data] : bad) {
+            chain.reopen([&, &data = data] {
+                QFile f(fileName); // replaces what was just saved, if anything
+                if (!f.open(QIODevice::WriteOnly) || f.write(data) != data.size())
+                    throw Exception("Unable to write the mempool file");
+            });
+            auto [mempool, lock] = chain.storage->mempool();
+            if (!mempool.txs.empty() || !mempool.hashXTxs.empty() || !mempool.feeRateSizes.empty() || mempool.txsMemBytes)
+                throw Exception(QString("A mempool file with %1 was not rejected").arg(QString(what)));
+            if (QFile::exists(fileName))
+                throw Exception(QString("A mempool file with %1 was not deleted").arg(QString(what)));
+        }
+
+        Log() << "storage_mempoolfile: " << saved.size() << " bytes; test passed";
+    }
+
+    const auto test_mempoolfile = App::registerTest("storage_mempoolfile", &testMempoolFile);
+
+    /// Undoing a block drops just the mempool txs that spent its outputs, along with their descendants, and the
+    /// scripthashes it notifies (and whose cached results it drops) are exactly those of the undone block plus those
+    /// of the dropped txs.
+    void testUndoMempool() {
+        TestChain chain(16);
+        for (int i = 0; i < 4; ++i)
+            chain.addBlock(4);
+        chain.addBlock(1);
+        auto & storage = *chain.storage;
+        const int tip = storage.latestTip().first;
+        std::set<HashX> blockHashXs;
+        for (const auto & hashX : chain.hashXs)
+            for (const auto & item : chain.expectedHistory(hashX, true, false))
+                if (item.height == tip)
+                    blockHashXs.insert(hashX);
+        const auto other = std::find_if(chain.hashXs.begin(), chain.hashXs.end(),
+                                        [&](const HashX &hashX) { return !blockHashXs.count(hashX); });
+        if (blockHashXs.empty() || other == chain.hashXs.end())
+            throw Exception("Bad test: the tip block has an unexpected set of scripthashes");
+
+        const auto FromTip = [tip](const TestChain::Utxo &utxo) { return utxo.item.height == tip; };
+        const auto NotFromTip = [tip](const TestChain::Utxo &utxo) { return utxo.item.height < tip; };
+        const std::vector<Mempool::TxRef> kept = { chain.addMempoolTx(NotFromTip), chain.addMempoolTx(NotFromTip) };
+        const auto keptChild = chain.addMempoolChild(kept.front(), 1);
+        const auto stale = chain.addMempoolTx(FromTip);
+        const auto staleChild = chain.addMempoolChild(stale, 1, *other); // pays to a scripthash the block didn't touch
+        std::set<HashX> expected = blockHashXs;
+        for (const auto & tx : { stale, staleChild })
+            for (const auto & [hashX, ioinfo] : tx->hashXs)
+                expected.insert(hashX);
+        if (!std::any_of(stale->hashXs.begin(), stale->hashXs.end(), [](const auto &pair) { return !pair.second.confirmedSpends.empty(); }))
+            throw Exception("Bad test: the tx that should spend from the tip block spends nothing");
+
+        using Kind = Storage::CachedResultKind;
+        const QByteArray json = "[]";
+        for (const auto & hashX : chain.hashXs)
+            storage.putCachedResult(Kind::Mempool, hashX, json, storage.resultCacheGeneration());
+        chain.undoBlock(true);
+        {
+            auto [mempool, lock] = storage.mempool();
+            if (mempool.txs.count(stale->hash) || mempool.txs.count(staleChild->hash))
+                throw Exception("A mempool tx that spent from the undone block, or its child, was kept");
+            if (mempool.txs.size() != 3 || !mempool.txs.count(kept[0]->hash) || !mempool.txs.count(kept[1]->hash)
+                    || !mempool.txs.count(keptChild->hash))
+                throw Exception("An unrelated mempool tx was dropped");
+        }
+        if (chain.mempoolTxs.size() != 3)
+            throw Exception("Bad test: TestChain::undoBlock did not drop the expected txs");
+        for (const auto & hashX : chain.hashXs) {
+            const bool notified = !storage.getCachedResult(Kind::Mempool, hashX).has_value();
+            if (notified != bool(expected.count(hashX)))
+                throw Exception(QString("Scripthash %1 was %2").arg(QString(hashX.toHex()), notified ? "notified" : "not notified"));
+            if (storage.getHistory(hashX, true, true) != chain.expectedHistory(hashX)
+                    || !TestChain::sameUnspent(storage.listUnspent(hashX), chain.expectedUnspent(hashX))
+                    || storage.getBalance(hashX) != chain.expectedBalance(hashX))
+                throw Exception(QString("Scripthash %1 differs after the undo").arg(QString(hashX.toHex())));
+        }
+
+        Log() << "storage_undomempool: " << expected.size() << " of " << chain.hashXs.size()
+              << " scripthashes notified; test passed";
+    }
+
+    const auto test_undomempool = App::registerTest("storage_undomempool", &testUndoMempool);
+} // namespace
+#endif
@@ -42,6 +42,7 @@
 #include <mutex>
 #include <optional>
 #include <shared_mutex>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -174,6 +175,12 @@ public:
     /// Given a TxNum, returns the block height for the TxNum's block (if it exists).
     /// Used to resolve scripthash_history -> block height for get_history. (thread safe, takes blkInfo lock)
     std::optional<unsigned> heightForTxNum(TxNum) const;
+    /// Batched version of hashForTxNum. Returns a vector parallel to `nums`. Cache misses are read from the txnum file
+    /// in one pass. Throws DatabaseError if any TxNum is missing (thread safe, takes no class-level locks)
+    std::vector<TxHash> hashesForTxNums(const std::vector<TxNum> &nums) const;
+    /// Batched version of heightForTxNum: takes the blkInfo lock once for all of `nums`. Returns a vector parallel to
+    /// `nums` (thread safe)
+    std::vector<std::optional<unsigned>> heightsForTxNums(const std::vector<TxNum> &nums) const;
     /// Given a block height and a position in the block (txIdx), return a TxHash.  Never throws. Returns !has_value if
     /// height/posInBlock pair is not found (or in very unlikely cases, if there was an underlying low-level error).
     /// Thread safe, takes class-level locks.
@@ -211,6 +218,35 @@ public:
     /// Thread-safe. Will return an empty vector if the confirmed history size exceeds MaxHistory, or a truncated
     /// vector if the confirmed + unconfirmed history exceeds MaxHistory.
     History getHistory(const HashX &, bool includeConfirmed, bool includeMempool) const;
+    /// Thread-safe. Batched version of the above for many scripthashes. Takes the blocks lock and the mempool lock once
+    /// for all of them, reads the confirmed histories with a single db MultiGet, and resolves all of the TxNums in one
+    /// pass. The returned vector is parallel to `hashXs`; each item is limited by MaxHistory as above. Unlike
+    /// getHistory(), this throws HistoryTooLarge if the total number of items across all of the histories would exceed
+    /// MaxHistory, and some other exception on database error (rather than returning empty histories).
+    std::vector<History> getHistories(const std::vector<HashX> &hashXs, bool includeConfirmed, bool includeMempool) const;
+
+    /// Result of getHistoryTail(). Used by SubsMgr to update a status hash incrementally.
+    struct HistoryTail {
+        size_t startIndex = 0; ///< index within the full confirmed history of `confirmed.front()`
+        History confirmed; ///< the confirmed items from startIndex onward
+        History unconfirmed; ///< the mempool items (left empty if confirmed + unconfirmed would exceed MaxHistory)
+        size_t nConfirmed = 0; ///< the size of the full confirmed history
+        TxNum lastConfirmedTxNum = 0; ///< the TxNum of the last confirmed item (only meaningful if nConfirmed > 0)
+        bool tooLarge = false; ///< if true the confirmed history exceeds MaxHistory and everything else is empty
+        uint64_t undoCount = 0; ///< the number of blocks undone so far, as of this read (pass it back in next time)
+    };
+    /// Thread-safe. Like getHistory(hashX, true, true), except that only the confirmed items from `startIndex` onward
+    /// are looked up, provided no block was undone since `undoCount` was returned by a previous call, and the confirmed
+    /// item at `startIndex - 1` still has TxNum `prevTxNum`. Otherwise (TxNums get recycled on undo), the whole
+    /// confirmed history is returned (with .startIndex = 0). May throw on database error.
+    HistoryTail getHistoryTail(const HashX &hashX, size_t startIndex, TxNum prevTxNum, uint64_t undoCount) const;
+
+    /// Thread-safe. Returns the confirmed history of hashX for blocks in the range [fromHeight, toHeight), followed by
+    /// the mempool history if toHeight is not specified. Unlike getHistory(), only the items in the range are decoded
+    /// and resolved (the range is found by binary search over the TxNums in the stored history), and the MaxHistory
+    /// limit applies only to the size of the result. Throws HistoryTooLarge if the result would exceed MaxHistory, or
+    /// some other exception on database error.
+    History getHistoryRange(const HashX &hashX, unsigned fromHeight, std::optional<unsigned> toHeight) const;
 
     struct UnspentItem : HistoryItem {
         IONum tx_pos = 0;
@@ -226,9 +262,34 @@ public:
     /// Thread-safe. Will return an empty vector if the confirmed unspent size exceeds MaxHistory items. It may also
     /// return a truncated vector if the overflow is as a result of confirmed+unconfirmed exceeding MaxHistory.
     UnspentItems listUnspent(const HashX &) const;
+    /// Thread-safe. Batched version of the above for many scripthashes, under a single acquisition of the blocks lock
+    /// and the mempool lock. The utxo amounts are read with a single db MultiGet. The returned vector is parallel to
+    /// `hashXs`. Throws HistoryTooLarge if the total number of items would exceed MaxHistory, and some other exception
+    /// on database error.
+    std::vector<UnspentItems> listUnspents(const std::vector<HashX> &hashXs) const;
 
     /// thread safe -- returns confirmd, unconfirmed balance for a scripthash
     std::pair<bitcoin::Amount, bitcoin::Amount> getBalance(const HashX &) const;
+    /// thread safe -- batched version of the above, under a single acquisition of the blocks lock and the mempool lock.
+    /// The returned vector is parallel to `hashXs`. Throws on database error.
+    std::vector<std::pair<bitcoin::Amount, bitcoin::Amount>> getBalances(const std::vector<HashX> &hashXs) const;
+
+    //-- scripthash query result cache
+    /// The kinds of per-scripthash results that may be cached. The serialized JSON for each is opaque to us.
+    enum class CachedResultKind : char { History = 'h', Mempool = 'm', Balance = 'b', Unspent = 'u' };
+    /// Thread-safe. Returns a counter that is incremented every time cached results are invalidated. Read this
+    /// *before* running a query and pass it to putCachedResult() along with the result, so that a result computed
+    /// from data that was invalidated while the query was running is never cached.
+    uint64_t resultCacheGeneration() const;
+    /// Thread-safe. Returns the cached serialized JSON result for (kind, hashX), if any.
+    std::optional<QByteArray> getCachedResult(CachedResultKind kind, const HashX &hashX) const;
+    /// Thread-safe. Caches `json` for (kind, hashX) unless the cache was invalidated since `generation` was read.
+    void putCachedResult(CachedResultKind kind, const HashX &hashX, const QByteArray &json, uint64_t generation);
+    /// Thread-safe. Drops all cached results for the scripthashes in `hashXs`. Called by us and by Controller right
+    /// after the history of those scripthashes changes (the same sets that are used for subscription notifications).
+    void invalidateCachedResults(const std::unordered_set<HashX, HashHasher> &hashXs);
+    /// Thread-safe. Drops all cached results. Used when a change did not compute the set of affected scripthashes.
+    void invalidateAllCachedResults();
 
     /// thread safe, called from controller when we are up-to-date
     void updateMerkleCache(unsigned height);
@@ -245,6 +306,9 @@ public:
     /// Thread-safe. Query db (but not mempool) for a UTXO, and return its info if found.  May throw on database error.
     /// (Does not take the blocks lock)
     std::optional<TXOInfo> utxoGetFromDB(const TXO &, bool throwIfMissing = false);
+    /// Thread-safe. Batched version of the above using a single db MultiGet. The returned vector is parallel to `txos`,
+    /// with !has_value() elements for TXOs that are not in the utxo db. May throw on database error.
+    std::vector<std::optional<TXOInfo>> utxoGetFromDB(const std::vector<TXO> &txos);
 
     /// Thread-safe. Query the mempool and the DB for a TXO. If the TXO is unspent, will return a valid
     /// optional.  If the TXO is spent or non-existant, will return a !has_value optional. May throw on internal
@@ -262,11 +326,8 @@ public:
     /// subsystems and multiple threads).
     inline SubsMgr * subs() const { return subsmgr.get(); }
 
-    /// called from a timer periodically from Controller (see Controller.cpp)
-    /// -- takes locks, updates compact fee histogram for the mempool
-    void refreshMempoolHistogram();
-
-    /// Takes a shared lock and returns the cached mempool histogram (calculated periodically in refreshMempoolHistogram above)
+    /// Takes a shared lock and returns the compact mempool fee histogram. The mempool maintains its fee rate bins
+    /// incrementally (see Mempool::feeRateSizes), and the compact form is only recomputed after they change.
     Mempool::FeeHistogramVec mempoolHistogram() const;
 
     // --- DUMP methods --- (used for debugging, largely)
@@ -278,6 +339,14 @@ public:
     /// optionally indented by `indent*indentLevel` spaces.  If indent is 0, the output will all be on 1 line with no padding.
     size_t dumpAllScriptHashes(QIODevice *outDev, unsigned indent=0, unsigned indentLevel=0, const DumpProgressFunc & = {}, size_t progInterval = 100000) const;
 
+    // --- SNAPSHOT methods --- (see the comment above Storage::exportSnapshot in Storage.cpp for the file format)
+
+    /// Thread-safe.  Writes a portable snapshot of the entire index (all of the rocksdb tables as well as the headers
+    /// and txnum2txhash RecordFiles) to fileName.  Chunks are compressed in parallel using the app-global ThreadPool.
+    /// Takes the blocks lock (shared) for the duration, so it is intended to be called before the Controller begins
+    /// processing blocks (see Controller::startup).  Returns the number of bytes written.  May throw on error.
+    uint64_t exportSnapshot(const QString &fileName) const;
+
 protected:
     virtual Stats stats() const override; ///< from StatsMixin
 
@@ -348,6 +417,18 @@ private:
     void loadCheckUTXOsInDB(); ///< may throw -- called from startup()
     void loadCheckTxNumsFileAndBlkInfo(); ///< may throw -- called from startup()
     void loadCheckEarliestUndo(); ///< may throw -- called from startup()
+    /// May throw -- called from startup() iff --import-snapshot was specified, after the db's are opened but before
+    /// any of the loadCheck*() functions above run. Requires an empty datadir.
+    void importSnapshot(const QString &fileName);
+
+    /// Called from cleanup() on clean shutdown: writes the processed mempool to the datadir, tagged with the
+    /// current chain tip, so that the next startup doesn't have to download it all again. Never throws.
+    void saveMempool();
+    /// Called from startup() after the loadCheck*() functions above. If a mempool file from saveMempool() exists and
+    /// matches the current chain tip, loads it into the (empty) mempool. The file is always deleted afterwards.
+    /// The first SynchMempoolTask then keeps whichever of these txs are still in bitcoind's mempool, drops the rest,
+    /// and downloads only the txs it doesn't yet know about. Never throws.
+    void loadMempool();
 
     std::optional<Header> headerForHeight_nolock(BlockHeight height, QString *errMsg = nullptr) const;
     std::vector<Header> headersFromHeight_nolock_nocheck(BlockHeight height, unsigned count, QString *errMsg = nullptr) const;
@@ -24,6 +24,7 @@
 #include <QThread>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <mutex>
 
@@ -358,27 +359,127 @@ std::pair<bool, bool> SubsMgr::globalSubsLimitFlags() const
     return { numActiveClientSubscriptions() > thresh, numScripthashesSubscribed() > thresh };
 }
 
+namespace {
+    /// Feeds `hasher` the status text for `hist`, that is: "txid:height:" for each item. The text is built directly
+    /// as bytes in a stack buffer, one item at a time.
+    void HashHistoryItems(CSHA256 &hasher, const Storage::History &hist) {
+        constexpr size_t kSuffixMax = 13; // ':' + at most 11 chars for an int + ':'
+        std::array<char, HashLen * 2 + kSuffixMax> buf;
+        for (const auto & item : hist) {
+            if (UNLIKELY(!Util::ToHexFastInPlace(item.hash, buf.data(), buf.size() - kSuffixMax)))
+                throw InternalError("HashHistoryItems: failed to hex encode a txid. FIXME!");
+            char *p = buf.data() + item.hash.size() * 2;
+            *p++ = ':';
+            // decimal height, may be 0 or -1 for mempool txs
+            char digits[12];
+            int n = 0;
+            unsigned h = item.height < 0 ? 0u - unsigned(item.height) : unsigned(item.height);
+            do { digits[n++] = char('0' + h % 10); h /= 10; } while (h);
+            if (item.height < 0)
+                *p++ = '-';
+            while (n)
+                *p++ = digits[--n];
+            *p++ = ':';
+            hasher.Write(reinterpret_cast<const uint8_t *>(buf.data()), size_t(p - buf.data()));
+        }
+    }
+    StatusHash FinalizeStatus(CSHA256 &hasher) {
+        StatusHash ret(int(CSHA256::OUTPUT_SIZE), Qt::Uninitialized);
+        hasher.Finalize(reinterpret_cast<uint8_t *>(ret.data()));
+        return ret;
+    }
+    /// status is non-reversed, single sha256 (32 bytes) of the history string. Empty if there is no history.
+    StatusHash StatusFromHistory(const Storage::History &hist) {
+        if (hist.empty())
+            // no history, return an empty QByteArray
+            return StatusHash();
+        CSHA256 hasher;
+        HashHistoryItems(hasher, hist);
+        return FinalizeStatus(hasher);
+    }
+    constexpr qint64 kTookKindaLongNS = 7500000LL; // 7.5mec -- if it takes longer than this, log it to debug log, otherwise don't as this can get spammy.
+}
+
 auto SubsMgr::getFullStatus(const HashX &sh) const -> StatusHash
 {
     const auto t0 = Util::getTimeNS();
-    StatusHash ret;
-    const auto hist = storage->getHistory(sh, true, true);
-    if (hist.empty())
-        // no history, return an empty QByteArray
+    const SubRef sub = findExistingSubRef(sh);
+    if (!sub) {
+        // not subscribed, nowhere to keep a midstate -- just hash the whole history
+        const auto hist = storage->getHistory(sh, true, true);
+        const StatusHash ret = StatusFromHistory(hist);
+        const auto elapsed = Util::getTimeNS() - t0;
+        if (elapsed > kTookKindaLongNS) {
+            DebugM("full status for ",  Util::ToHexFast(sh), " ", hist.size(), " items in ", QString::number(elapsed/1e6, 'f', 4), " msec");
+        }
         return ret;
-    QString historyString;
+    }
+    std::optional<Subscription::StatusMidstate> mid;
     {
-        QTextStream ts(&historyString, QIODevice::WriteOnly);
-        for (const auto & item : hist) {
-            ts << Util::ToHexFast(item.hash) << ":" << item.height << ":";
+        LockGuard g(sub->mut);
+        mid = sub->statusMidstate;
+    }
+    // Note: we must not hold sub->mut while taking the Storage locks in getHistoryTail
+    Storage::HistoryTail tail;
+    try {
+        tail = mid ? storage->getHistoryTail(sh, mid->nConfirmed, mid->lastTxNum, mid->undoCount)
+                   : storage->getHistoryTail(sh, 0, 0, 0);
+    } catch (const std::exception &e) {
+        // mimic Storage::getHistory, which logs the error and returns an empty history
+        Warning(Log::Magenta) << __func__ << ": " << e.what();
+        LockGuard g(sub->mut);
+        sub->statusMidstate.reset();
+        return StatusHash();
+    }
+    if (tail.tooLarge) {
+        Warning(Log::Magenta) << "getHistory: " << QString("History for scripthash %1 exceeds MaxHistory %2 with %3 items!")
+                                                   .arg(QString(sh.toHex())).arg(options->maxHistory).arg(tail.nConfirmed);
+        LockGuard g(sub->mut);
+        sub->statusMidstate.reset();
+        return StatusHash();
+    }
+    const bool resumed = mid && tail.startIndex > 0;
+    CSHA256 hasher = resumed ? mid->hasher : CSHA256();
+    HashHistoryItems(hasher, tail.confirmed);
+    {
+        LockGuard g(sub->mut);
+        sub->statusMidstate = Subscription::StatusMidstate{hasher, tail.nConfirmed, tail.lastConfirmedTxNum, tail.undoCount};
+    }
+    StatusHash ret;
+    if (tail.nConfirmed || !tail.unconfirmed.empty()) {
+        HashHistoryItems(hasher, tail.unconfirmed);
+        ret = FinalizeStatus(hasher);
+    }
+    const auto elapsed = Util::getTimeNS() - t0;
+    if (elapsed > kTookKindaLongNS) {
+        DebugM("status for ",  Util::ToHexFast(sh), " ", tail.nConfirmed + tail.unconfirmed.size(), " items (",
+               tail.confirmed.size() + tail.unconfirmed.size(), " hashed, resumed at ", tail.startIndex, ") in ",
+               QString::number(elapsed/1e6, 'f', 4), " msec");
+    }
+    return ret;
+}
+
+auto SubsMgr::getFullStatuses(const std::vector<HashX> &shs) const -> std::vector<StatusHash>
+{
+    const auto t0 = Util::getTimeNS();
+    std::vector<StatusHash> ret;
+    ret.reserve(shs.size());
+    size_t nItems = 0;
+    try {
+        for (const auto & hist : storage->getHistories(shs, true, true)) {
+            nItems += hist.size();
+            ret.push_back(StatusFromHistory(hist));
         }
+    } catch (const HistoryTooLarge &) {
+        // The combined history is too large to read in one go: fall back to reading them one at a time, so that the
+        // blocksLock is not held for too long.
+        ret.clear();
+        for (const auto & sh : shs)
+            ret.push_back(getFullStatus(sh));
     }
-    // status is non-reversed, single sha256 (32 bytes)
-    ret = BTC::HashOnce(historyString.toUtf8());
     const auto elapsed = Util::getTimeNS() - t0;
-    constexpr qint64 kTookKindaLongNS = 7500000LL; // 7.5mec -- if it takes longer than this, log it to debug log, otherwise don't as this can get spammy.
     if (elapsed > kTookKindaLongNS) {
-        DebugM("full status for ",  Util::ToHexFast(sh), " ", hist.size(), " items in ", QString::number(elapsed/1e6, 'f', 4), " msec");
+        DebugM("full status for ", shs.size(), " scripthashes, ", nItems, " items in ", QString::number(elapsed/1e6, 'f', 4), " msec");
     }
     return ret;
 }
@@ -459,3 +560,68 @@ auto SubsMgr::stats() const -> Stats
     ret["activeTimers"] = activeTimerMapForStats();
     return ret;
 }
+
+#ifdef ENABLE_TESTS
+#include "App.h"
+#include "BTC.h"
+
+#include <QRandomGenerator>
+#include <QTextStream>
+
+#include <limits>
+
+namespace {
+    /// The status as it was computed before the midstate: formatted with QTextStream, then hashed in one go. This is
+    /// what clients compare against, so the two must agree byte-for-byte.
+    StatusHash LegacyStatus(const Storage::History &hist) {
+        if (hist.empty())
+            return StatusHash();
+        QString historyString;
+        {
+            QTextStream ts(&historyString, QIODevice::WriteOnly);
+            for (const auto & item : hist)
+                ts << Util::ToHexFast(item.hash) << ":" << item.height << ":";
+        }
+        return BTC::HashOnce(historyString.toUtf8());
+    }
+
+    void testStatus() {
+        QRandomGenerator rng(1);
+        const auto RandHash = [&rng] {
+            QByteArray ret(HashLen, Qt::Uninitialized);
+            for (auto & c : ret)
+                c = char(rng.bounded(256));
+            return ret;
+        };
+        const auto Check = [](const Storage::History &hist, const char *what) {
+            if (StatusFromHistory(hist) != LegacyStatus(hist))
+                throw Exception(QString("Status mismatch for %1").arg(what));
+        };
+        Check({}, "an empty history");
+        constexpr int maxInt = std::numeric_limits<int>::max(), minInt = std::numeric_limits<int>::min();
+        for (const int height : {0, -1, 1, 9, 10, 99, 100, 999'999, 1'000'000, maxInt, -maxInt, minInt})
+            Check({Storage::HistoryItem{RandHash(), height, {}}}, qPrintable(QString("height %1").arg(height)));
+        Check({{RandHash(), 0, {}}, {RandHash(), -1, {}}, {RandHash(), -1, {}}}, "a mempool-only history");
+
+        // a long history, hashed in one go and resumed from a midstate at every split point
+        Storage::History hist;
+        for (int i = 0; i < 100; ++i)
+            hist.push_back(Storage::HistoryItem{RandHash(), int(rng.bounded(2'000'000)), {}});
+        hist.push_back(Storage::HistoryItem{RandHash(), 0, {}});
+        hist.push_back(Storage::HistoryItem{RandHash(), -1, {}});
+        Check(hist, "a long history");
+        const auto expected = LegacyStatus(hist);
+        for (size_t k = 0; k <= hist.size(); ++k) {
+            CSHA256 hasher;
+            HashHistoryItems(hasher, Storage::History(hist.begin(), hist.begin() + std::ptrdiff_t(k)));
+            CSHA256 resumed = hasher; // as SubsMgr::getFullStatus does with Subscription::StatusMidstate
+            HashHistoryItems(resumed, Storage::History(hist.begin() + std::ptrdiff_t(k), hist.end()));
+            if (FinalizeStatus(resumed) != expected)
+                throw Exception(QString("Status mismatch when resuming at item %1").arg(k));
+        }
+        Log() << "subsmgr_status: test passed";
+    }
+
+    const auto test_status = App::registerTest("subsmgr_status", &testStatus);
+} // namespace
+#endif
@@ -26,6 +26,8 @@
 #include "Storage.h"
 #include "Util.h"
 
+#include "bitcoin/crypto/sha256.h"
+
 #include <QObject>
 
 #include <functional>
@@ -64,6 +66,16 @@ protected:
     /// slightly delayed value -- but that's ok as a future notification to a client will rectify the situation with
     /// the most up-to-date status in the near future anyway.
     std::optional<StatusHash> cachedStatus;
+    /// The SHA-256 state after hashing the status text for the first `nConfirmed` confirmed history items, the last of
+    /// which has TxNum `lastTxNum`. Lets SubsMgr::getFullStatus hash only the newly confirmed items plus the mempool
+    /// suffix, rather than the entire history, each time the status is recomputed.
+    struct StatusMidstate {
+        CSHA256 hasher;
+        size_t nConfirmed = 0;
+        TxNum lastTxNum = 0;
+        uint64_t undoCount = 0; ///< from Storage::HistoryTail; a block undo invalidates this midstate
+    };
+    std::optional<StatusMidstate> statusMidstate;
     /// The last time this sub was accessed in milliseconds (Util::getTime()). If the ts goes beyond 1 minute in the
     /// past, and it has no clients attached, its entry may be removed.
     int64_t tsMsec = Util::getTime();
@@ -150,11 +162,17 @@ public:
 
 
     /// Thread-safe. Returns the status hash bytes (32 bytes single sha256 hash of the status text). Will return
-    /// an empty byte vector if the scriptHash in question has no history.
+    /// an empty byte vector if the scriptHash in question has no history. If `scriptHash` is subscribed, only the
+    /// confirmed items added since the last call are read and hashed (see Subscription::StatusMidstate).
     ///
     /// Note that this implicitly will take the Storage "blocksLock" as a shared lock -- so bear that in mind if calling
     /// this from `Storage` with that lock already held.
     StatusHash getFullStatus(const HashX &scriptHash) const;
+    /// Thread-safe. Batched version of the above. The histories are all read with a single Storage::getHistories call
+    /// (one acquisition of the "blocksLock"), unless their combined size exceeds MaxHistory, in which case they are
+    /// read one at a time as if by getFullStatus. The returned vector is parallel to `scriptHashes`. May throw on
+    /// database error.
+    std::vector<StatusHash> getFullStatuses(const std::vector<HashX> &scriptHashes) const;
 
     /// Thread-safe.  Client calls this to maybe save the status hash it just got from getFullStatus. We don't always
     /// take the value and cache it -- only under very specific conditions.
@@ -195,4 +213,9 @@ private:
     void doNotifyAllPending();
 
     void removeZombies(bool forced);
+#ifdef ENABLE_TESTS
+public:
+    /// Subscribes `sh` with no clients attached, so that getFullStatus() keeps a midstate for it.
+    void testSubscribe(const HashX &sh) { getOrMakeSubRef(sh); }
+#endif
 };
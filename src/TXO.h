@@ -43,7 +43,8 @@ struct TXO {
     QString toString() const;
 
     bool operator==(const TXO &o) const noexcept { return txHash == o.txHash && outN == o.outN; }
-    bool operator<(const TXO &o) const noexcept { return txHash < o.txHash && outN < o.outN; }
+    /// Lexicographic (txHash, outN) ordering, so that TXOs may be kept in sorted containers.
+    bool operator<(const TXO &o) const noexcept { return txHash != o.txHash ? txHash < o.txHash : outN < o.outN; }
 
 
     // serialization/deserialization
@@ -18,13 +18,19 @@
 //
 #pragma once
 
+#include "Common.h"
+
 #include <QObject>
 #include <QPointer>
 #include <QRunnable>
 
+#include <algorithm>
 #include <atomic>
+#include <exception>
 #include <functional>
+#include <future>
 #include <memory>
+#include <vector>
 
 class QThreadPool;
 
@@ -35,7 +41,8 @@ class QThreadPool;
 /// Each instance of this class internally creates its own QThreadPool instance, thus each instance never conflicts with
 /// other thread pools such as the Qt-provided QThreadPool::globalInstance().
 ///
-/// All of the public methods of this class are thread-safe.  None of the methods of this class throw.
+/// All of the public methods of this class are thread-safe.  None of the methods of this class throw (except
+/// parallelFor(), see its documentation).
 class ThreadPool : public QObject
 {
     Q_OBJECT
@@ -49,6 +56,9 @@ public:
     using FailFunc = std::function<void(const QString &)>;
     using VoidFunc = std::function<void()>;
 
+    /// Thrown by parallelFor() if the pool shut down before it got to run all of the chunks.
+    struct ShuttingDown : public Exception { using Exception::Exception; };
+
     /// Submit work to be performed asynchronously from a thread pool thread.
     ///
     /// `work` is called in the context of one of this instance's QThreadPool threads (it should lambda-capture all
@@ -74,6 +84,17 @@ public:
     void submitWork(QObject *context, const VoidFunc & work, const VoidFunc & completion = VoidFunc(),
                     const FailFunc & fail = FailFunc(), int priority = 0);
 
+    /// Blocking parallel-for. Splits the index range [0, n) into at most maxThreadCount() contiguous chunks of at
+    /// least `minChunk` elements each, and calls `func(begin, end)` once per chunk. The first chunk runs in the calling
+    /// thread, the rest run in this pool. Returns when all chunks are done. If any chunk throws, the first exception is
+    /// rethrown here (after all the other chunks have finished). If the job queue is full, the rejected chunk runs in
+    /// the calling thread instead. If the pool is shut down while the call is in progress, chunks it never got to run
+    /// are reported by throwing ShuttingDown.
+    ///
+    /// `func` must be safe to call concurrently on disjoint ranges. Do not call this from one of this pool's threads.
+    template <typename Func>
+    void parallelFor(size_t n, size_t minChunk, const Func & func);
+
     /// Call this on app or pool shutdown to wait for extant jobs that may be running to complete. This prevents jobs
     /// that are currently running from referencing data that may go away during shutdown (a situation that would cause
     /// a segfault).
@@ -130,6 +151,47 @@ private:
     std::atomic_int extantLimit = 10000;
 };
 
+template <typename Func>
+void ThreadPool::parallelFor(size_t n, size_t minChunk, const Func & func)
+{
+    if (!n)
+        return;
+    const size_t nChunks = std::clamp<size_t>(n / std::max<size_t>(minChunk, 1), 1, size_t(std::max(maxThreadCount(), 1)));
+    const size_t chunkSize = (n + nChunks - 1) / nChunks;
+    std::vector<std::future<void>> futures;
+    futures.reserve(nChunks);
+    for (size_t begin = chunkSize; begin < n; begin += chunkSize) {
+        auto task = std::make_shared<std::packaged_task<void()>>([&func, begin, end = std::min(begin + chunkSize, n)]{
+            func(begin, end);
+        });
+        futures.push_back(task->get_future());
+        bool rejected = false; // only ever set synchronously by submitWork() below, if the queue is full
+        submitWork(this, [task]{ (*task)(); }, VoidFunc(), [&rejected](const QString &){ rejected = true; });
+        if (rejected)
+            (*task)();
+    }
+    std::exception_ptr firstError;
+    try {
+        func(size_t(0), std::min(chunkSize, n));
+    } catch (...) {
+        firstError = std::current_exception();
+    }
+    for (auto & fut : futures) {
+        try {
+            fut.get();
+        } catch (const std::future_error &) {
+            // broken promise: the pool dropped the chunk without running it, which it only does when shutting down
+            if (!firstError)
+                firstError = std::make_exception_ptr(ShuttingDown("ThreadPool::parallelFor: the pool is shutting down"));
+        } catch (...) {
+            if (!firstError)
+                firstError = std::current_exception();
+        }
+    }
+    if (firstError)
+        std::rethrow_exception(firstError);
+}
+
 /// Semi-private class not intended to be constructed by client code, but used inside ThreadPool::SubmitWork.
 /// We put it here because the meta object compiler needs to see it for signal/slot glue code generation.
 class Job : public QObject, public QRunnable {
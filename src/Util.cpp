@@ -214,6 +214,26 @@ namespace Util {
         return ret;
     }
 
+    bool ParseHexFastInPlace(const QString &hex, char *buf, size_t bufsz)
+    {
+        if (size_t(hex.size()) != bufsz * 2)
+            return false;
+        const auto nibble = [](ushort c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 0xa;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 0xa;
+            return -1;
+        };
+        const QChar *d = hex.constData();
+        for (char * const end = buf + bufsz; buf < end; d += 2, ++buf) {
+            const int c1 = nibble(d[0].unicode()), c2 = nibble(d[1].unicode());
+            if (UNLIKELY(c1 < 0 || c2 < 0))
+                return false;
+            *buf = char((c1 << 4) | c2);
+        }
+        return true;
+    }
+
     QByteArray ToHexFast(const QByteArray &ba)
     {
         QByteArray ret(ba.size()*2, Qt::Initialization::Uninitialized);
@@ -576,6 +576,10 @@ namespace Util {
     ///         data if the input contains any non-hex digits (including spaces!).
     /// Note 3: Whitespace is *never* skipped -- the input data must be nothing but hex digits, lower or upprcase is ok.
     QByteArray ParseHexFast(const QByteArray &, bool checkDigits = false);
+    /// Allocation-free variant of the above for hex data held in a QString (such as the strings in a parsed JSON
+    /// reply). Decodes exactly bufsz bytes into `buf`. Returns false if `hex` is not exactly 2*bufsz hex digits
+    /// (digits are always checked here, lower or uppercase is ok), in which case the contents of `buf` are undefined.
+    bool ParseHexFastInPlace(const QString &hex, char *buf, size_t bufsz);
     /// Identical to Qt's toHex, but 60% faster (returned string is lcase hex encoded).
     QByteArray ToHexFast(const QByteArray &);
     /// More efficient, if less convenient version of above. Operates on a buffer in-place.  Make sure bufsz is at least
@@ -0,0 +1,275 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2020  Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#include "ZmqSubNotifier.h"
+
+#include "Common.h"
+#include "Util.h"
+
+#if defined(ENABLE_ZMQ)
+#include <zmq.h>
+
+#include <QSocketNotifier>
+#include <QtEndian>
+#endif
+
+#include <algorithm>
+#include <array>
+
+#if defined(ENABLE_ZMQ)
+namespace {
+    /// The app-wide ZMQ context. It's never terminated since zmq_ctx_term() blocks until every socket is closed,
+    /// and there's nothing to gain from doing so at app exit.
+    void *zmqContext() {
+        static void * const ctx = zmq_ctx_new();
+        return ctx;
+    }
+    QString zmqErrorString() { return QString::fromUtf8(zmq_strerror(zmq_errno())); }
+} // namespace
+
+struct ZmqSubNotifier::Pvt
+{
+    void *sock = nullptr;
+    std::unique_ptr<QSocketNotifier> notifier;
+
+    ~Pvt() { close(); }
+    void close() {
+        notifier.reset();
+        if (sock) {
+            zmq_close(sock);
+            sock = nullptr;
+        }
+    }
+};
+#else
+struct ZmqSubNotifier::Pvt {};
+#endif
+
+ZmqSubNotifier::ZmqSubNotifier(QObject *parent) : QObject(parent), p(std::make_unique<Pvt>()) {}
+ZmqSubNotifier::~ZmqSubNotifier() { stop(); }
+
+// static
+bool ZmqSubNotifier::isAvailable()
+{
+#if defined(ENABLE_ZMQ)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// static
+QString ZmqSubNotifier::versionString()
+{
+#if defined(ENABLE_ZMQ)
+    int major = 0, minor = 0, patch = 0;
+    zmq_version(&major, &minor, &patch);
+    return QString("%1.%2.%3").arg(major).arg(minor).arg(patch);
+#else
+    return QString();
+#endif
+}
+
+bool ZmqSubNotifier::start(const QString &address, const QString &topic, QString *errMsg)
+{
+    stop();
+#if defined(ENABLE_ZMQ)
+    const auto fail = [this, errMsg](const QString &why) {
+        if (errMsg) *errMsg = why;
+        p->close();
+        return false;
+    };
+    void *ctx = zmqContext();
+    if (!ctx)
+        return fail("failed to create the ZMQ context: " + zmqErrorString());
+    p->sock = zmq_socket(ctx, ZMQ_SUB);
+    if (!p->sock)
+        return fail("failed to create a ZMQ socket: " + zmqErrorString());
+    const int linger = 0, tcpKeepAlive = 1;
+    zmq_setsockopt(p->sock, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(p->sock, ZMQ_TCP_KEEPALIVE, &tcpKeepAlive, sizeof(tcpKeepAlive));
+    const QByteArray topicUtf8 = topic.toUtf8(), addressUtf8 = address.toUtf8();
+    if (zmq_setsockopt(p->sock, ZMQ_SUBSCRIBE, topicUtf8.constData(), size_t(topicUtf8.size())) != 0)
+        return fail(QString("failed to subscribe to \"%1\": %2").arg(topic, zmqErrorString()));
+    if (zmq_connect(p->sock, addressUtf8.constData()) != 0)
+        return fail(QString("failed to connect to \"%1\": %2").arg(address, zmqErrorString()));
+#if defined(Q_OS_WIN)
+    quintptr fd = 0; // SOCKET
+#else
+    int fd = -1;
+#endif
+    size_t fdSize = sizeof(fd);
+    if (zmq_getsockopt(p->sock, ZMQ_FD, &fd, &fdSize) != 0)
+        return fail("failed to get the ZMQ socket's file descriptor: " + zmqErrorString());
+    p->notifier = std::make_unique<QSocketNotifier>(qintptr(fd), QSocketNotifier::Read);
+    connect(p->notifier.get(), SIGNAL(activated(int)), this, SLOT(readAll()));
+    addr = address;
+    top = topic;
+    // ZMQ_FD is edge-triggered, so we must always drain the socket completely, including anything that may already
+    // be queued right now.
+    QMetaObject::invokeMethod(this, &ZmqSubNotifier::readAll, Qt::QueuedConnection);
+    return true;
+#else
+    Q_UNUSED(address) Q_UNUSED(topic)
+    if (errMsg) *errMsg = "this build of " APPNAME " lacks ZMQ support";
+    return false;
+#endif
+}
+
+void ZmqSubNotifier::stop()
+{
+#if defined(ENABLE_ZMQ)
+    p->close();
+#endif
+    lastSeq = -1;
+}
+
+bool ZmqSubNotifier::isRunning() const
+{
+#if defined(ENABLE_ZMQ)
+    return p->sock != nullptr;
+#else
+    return false;
+#endif
+}
+
+void ZmqSubNotifier::readAll()
+{
+#if defined(ENABLE_ZMQ)
+    // bitcoind sends 3-part messages: topic, body, and a 4-byte little endian sequence number
+    std::array<QByteArray, 3> frames;
+    while (p->sock) {
+        int events = 0;
+        size_t eventsSize = sizeof(events);
+        if (zmq_getsockopt(p->sock, ZMQ_EVENTS, &events, &eventsSize) != 0 || !(events & ZMQ_POLLIN))
+            return;
+        size_t nFrames = 0;
+        for (bool more = true; more; ++nFrames) {
+            zmq_msg_t msg;
+            zmq_msg_init(&msg);
+            if (zmq_msg_recv(&msg, p->sock, ZMQ_DONTWAIT) < 0) {
+                zmq_msg_close(&msg);
+                if (zmq_errno() != EAGAIN)
+                    Warning() << "ZMQ " << top << ": receive error: " << zmqErrorString();
+                return;
+            }
+            if (nFrames < frames.size())
+                frames[nFrames] = QByteArray(static_cast<const char *>(zmq_msg_data(&msg)), int(zmq_msg_size(&msg)));
+            more = zmq_msg_more(&msg);
+            zmq_msg_close(&msg);
+        }
+        if (nFrames < 2) {
+            DebugM("ZMQ ", top, ": ignoring a message with ", nFrames, " frame(s)");
+            continue;
+        }
+        qint64 seq = -1;
+        if (nFrames >= 3 && frames[2].size() == int(sizeof(quint32)))
+            seq = qFromLittleEndian<quint32>(frames[2].constData());
+        if (seq >= 0 && lastSeq >= 0 && seq != ((lastSeq + 1) & 0xffffffff))
+            // the publisher restarted, or it dropped messages because we weren't reading fast enough
+            DebugM("ZMQ ", top, ": sequence jumped from ", lastSeq, " to ", seq);
+        lastSeq = seq;
+        lastMsgTime = Util::getTimeSecs();
+        ++nMsgs;
+        emit gotMessage(QString::fromUtf8(frames[0]), frames[1], seq);
+    }
+#endif
+}
+
+#if defined(ENABLE_TESTS) && defined(ENABLE_ZMQ)
+#include "App.h"
+
+#include <QEventLoop>
+#include <QRandomGenerator>
+#include <QTimer>
+
+#include <vector>
+
+namespace {
+    /// Loopback test: a stand-in for bitcoind's publisher (a ZMQ PUB socket on localhost sending bitcoind-style
+    /// 3-part messages on two topics) feeding a ZmqSubNotifier subscribed to just one of them.
+    void test()
+    {
+        void *pub = zmq_socket(zmqContext(), ZMQ_PUB);
+        if (!pub)
+            throw Exception("failed to create PUB socket: " + zmqErrorString());
+        Defer closePub([pub]{ zmq_close(pub); });
+        if (zmq_bind(pub, "tcp://127.0.0.1:*") != 0)
+            throw Exception("failed to bind PUB socket: " + zmqErrorString());
+        std::array<char, 256> endpoint{};
+        size_t endpointSize = endpoint.size();
+        zmq_getsockopt(pub, ZMQ_LAST_ENDPOINT, endpoint.data(), &endpointSize);
+        Log() << "Stand-in publisher bound to " << endpoint.data();
+
+        const auto publish = [pub](const QByteArray &topic, const QByteArray &body, quint32 seq) {
+            std::array<char, sizeof(seq)> seqBytes;
+            qToLittleEndian(seq, seqBytes.data());
+            zmq_send(pub, topic.constData(), size_t(topic.size()), ZMQ_SNDMORE);
+            zmq_send(pub, body.constData(), size_t(body.size()), ZMQ_SNDMORE);
+            zmq_send(pub, seqBytes.data(), seqBytes.size(), 0);
+        };
+
+        ZmqSubNotifier sub;
+        if (QString err; !sub.start(QString::fromUtf8(endpoint.data()), "hashblock", &err))
+            throw Exception("failed to start subscriber: " + err);
+
+        constexpr int nExpected = 5;
+        std::vector<QByteArray> sent, received;
+        std::vector<qint64> seqs;
+        bool badTopic = false;
+        QEventLoop loop;
+        QObject::connect(&sub, &ZmqSubNotifier::gotMessage, &loop, [&](const QString &topic, const QByteArray &body, qint64 seq) {
+            badTopic = badTopic || topic != "hashblock";
+            received.push_back(body);
+            seqs.push_back(seq);
+            if (received.size() >= nExpected)
+                loop.quit();
+        });
+        // A ZMQ subscriber only gets messages published after its connection completes (the "slow joiner" problem),
+        // so we keep publishing until enough arrive, and then compare against the tail of what was sent.
+        QTimer pubTimer;
+        quint32 seq = 0;
+        QObject::connect(&pubTimer, &QTimer::timeout, &loop, [&]{
+            QByteArray hash(32, Qt::Uninitialized);
+            QRandomGenerator::global()->fillRange(reinterpret_cast<quint32 *>(hash.data()), hash.size() / int(sizeof(quint32)));
+            publish("rawtx", QByteArray(100, 'x'), seq); // not subscribed -- must be filtered out
+            publish("hashblock", hash, seq++);
+            sent.push_back(hash);
+        });
+        pubTimer.start(20);
+        QTimer::singleShot(10000, &loop, &QEventLoop::quit); // timeout
+        loop.exec();
+        pubTimer.stop();
+
+        if (received.size() < nExpected)
+            throw Exception(QString("expected %1 messages, got %2").arg(nExpected).arg(received.size()));
+        if (badTopic)
+            throw Exception("received a message for a topic we didn't subscribe to");
+        const auto it = std::find(sent.begin(), sent.end(), received.front());
+        if (it == sent.end() || size_t(sent.end() - it) < received.size()
+                || !std::equal(received.begin(), received.end(), it))
+            throw Exception("received messages do not match the ones sent");
+        for (size_t i = 1; i < seqs.size(); ++i)
+            if (seqs[i] != seqs[i-1] + 1)
+                throw Exception("bad sequence numbers");
+        Log() << "zmq test passed: received " << received.size() << " messages ok (libzmq " << ZmqSubNotifier::versionString() << ")";
+    }
+
+    const auto test_ = App::registerTest("zmq", &test);
+} // namespace
+#endif
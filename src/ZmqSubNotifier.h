@@ -0,0 +1,74 @@
+//
+// Fulcrum - A fast & nimble SPV Server for Bitcoin Cash
+// Copyright (C) 2019-2020  Calin A. Culianu <calin.culianu@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program (see LICENSE.txt).  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+
+#include <memory>
+
+/// Subscribes to a single topic on a bitcoind ZMQ notification endpoint (see bitcoind's -zmqpub* options), e.g.
+/// topic "hashblock" at "tcp://127.0.0.1:28332".
+///
+/// The ZMQ socket is driven by the event loop of the thread this object lives in (via a QSocketNotifier on the
+/// socket's ZMQ_FD), so construct, start and destroy this object from that thread. If the app was built without
+/// libzmq (ENABLE_ZMQ not defined), start() always fails and isAvailable() returns false.
+class ZmqSubNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ZmqSubNotifier(QObject *parent = nullptr);
+    ~ZmqSubNotifier() override;
+
+    /// Returns true if this build of the app has ZMQ support compiled-in.
+    static bool isAvailable();
+    /// Returns the libzmq version e.g. "4.3.2", or an empty string if !isAvailable().
+    static QString versionString();
+
+    /// Connects to `address` and subscribes to `topic`, stopping any previous subscription first. Note that ZMQ
+    /// connects asynchronously (and reconnects automatically), so a true return does not mean the publisher is up.
+    /// Returns false on error, with the reason in *errMsg.
+    bool start(const QString &address, const QString &topic, QString *errMsg = nullptr);
+    void stop();
+    bool isRunning() const;
+
+    const QString & address() const { return addr; }
+    const QString & topic() const { return top; }
+    /// Returns the Util::getTimeSecs() timestamp of the last message received, or 0 if none yet.
+    double lastMessageTime() const { return lastMsgTime; }
+    quint64 messagesReceived() const { return nMsgs; }
+
+signals:
+    /// Emitted for each message received. `body` is the message's second frame (e.g. a block hash or a raw tx), and
+    /// `seq` is the publisher's per-topic sequence number from the third frame (or -1 if absent).
+    /// Do not delete this object from a slot connected to this signal (stop() is fine, though).
+    void gotMessage(const QString &topic, const QByteArray &body, qint64 seq);
+
+private slots:
+    void readAll(); ///< drains all the messages queued on the socket. Connected to our QSocketNotifier.
+
+private:
+    struct Pvt;
+    std::unique_ptr<Pvt> p;
+    QString addr, top;
+    double lastMsgTime = 0.;
+    quint64 nMsgs = 0;
+    qint64 lastSeq = -1;
+};
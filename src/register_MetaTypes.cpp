@@ -21,6 +21,7 @@
 #include "BTC.h"
 #include "BTC_Address.h"
 #include "Controller.h"
+#include "Json.h"
 #include "Mixins.h"
 #include "PeerMgr.h"
 #include "RPC.h"
@@ -38,6 +39,10 @@ void App::register_MetaTypes()
         qRegisterMetaType<RPC::Message>("RPC::Message");
         qRegisterMetaType<RPC::Message::Id>("RPC::Message::Id"); // for some reason when this is an alias for QVariant it needs this string here
         qRegisterMetaType<IdMixin::Id>("IdMixin::Id");
+        // Used by the RPC::ConnectionBase::sendRequestBatch signal
+        qRegisterMetaType<RPC::Batch>("RPC::Batch");
+        // Used as an RPC result that is already JSON (see Json::PreSerialized)
+        qRegisterMetaType<Json::PreSerialized>("Json::PreSerialized");
 
         // Used by the Controller::putBlock signal
         qRegisterMetaType<CtlTask *>("CtlTask *");